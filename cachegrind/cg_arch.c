@@ -134,6 +134,17 @@ Bool VG_(str_clo_cache_opt)(const HChar *arg,
       return False;
 }
 
+Bool VG_(str_clo_ML_cache_opt)(const HChar *arg, cache_t* clo_MLc)
+{
+   const HChar* tmp_str;
+
+   if VG_STR_CLO(arg, "--ML", tmp_str) {
+      parse_cache_opt(clo_MLc, arg, tmp_str);
+      return True;
+   } else
+      return False;
+}
+
 static void umsg_cache_img(const HChar* desc, cache_t* c)
 {
    VG_(umsg)("  %s: %'d B, %d-way, %d B lines\n", desc,
@@ -319,6 +330,8 @@ void VG_(print_cache_clo_opts)()
 "    --I1=<size>,<assoc>,<line_size>  set I1 cache manually\n"
 "    --D1=<size>,<assoc>,<line_size>  set D1 cache manually\n"
 "    --LL=<size>,<assoc>,<line_size>  set LL cache manually\n"
+"    --ML=<size>,<assoc>,<line_size>  simulate a mid-level cache between\n"
+"                                     I1/D1 and LL [none]\n"
                );
 }
 
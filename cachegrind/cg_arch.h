@@ -52,6 +52,12 @@ Bool VG_(str_clo_cache_opt)(const HChar *arg,
                             cache_t* clo_D1c,
                             cache_t* clo_LLc);
 
+// If arg is the command line option configuring the optional mid-level
+// (ML) cache, then parses arg to set clo_MLc.  The ML cache is never
+// auto-detected: it is only simulated when this option is given.
+// Returns True if arg is the ML cache option, False otherwise.
+Bool VG_(str_clo_ML_cache_opt)(const HChar *arg, cache_t* clo_MLc);
+
 // Checks the correctness of the auto-detected caches.
 // If a cache has been configured by command line options, it
 // replaces the equivalent auto-detected cache.
@@ -33,13 +33,21 @@
    associated state.  As with cg_sim.c it is #included directly into
    cg_main.c.  It provides:
 
-   - a taken/not-taken predictor for conditional branches
+   - a taken/not-taken predictor for conditional branches, one of
+     - gselect: 2-bit counters indexed by global history and address
+     - gshare:  2-bit counters indexed by global history XOR address
+     - tage:    a small TAGE predictor, i.e. a bimodal base predictor
+                and a few tagged tables indexed with geometrically
+                increasing global history lengths
    - a branch target address predictor for indirect branches
+   - optionally, a return stack buffer predicting function returns
 
-   Function return-address prediction is not modelled, on the basis
-   that return stack predictors almost always predict correctly, and
-   also that it is difficult for Valgrind to robustly identify
-   function calls and returns.
+   Without the return stack buffer, function returns are not modelled,
+   on the basis that return stack predictors almost always predict
+   correctly.  Calls and returns are identified by the jump kind VEX
+   gives to the end of a superblock, which is reliable enough for this.
+
+   bp_init() must be called before any prediction.
 */
 
 /* How many bits at the bottom of an instruction address are
@@ -57,103 +65,340 @@
 #  error "Unsupported architecture"
 #endif
 
+typedef enum {
+   Bp_GSelect,
+   Bp_GShare,
+   Bp_Tage
+} bp_model_t;
 
-/* Get a taken/not-taken prediction for the instruction (presumably a
-   conditional branch) at instr_addr.  Once that's done, update the
-   predictor state based on whether or not it was actually taken, as
-   indicated by 'taken'.  Finally, return 1 for a mispredict and 0 for
-   a successful predict.
-
-   The predictor is an array of 16k (== 2^14) 2-bit saturating
-   counters.  Given the address of the branch instruction, the array
-   index to use is computed both from the low order bits of the branch
-   instruction's address, and the global history - that is, from the
-   taken/not-taken behaviour of the most recent few branches.  This
-   makes the predictor able to correlate this branch's behaviour with
-   that of other branches. 
-
-   TODO: use predictor written by someone who understands this stuff.
-   Perhaps it would be better to move to a standard GShare predictor
-   and/or tournament predictor.
-*/
-/* The index is composed of N_HIST bits at the top and N_IADD bits at
-   the bottom.  These numbers chosen somewhat arbitrarily, but note
-   that making N_IADD_BITS too small (eg 4) can cause large amounts of
-   aliasing, and hence misprediction, particularly if the history bits
-   are mostly unchanging. */
-#define N_HIST_BITS 7
-#define N_IADD_BITS 7
+static const HChar* bp_model_name(bp_model_t model)
+{
+   switch (model) {
+      case Bp_GSelect: return "gselect";
+      case Bp_GShare:  return "gshare";
+      case Bp_Tage:    return "tage";
+   }
+   tl_assert(0);
+   return NULL;
+}
 
-#define N_BITS     (N_HIST_BITS + N_IADD_BITS)
-#define N_COUNTERS (1 << N_BITS)
+/* Default sizes, as the original fixed-size predictors */
+#define BP_DEFAULT_COND_BITS 14
+#define BP_DEFAULT_IND_BITS   9
 
-static UWord shift_register = 0;   /* Contains global history */
-static UChar counters[N_COUNTERS]; /* Counter array; presumably auto-zeroed */
+/* Limits for the configurable sizes */
+#define BP_MIN_BITS     4
+#define BP_MAX_BITS    24
+#define BP_MAX_RSB   1024
 
+static bp_model_t bp_model     = Bp_GSelect;
+static Int        bp_cond_bits = BP_DEFAULT_COND_BITS;
+static Int        bp_ind_bits  = BP_DEFAULT_IND_BITS;
+static Int        bp_rsb_size  = 0;
 
-static ULong do_cond_branch_predict ( Addr instr_addr, Word takenW )
-{
-   UWord indx;
-   Bool  predicted_taken, actually_taken, mispredict;
+static ULong  shift_register = 0;   /* Contains global history */
+static UChar* counters;             /* 2-bit counters, 2^bp_cond_bits */
 
-   const UWord hist_mask = (1 << N_HIST_BITS) - 1;
-   const UWord iadd_mask = (1 << N_IADD_BITS) - 1;
-         UWord hist_bits = shift_register & hist_mask;
-         UWord iadd_bits = (instr_addr >> N_IADDR_LO_ZERO_BITS)
-                           & iadd_mask;
 
-   tl_assert(hist_bits <= hist_mask);
-   tl_assert(iadd_bits <= iadd_mask);
-   indx = (hist_bits << N_IADD_BITS) | iadd_bits;
-   tl_assert(indx < N_COUNTERS);
-   if (0) VG_(printf)("index = %d\n", (Int)indx);
+/*------------------------------------------------------------*/
+/*--- gselect / gshare                                     ---*/
+/*------------------------------------------------------------*/
 
-   tl_assert(takenW <= 1);
-   predicted_taken = counters[ indx ] >= 2;
-   actually_taken  = takenW > 0;
+/* gselect: the index is composed of history bits at the top and
+   address bits at the bottom, half of the index each.  Note that
+   making the address part too small (eg 4 bits) can cause large
+   amounts of aliasing, and hence misprediction, particularly if the
+   history bits are mostly unchanging.
 
-   mispredict = (actually_taken && (!predicted_taken))
-                || ((!actually_taken) && predicted_taken);
+   gshare: the index is the address XORed with as many history bits. */
+static __inline__ UWord bp_counter_index ( Addr instr_addr )
+{
+   UWord iadd = instr_addr >> N_IADDR_LO_ZERO_BITS;
+   UWord mask = ((UWord)1 << bp_cond_bits) - 1;
+
+   if (bp_model == Bp_GShare)
+      return (iadd ^ (UWord)shift_register) & mask;
+   else {
+      Int   n_hist = bp_cond_bits / 2;
+      Int   n_iadd = bp_cond_bits - n_hist;
+      UWord hist   = (UWord)shift_register & (((UWord)1 << n_hist) - 1);
+      return (hist << n_iadd) | (iadd & (((UWord)1 << n_iadd) - 1));
+   }
+}
 
-   shift_register <<= 1;
-   shift_register |= (actually_taken ? 1 : 0);
+static __inline__ Bool bp_counter_update ( UChar* ctr, Bool taken )
+{
+   Bool predicted_taken = *ctr >= 2;
 
-   if (actually_taken) {
-      if (counters[indx] < 3)
-         counters[indx]++;
+   if (taken) {
+      if (*ctr < 3)
+         (*ctr)++;
    } else {
-      if (counters[indx] > 0)
-         counters[indx]--;
+      if (*ctr > 0)
+         (*ctr)--;
+   }
+   return predicted_taken != taken;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- TAGE                                                 ---*/
+/*------------------------------------------------------------*/
+
+/* A reduced TAGE predictor (Seznec & Michaud, 2006).  The base
+   predictor is the table of 2-bit counters indexed by address only.
+   Each tagged table has a quarter of its size, and entries with an
+   8-bit tag, a 3-bit signed counter and a 2-bit usefulness counter.
+   The prediction comes from the table with the longest history whose
+   tag matches, falling back to the base predictor. */
+#define TAGE_TABLES   4
+#define TAGE_TAG_BITS 8
+
+static const Int tage_hist_len[TAGE_TABLES] = { 5, 11, 23, 47 };
+
+typedef struct {
+   UChar tag;
+   Char  ctr;       /* -4 .. 3; taken if >= 0 */
+   UChar u;         /* 0 .. 3 */
+   UChar valid;     /* allocated; calloc'd entries never match a tag */
+} tage_entry;
+
+static tage_entry* tage_table[TAGE_TABLES];
+static Int         tage_bits;      /* log2 of entries per tagged table */
+static UInt        tage_tick = 0;  /* for periodic aging of u */
+
+/* Fold the most recent len bits of history into n bits */
+static __inline__ UWord tage_fold ( Int len, Int n )
+{
+   ULong h = shift_register & ((1ULL << len) - 1);
+   UWord f = 0;
+
+   while (h) {
+      f ^= (UWord)h & (((UWord)1 << n) - 1);
+      h >>= n;
+   }
+   return f;
+}
+
+static ULong tage_predict ( Addr instr_addr, Bool taken )
+{
+   UWord       pc = instr_addr >> N_IADDR_LO_ZERO_BITS;
+   UWord       idx_mask = ((UWord)1 << tage_bits) - 1;
+   UWord       idx[TAGE_TABLES];
+   UChar       tag[TAGE_TABLES];
+   Int         i, provider = -1, alt = -1;
+   Bool        pred, alt_pred, mispredict;
+   UChar*      base = &counters[pc & (((UWord)1 << bp_cond_bits) - 1)];
+   tage_entry* e;
+
+   for (i = 0; i < TAGE_TABLES; i++) {
+      idx[i] = (pc ^ (pc >> tage_bits) ^ tage_fold(tage_hist_len[i], tage_bits))
+               & idx_mask;
+      tag[i] = (UChar)((pc ^ tage_fold(tage_hist_len[i], TAGE_TAG_BITS)
+                        ^ (tage_fold(tage_hist_len[i], TAGE_TAG_BITS - 1) << 1))
+                       & ((1 << TAGE_TAG_BITS) - 1));
+   }
+   for (i = TAGE_TABLES - 1; i >= 0; i--) {
+      e = &tage_table[i][idx[i]];
+      if (e->valid && e->tag == tag[i]) {
+         if (provider < 0)
+            provider = i;
+         else {
+            alt = i;
+            break;
+         }
+      }
+   }
+
+   alt_pred = alt >= 0 ? tage_table[alt][idx[alt]].ctr >= 0 : *base >= 2;
+   pred     = provider >= 0 ? tage_table[provider][idx[provider]].ctr >= 0
+                            : alt_pred;
+   mispredict = pred != taken;
+
+   /* update the provider, or the base predictor */
+   if (provider >= 0) {
+      e = &tage_table[provider][idx[provider]];
+      if (taken) {
+         if (e->ctr < 3) e->ctr++;
+      } else {
+         if (e->ctr > -4) e->ctr--;
+      }
+      if (pred != alt_pred) {
+         if (!mispredict) {
+            if (e->u < 3) e->u++;
+         } else {
+            if (e->u > 0) e->u--;
+         }
+      }
+   } else
+      bp_counter_update(base, taken);
+
+   /* on a misprediction, allocate an entry with longer history */
+   if (mispredict && provider < TAGE_TABLES - 1) {
+      Bool allocated = False;
+      for (i = provider + 1; i < TAGE_TABLES; i++) {
+         e = &tage_table[i][idx[i]];
+         if (e->u == 0) {
+            e->valid = 1;
+            e->tag   = tag[i];
+            e->ctr   = taken ? 0 : -1;
+            allocated = True;
+            break;
+         }
+      }
+      if (!allocated)
+         for (i = provider + 1; i < TAGE_TABLES; i++)
+            tage_table[i][idx[i]].u--;
    }
 
-   tl_assert(counters[indx] <= 3);
+   /* age usefulness, so that stale entries can be replaced */
+   if (++tage_tick == (1 << 18)) {
+      tage_tick = 0;
+      for (i = 0; i < TAGE_TABLES; i++) {
+         UWord j;
+         for (j = 0; j <= idx_mask; j++)
+            tage_table[i][j].u >>= 1;
+      }
+   }
 
    return mispredict ? 1 : 0;
 }
 
 
+/*------------------------------------------------------------*/
+/*--- Conditional branches                                 ---*/
+/*------------------------------------------------------------*/
+
+/* Get a taken/not-taken prediction for the instruction (presumably a
+   conditional branch) at instr_addr.  Once that's done, update the
+   predictor state based on whether or not it was actually taken, as
+   indicated by 'taken'.  Finally, return 1 for a mispredict and 0 for
+   a successful predict. */
+static ULong do_cond_branch_predict ( Addr instr_addr, Word takenW )
+{
+   Bool  actually_taken, mispredict;
+
+   tl_assert(takenW <= 1);
+   actually_taken = takenW > 0;
+
+   if (bp_model == Bp_Tage)
+      mispredict = tage_predict(instr_addr, actually_taken);
+   else {
+      UWord indx = bp_counter_index(instr_addr);
+      if (0) VG_(printf)("index = %d\n", (Int)indx);
+      mispredict = bp_counter_update(&counters[indx], actually_taken);
+      tl_assert(counters[indx] <= 3);
+   }
+
+   shift_register <<= 1;
+   shift_register |= (actually_taken ? 1 : 0);
+
+   return mispredict ? 1 : 0;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Indirect branches, calls and returns                 ---*/
+/*------------------------------------------------------------*/
+
 /* A very simple indirect branch predictor.  Use the branch's address
    to index a table which records the previous target address for this
    branch (or whatever aliased with it) and use that as the
    prediction. */
-#define N_BTAC_BITS 9
-#define N_BTAC      (1 << N_BTAC_BITS)
-static Addr btac[N_BTAC]; /* BTAC; presumably auto-zeroed */
+static Addr* btac;   /* 2^bp_ind_bits entries */
 
 static ULong do_ind_branch_predict ( Addr instr_addr, Addr actual )
 {
    Bool mispredict;
-   const UWord mask = (1 << N_BTAC_BITS) - 1;
+   const UWord mask = ((UWord)1 << bp_ind_bits) - 1;
          UWord indx = (instr_addr >> N_IADDR_LO_ZERO_BITS) 
                       & mask;
-   tl_assert(indx < N_BTAC);
    mispredict = btac[indx] != actual;
    btac[indx] = actual;
    return mispredict ? 1 : 0;
 }
 
+/* The return stack buffer is a circular buffer: a call pushes its
+   return address, overwriting the oldest entry when full; a return
+   pops the predicted address.  An underflow is a mispredict. */
+static Addr* rsb;
+static Int   rsb_top   = 0;   /* index of the next free entry */
+static Int   rsb_depth = 0;   /* # valid entries */
+
+static void do_call_push ( Addr return_addr )
+{
+   tl_assert(bp_rsb_size > 0);
+   rsb[rsb_top] = return_addr;
+   rsb_top = (rsb_top + 1) % bp_rsb_size;
+   if (rsb_depth < bp_rsb_size)
+      rsb_depth++;
+}
+
+static ULong do_ret_predict ( Addr actual )
+{
+   if (rsb_depth == 0)
+      return 1;
+   rsb_top = (rsb_top + bp_rsb_size - 1) % bp_rsb_size;
+   rsb_depth--;
+   return rsb[rsb_top] != actual ? 1 : 0;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Setup                                                ---*/
+/*------------------------------------------------------------*/
+
+/* Check a table size given on the command line */
+static Bool bp_check_bits ( Int bits )
+{
+   return bits >= BP_MIN_BITS && bits <= BP_MAX_BITS;
+}
+
+static void bp_init ( bp_model_t model, Int cond_bits, Int ind_bits,
+                      Int rsb_size )
+{
+   Int i;
+
+   tl_assert(bp_check_bits(cond_bits) && bp_check_bits(ind_bits));
+   tl_assert(rsb_size >= 0 && rsb_size <= BP_MAX_RSB);
+
+   bp_model     = model;
+   bp_cond_bits = cond_bits;
+   bp_ind_bits  = ind_bits;
+   bp_rsb_size  = rsb_size;
+
+   counters = VG_(calloc)("cg.bp.ctr.1", (SizeT)1 << cond_bits, sizeof(UChar));
+   btac     = VG_(calloc)("cg.bp.btac.1", (SizeT)1 << ind_bits, sizeof(Addr));
+   if (rsb_size > 0)
+      rsb = VG_(calloc)("cg.bp.rsb.1", rsb_size, sizeof(Addr));
+
+   if (model == Bp_Tage) {
+      tage_bits = cond_bits - 2;
+      for (i = 0; i < TAGE_TABLES; i++)
+         tage_table[i] = VG_(calloc)("cg.bp.tage.1", (SizeT)1 << tage_bits,
+                                     sizeof(tage_entry));
+   }
+}
+
+/* Write a description of the configuration into buf */
+static void bp_desc ( HChar* buf )
+{
+   VG_(sprintf)(buf, "%s, %d counter bits, %d BTB bits, ",
+                bp_model_name(bp_model), bp_cond_bits, bp_ind_bits);
+   if (bp_rsb_size > 0)
+      VG_(sprintf)(buf + VG_(strlen)(buf), "%d-entry RSB", bp_rsb_size);
+   else
+      VG_(strcat)(buf, "no RSB");
+}
+
+/* Is the predictor configured as before it became configurable? */
+static Bool bp_is_default ( void )
+{
+   return bp_model == Bp_GSelect && bp_cond_bits == BP_DEFAULT_COND_BITS
+          && bp_ind_bits == BP_DEFAULT_IND_BITS && bp_rsb_size == 0;
+}
+
 
 /*--------------------------------------------------------------------*/
 /*--- end                                          cg_branchpred.c ---*/
 /*--------------------------------------------------------------------*/
-
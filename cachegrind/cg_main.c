@@ -31,6 +31,8 @@
 
 #include "pub_tool_basics.h"
 #include "pub_tool_debuginfo.h"
+#include "pub_tool_deduppoolalloc.h"
+#include "pub_tool_hashtable.h"
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcassert.h"
 #include "pub_tool_libcfile.h"
@@ -38,13 +40,14 @@
 #include "pub_tool_libcproc.h"
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_options.h"
-#include "pub_tool_oset.h"
+#include "pub_tool_threadstate.h"
 #include "pub_tool_tooliface.h"
 #include "pub_tool_xarray.h"
 #include "pub_tool_clientstate.h"
 #include "pub_tool_machine.h"      // VG_(fnptr_to_fnentry)
 
 #include "cg_arch.h"
+#include "cg_prefetch.c"
 #include "cg_sim.c"
 #include "cg_branchpred.c"
 
@@ -60,27 +63,29 @@
 /*------------------------------------------------------------*/
 
 static Bool  clo_cache_sim  = True;  /* do cache simulation? */
+static Bool  clo_cache_sim_batch = False; /* batch cache sim events? */
+static repl_policy_t  clo_L1_policy = Repl_LRU; /* I1/D1 replacement */
+static repl_policy_t  clo_LL_policy = Repl_LRU; /* LL replacement */
+static ll_inclusion_t clo_LL_inclusion = LL_NonInclusive;
+static Bool  clo_private_caches = False; /* per-thread I1/D1/ML? */
+static prefetch_model_t clo_prefetcher = Pf_None; /* prefetcher model */
 static Bool  clo_branch_sim = False; /* do branch simulation? */
+static bp_model_t clo_branch_cond = Bp_GSelect; /* conditional predictor */
+static Int   clo_branch_cond_bits = BP_DEFAULT_COND_BITS; /* log2 counters */
+static Int   clo_branch_ind_bits  = BP_DEFAULT_IND_BITS;  /* log2 BTB size */
+static Int   clo_branch_rsb = 0;       /* return stack entries, 0 = none */
 static const HChar* clo_cachegrind_out_file = "cachegrind.out.%p";
 
 /*------------------------------------------------------------*/
 /*--- Cachesim configuration                               ---*/
 /*------------------------------------------------------------*/
 
-static Int min_line_size = 0; /* min of L1 and LL cache line sizes */
+static Int min_line_size = 0; /* min of L1, ML and LL cache line sizes */
 
 /*------------------------------------------------------------*/
 /*--- Types and Data Structures                            ---*/
 /*------------------------------------------------------------*/
 
-typedef
-   struct {
-      ULong a;  /* total # memory accesses of this kind */
-      ULong m1; /* misses in the first level cache */
-      ULong mL; /* misses in the second level cache */
-   }
-   CacheCC;
-
 typedef
    struct {
       ULong b;  /* total # branches of this kind */
@@ -91,45 +96,69 @@ typedef
 //------------------------------------------------------------
 // Primary data structure #1: CC table
 // - Holds the per-source-line hit/miss stats, grouped by file/function/line.
-// - an ordered set of CCs.  CC indexing done by file/function/line (as
-//   determined from the instrAddr).
-// - Traversed for dumping stats at end in file/func/line hierarchy.
+// - a hash table of CCs.  CC indexing done by file/function/line (as
+//   determined from the instrAddr).  File and function names are
+//   interned in the string table first, so the lookup only compares
+//   pointers and the line number.
+// - Sorted and traversed for dumping stats at end in file/func/line
+//   hierarchy.
 
 typedef struct {
-   HChar* file;
+   const HChar* file;
    const HChar* fn;
    Int    line;
 }
 CodeLoc;
 
-typedef struct {
+typedef struct _LineCC LineCC;
+struct _LineCC {
+   LineCC*  next; /* hash table chain;  MUST BE FIRST */
+   UWord    key;  /* hash of loc;  MUST BE SECOND */
    CodeLoc  loc; /* Source location that these counts pertain to */
    CacheCC  Ir;  /* Insn read counts */
    CacheCC  Dr;  /* Data read counts */
    CacheCC  Dw;  /* Data write/modify counts */
    BranchCC Bc;  /* Conditional branch counts */
    BranchCC Bi;  /* Indirect branch counts */
-} LineCC;
+};
 
-// First compare file, then fn, then line.
-static Word cmp_CodeLoc_LineCC(const void *vloc, const void *vcc)
+static UWord hash_CodeLoc(const CodeLoc* loc)
 {
-   Word res;
-   const CodeLoc* a = (const CodeLoc*)vloc;
-   const CodeLoc* b = &(((const LineCC*)vcc)->loc);
+   return (UWord)loc->file * 31 + (UWord)loc->fn * 7 + loc->line;
+}
+
+// Used for lookups: strings are interned, so compare pointers.
+static Word cmp_LineCC_loc(const void* v1, const void* v2)
+{
+   const CodeLoc* a = &(((const LineCC*)v1)->loc);
+   const CodeLoc* b = &(((const LineCC*)v2)->loc);
+
+   return !(a->file == b->file && a->fn == b->fn && a->line == b->line);
+}
 
-   res = VG_(strcmp)(a->file, b->file);
-   if (0 != res)
-      return res;
+// Used for sorting before output: first compare file, then fn, then line.
+static Int cmp_LineCC_ptrs(const void* v1, const void* v2)
+{
+   Int res;
+   const CodeLoc* a = &((*(const LineCC* const *)v1)->loc);
+   const CodeLoc* b = &((*(const LineCC* const *)v2)->loc);
+
+   if (a->file != b->file) {
+      res = VG_(strcmp)(a->file, b->file);
+      if (0 != res)
+         return res;
+   }
 
-   res = VG_(strcmp)(a->fn, b->fn);
-   if (0 != res)
-      return res;
+   if (a->fn != b->fn) {
+      res = VG_(strcmp)(a->fn, b->fn);
+      if (0 != res)
+         return res;
+   }
 
    return a->line - b->line;
 }
 
-static OSet* CC_table;
+static VgHashTable* CC_table;
 
 //------------------------------------------------------------
 // Primary data structure #2: InstrInfo table
@@ -149,12 +178,13 @@ struct _InstrInfo {
 
 typedef struct _SB_info SB_info;
 struct _SB_info {
-   Addr      SB_addr;      // key;  MUST BE FIRST
+   SB_info*  next;         // hash table chain;  MUST BE FIRST
+   Addr      SB_addr;      // key;  MUST BE SECOND
    Int       n_instrs;
    InstrInfo instrs[0];
 };
 
-static OSet* instrInfoTable;
+static VgHashTable* instrInfoTable;
 
 //------------------------------------------------------------
 // Secondary data structure: string table
@@ -162,9 +192,9 @@ static OSet* instrInfoTable;
 // - used for filenames and function names, each of which will be
 //   pointed to by one or more CCs.
 // - it also allows equality checks just by pointer comparison, which
-//   is good when printing the output file at the end.
+//   is what the CC table lookups rely on.
 
-static OSet* stringTable;
+static DedupPoolAlloc* stringTable;
 
 //------------------------------------------------------------
 // Stats
@@ -183,24 +213,11 @@ static Int  no_debugs           = 0;
 /*--- String table operations                              ---*/
 /*------------------------------------------------------------*/
 
-static Word stringCmp( const void* key, const void* elem )
-{
-   return VG_(strcmp)(*(const HChar *const *)key, *(const HChar *const *)elem);
-}
-
 // Get a permanent string;  either pull it out of the string table if it's
-// been encountered before, or dup it and put it into the string table.
-static HChar* get_perm_string(const HChar* s)
+// been encountered before, or copy it into the string table.
+static const HChar* get_perm_string(const HChar* s)
 {
-   HChar** s_ptr = VG_(OSetGen_Lookup)(stringTable, &s);
-   if (s_ptr) {
-      return *s_ptr;
-   } else {
-      HChar** s_node = VG_(OSetGen_AllocNode)(stringTable, sizeof(HChar*));
-      *s_node = VG_(strdup)("cg.main.gps.1", s);
-      VG_(OSetGen_Insert)(stringTable, s_node);
-      return *s_node;
-   }
+   return VG_(allocEltDedupPA)(stringTable, VG_(strlen)(s) + 1, s);
 }
 
 /*------------------------------------------------------------*/
@@ -240,7 +257,7 @@ static LineCC* get_lineCC(Addr origAddr)
 {
    const HChar *fn, *file, *dir;
    UInt    line;
-   CodeLoc loc;
+   LineCC  key;
    LineCC* lineCC;
 
    get_debug_info(origAddr, &dir, &file, &fn, &line);
@@ -254,31 +271,40 @@ static LineCC* get_lineCC(Addr origAddr)
       VG_(sprintf)(absfile, "%s", file);
    }
 
-   loc.file = absfile;
-   loc.fn   = fn;
-   loc.line = line;
+   key.loc.file = get_perm_string(absfile);
+   key.loc.fn   = get_perm_string(fn);
+   key.loc.line = line;
+   key.key      = hash_CodeLoc(&key.loc);
 
-   lineCC = VG_(OSetGen_Lookup)(CC_table, &loc);
+   lineCC = VG_(HT_gen_lookup)(CC_table, &key, cmp_LineCC_loc);
    if (!lineCC) {
       // Allocate and zero a new node.
-      lineCC           = VG_(OSetGen_AllocNode)(CC_table, sizeof(LineCC));
-      lineCC->loc.file = get_perm_string(loc.file);
-      lineCC->loc.fn   = get_perm_string(loc.fn);
-      lineCC->loc.line = loc.line;
+      lineCC           = VG_(malloc)("cg.main.glcc.1", sizeof(LineCC));
+      lineCC->key      = key.key;
+      lineCC->loc      = key.loc;
       lineCC->Ir.a     = 0;
       lineCC->Ir.m1    = 0;
+      lineCC->Ir.m2    = 0;
       lineCC->Ir.mL    = 0;
+      lineCC->Ir.p1    = 0;
+      lineCC->Ir.pL    = 0;
       lineCC->Dr.a     = 0;
       lineCC->Dr.m1    = 0;
+      lineCC->Dr.m2    = 0;
       lineCC->Dr.mL    = 0;
+      lineCC->Dr.p1    = 0;
+      lineCC->Dr.pL    = 0;
       lineCC->Dw.a     = 0;
       lineCC->Dw.m1    = 0;
+      lineCC->Dw.m2    = 0;
       lineCC->Dw.mL    = 0;
+      lineCC->Dw.p1    = 0;
+      lineCC->Dw.pL    = 0;
       lineCC->Bc.b     = 0;
       lineCC->Bc.mp    = 0;
       lineCC->Bi.b     = 0;
       lineCC->Bi.mp    = 0;
-      VG_(OSetGen_Insert)(CC_table, lineCC);
+      VG_(HT_add_node)(CC_table, lineCC);
    }
 
    return lineCC;
@@ -332,7 +358,7 @@ void log_1IrGen_0D_cache_access(InstrInfo* n)
    //VG_(printf)("1IrGen_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
    //             n, n->instr_addr, n->instr_len);
    cachesim_I1_doref_Gen(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir);
    n->parent->Ir.a++;
 }
 
@@ -342,7 +368,7 @@ void log_1IrNoX_0D_cache_access(InstrInfo* n)
    //VG_(printf)("1IrNoX_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
    //             n, n->instr_addr, n->instr_len);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir);
    n->parent->Ir.a++;
 }
 
@@ -354,10 +380,10 @@ void log_2IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2)
    //            n,  n->instr_addr,  n->instr_len,
    //            n2, n2->instr_addr, n2->instr_len);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir);
    n->parent->Ir.a++;
    cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
-			 &n2->parent->Ir.m1, &n2->parent->Ir.mL);
+			 &n2->parent->Ir);
    n2->parent->Ir.a++;
 }
 
@@ -371,13 +397,13 @@ void log_3IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
    //            n2, n2->instr_addr, n2->instr_len,
    //            n3, n3->instr_addr, n3->instr_len);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir);
    n->parent->Ir.a++;
    cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
-			 &n2->parent->Ir.m1, &n2->parent->Ir.mL);
+			 &n2->parent->Ir);
    n2->parent->Ir.a++;
    cachesim_I1_doref_NoX(n3->instr_addr, n3->instr_len,
-			 &n3->parent->Ir.m1, &n3->parent->Ir.mL);
+			 &n3->parent->Ir);
    n3->parent->Ir.a++;
 }
 
@@ -388,11 +414,11 @@ void log_1IrNoX_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
    //            "                               daddr=0x%010lx,  dsize=%lu\n",
    //            n, n->instr_addr, n->instr_len, data_addr, data_size);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir);
    n->parent->Ir.a++;
 
    cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dr.m1, &n->parent->Dr.mL);
+                     &n->parent->Dr);
    n->parent->Dr.a++;
 }
 
@@ -403,11 +429,11 @@ void log_1IrNoX_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
    //            "                               daddr=0x%010lx,  dsize=%lu\n",
    //            n, n->instr_addr, n->instr_len, data_addr, data_size);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir);
    n->parent->Ir.a++;
 
    cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dw.m1, &n->parent->Dw.mL);
+                     &n->parent->Dw);
    n->parent->Dw.a++;
 }
 
@@ -420,7 +446,7 @@ void log_0Ir_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
    //VG_(printf)("0Ir_1Dr:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
    //            n, data_addr, data_size);
    cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dr.m1, &n->parent->Dr.mL);
+                     &n->parent->Dr);
    n->parent->Dr.a++;
 }
 
@@ -431,14 +457,98 @@ void log_0Ir_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
    //VG_(printf)("0Ir_1Dw:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
    //            n, data_addr, data_size);
    cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dw.m1, &n->parent->Dw.mL);
+                     &n->parent->Dw);
    n->parent->Dw.a++;
 }
 
+/*------------------------------------------------------------*/
+/*--- Batched cache simulation                             ---*/
+/*------------------------------------------------------------*/
+
+/* With --cache-sim-batch=yes, the translated code does not call a
+ * simulation helper for each (group of) cache events.  Instead it
+ * appends a compact record per event to batch_buf using plain IR
+ * stores, and only calls batch_drain() once the buffer is full.  The
+ * drain loop then runs all the records through the simulator in one
+ * go, keeping the simulator code and cache tags hot in the host caches
+ * and saving the helper call overhead per event.
+ *
+ * The simulated caches are shared by all threads and Valgrind runs
+ * only one thread at a time, so a single buffer preserves the order
+ * in which the events happened.  The buffer must be drained before
+ * the counts are read (cg_fini) and before the InstrInfos referenced
+ * by the records are freed (cg_discard_superblock_info).
+ *
+ * Branch events do not interact with the cache simulation, and are
+ * handled by calling their helpers directly as before.
+ */
+
+typedef enum {
+   Batch_IrNoX = 0,
+   Batch_IrGen = 1,
+   Batch_Dr    = 2,
+   Batch_Dw    = 3
+} BatchKind;
+
+typedef struct {
+   InstrInfo* inode;
+   Addr       data_addr;   /* unused for Ir records */
+   UWord      kind_szB;    /* (data size << 2) | BatchKind */
+} BatchRec;
+
+/* Drain the buffer when at least this many records are in it.  One
+   flush of the event queue appends at most N_EVENTS records after
+   the check, hence the slack at the end of batch_buf. */
+#define N_BATCH_RECS 4096
+
+static BatchRec  batch_buf[N_BATCH_RECS + 16];
+static BatchRec* batch_next = batch_buf;
+
+static ULong batch_recs   = 0;
+static ULong batch_drains = 0;
+
+static VG_REGPARM(0)
+void batch_drain(void)
+{
+   BatchRec* r;
+   InstrInfo* n;
+
+   for (r = batch_buf; r < batch_next; r++) {
+      n = r->inode;
+      switch (r->kind_szB & 3) {
+         case Batch_IrNoX:
+            cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
+                                  &n->parent->Ir);
+            n->parent->Ir.a++;
+            break;
+         case Batch_IrGen:
+            cachesim_I1_doref_Gen(n->instr_addr, n->instr_len,
+                                  &n->parent->Ir);
+            n->parent->Ir.a++;
+            break;
+         case Batch_Dr:
+            cachesim_D1_doref(r->data_addr, r->kind_szB >> 2,
+                              &n->parent->Dr);
+            n->parent->Dr.a++;
+            break;
+         case Batch_Dw:
+            cachesim_D1_doref(r->data_addr, r->kind_szB >> 2,
+                              &n->parent->Dw);
+            n->parent->Dw.a++;
+            break;
+      }
+   }
+   batch_recs += batch_next - batch_buf;
+   batch_drains++;
+   batch_next = batch_buf;
+}
+
 /* For branches, we consult two different predictors, one which
    predicts taken/untaken for conditional branches, and the other
    which predicts the branch target address for indirect branches
-   (jump-to-register style ones). */
+   (jump-to-register style ones).  With --branch-rsb, returns are
+   predicted by the return stack buffer and counted as indirect
+   branches, and every call pushes its return address. */
 
 static VG_REGPARM(2)
 void log_cond_branch(InstrInfo* n, Word taken)
@@ -460,6 +570,28 @@ void log_ind_branch(InstrInfo* n, UWord actual_dst)
       += (1 & do_ind_branch_predict(n->instr_addr, actual_dst));
 }
 
+static VG_REGPARM(2)
+void log_ind_call(InstrInfo* n, UWord actual_dst)
+{
+   n->parent->Bi.b++;
+   n->parent->Bi.mp
+      += (1 & do_ind_branch_predict(n->instr_addr, actual_dst));
+   do_call_push(n->instr_addr + n->instr_len);
+}
+
+static VG_REGPARM(2)
+void log_direct_call(InstrInfo* n, UWord actual_dst)
+{
+   do_call_push(n->instr_addr + n->instr_len);
+}
+
+static VG_REGPARM(2)
+void log_ret_branch(InstrInfo* n, UWord actual_dst)
+{
+   n->parent->Bi.b++;
+   n->parent->Bi.mp += (1 & do_ret_predict(actual_dst));
+}
+
 
 /*------------------------------------------------------------*/
 /*--- Instrumentation types and structures                 ---*/
@@ -506,7 +638,8 @@ typedef
       Ev_Dw,     // Data write
       Ev_Dm,     // Data modify (read then write)
       Ev_Bc,     // branch conditional
-      Ev_Bi      // branch indirect (to unknown destination)
+      Ev_Bi      // branch indirect (to unknown destination), or any
+                 // call or return if the return stack is modelled
    }
    EventTag;
 
@@ -535,7 +668,8 @@ typedef
             IRAtom* taken; /* :: Ity_I1 */
          } Bc;
          struct {
-            IRAtom* dst;
+            IRAtom*     dst;
+            IRJumpKind  jk;   /* Ijk_Boring, Ijk_Call or Ijk_Ret */
          } Bi;
       } Ev;
    }
@@ -615,16 +749,16 @@ SB_info* get_SB_info(IRSB* sbIn, Addr origAddr)
    // If this assertion fails, there has been some screwup:  some
    // translations must have been discarded but Cachegrind hasn't discarded
    // the corresponding entries in the instr-info table.
-   sbInfo = VG_(OSetGen_Lookup)(instrInfoTable, &origAddr);
+   sbInfo = VG_(HT_lookup)(instrInfoTable, origAddr);
    tl_assert(NULL == sbInfo);
 
    // BB never translated before (at this address, at least;  could have
    // been unloaded and then reloaded elsewhere in memory)
-   sbInfo = VG_(OSetGen_AllocNode)(instrInfoTable,
-                                sizeof(SB_info) + n_instrs*sizeof(InstrInfo)); 
+   sbInfo = VG_(malloc)("cg.main.gsbi.1",
+                        sizeof(SB_info) + n_instrs*sizeof(InstrInfo)); 
    sbInfo->SB_addr  = origAddr;
    sbInfo->n_instrs = n_instrs;
-   VG_(OSetGen_Insert)( instrInfoTable, sbInfo );
+   VG_(HT_add_node)( instrInfoTable, sbInfo );
 
    return sbInfo;
 }
@@ -660,7 +794,9 @@ static void showEvent ( Event* ev )
          VG_(printf)("\n");
          break;
       case Ev_Bi:
-         VG_(printf)("Bi %p  DST=", ev->inode);
+         VG_(printf)("Bi %p  ", ev->inode);
+         ppIRJumpKind(ev->Ev.Bi.jk);
+         VG_(printf)(" DST=");
          ppIRExpr(ev->Ev.Bi.dst); 
          VG_(printf)("\n");
          break;
@@ -670,6 +806,39 @@ static void showEvent ( Event* ev )
    }
 }
 
+/* Select the helper for an Ev_Bi event.  A call to a known address is
+   only there to push the return address onto the return stack. */
+static void get_Bi_helper ( Event* ev, const HChar** name, void** addr )
+{
+   tl_assert(ev->tag == Ev_Bi);
+   switch (ev->Ev.Bi.jk) {
+      case Ijk_Boring:
+         *name = "log_ind_branch";
+         *addr = &log_ind_branch;
+         break;
+      case Ijk_Call:
+         /* Without a return stack, a call is just an indirect branch */
+         if (ev->Ev.Bi.dst->tag == Iex_Const) {
+            tl_assert(clo_branch_rsb > 0);
+            *name = "log_direct_call";
+            *addr = &log_direct_call;
+         } else if (clo_branch_rsb > 0) {
+            *name = "log_ind_call";
+            *addr = &log_ind_call;
+         } else {
+            *name = "log_ind_branch";
+            *addr = &log_ind_branch;
+         }
+         break;
+      case Ijk_Ret:
+         *name = "log_ret_branch";
+         *addr = &log_ret_branch;
+         break;
+      default:
+         tl_assert(0);
+   }
+}
+
 // Reserve and initialise an InstrInfo for the first mention of a new insn.
 static
 InstrInfo* setup_InstrInfo ( CgState* cgs, Addr instr_addr, UInt instr_len )
@@ -686,6 +855,147 @@ InstrInfo* setup_InstrInfo ( CgState* cgs, Addr instr_addr, UInt instr_len )
 }
 
 
+#if defined(VG_BIGENDIAN)
+# define CGEndness Iend_BE
+#elif defined(VG_LITTLEENDIAN)
+# define CGEndness Iend_LE
+#else
+# error "Unknown endianness"
+#endif
+
+static IRExpr* mkBatchAddr ( IRTemp base, UWord offset )
+{
+   if (sizeof(HWord) == 4)
+      return IRExpr_Binop(Iop_Add32, IRExpr_RdTmp(base),
+                          IRExpr_Const(IRConst_U32(offset)));
+   else
+      return IRExpr_Binop(Iop_Add64, IRExpr_RdTmp(base),
+                          IRExpr_Const(IRConst_U64(offset)));
+}
+
+/* Generate code that appends a record for the cache event ev to the
+   batch buffer.  'base' holds the value of batch_next at the start of
+   the flush, and 'n' is the index of the record relative to it. */
+static void addBatchRec ( CgState* cgs, IRTemp base, Int n, Event* ev )
+{
+   UWord     off  = n * sizeof(BatchRec);
+   BatchKind kind;
+   UWord     szB  = 0;
+
+   switch (ev->tag) {
+      case Ev_IrNoX: kind = Batch_IrNoX; break;
+      case Ev_IrGen: kind = Batch_IrGen; break;
+      case Ev_Dr:
+      case Ev_Dm:    kind = Batch_Dr; szB = get_Event_dszB(ev); break;
+      case Ev_Dw:    kind = Batch_Dw; szB = get_Event_dszB(ev); break;
+      default:       tl_assert(0);
+   }
+
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_Store(CGEndness,
+                               mkBatchAddr(base, off
+                                           + offsetof(BatchRec, inode)),
+                               mkIRExpr_HWord( (HWord)ev->inode )) );
+   if (kind == Batch_Dr || kind == Batch_Dw)
+      addStmtToIRSB( cgs->sbOut,
+                     IRStmt_Store(CGEndness,
+                                  mkBatchAddr(base, off
+                                              + offsetof(BatchRec, data_addr)),
+                                  get_Event_dea(ev)) );
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_Store(CGEndness,
+                               mkBatchAddr(base, off
+                                           + offsetof(BatchRec, kind_szB)),
+                               mkIRExpr_HWord( (szB << 2) | kind )) );
+}
+
+/* Generate a call to batch_drain(), guarded by 'guard' if non-NULL. */
+static void addBatchDrain ( CgState* cgs, IRExpr* guard )
+{
+   IRDirty* di = unsafeIRDirty_0_N( 0, "batch_drain",
+                                    VG_(fnptr_to_fnentry)( &batch_drain ),
+                                    mkIRExprVec_0() );
+   if (guard)
+      di->guard = guard;
+   addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+}
+
+/* The batched equivalent of flushEvents: cache events are appended to
+   the batch buffer, branch events still call their helpers.  The
+   buffer is drained at the end if it is full. */
+static void flushEvents_batch ( CgState* cgs )
+{
+   Int      i, n_recs;
+   IRType   tyW = sizeof(HWord) == 4 ? Ity_I32 : Ity_I64;
+   IRTemp   base, next;
+   IRExpr*  next_addr = mkIRExpr_HWord( (HWord)&batch_next );
+   IRExpr*  limit     = mkIRExpr_HWord( (HWord)&batch_buf[N_BATCH_RECS] );
+   IRExpr** argv;
+   IRDirty* di;
+   Event*   ev;
+
+   tl_assert(N_BATCH_RECS + N_EVENTS
+             <= sizeof(batch_buf) / sizeof(batch_buf[0]));
+
+   base   = IRTemp_INVALID;
+   n_recs = 0;
+   for (i = 0; i < cgs->events_used; i++) {
+      ev = &cgs->events[i];
+      if (DEBUG_CG) {
+         VG_(printf)("   flush "); 
+         showEvent( ev );
+      }
+      switch (ev->tag) {
+         case Ev_Bc:
+            argv = mkIRExprVec_2( mkIRExpr_HWord( (HWord)ev->inode ),
+                                  ev->Ev.Bc.taken );
+            di = unsafeIRDirty_0_N( 2, "log_cond_branch",
+                                    VG_(fnptr_to_fnentry)( &log_cond_branch ),
+                                    argv );
+            addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+            break;
+         case Ev_Bi: {
+            const HChar* helperName;
+            void*        helperAddr;
+            get_Bi_helper(ev, &helperName, &helperAddr);
+            argv = mkIRExprVec_2( mkIRExpr_HWord( (HWord)ev->inode ),
+                                  ev->Ev.Bi.dst );
+            di = unsafeIRDirty_0_N( 2, helperName,
+                                    VG_(fnptr_to_fnentry)( helperAddr ),
+                                    argv );
+            addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+            break;
+         }
+         default:
+            if (n_recs == 0) {
+               base = newIRTemp(cgs->sbOut->tyenv, tyW);
+               addStmtToIRSB( cgs->sbOut,
+                              IRStmt_WrTmp(base,
+                                           IRExpr_Load(CGEndness, tyW,
+                                                       next_addr)) );
+            }
+            addBatchRec(cgs, base, n_recs, ev);
+            n_recs++;
+            break;
+      }
+   }
+
+   if (n_recs > 0) {
+      tl_assert(n_recs <= N_EVENTS);
+      next = newIRTemp(cgs->sbOut->tyenv, tyW);
+      addStmtToIRSB( cgs->sbOut,
+                     IRStmt_WrTmp(next,
+                                  mkBatchAddr(base, n_recs * sizeof(BatchRec))) );
+      addStmtToIRSB( cgs->sbOut,
+                     IRStmt_Store(CGEndness, next_addr, IRExpr_RdTmp(next)) );
+      addBatchDrain( cgs,
+                     IRExpr_Binop(tyW == Ity_I32 ? Iop_CmpLE32U : Iop_CmpLE64U,
+                                  limit, IRExpr_RdTmp(next)) );
+   }
+
+   cgs->events_used = 0;
+}
+
 /* Generate code for all outstanding memory events, and mark the queue
    empty.  Code is generated into cgs->bbOut, and this activity
    'consumes' slots in cgs->sbInfo. */
@@ -702,6 +1012,11 @@ static void flushEvents ( CgState* cgs )
    Event*     ev2;
    Event*     ev3;
 
+   if (clo_cache_sim && clo_cache_sim_batch) {
+      flushEvents_batch(cgs);
+      return;
+   }
+
    i = 0;
    while (i < cgs->events_used) {
 
@@ -848,9 +1163,8 @@ static void flushEvents ( CgState* cgs )
             i++;
             break;
          case Ev_Bi:
-            /* Branch to an unknown destination */
-            helperName = "log_ind_branch";
-            helperAddr = &log_ind_branch;
+            /* Branch to an unknown destination, call or return */
+            get_Bi_helper(ev, &helperName, &helperAddr);
             argv = mkIRExprVec_2( i_node_expr, ev->Ev.Bi.dst );
             regparms = 2;
             i++;
@@ -970,6 +1284,10 @@ void addEvent_D_guarded ( CgState* cgs, InstrInfo* inode,
    tl_assert(cgs->events_used >= 0);
    flushEvents(cgs);
    tl_assert(cgs->events_used == 0);
+   /* The helper below simulates the access immediately, so any batched
+      events must be simulated first to preserve the order. */
+   if (clo_cache_sim_batch)
+      addBatchDrain( cgs, guard );
    /* Same as case Ev_Dw / case Ev_Dr in flushEvents, except with guard */
    IRExpr*      i_node_expr;
    const HChar* helperName;
@@ -1015,7 +1333,8 @@ void addEvent_Bc ( CgState* cgs, InstrInfo* inode, IRAtom* guard )
 }
 
 static
-void addEvent_Bi ( CgState* cgs, InstrInfo* inode, IRAtom* whereTo )
+void addEvent_Bi ( CgState* cgs, InstrInfo* inode, IRAtom* whereTo,
+                   IRJumpKind jk )
 {
    Event* evt;
    tl_assert(isIRAtom(whereTo));
@@ -1031,6 +1350,7 @@ void addEvent_Bi ( CgState* cgs, InstrInfo* inode, IRAtom* whereTo )
    evt->tag       = Ev_Bi;
    evt->inode     = inode;
    evt->Ev.Bi.dst = whereTo;
+   evt->Ev.Bi.jk  = jk;
    cgs->events_used++;
 }
 
@@ -1314,16 +1634,22 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
    }
 
    /* Deal with branches to unknown destinations.  Except ignore ones
-      which are function returns as we assume the return stack
-      predictor never mispredicts. */
-   if ((sbIn->jumpkind == Ijk_Boring) || (sbIn->jumpkind == Ijk_Call)) {
+      which are function returns, unless the return stack is modelled;
+      otherwise we assume the return stack predictor never
+      mispredicts.  With the return stack, calls to known addresses
+      are needed too, to push the return address. */
+   if ((sbIn->jumpkind == Ijk_Boring) || (sbIn->jumpkind == Ijk_Call)
+       || (sbIn->jumpkind == Ijk_Ret && clo_branch_rsb > 0)) {
       if (0) { ppIRExpr( sbIn->next ); VG_(printf)("\n"); }
       switch (sbIn->next->tag) {
          case Iex_Const: 
-            break; /* boring - branch to known address */
+            /* boring - branch to known address */
+            if (sbIn->jumpkind == Ijk_Call && clo_branch_rsb > 0)
+               addEvent_Bi( &cgs, curr_inode, sbIn->next, Ijk_Call );
+            break;
          case Iex_RdTmp: 
             /* looks like an indirect branch (branch to unknown) */
-            addEvent_Bi( &cgs, curr_inode, sbIn->next );
+            addEvent_Bi( &cgs, curr_inode, sbIn->next, sbIn->jumpkind );
             break;
          default:
             /* shouldn't happen - if the incoming IR is properly
@@ -1357,6 +1683,7 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
 static cache_t clo_I1_cache = UNDEFINED_CACHE;
 static cache_t clo_D1_cache = UNDEFINED_CACHE;
 static cache_t clo_LL_cache = UNDEFINED_CACHE;
+static cache_t clo_ML_cache = UNDEFINED_CACHE;
 
 /*------------------------------------------------------------*/
 /*--- cg_fini() and related function                       ---*/
@@ -1370,13 +1697,56 @@ static CacheCC  Dw_total;
 static BranchCC Bc_total;
 static BranchCC Bi_total;
 
+// Print the names of the events of one CacheCC: the access event ev,
+// then the misses for instructions or data (x is 'I' or 'D') on reads or
+// writes (rw is 'r' or 'w').
+static void fprint_CacheCC_events(VgFile* fp, const HChar* ev,
+                                  HChar x, HChar rw)
+{
+   VG_(fprintf)(fp, " %s %c1m%c", ev, x, rw);
+   if (ML_enabled)
+      VG_(fprintf)(fp, " %cMm%c", x, rw);
+   VG_(fprintf)(fp, " %cLm%c", x, rw);
+   if (pf_model != Pf_None)
+      VG_(fprintf)(fp, " %c1pm%c %cLpm%c", x, rw, x, rw);
+}
+
+static void fprint_CacheCC(VgFile* fp, const CacheCC* cc)
+{
+   if (ML_enabled)
+      VG_(fprintf)(fp, " %llu %llu %llu %llu", cc->a, cc->m1, cc->m2, cc->mL);
+   else
+      VG_(fprintf)(fp, " %llu %llu %llu", cc->a, cc->m1, cc->mL);
+   if (pf_model != Pf_None)
+      VG_(fprintf)(fp, " %llu %llu", cc->p1, cc->pL);
+}
+
+// Print the counts of one line (or the totals) in "events:" line order.
+static void fprint_CCs(VgFile* fp, const CacheCC* Ir, const CacheCC* Dr,
+                       const CacheCC* Dw, const BranchCC* Bc,
+                       const BranchCC* Bi)
+{
+   if (clo_cache_sim) {
+      fprint_CacheCC(fp, Ir);
+      fprint_CacheCC(fp, Dr);
+      fprint_CacheCC(fp, Dw);
+   } else {
+      VG_(fprintf)(fp, " %llu", Ir->a);
+   }
+   if (clo_branch_sim)
+      VG_(fprintf)(fp, " %llu %llu %llu %llu", Bc->b, Bc->mp, Bi->b, Bi->mp);
+   VG_(fprintf)(fp, "\n");
+}
+
 static void fprint_CC_table_and_calc_totals(void)
 {
    Int     i;
+   UInt    j, n_lineCCs;
    VgFile  *fp;
-   HChar   *currFile = NULL;
+   const HChar *currFile = NULL;
    const HChar *currFn = NULL;
    LineCC* lineCC;
+   LineCC** lineCCs;
 
    // Setup output filename.  Nb: it's important to do this now, ie. as late
    // as possible.  If we do it at start-up and the program forks and the
@@ -1400,12 +1770,22 @@ static void fprint_CC_table_and_calc_totals(void)
       VG_(free)(cachegrind_out_file);
    }
 
-   // "desc:" lines (giving I1/D1/LL cache configuration).  The spaces after
+   // "desc:" lines (giving I1/D1/LL/ML cache configuration).  The spaces after
    // the 2nd colon makes cg_annotate's output look nicer.
    VG_(fprintf)(fp,  "desc: I1 cache:         %s\n"
                      "desc: D1 cache:         %s\n"
                      "desc: LL cache:         %s\n",
                      I1.desc_line, D1.desc_line, LL.desc_line);
+   if (ML_enabled)
+      VG_(fprintf)(fp, "desc: ML cache:         %s\n", ML.desc_line);
+   if (pf_model != Pf_None)
+      VG_(fprintf)(fp, "desc: Prefetcher:       %s\n",
+                       pf_model_name(pf_model));
+   if (clo_branch_sim && !bp_is_default()) {
+      HChar bp_desc_line[128];
+      bp_desc(bp_desc_line);
+      VG_(fprintf)(fp, "desc: Branch predictor: %s\n", bp_desc_line);
+   }
 
    // "cmd:" line
    VG_(fprintf)(fp, "cmd: %s", VG_(args_the_exename));
@@ -1414,25 +1794,25 @@ static void fprint_CC_table_and_calc_totals(void)
       VG_(fprintf)(fp, " %s", arg);
    }
    // "events:" line
-   if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "Bc Bcm Bi Bim\n");
-   }
-   else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "\n");
-   }
-   else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir Bc Bcm Bi Bim\n");
-   }
-   else {
-      VG_(fprintf)(fp, "\nevents: Ir\n");
+   VG_(fprintf)(fp, "\nevents:");
+   if (clo_cache_sim) {
+      fprint_CacheCC_events(fp, "Ir", 'I', 'r');
+      fprint_CacheCC_events(fp, "Dr", 'D', 'r');
+      fprint_CacheCC_events(fp, "Dw", 'D', 'w');
+   } else {
+      VG_(fprintf)(fp, " Ir");
    }
-
-   // Traverse every lineCC
-   VG_(OSetGen_ResetIter)(CC_table);
-   while ( (lineCC = VG_(OSetGen_Next)(CC_table)) ) {
+   if (clo_branch_sim)
+      VG_(fprintf)(fp, " Bc Bcm Bi Bim");
+   VG_(fprintf)(fp, "\n");
+
+   // Traverse every lineCC, in file/fn/line order
+   lineCCs = (LineCC**)VG_(HT_to_array)(CC_table, &n_lineCCs);
+   if (n_lineCCs > 0)
+      VG_(ssort)(lineCCs, n_lineCCs, sizeof(LineCC*), cmp_LineCC_ptrs);
+   for (j = 0; j < n_lineCCs; j++) {
       Bool just_hit_a_new_file = False;
+      lineCC = lineCCs[j];
       // If we've hit a new file, print a "fl=" line.  Note that because
       // each string is stored exactly once in the string table, we can use
       // pointer comparison rather than strcmp() to test for equality, which
@@ -1455,51 +1835,29 @@ static void fprint_CC_table_and_calc_totals(void)
       }
 
       // Print the LineCC
-      if (clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL,
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else if (clo_cache_sim && !clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL);
-      }
-      else if (!clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, 
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else {
-         VG_(fprintf)(fp,  "%d %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a);
-      }
+      VG_(fprintf)(fp, "%d", lineCC->loc.line);
+      fprint_CCs(fp, &lineCC->Ir, &lineCC->Dr, &lineCC->Dw,
+                 &lineCC->Bc, &lineCC->Bi);
 
       // Update summary stats
       Ir_total.a  += lineCC->Ir.a;
       Ir_total.m1 += lineCC->Ir.m1;
+      Ir_total.m2 += lineCC->Ir.m2;
       Ir_total.mL += lineCC->Ir.mL;
+      Ir_total.p1 += lineCC->Ir.p1;
+      Ir_total.pL += lineCC->Ir.pL;
       Dr_total.a  += lineCC->Dr.a;
       Dr_total.m1 += lineCC->Dr.m1;
+      Dr_total.m2 += lineCC->Dr.m2;
       Dr_total.mL += lineCC->Dr.mL;
+      Dr_total.p1 += lineCC->Dr.p1;
+      Dr_total.pL += lineCC->Dr.pL;
       Dw_total.a  += lineCC->Dw.a;
       Dw_total.m1 += lineCC->Dw.m1;
+      Dw_total.m2 += lineCC->Dw.m2;
       Dw_total.mL += lineCC->Dw.mL;
+      Dw_total.p1 += lineCC->Dw.p1;
+      Dw_total.pL += lineCC->Dw.pL;
       Bc_total.b  += lineCC->Bc.b;
       Bc_total.mp += lineCC->Bc.mp;
       Bi_total.b  += lineCC->Bi.b;
@@ -1507,43 +1865,13 @@ static void fprint_CC_table_and_calc_totals(void)
 
       distinct_lines++;
    }
+   if (lineCCs)
+      VG_(free)(lineCCs);
 
    // Summary stats must come after rest of table, since we calculate them
    // during traversal.  */
-   if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
-   }
-   else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu\n",
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL);
-   }
-   else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
-   }
-   else {
-      VG_(fprintf)(fp, "summary:"
-                        " %llu\n", 
-                        Ir_total.a);
-   }
+   VG_(fprintf)(fp, "summary:");
+   fprint_CCs(fp, &Ir_total, &Dr_total, &Dw_total, &Bc_total, &Bi_total);
 
    VG_(fclose)(fp);
 }
@@ -1567,8 +1895,13 @@ static void cg_fini(Int exitcode)
    BranchCC B_total;
    ULong LL_total_m, LL_total_mr, LL_total_mw,
          LL_total, LL_total_r, LL_total_w;
+   ULong ML_total_m = 0, ML_total_mr = 0, ML_total_mw = 0,
+         ML_total, ML_total_r, ML_total_w;
    Int l1, l2, l3;
 
+   if (clo_cache_sim && clo_cache_sim_batch)
+      batch_drain();
+
    fprint_CC_table_and_calc_totals();
 
    if (VG_(clo_verbosity) == 0) 
@@ -1593,11 +1926,20 @@ static void cg_fini(Int exitcode)
       miss numbers */
    if (clo_cache_sim) {
       VG_(umsg)(fmt, "I1  misses:   ", Ir_total.m1);
+      if (ML_enabled)
+         VG_(umsg)(fmt, "MLi misses:   ", Ir_total.m2);
       VG_(umsg)(fmt, "LLi misses:   ", Ir_total.mL);
+      if (pf_model != Pf_None) {
+         VG_(umsg)(fmt, "I1  covered:  ", Ir_total.p1);
+         VG_(umsg)(fmt, "LLi covered:  ", Ir_total.pL);
+      }
 
       if (0 == Ir_total.a) Ir_total.a = 1;
       VG_(umsg)("I1  miss rate: %*.2f%%\n", l1,
                 Ir_total.m1 * 100.0 / Ir_total.a);
+      if (ML_enabled)
+         VG_(umsg)("MLi miss rate: %*.2f%%\n", l1,
+                   Ir_total.m2 * 100.0 / Ir_total.a);
       VG_(umsg)("LLi miss rate: %*.2f%%\n", l1,
                 Ir_total.mL * 100.0 / Ir_total.a);
       VG_(umsg)("\n");
@@ -1606,7 +1948,10 @@ static void cg_fini(Int exitcode)
        * determine the width of columns 2 & 3. */
       D_total.a  = Dr_total.a  + Dw_total.a;
       D_total.m1 = Dr_total.m1 + Dw_total.m1;
+      D_total.m2 = Dr_total.m2 + Dw_total.m2;
       D_total.mL = Dr_total.mL + Dw_total.mL;
+      D_total.p1 = Dr_total.p1 + Dw_total.p1;
+      D_total.pL = Dr_total.pL + Dw_total.pL;
 
       /* Make format string, getting width right for numbers */
       VG_(sprintf)(fmt, "%%s %%,%dllu  (%%,%dllu rd   + %%,%dllu wr)\n",
@@ -1616,8 +1961,17 @@ static void cg_fini(Int exitcode)
                      D_total.a, Dr_total.a, Dw_total.a);
       VG_(umsg)(fmt, "D1  misses:   ",
                      D_total.m1, Dr_total.m1, Dw_total.m1);
+      if (ML_enabled)
+         VG_(umsg)(fmt, "MLd misses:   ",
+                        D_total.m2, Dr_total.m2, Dw_total.m2);
       VG_(umsg)(fmt, "LLd misses:   ",
                      D_total.mL, Dr_total.mL, Dw_total.mL);
+      if (pf_model != Pf_None) {
+         VG_(umsg)(fmt, "D1  covered:  ",
+                        D_total.p1, Dr_total.p1, Dw_total.p1);
+         VG_(umsg)(fmt, "LLd covered:  ",
+                        D_total.pL, Dr_total.pL, Dw_total.pL);
+      }
 
       if (0 == D_total.a)  D_total.a = 1;
       if (0 == Dr_total.a) Dr_total.a = 1;
@@ -1626,17 +1980,50 @@ static void cg_fini(Int exitcode)
                 l1, D_total.m1  * 100.0 / D_total.a,
                 l2, Dr_total.m1 * 100.0 / Dr_total.a,
                 l3, Dw_total.m1 * 100.0 / Dw_total.a);
+      if (ML_enabled)
+         VG_(umsg)("MLd miss rate: %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
+                   l1, D_total.m2  * 100.0 / D_total.a,
+                   l2, Dr_total.m2 * 100.0 / Dr_total.a,
+                   l3, Dw_total.m2 * 100.0 / Dw_total.a);
       VG_(umsg)("LLd miss rate: %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
                 l1, D_total.mL  * 100.0 / D_total.a,
                 l2, Dr_total.mL * 100.0 / Dr_total.a,
                 l3, Dw_total.mL * 100.0 / Dw_total.a);
       VG_(umsg)("\n");
 
+      /* ML overall results.  ML is referenced on every L1 miss, and LL
+         on every ML miss. */
+      if (ML_enabled) {
+         ML_total   = Dr_total.m1 + Dw_total.m1 + Ir_total.m1;
+         ML_total_r = Dr_total.m1 + Ir_total.m1;
+         ML_total_w = Dw_total.m1;
+         VG_(umsg)(fmt, "ML refs:      ",
+                        ML_total, ML_total_r, ML_total_w);
+
+         ML_total_m  = Dr_total.m2 + Dw_total.m2 + Ir_total.m2;
+         ML_total_mr = Dr_total.m2 + Ir_total.m2;
+         ML_total_mw = Dw_total.m2;
+         VG_(umsg)(fmt, "ML misses:    ",
+                        ML_total_m, ML_total_mr, ML_total_mw);
+
+         VG_(umsg)("ML miss rate:  %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
+                   l1, ML_total_m  * 100.0 / (Ir_total.a + D_total.a),
+                   l2, ML_total_mr * 100.0 / (Ir_total.a + Dr_total.a),
+                   l3, ML_total_mw * 100.0 / Dw_total.a);
+         VG_(umsg)("\n");
+      }
+
       /* LL overall results */
 
-      LL_total   = Dr_total.m1 + Dw_total.m1 + Ir_total.m1;
-      LL_total_r = Dr_total.m1 + Ir_total.m1;
-      LL_total_w = Dw_total.m1;
+      if (ML_enabled) {
+         LL_total   = ML_total_m;
+         LL_total_r = ML_total_mr;
+         LL_total_w = ML_total_mw;
+      } else {
+         LL_total   = Dr_total.m1 + Dw_total.m1 + Ir_total.m1;
+         LL_total_r = Dr_total.m1 + Ir_total.m1;
+         LL_total_w = Dw_total.m1;
+      }
       VG_(umsg)(fmt, "LL refs:      ",
                      LL_total, LL_total_r, LL_total_w);
 
@@ -1645,6 +2032,10 @@ static void cg_fini(Int exitcode)
       LL_total_mw = Dw_total.mL;
       VG_(umsg)(fmt, "LL misses:    ",
                      LL_total_m, LL_total_mr, LL_total_mw);
+      if (pf_model != Pf_None)
+         VG_(umsg)(fmt, "LL covered:   ",
+                        Dr_total.pL + Dw_total.pL + Ir_total.pL,
+                        Dr_total.pL + Ir_total.pL, Dw_total.pL);
 
       VG_(umsg)("LL miss rate:  %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
                 l1, LL_total_m  * 100.0 / (Ir_total.a + D_total.a),
@@ -1699,11 +2090,19 @@ static void cg_fini(Int exitcode)
                 no_debugs * 100.0 / debug_lookups, no_debugs);
 
       VG_(dmsg)("cachegrind: string table size: %u\n",
-                VG_(OSetGen_Size)(stringTable));
+                VG_(sizeDedupPA)(stringTable));
       VG_(dmsg)("cachegrind: CC table size: %u\n",
-                VG_(OSetGen_Size)(CC_table));
+                VG_(HT_count_nodes)(CC_table));
       VG_(dmsg)("cachegrind: InstrInfo table size: %u\n",
-                VG_(OSetGen_Size)(instrInfoTable));
+                VG_(HT_count_nodes)(instrInfoTable));
+      if (clo_cache_sim && clo_cache_sim_batch)
+         VG_(dmsg)("cachegrind: batched events: %llu in %llu drains\n",
+                   batch_recs, batch_drains);
+      if (clo_cache_sim && pf_model != Pf_None)
+         VG_(dmsg)("cachegrind: prefetches I1/D1/LL: %llu/%llu/%llu issued,"
+                   " %llu/%llu/%llu used\n",
+                   pf_I1.issued, pf_D1.issued, pf_LL.issued,
+                   pf_I1.covered, pf_D1.covered, pf_LL.covered);
    }
 }
 
@@ -1722,6 +2121,10 @@ void cg_discard_superblock_info ( Addr orig_addr64, VexGuestExtents vge )
 
    tl_assert(vge.n_used > 0);
 
+   // Pending batch records may refer to the InstrInfos about to be freed.
+   if (clo_cache_sim && clo_cache_sim_batch)
+      batch_drain();
+
    if (DEBUG_CG)
       VG_(printf)( "discard_basic_block_info: %p, %p, %llu\n", 
                    (void*)orig_addr,
@@ -1729,9 +2132,9 @@ void cg_discard_superblock_info ( Addr orig_addr64, VexGuestExtents vge )
 
    // Get BB info, remove from table, free BB info.  Simple!  Note that we
    // use orig_addr, not the first instruction address in vge.
-   sbInfo = VG_(OSetGen_Remove)(instrInfoTable, &orig_addr);
+   sbInfo = VG_(HT_remove)(instrInfoTable, orig_addr);
    tl_assert(NULL != sbInfo);
-   VG_(OSetGen_FreeNode)(instrInfoTable, sbInfo);
+   VG_(free)(sbInfo);
 }
 
 /*--------------------------------------------------------------------*/
@@ -1744,10 +2147,44 @@ static Bool cg_process_cmd_line_option(const HChar* arg)
                               &clo_I1_cache,
                               &clo_D1_cache,
                               &clo_LL_cache)) {}
+   else if (VG_(str_clo_ML_cache_opt)(arg, &clo_ML_cache)) {}
 
    else if VG_STR_CLO( arg, "--cachegrind-out-file", clo_cachegrind_out_file) {}
    else if VG_BOOL_CLO(arg, "--cache-sim",  clo_cache_sim)  {}
+   else if VG_BOOL_CLO(arg, "--cache-sim-batch", clo_cache_sim_batch) {}
    else if VG_BOOL_CLO(arg, "--branch-sim", clo_branch_sim) {}
+   else if VG_XACT_CLO(arg, "--L1-policy=lru",    clo_L1_policy, Repl_LRU) {}
+   else if VG_XACT_CLO(arg, "--L1-policy=plru",   clo_L1_policy, Repl_PLRU) {}
+   else if VG_XACT_CLO(arg, "--L1-policy=rrip",   clo_L1_policy, Repl_RRIP) {}
+   else if VG_XACT_CLO(arg, "--L1-policy=random", clo_L1_policy, Repl_Random) {}
+   else if VG_XACT_CLO(arg, "--LL-policy=lru",    clo_LL_policy, Repl_LRU) {}
+   else if VG_XACT_CLO(arg, "--LL-policy=plru",   clo_LL_policy, Repl_PLRU) {}
+   else if VG_XACT_CLO(arg, "--LL-policy=rrip",   clo_LL_policy, Repl_RRIP) {}
+   else if VG_XACT_CLO(arg, "--LL-policy=random", clo_LL_policy, Repl_Random) {}
+   else if VG_XACT_CLO(arg, "--LL-inclusion=non-inclusive",
+                            clo_LL_inclusion, LL_NonInclusive) {}
+   else if VG_XACT_CLO(arg, "--LL-inclusion=inclusive",
+                            clo_LL_inclusion, LL_Inclusive) {}
+   else if VG_XACT_CLO(arg, "--LL-inclusion=exclusive",
+                            clo_LL_inclusion, LL_Exclusive) {}
+   else if VG_BOOL_CLO(arg, "--private-caches", clo_private_caches) {}
+   else if VG_XACT_CLO(arg, "--prefetcher=none", clo_prefetcher, Pf_None) {}
+   else if VG_XACT_CLO(arg, "--prefetcher=next-line",
+                            clo_prefetcher, Pf_NextLine) {}
+   else if VG_XACT_CLO(arg, "--prefetcher=stride",
+                            clo_prefetcher, Pf_Stride) {}
+   else if VG_XACT_CLO(arg, "--branch-cond=gselect",
+                            clo_branch_cond, Bp_GSelect) {}
+   else if VG_XACT_CLO(arg, "--branch-cond=gshare",
+                            clo_branch_cond, Bp_GShare) {}
+   else if VG_XACT_CLO(arg, "--branch-cond=tage",
+                            clo_branch_cond, Bp_Tage) {}
+   else if VG_BINT_CLO(arg, "--branch-cond-bits", clo_branch_cond_bits,
+                            BP_MIN_BITS, BP_MAX_BITS) {}
+   else if VG_BINT_CLO(arg, "--branch-ind-bits", clo_branch_ind_bits,
+                            BP_MIN_BITS, BP_MAX_BITS) {}
+   else if VG_BINT_CLO(arg, "--branch-rsb", clo_branch_rsb,
+                            0, BP_MAX_RSB) {}
    else
       return False;
 
@@ -1759,7 +2196,21 @@ static void cg_print_usage(void)
    VG_(print_cache_clo_opts)();
    VG_(printf)(
 "    --cache-sim=yes|no  [yes]        collect cache stats?\n"
+"    --cache-sim-batch=yes|no [no]    simulate cache accesses in batches?\n"
+"    --L1-policy=lru|plru|rrip|random [lru]  I1/D1 replacement policy\n"
+"    --LL-policy=lru|plru|rrip|random [lru]  LL replacement policy\n"
+"    --LL-inclusion=non-inclusive|inclusive|exclusive [non-inclusive]\n"
+"                                     LL inclusion policy w.r.t. I1/D1\n"
+"    --private-caches=yes|no [no]     per-thread I1/D1/ML caches, shared LL?\n"
+"    --prefetcher=none|next-line|stride [none]\n"
+"                                     count misses covered by this prefetcher\n"
 "    --branch-sim=yes|no [no]         collect branch prediction stats?\n"
+"    --branch-cond=gselect|gshare|tage [gselect]\n"
+"                                     conditional branch predictor\n"
+"    --branch-cond-bits=<n> [14]      log2 of the conditional predictor size\n"
+"    --branch-ind-bits=<n> [9]        log2 of the indirect branch BTB size\n"
+"    --branch-rsb=<n> [0]             return stack entries, 0 = returns\n"
+"                                     are not modelled\n"
 "    --cachegrind-out-file=<file>     output file name [cachegrind.out.%%p]\n"
    );
 }
@@ -1801,25 +2252,31 @@ static void cg_pre_clo_init(void)
                                    cg_print_debug_usage);
 }
 
+/* The running thread changes: switch in its private caches.  Batched
+   accesses were made by the previous thread, so simulate them first. */
+static void cg_start_client_code(ThreadId tid, ULong blocks_done)
+{
+   if (batch_next != batch_buf)
+      batch_drain();
+   cachesim_switch_thread(tid);
+}
+
+static void cg_thread_exit(ThreadId tid)
+{
+   if (batch_next != batch_buf)
+      batch_drain();
+   cachesim_thread_exit(tid);
+}
+
 static void cg_post_clo_init(void)
 {
    cache_t I1c, D1c, LLc; 
+   Bool    ML_given = clo_ML_cache.size != -1;
 
-   CC_table =
-      VG_(OSetGen_Create)(offsetof(LineCC, loc),
-                          cmp_CodeLoc_LineCC,
-                          VG_(malloc), "cg.main.cpci.1",
-                          VG_(free));
-   instrInfoTable =
-      VG_(OSetGen_Create)(/*keyOff*/0,
-                          NULL,
-                          VG_(malloc), "cg.main.cpci.2",
-                          VG_(free));
-   stringTable =
-      VG_(OSetGen_Create)(/*keyOff*/0,
-                          stringCmp,
-                          VG_(malloc), "cg.main.cpci.3",
-                          VG_(free));
+   CC_table       = VG_(HT_construct)("cg.main.cpci.1");
+   instrInfoTable = VG_(HT_construct)("cg.main.cpci.2");
+   stringTable    = VG_(newDedupPA)(16000, 1, VG_(malloc),
+                                    "cg.main.cpci.3", VG_(free));
 
    VG_(post_clo_init_configure_caches)(&I1c, &D1c, &LLc,
                                        &clo_I1_cache,
@@ -1831,6 +2288,8 @@ static void cg_post_clo_init(void)
    // cache lines at any cache level
    min_line_size = (I1c.line_size < D1c.line_size) ? I1c.line_size : D1c.line_size;
    min_line_size = (LLc.line_size < min_line_size) ? LLc.line_size : min_line_size;
+   if (ML_given && clo_ML_cache.line_size < min_line_size)
+      min_line_size = clo_ML_cache.line_size;
 
    Int largest_load_or_store_size
       = VG_(machine_get_size_of_largest_guest_register)();
@@ -1846,7 +2305,35 @@ static void cg_post_clo_init(void)
       VG_(exit)(1);
    }
 
-   cachesim_initcaches(I1c, D1c, LLc);
+   if (clo_LL_inclusion == LL_Exclusive
+       && (I1c.line_size != LLc.line_size || D1c.line_size != LLc.line_size)) {
+      VG_(umsg)("Cachegrind: cannot continue: --LL-inclusion=exclusive"
+                " requires\n");
+      VG_(umsg)("  the I1, D1 and LL line sizes to be equal.  Exiting now.\n");
+      VG_(exit)(1);
+   }
+
+   if (clo_LL_inclusion != LL_NonInclusive
+       && (ML_given || clo_private_caches)) {
+      VG_(umsg)("Cachegrind: cannot continue: --LL-inclusion=%s"
+                " cannot be combined\n",
+                clo_LL_inclusion == LL_Inclusive ? "inclusive" : "exclusive");
+      VG_(umsg)("  with --ML or --private-caches=yes.  Exiting now.\n");
+      VG_(exit)(1);
+   }
+
+   cachesim_initcaches(I1c, D1c, LLc, ML_given ? &clo_ML_cache : NULL,
+                       clo_L1_policy, clo_LL_policy, clo_LL_inclusion,
+                       clo_private_caches, clo_prefetcher);
+
+   if (clo_branch_sim)
+      bp_init(clo_branch_cond, clo_branch_cond_bits, clo_branch_ind_bits,
+              clo_branch_rsb);
+
+   if (clo_private_caches) {
+      VG_(track_start_client_code)(cg_start_client_code);
+      VG_(track_pre_thread_ll_exit)(cg_thread_exit);
+   }
 }
 
 VG_DETERMINE_INTERFACE_VERSION(cg_pre_clo_init)
@@ -39,6 +39,10 @@
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
 
 typedef  signed long   Word;
 typedef  unsigned long UWord;
@@ -113,6 +117,13 @@ WordFM* dopyFM ( WordFM* fm, Word(*dopyK)(Word), Word(*dopyV)(Word) );
 
 static const char* argv0 = "cg_merge";
 
+/* With -d, the costs of the first file are subtracted from those of
+   the second, and summed up per function, as cg_diff does. */
+static Bool diff_mode = False;
+
+/* -q: no progress messages */
+static Bool quiet = False;
+
 /* Keep track of source filename/line no so as to be able to
    print decent error messages. */
 typedef
@@ -120,6 +131,8 @@ typedef
       FILE* fp;
       UInt  lno;
       char* filename;
+      char*  line;     /* buffer for readline() */
+      size_t linesiz;
    }
    SOURCE;
 
@@ -153,28 +166,25 @@ static void barf ( SOURCE* s, const char* msg )
 }
 
 // Read a line. Return the line read, or NULL if at EOF.
-// The line is allocated dynamically but will be overwritten with
+// The line is allocated dynamically in s but will be overwritten with
 // every invocation. Caller must not free it.
 static const char *readline ( SOURCE* s )
 {
-   static char  *line = NULL;
-   static size_t linesiz = 0;
-
    int ch, i = 0;
 
    while (1) {
       ch = getc(s->fp);
       if (ch != EOF) {
-          if (i + 1 >= linesiz) {
-             linesiz += 500;
-             line = realloc(line, linesiz * sizeof *line);
-             if (line == NULL)
+          if (i + 1 >= s->linesiz) {
+             s->linesiz += 500;
+             s->line = realloc(s->line, s->linesiz * sizeof *s->line);
+             if (s->line == NULL)
                 mallocFail(s, "readline:");
           }
-          line[i++] = ch;
-          line[i] = 0;
+          s->line[i++] = ch;
+          s->line[i] = 0;
           if (ch == '\n') {
-             line[i-1] = 0;
+             s->line[i-1] = 0;
              s->lno++;
              break;
           }
@@ -188,7 +198,7 @@ static const char *readline ( SOURCE* s )
          }
       }
    }
-   return i == 0 ? NULL : line;
+   return i == 0 ? NULL : s->line;
 }
 
 static Bool streqn ( const char* s1, const char* s2, size_t n )
@@ -403,41 +413,6 @@ static void showCounts ( FILE* f, Counts* c )
    }
 }
 
-static void show_CacheProfFile ( FILE* f, CacheProfFile* cpf )
-{
-   Int     i;
-   char**  d;
-   FileFn* topKey;
-   WordFM* topVal;
-   UWord   subKey;
-   Counts* subVal;  
-
-   for (d = cpf->desc_lines; *d; d++)
-      fprintf(f, "%s\n", *d);
-   fprintf(f, "%s\n", cpf->cmd_line);
-   fprintf(f, "%s\n", cpf->events_line);
-
-   initIterFM( cpf->outerMap );
-   while (nextIterFM( cpf->outerMap, (Word*)(&topKey), (Word*)(&topVal) )) {
-      fprintf(f, "fl=%s\nfn=%s\n", 
-                 topKey->fi_name, topKey->fn_name );
-      initIterFM( topVal );
-      while (nextIterFM( topVal, (Word*)(&subKey), (Word*)(&subVal) )) {
-         fprintf(f, "%ld   ", subKey );
-         showCounts( f, subVal );
-         fprintf(f, "\n");
-      }
-      doneIterFM( topVal );
-   }
-   doneIterFM( cpf->outerMap );
-
-   //fprintf(f, "%s\n", cpf->summary_line);
-   fprintf(f, "summary:");
-   for (i = 0; i < cpf->summary->n_counts; i++)
-      fprintf(f, " %lld", cpf->summary->counts[i]);
-   fprintf(f, "\n");
-}
-
 ////////////////////////////////////////////////////////////////
 
 static Word cmp_FileFn ( Word s1, Word s2 )
@@ -562,6 +537,8 @@ void handle_counts ( SOURCE* s,
 
    // parse the numbers
    newCounts = splitUpCountsLine( s, &lnno, newCountsStr );
+   if (diff_mode)
+      lnno = 0;
 
    // Did we get the right number?
    if (newCounts->n_counts != cpf->n_events)
@@ -847,24 +824,539 @@ static void merge_CacheProfInfo ( SOURCE* s,
    mallocFail(s, "merge_CacheProfInfo");
 }
 
+////////////////////////////////////////////////////////////////
+//
+// Streaming merge.
+//
+// The input files are parsed by -j worker threads.  Each worker merges
+// the files it parsed into its own running totals.  When those grow
+// beyond the worker's share of the -m memory budget, they are written
+// to a temporary file, sorted by file, function and line (which is the
+// order of the WordFM maps), and the worker starts afresh.  Finally, all
+// the sorted runs, in memory or on disk, are merged in a single pass
+// into the output, so at most one entry of each run is in memory for
+// spilled runs.  To bound the number of open temporary files, every
+// MAX_SPILLED_RUNS spilled runs are merged into a single one right away.
+//
+// -m does not bound everything: each worker also holds the input file
+// it is parsing, in full, until it is merged into the worker's totals.
+// So the memory used is up to the budget plus the size of the parsed
+// form of the -j largest input files.
+//
+// With -d, each of the two inputs forms runs of its own, and the runs
+// of the first one are subtracted instead of added.
+
+typedef
+   struct {
+      Int     sign;     // +1, or -1 for a subtracted run
+      // in memory: iteration over the maps of cpf
+      CacheProfFile* cpf;
+      WordFM* inner;    // inner map being iterated, or NULL
+      // spilled: entries are read back from src
+      SOURCE  src;
+      char*   fi_name;  // owned only for spilled runs
+      char*   fn_name;
+      // the current entry
+      Bool    valid;
+      const char* fi;
+      const char* fn;
+      UWord   lno;
+      Counts* counts;
+   }
+   Run;
+
+typedef
+   struct {
+      pthread_t      thread;
+      CacheProfFile* acc;    // running totals, or NULL
+      Int            sign;   // sign of the files merged into acc
+      size_t         mem;    // estimated memory used by acc
+   }
+   Worker;
+
+static char**  in_names   = NULL;
+static Int     n_in_names = 0;
+static Int     next_in    = 0;
+
+static Int     n_workers  = 1;
+static size_t  mem_budget = 0;   // in bytes; 0 means unlimited
+
+static Run**   runs       = NULL;
+static Int     n_runs     = 0;
+
+// Taken from the first two input files
+static char**  out_desc_lines = NULL;
+static char*   in_cmd_lines[2] = { NULL, NULL };
+
+static char*   events_line = NULL;
+static Int     n_events    = 0;
+static Counts* summary     = NULL;
+
+static pthread_mutex_t merge_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Rough memory use of an entry in the maps, for -m only
+#define ENTRY_OVERHEAD (sizeof(Counts) + 48)
+
+// Spilled runs of one sign before they are merged into one
+#define MAX_SPILLED_RUNS 32
+
+static size_t estimate_size ( CacheProfFile* cpf )
+{
+   FileFn* key;
+   WordFM* innerMap;
+   size_t  sz = 0;
+
+   initIterFM( cpf->outerMap );
+   while (nextIterFM( cpf->outerMap, (Word*)&key, (Word*)&innerMap )) {
+      sz += sizeof(FileFn) + ENTRY_OVERHEAD
+            + strlen(key->fi_name) + strlen(key->fn_name) + 2;
+      sz += sizeFM(innerMap) * (ENTRY_OVERHEAD + n_events * sizeof(ULong));
+   }
+   doneIterFM( cpf->outerMap );
+   return sz;
+}
+
+static void add_run ( Run* r )
+{
+   pthread_mutex_lock(&merge_lock);
+   runs = realloc(runs, (n_runs + 1) * sizeof(Run*));
+   if (runs == NULL) {
+      fprintf(stderr, "%s: out of memory in add_run\n", argv0);
+      exit(2);
+   }
+   runs[n_runs++] = r;
+   pthread_mutex_unlock(&merge_lock);
+}
+
+static Run* new_Run ( Int sign )
+{
+   Run* r = calloc(1, sizeof(Run));
+   if (r == NULL) {
+      fprintf(stderr, "%s: out of memory in new_Run\n", argv0);
+      exit(2);
+   }
+   r->sign = sign;
+   return r;
+}
+
+// Hand the running totals of a worker over as an in-memory run.
+static void finish_worker_acc ( Worker* w )
+{
+   Run* r = new_Run( w->sign );
+   r->cpf = w->acc;
+   add_run( r );
+   w->acc = NULL;
+   w->mem = 0;
+}
+
+// A new run to be written to a temporary file.
+static Run* new_spilled_Run ( Int sign )
+{
+   Run* r = new_Run( sign );
+
+   r->src.filename = "(temporary file)";
+   r->src.lno      = 1;
+   r->src.fp       = tmpfile();
+   if (!r->src.fp) {
+      perror(argv0);
+      barf(&r->src, "Cannot create temporary file");
+   }
+   return r;
+}
+
+// Done writing r: rewind it for reading.
+static void finish_spilled_Run ( Run* r )
+{
+   if (fflush(r->src.fp) != 0 || ferror(r->src.fp)) {
+      perror(argv0);
+      barf(&r->src, "I/O error while writing temporary file");
+   }
+   rewind(r->src.fp);
+}
+
+static void start_Run ( Run* r );
+static void del_Run ( Run* r );
+static void merge_Runs ( FILE* f, Run** rs, Int n, Bool to_spill );
+
+// Add a spilled run.  Once there are MAX_SPILLED_RUNS of them with the
+// same sign, take them out and merge them into a single run.  They do
+// not need the lock meanwhile, as no other thread can see them.
+static void add_spilled_run ( Run* r )
+{
+   Run** group;
+   Run*  merged;
+   Int   i, j, n = 0;
+
+   pthread_mutex_lock(&merge_lock);
+   for (i = 0; i < n_runs; i++)
+      if (!runs[i]->cpf && runs[i]->sign == r->sign)
+         n++;
+   if (n + 1 < MAX_SPILLED_RUNS) {
+      pthread_mutex_unlock(&merge_lock);
+      add_run( r );
+      return;
+   }
+   group = malloc((n + 1) * sizeof(Run*));
+   if (group == NULL) {
+      fprintf(stderr, "%s: out of memory in add_spilled_run\n", argv0);
+      exit(2);
+   }
+   n = 0;
+   for (i = j = 0; i < n_runs; i++) {
+      if (!runs[i]->cpf && runs[i]->sign == r->sign)
+         group[n++] = runs[i];
+      else
+         runs[j++] = runs[i];
+   }
+   n_runs = j;
+   pthread_mutex_unlock(&merge_lock);
+   group[n++] = r;
+
+   merged = new_spilled_Run( r->sign );
+   for (i = 0; i < n; i++)
+      start_Run( group[i] );
+   merge_Runs( merged->src.fp, group, n, True );
+   for (i = 0; i < n; i++)
+      del_Run( group[i] );
+   free(group);
+   finish_spilled_Run( merged );
+   add_run( merged );
+}
+
+// Write the running totals of a worker to a temporary file, sorted,
+// and free them.
+static void spill_worker_acc ( Worker* w )
+{
+   FileFn* topKey;
+   WordFM* topVal;
+   UWord   subKey;
+   Counts* subVal;
+   Int     i;
+   Run*    r = new_spilled_Run( w->sign );
+
+   initIterFM( w->acc->outerMap );
+   while (nextIterFM( w->acc->outerMap, (Word*)&topKey, (Word*)&topVal )) {
+      fprintf(r->src.fp, "fl=%s\nfn=%s\n", topKey->fi_name, topKey->fn_name);
+      initIterFM( topVal );
+      while (nextIterFM( topVal, (Word*)&subKey, (Word*)&subVal )) {
+         fprintf(r->src.fp, "%lu", subKey);
+         for (i = 0; i < subVal->n_counts; i++)
+            fprintf(r->src.fp, " %llu", subVal->counts[i]);
+         fprintf(r->src.fp, "\n");
+      }
+      doneIterFM( topVal );
+   }
+   doneIterFM( w->acc->outerMap );
+
+   finish_spilled_Run( r );
+   add_spilled_run( r );
+
+   ddel_CacheProfFile( w->acc );
+   w->acc = NULL;
+   w->mem = 0;
+}
+
+static void* worker_thread ( void* arg )
+{
+   Worker*        w = arg;
+   SOURCE         src;
+   CacheProfFile* cpf;
+   Int            ix, i, sign;
+
+   while (1) {
+      pthread_mutex_lock(&merge_lock);
+      ix = next_in < n_in_names ? next_in++ : -1;
+      pthread_mutex_unlock(&merge_lock);
+      if (ix < 0)
+         break;
+
+      if (!quiet)
+         fprintf(stderr, "%s: parsing %s\n", argv0, in_names[ix]);
+      memset(&src, 0, sizeof(src));
+      src.lno      = 1;
+      src.filename = in_names[ix];
+      src.fp       = fopen(src.filename, "r");
+      if (!src.fp) {
+         perror(argv0);
+         barf(&src, "Cannot open input file");
+      }
+      assert(src.fp);
+      cpf = parse_CacheProfFile( &src );
+      fclose(src.fp);
+
+      sign = (diff_mode && ix == 0) ? -1 : 1;
+
+      pthread_mutex_lock(&merge_lock);
+      if (events_line == NULL) {
+         events_line = strdup(cpf->events_line);
+         n_events    = cpf->n_events;
+         summary     = new_Counts_Zeroed( n_events );
+         if (events_line == NULL || summary == NULL)
+            mallocFail(&src, "worker_thread");
+      }
+      else if (!streq( events_line, cpf->events_line ))
+         barf(&src, "\"events:\" line of most recent file does "
+                    "not match those previously processed");
+      for (i = 0; i < n_events; i++)
+         summary->counts[i] += sign * cpf->summary->counts[i];
+      if (ix == 0) {
+         out_desc_lines  = cpf->desc_lines;
+         cpf->desc_lines = NULL;
+      }
+      if (ix < 2) {
+         in_cmd_lines[ix] = cpf->cmd_line;
+         cpf->cmd_line    = NULL;
+      }
+      pthread_mutex_unlock(&merge_lock);
+
+      // runs are added or subtracted as a whole
+      if (w->acc && w->sign != sign)
+         finish_worker_acc( w );
+
+      if (w->acc == NULL) {
+         w->acc  = cpf;
+         w->sign = sign;
+      } else {
+         if (!quiet)
+            fprintf(stderr, "%s: merging %s\n", argv0, in_names[ix]);
+         merge_CacheProfInfo( &src, w->acc, cpf );
+         ddel_CacheProfFile( cpf );
+      }
+      w->mem = estimate_size( w->acc );
+      free(src.line);
+
+      if (mem_budget > 0 && w->mem > mem_budget / n_workers)
+         spill_worker_acc( w );
+   }
+
+   if (w->acc)
+      finish_worker_acc( w );
+   return NULL;
+}
+
+// Move r to its next entry; clears r->valid at the end.
+static void next_Run ( Run* r )
+{
+   FileFn*     topKey;
+   const char* line;
+
+   if (r->cpf) {
+      while (1) {
+         if (r->inner) {
+            if (nextIterFM( r->inner, (Word*)&r->lno, (Word*)&r->counts ))
+               return;
+            doneIterFM( r->inner );
+            r->inner = NULL;
+         }
+         if (!nextIterFM( r->cpf->outerMap, (Word*)&topKey,
+                                            (Word*)&r->inner )) {
+            doneIterFM( r->cpf->outerMap );
+            r->valid = False;
+            return;
+         }
+         r->fi = topKey->fi_name;
+         r->fn = topKey->fn_name;
+         initIterFM( r->inner );
+      }
+   }
+
+   if (r->counts)
+      ddel_Counts( r->counts );
+   r->counts = NULL;
+   while ((line = readline( &r->src )) != NULL) {
+      if (streqn(line, "fl=", 3)) {
+         free(r->fi_name);
+         r->fi = r->fi_name = strdup(line+3);
+      }
+      else if (streqn(line, "fn=", 3)) {
+         free(r->fn_name);
+         r->fn = r->fn_name = strdup(line+3);
+      }
+      else {
+         r->counts = splitUpCountsLine( &r->src, &r->lno, line );
+         if (r->counts == NULL)
+            mallocFail( &r->src, "next_Run" );
+         if (r->fi == NULL || r->fn == NULL)
+            mallocFail( &r->src, "next_Run" );
+         return;
+      }
+   }
+   r->valid = False;
+}
+
+static void start_Run ( Run* r )
+{
+   r->valid = True;
+   if (r->cpf)
+      initIterFM( r->cpf->outerMap );
+   next_Run( r );
+}
+
+static void del_Run ( Run* r )
+{
+   if (r->cpf)
+      ddel_CacheProfFile( r->cpf );
+   else {
+      fclose(r->src.fp);
+      free(r->src.line);
+      free(r->fi_name);
+      free(r->fn_name);
+      if (r->counts)
+         ddel_Counts( r->counts );
+   }
+   free(r);
+}
+
+static Word cmp_Run ( Run* r1, Run* r2 )
+{
+   Word r = strcmp(r1->fi, r2->fi);
+   if (r == 0)
+      r = strcmp(r1->fn, r2->fn);
+   if (r == 0)
+      r = cmp_unboxed_UWord( (Word)r1->lno, (Word)r2->lno );
+   return r;
+}
+
+// Merge the n started runs rs into f, writing each entry once, in
+// sorted order.  With to_spill, all of rs have the same sign, and the
+// entries are written unsigned, in the format of spill_worker_acc.
+static void merge_Runs ( FILE* f, Run** rs, Int n, Bool to_spill )
+{
+   Bool*   same = malloc(n * sizeof(Bool));
+   Counts* sum  = new_Counts_Zeroed( n_events );
+   char*   last_fi = NULL;
+   char*   last_fn = NULL;
+   Run*    min;
+   Int     i, j;
+
+   if (same == NULL || sum == NULL) {
+      fprintf(stderr, "%s: out of memory in merge_Runs\n", argv0);
+      exit(2);
+   }
+
+   while (1) {
+      min = NULL;
+      for (i = 0; i < n; i++)
+         if (rs[i]->valid && (!min || cmp_Run(rs[i], min) < 0))
+            min = rs[i];
+      if (!min)
+         break;
+
+      for (j = 0; j < n_events; j++)
+         sum->counts[j] = 0;
+      for (i = 0; i < n; i++) {
+         same[i] = rs[i]->valid && cmp_Run(rs[i], min) == 0;
+         if (!same[i])
+            continue;
+         if (rs[i]->counts->n_counts != n_events) {
+            fprintf(stderr, "%s: # counts doesn't match # events\n", argv0);
+            exit(1);
+         }
+         for (j = 0; j < n_events; j++)
+            sum->counts[j] += (to_spill ? 1 : rs[i]->sign)
+                              * rs[i]->counts->counts[j];
+      }
+
+      if (diff_mode && !to_spill) {
+         fprintf(f, "fl=%s\nfn=%s\n0", min->fi, min->fn);
+         for (j = 0; j < n_events; j++)
+            fprintf(f, " %lld", (long long)sum->counts[j]);
+         fprintf(f, "\n");
+      } else {
+         if (!last_fi || !streq(last_fi, min->fi)
+                      || !streq(last_fn, min->fn)) {
+            free(last_fi);
+            free(last_fn);
+            last_fi = strdup(min->fi);
+            last_fn = strdup(min->fn);
+            fprintf(f, "fl=%s\nfn=%s\n", min->fi, min->fn);
+         }
+         if (to_spill) {
+            fprintf(f, "%lu", min->lno);
+            for (j = 0; j < n_events; j++)
+               fprintf(f, " %llu", sum->counts[j]);
+         } else {
+            fprintf(f, "%ld   ", min->lno );
+            showCounts( f, sum );
+         }
+         fprintf(f, "\n");
+      }
+
+      for (i = 0; i < n; i++)
+         if (same[i])
+            next_Run( rs[i] );
+   }
+
+   free(last_fi);
+   free(last_fn);
+   free(same);
+   ddel_Counts( sum );
+}
+
+static void show_header ( FILE* f )
+{
+   char** d;
+   char*  ev;
+   char*  tok;
+
+   if (!diff_mode) {
+      for (d = out_desc_lines; *d; d++)
+         fprintf(f, "%s\n", *d);
+      fprintf(f, "%s\n", in_cmd_lines[0]);
+      fprintf(f, "%s\n", events_line);
+      return;
+   }
+
+   // as written by cg_diff
+   fprintf(f, "desc: Files compared:   %s; %s\n", in_names[0], in_names[1]);
+   fprintf(f, "cmd:  %s; %s\n", in_cmd_lines[0] + 5, in_cmd_lines[1] + 5);
+   fprintf(f, "events: ");
+   ev = strdup(events_line + 8);
+   if (ev == NULL) {
+      fprintf(stderr, "%s: out of memory in show_header\n", argv0);
+      exit(2);
+   }
+   for (tok = strtok(ev, " \t"); tok; tok = strtok(NULL, " \t"))
+      fprintf(f, " %s", tok);
+   fprintf(f, "\n");
+   free(ev);
+}
+
 static void usage ( void )
 {
    fprintf(stderr, "%s: Merges multiple cachegrind output files into one\n", 
                    argv0);
-   fprintf(stderr, "%s: usage: %s [-o outfile] [files-to-merge]\n", 
+   fprintf(stderr, "%s: usage: %s [-o outfile] [-j threads] [-m megabytes] "
+                   "[-d] [-q] [files-to-merge]\n",
+                   argv0, argv0);
+   fprintf(stderr, "%s: -m bounds the running totals only; each of the "
+                   "-j threads also\n"
+                   "%s: holds the input file it is reading, in full\n",
                    argv0, argv0);
    exit(1);
 }
 
+/* Parses the value of a numeric option, which must be a decimal number
+   in [min, max];  anything else is a usage error. */
+static long parse_num_opt ( const char* s, long min, long max )
+{
+   char* end;
+   long  n;
+
+   errno = 0;
+   n = strtol(s, &end, 10);
+   if (end == s || *end != '\0' || errno != 0 || n < min || n > max)
+      usage();
+   return n;
+}
+
 int main ( int argc, char** argv )
 {
    Int            i;
-   SOURCE         src;
-   CacheProfFile  *cpf, *cpfTmp;
+   Worker*        workers;
 
    FILE*          outfile = NULL;
    char*          outfilename = NULL;
-   Int            outfileix = 0;
 
    if (argv[0])
       argv0 = argv[0];
@@ -877,60 +1369,66 @@ int main ( int argc, char** argv )
          usage();
    }
 
-   /* Scan args, looking for '-o outfilename'. */
+   in_names = malloc(argc * sizeof(char*));
+   if (in_names == NULL) {
+      fprintf(stderr, "%s: out of memory\n", argv0);
+      exit(2);
+   }
+
+   /* Scan args for options; everything else is an input file. */
    for (i = 1; i < argc; i++) {
-      if (streq(argv[i], "-o")) {
-         if (i+1 < argc) {
-            outfilename = argv[i+1];
-            outfileix   = i;
-            break;
-         } else {
+      if (streq(argv[i], "-o") || streq(argv[i], "-j")
+          || streq(argv[i], "-m")) {
+         if (i+1 >= argc)
             usage();
-         }
+         if (argv[i][1] == 'o')
+            outfilename = argv[i+1];
+         else if (argv[i][1] == 'j')
+            n_workers = (Int)parse_num_opt(argv[i+1], 1, INT_MAX);
+         else
+            mem_budget = (size_t)parse_num_opt(argv[i+1], 0,
+                                               (long)(SIZE_MAX >> 20)) << 20;
+         i++;
       }
+      else if (streq(argv[i], "-d"))
+         diff_mode = True;
+      else if (streq(argv[i], "-q"))
+         quiet = True;
+      else
+         in_names[n_in_names++] = argv[i];
    }
 
-   cpf = NULL;
-
-   for (i = 1; i < argc; i++) {
+   if (diff_mode && n_in_names != 2)
+      usage();
+   if (n_workers > n_in_names)
+      n_workers = n_in_names;
+   if (n_workers < 1)
+      n_workers = 1;
 
-      if (i == outfileix) {
-         /* Skip '-o' and whatever follows it */
-         i += 1;
-         continue;
-      }
+   if (n_in_names > 0) {
 
-      fprintf(stderr, "%s: parsing %s\n", argv0, argv[i]);
-      src.lno      = 1;
-      src.filename = argv[i];
-      src.fp       = fopen(src.filename, "r");
-      if (!src.fp) {
-         perror(argv0);
-         barf(&src, "Cannot open input file");
+      workers = calloc(n_workers, sizeof(Worker));
+      if (workers == NULL) {
+         fprintf(stderr, "%s: out of memory\n", argv0);
+         exit(2);
       }
-      assert(src.fp);
-      cpfTmp = parse_CacheProfFile( &src );
-      fclose(src.fp);
-
-      /* If this isn't the first file, merge */
-      if (cpf == NULL) {
-         /* this is the first file */
-         cpf = cpfTmp;
-      } else {
-         /* not the first file; merge */
-         fprintf(stderr, "%s: merging %s\n", argv0, argv[i]);
-         merge_CacheProfInfo( &src, cpf, cpfTmp );
-         ddel_CacheProfFile( cpfTmp );
+      for (i = 1; i < n_workers; i++) {
+         if (pthread_create(&workers[i].thread, NULL,
+                            worker_thread, &workers[i]) != 0) {
+            fprintf(stderr, "%s: can't create thread\n", argv0);
+            exit(1);
+         }
       }
+      worker_thread(&workers[0]);
+      for (i = 1; i < n_workers; i++)
+         pthread_join(workers[i].thread, NULL);
+      free(workers);
 
-   }
-
-   /* Now create the output file. */
-
-   if (cpf) {
+      /* Now create the output file. */
 
-      fprintf(stderr, "%s: writing %s\n", 
-                       argv0, outfilename ? outfilename : "(stdout)" );
+      if (!quiet)
+         fprintf(stderr, "%s: writing %s\n", 
+                          argv0, outfilename ? outfilename : "(stdout)" );
 
       /* Write the output. */
       if (outfilename) {
@@ -945,7 +1443,15 @@ int main ( int argc, char** argv )
          outfile = stdout;
       }
 
-      show_CacheProfFile( outfile, cpf );
+      show_header( outfile );
+      for (i = 0; i < n_runs; i++)
+         start_Run( runs[i] );
+      merge_Runs( outfile, runs, n_runs, False );
+      fprintf(outfile, "summary:");
+      for (i = 0; i < summary->n_counts; i++)
+         fprintf(outfile, " %lld", summary->counts[i]);
+      fprintf(outfile, "\n");
+
       if (ferror(outfile)) {
          fprintf(stderr, "%s: error writing output file %s\n", 
                          argv0, outfilename ? outfilename : "(stdout)" );
@@ -959,9 +1465,12 @@ int main ( int argc, char** argv )
       if (outfile != stdout)
          fclose( outfile );
 
-      ddel_CacheProfFile( cpf );
+      for (i = 0; i < n_runs; i++)
+         del_Run( runs[i] );
+      free(runs);
    }
 
+   free(in_names);
    return 0;
 }
 
@@ -0,0 +1,161 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Hardware prefetcher model                      cg_prefetch.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a Valgrind tool for cache
+   profiling programs.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* This file contains a model of the hardware prefetcher in front of a
+   cache.  As with cg_branchpred.c it is #included directly, into
+   cg_main.c and into Callgrind's sim.c.  It provides:
+
+   - a next-line prefetcher: every miss requests the following line
+   - a stride prefetcher: per 4 KiB page, the distance between
+     consecutive misses is tracked; once the same stride has been seen
+     twice in a row, the next one or two lines along the stride are
+     requested
+
+   The prefetcher is trained on the miss stream of its cache only, and
+   never crosses a page boundary, like most real prefetchers.
+
+   Prefetched lines are not put into the simulated cache.  Instead, the
+   prefetcher remembers the lines it requested, and a later miss to one
+   of those lines is reported as "covered": a real CPU would (at least
+   partially) have hidden it.  So the usual miss counts do not change
+   when a prefetcher is modelled, and covered misses are a subset of
+   them.
+*/
+
+typedef enum {
+   Pf_None,
+   Pf_NextLine,
+   Pf_Stride
+} prefetch_model_t;
+
+/* Number of requested lines remembered, direct-mapped by line.  Older
+   requests that were never used get overwritten, which roughly models
+   the limited lifetime of a prefetched line in a real cache. */
+#define PF_BUFFER_SIZE    64
+
+/* Number of pages tracked by the stride prefetcher. */
+#define PF_STRIDE_STREAMS 16
+#define PF_PAGE_BITS      12
+
+typedef struct {
+   UWord page;       /* page tracked by this entry */
+   UWord last;       /* last missing line in that page */
+   Word  stride;     /* last distance between misses, in lines */
+   Int   conf;       /* number of times in a row the stride repeated */
+} pf_stream;
+
+typedef struct {
+   prefetch_model_t model;
+   Int       page_shift;              /* line number -> page number */
+   UWord     buf[PF_BUFFER_SIZE];     /* requested lines; 0 is empty */
+   pf_stream streams[PF_STRIDE_STREAMS];
+   ULong     issued;                  /* # lines requested */
+   ULong     covered;                 /* # misses to requested lines */
+} prefetcher_t;
+
+static const HChar* pf_model_name(prefetch_model_t model)
+{
+   switch (model) {
+      case Pf_None:     return "none";
+      case Pf_NextLine: return "next-line";
+      case Pf_Stride:   return "stride";
+   }
+   tl_assert(0);
+   return NULL;
+}
+
+static void pf_init(prefetcher_t* pf, prefetch_model_t model,
+                    Int line_size_bits)
+{
+   VG_(memset)(pf, 0, sizeof(prefetcher_t));
+   pf->model      = model;
+   pf->page_shift = line_size_bits < PF_PAGE_BITS
+                    ? PF_PAGE_BITS - line_size_bits : 0;
+}
+
+/* Request line 'line' after a miss of line 'from'. */
+static __inline__
+void pf_request(prefetcher_t* pf, UWord from, UWord line)
+{
+   if ((from >> pf->page_shift) != (line >> pf->page_shift) || line == 0)
+      return;
+   pf->buf[line % PF_BUFFER_SIZE] = line;
+   pf->issued++;
+}
+
+/* Called on every miss of the cache in front of which pf sits, with the
+   number of the missing line.  Returns whether the prefetcher requested
+   that line before, and trains the prefetcher with the miss. */
+static Bool pf_miss_is_covered(prefetcher_t* pf, UWord line)
+{
+   UWord*     slot = &pf->buf[line % PF_BUFFER_SIZE];
+   Bool       covered = *slot == line;
+   pf_stream* s;
+   UWord      page;
+   Word       d;
+
+   if (covered) {
+      *slot = 0;
+      pf->covered++;
+   }
+
+   if (pf->model == Pf_NextLine) {
+      pf_request(pf, line, line + 1);
+      return covered;
+   }
+
+   tl_assert(pf->model == Pf_Stride);
+   page = line >> pf->page_shift;
+   s    = &pf->streams[page % PF_STRIDE_STREAMS];
+   if (s->page != page) {
+      s->page   = page;
+      s->last   = line;
+      s->stride = 0;
+      s->conf   = 0;
+      return covered;
+   }
+   d = (Word)(line - s->last);
+   if (d == 0)
+      return covered;
+   if (d == s->stride) {
+      if (s->conf < 3)
+         s->conf++;
+   } else {
+      s->stride = d;
+      s->conf   = 0;
+   }
+   s->last = line;
+   if (s->conf >= 1)
+      pf_request(pf, line, line + d);
+   if (s->conf >= 2)
+      pf_request(pf, line, line + 2 * d);
+   return covered;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                            cg_prefetch.c ---*/
+/*--------------------------------------------------------------------*/
@@ -36,8 +36,61 @@
       - both blocks hit                  --> one hit
       - one block hits, the other misses --> one miss
       - both blocks miss                 --> one miss (not two)
+  - the replacement policy of each cache is one of:
+      - LRU (the default): the tags of a set are kept in MRU order
+      - tree-PLRU: a binary tree of assoc-1 bits per set points to the
+        victim; for a non-power-of-2 associativity the tree is padded
+        and the missing ways are never chosen as victim
+      - SRRIP: static re-reference interval prediction with 2-bit
+        re-reference prediction values per line
+      - random
+    For all but LRU, lines stay in the way they were filled into, and
+    invalid (zero) ways are filled first.
+  - by default the LL cache is neither inclusive nor exclusive of the
+    L1 caches, i.e. it is accessed on every L1 miss and does not
+    interact with the L1 caches otherwise.  Optionally it is modelled
+    as inclusive (an LL eviction invalidates the line in I1 and D1) or
+    exclusive (lines enter LL only when evicted from an L1 cache, and
+    leave it when they are brought into an L1 cache).
+  - optionally, a mid-level (ML) cache sits between the L1 caches and
+    LL.  It is unified, uses the L1 replacement policy, and is only
+    accessed on an L1 miss; LL is then only accessed on an ML miss.
+  - optionally, I1, D1 and ML are private to each thread while LL is
+    shared by all threads.  The private caches of the running thread are
+    switched in by cachesim_switch_thread(); this only swaps the tag and
+    policy state arrays, so the simulation functions are unaffected.
+  - optionally, a prefetcher (see cg_prefetch.c) sits in front of each
+    of I1, D1 and LL.  It does not change the simulated caches, but
+    reports which misses it would have covered.
+  - a tag of zero denotes an invalid line; block 0 is never accessed.
 */
 
+/* Counts of one kind of access (Ir, Dr or Dw) to one source line,
+   updated by the simulation functions. */
+typedef
+   struct {
+      ULong a;  /* total # memory accesses of this kind */
+      ULong m1; /* misses in the first level cache */
+      ULong m2; /* misses in the mid-level cache, if simulated */
+      ULong mL; /* misses in the last level cache */
+      ULong p1; /* first level misses covered by the prefetcher */
+      ULong pL; /* last level misses covered by the prefetcher */
+   }
+   CacheCC;
+
+typedef enum {
+   Repl_LRU,
+   Repl_PLRU,
+   Repl_RRIP,
+   Repl_Random
+} repl_policy_t;
+
+typedef enum {
+   LL_NonInclusive,
+   LL_Inclusive,
+   LL_Exclusive
+} ll_inclusion_t;
+
 typedef struct {
    Int          size;                   /* bytes */
    Int          assoc;
@@ -46,18 +99,40 @@ typedef struct {
    Int          sets_min_1;
    Int          line_size_bits;
    Int          tag_shift;
+   repl_policy_t policy;
+   Int          state_per_set;          /* bytes of policy state per set */
    HChar        desc_line[128];         /* large enough */
    UWord*       tags;
+   UChar*       state;                  /* PLRU tree bits or RRIP values */
 } cache_t2;
 
+/* Maximum re-reference prediction value for SRRIP. */
+#define RRIP_MAX 3
+
+static UInt cachesim_random_seed = 0x12345678;
+
+static const HChar* cachesim_policy_name(repl_policy_t policy)
+{
+   switch (policy) {
+      case Repl_LRU:    return "LRU";
+      case Repl_PLRU:   return "tree-PLRU";
+      case Repl_RRIP:   return "SRRIP";
+      case Repl_Random: return "random";
+   }
+   tl_assert(0);
+   return NULL;
+}
+
 /* By this point, the size/assoc/line_size has been checked. */
-static void cachesim_initcache(cache_t config, cache_t2* c)
+static void cachesim_initcache(cache_t config, cache_t2* c,
+                               repl_policy_t policy)
 {
    Int i;
 
    c->size      = config.size;
    c->assoc     = config.assoc;
    c->line_size = config.line_size;
+   c->policy    = policy;
 
    c->sets           = (c->size / c->line_size) / c->assoc;
    c->sets_min_1     = c->sets - 1;
@@ -70,6 +145,9 @@ static void cachesim_initcache(cache_t config, cache_t2* c)
    } else {
       VG_(sprintf)(c->desc_line, "%d B, %d B, %d-way associative",
                                  c->size, c->line_size, c->assoc);
+      if (policy != Repl_LRU)
+         VG_(sprintf)(c->desc_line + VG_(strlen)(c->desc_line), ", %s",
+                      cachesim_policy_name(policy));
    }
 
    c->tags = VG_(malloc)("cg.sim.ci.1",
@@ -77,6 +155,150 @@ static void cachesim_initcache(cache_t config, cache_t2* c)
 
    for (i = 0; i < c->sets * c->assoc; i++)
       c->tags[i] = 0;
+
+   /* The PLRU tree of a set with 2^n ways has 2^n - 1 nodes, stored
+      from index 1 onwards.  The associativity is rounded up to a power
+      of two to get the same layout for all associativities. */
+   switch (policy) {
+      case Repl_PLRU:
+         for (c->state_per_set = 1; c->state_per_set < c->assoc; )
+            c->state_per_set *= 2;
+         break;
+      case Repl_RRIP:
+         c->state_per_set = c->assoc;
+         break;
+      default:
+         c->state_per_set = 0;
+         break;
+   }
+   c->state = NULL;
+   if (c->state_per_set > 0) {
+      c->state = VG_(malloc)("cg.sim.ci.2", c->state_per_set * c->sets);
+      VG_(memset)(c->state, policy == Repl_RRIP ? RRIP_MAX : 0,
+                  c->state_per_set * c->sets);
+   }
+}
+
+/* Returns the way of set holding tag, or -1.  The search compares four
+ * tags per iteration without data-dependent branches in between, which
+ * keeps it fast for the 12-, 16- and 20-way caches of current CPUs.
+ */
+__attribute__((always_inline))
+static __inline__
+Int cachesim_find_way(const UWord* set, Int assoc, UWord tag)
+{
+   Int i = 0;
+
+   for (; i + 4 <= assoc; i += 4) {
+      if ((set[i] == tag) | (set[i + 1] == tag)
+          | (set[i + 2] == tag) | (set[i + 3] == tag))
+         break;
+   }
+   for (; i < assoc; i++) {
+      if (set[i] == tag)
+         return i;
+   }
+   return -1;
+}
+
+/* Make the PLRU tree of a set point away from 'way'. */
+static __inline__
+void cachesim_plru_touch(UChar* tree, Int ways, Int way)
+{
+   Int node = 1, lo = 0, span = ways;
+
+   while (span > 1) {
+      span /= 2;
+      if (way < lo + span) {
+         tree[node] = 1;                /* next victim on the right */
+         node = 2 * node;
+      } else {
+         tree[node] = 0;                /* next victim on the left */
+         lo += span;
+         node = 2 * node + 1;
+      }
+   }
+}
+
+static __inline__
+Int cachesim_plru_victim(const UChar* tree, Int ways, Int assoc)
+{
+   Int node = 1, lo = 0, span = ways;
+
+   while (span > 1) {
+      span /= 2;
+      /* Ways beyond assoc only exist in the padded tree. */
+      if (tree[node] && lo + span < assoc) {
+         lo += span;
+         node = 2 * node + 1;
+      } else {
+         node = 2 * node;
+      }
+   }
+   return lo;
+}
+
+static __inline__
+Int cachesim_rrip_victim(UChar* rrpv, Int assoc)
+{
+   Int i;
+
+   for (;;) {
+      for (i = 0; i < assoc; i++) {
+         if (rrpv[i] == RRIP_MAX)
+            return i;
+      }
+      for (i = 0; i < assoc; i++)
+         rrpv[i]++;
+   }
+}
+
+/* Reference 'tag' in a cache with a policy other than LRU.  On a miss,
+ * the evicted tag (zero if an invalid way was filled) is stored in
+ * *victim.
+ */
+__attribute__((noinline))
+static Bool cachesim_setref_is_miss_nonlru(cache_t2* c, UInt set_no,
+                                           UWord tag, UWord* victim)
+{
+   UWord* set   = &(c->tags[set_no * c->assoc]);
+   UChar* state = c->state ? &(c->state[set_no * c->state_per_set]) : NULL;
+   Int    way   = cachesim_find_way(set, c->assoc, tag);
+
+   if (way >= 0) {
+      if (c->policy == Repl_PLRU)
+         cachesim_plru_touch(state, c->state_per_set, way);
+      else if (c->policy == Repl_RRIP)
+         state[way] = 0;
+      return False;
+   }
+
+   way = cachesim_find_way(set, c->assoc, 0);
+   if (way < 0) {
+      switch (c->policy) {
+         case Repl_PLRU:
+            way = cachesim_plru_victim(state, c->state_per_set, c->assoc);
+            break;
+         case Repl_RRIP:
+            way = cachesim_rrip_victim(state, c->assoc);
+            break;
+         case Repl_Random:
+            cachesim_random_seed ^= cachesim_random_seed << 13;
+            cachesim_random_seed ^= cachesim_random_seed >> 17;
+            cachesim_random_seed ^= cachesim_random_seed << 5;
+            way = cachesim_random_seed % c->assoc;
+            break;
+         default:
+            tl_assert(0);
+      }
+   }
+   *victim = set[way];
+   set[way] = tag;
+   if (c->policy == Repl_PLRU)
+      cachesim_plru_touch(state, c->state_per_set, way);
+   else if (c->policy == Repl_RRIP)
+      state[way] = RRIP_MAX - 1;
+   return True;
 }
 
 /* This attribute forces GCC to inline the function, getting rid of a
@@ -86,11 +308,15 @@ static void cachesim_initcache(cache_t config, cache_t2* c)
  */
 __attribute__((always_inline))
 static __inline__
-Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
+Bool cachesim_setref_is_miss_victim(cache_t2* c, UInt set_no, UWord tag,
+                                    UWord* victim)
 {
    int i, j;
    UWord *set;
 
+   if (c->policy != Repl_LRU)
+      return cachesim_setref_is_miss_nonlru(c, set_no, tag, victim);
+
    set = &(c->tags[set_no * c->assoc]);
 
    /* This loop is unrolled for just the first case, which is the most */
@@ -101,18 +327,18 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
 
    /* If the tag is one other than the MRU, move it into the MRU spot  */
    /* and shuffle the rest down.                                       */
-   for (i = 1; i < c->assoc; i++) {
-      if (tag == set[i]) {
-         for (j = i; j > 0; j--) {
-            set[j] = set[j - 1];
-         }
-         set[0] = tag;
-
-         return False;
+   i = 1 + cachesim_find_way(set + 1, c->assoc - 1, tag);
+   if (i > 0) {
+      for (j = i; j > 0; j--) {
+         set[j] = set[j - 1];
       }
+      set[0] = tag;
+
+      return False;
    }
 
    /* A miss;  install this tag as MRU, shuffle rest down. */
+   *victim = set[c->assoc - 1];
    for (j = c->assoc - 1; j > 0; j--) {
       set[j] = set[j - 1];
    }
@@ -121,6 +347,39 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
    return True;
 }
 
+__attribute__((always_inline))
+static __inline__
+Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
+{
+   UWord victim;
+
+   return cachesim_setref_is_miss_victim(c, set_no, tag, &victim);
+}
+
+/* Remove 'block' from cache c if present.  Returns whether it was. */
+static Bool cachesim_invalidate(cache_t2* c, UWord block)
+{
+   UInt   set_no = block & c->sets_min_1;
+   UWord* set    = &(c->tags[set_no * c->assoc]);
+   Int    way    = cachesim_find_way(set, c->assoc, block);
+   Int    j;
+
+   if (way < 0)
+      return False;
+
+   if (c->policy == Repl_LRU) {
+      /* Move the invalid line into the LRU spot. */
+      for (j = way; j < c->assoc - 1; j++)
+         set[j] = set[j + 1];
+      set[c->assoc - 1] = 0;
+   } else {
+      set[way] = 0;
+      if (c->policy == Repl_RRIP)
+         c->state[set_no * c->state_per_set + way] = RRIP_MAX;
+   }
+   return True;
+}
+
 __attribute__((always_inline))
 static __inline__
 Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
@@ -166,57 +425,357 @@ Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
 static cache_t2 LL;
 static cache_t2 I1;
 static cache_t2 D1;
+static cache_t2 ML;
+
+static Bool ML_enabled = False;
+
+static ll_inclusion_t LL_inclusion = LL_NonInclusive;
+
+static prefetch_model_t pf_model = Pf_None;
+static prefetcher_t     pf_I1, pf_D1, pf_LL;
+
+/* Per-thread state of the private caches, when they are private.  The
+   entry of the running thread is the one whose arrays are installed in
+   I1, D1 and ML. */
+typedef struct {
+   UWord* tags;
+   UChar* state;
+} cache_arrays;
+
+typedef struct {
+   cache_arrays I1, D1, ML;
+} private_cache_set;
+
+static private_cache_set* thread_caches = NULL;   /* [VG_N_THREADS] */
+static ThreadId        caches_tid    = VG_INVALID_THREADID;
+
+/* MLc is NULL if no mid-level cache is simulated. */
+static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc,
+                                const cache_t* MLc,
+                                repl_policy_t L1_policy,
+                                repl_policy_t LL_policy,
+                                ll_inclusion_t inclusion,
+                                Bool private_caches,
+                                prefetch_model_t prefetch)
+{
+   cachesim_initcache(I1c, &I1, L1_policy);
+   cachesim_initcache(D1c, &D1, L1_policy);
+   cachesim_initcache(LLc, &LL, LL_policy);
+   if (MLc) {
+      cachesim_initcache(*MLc, &ML, L1_policy);
+      ML_enabled = True;
+   }
+   LL_inclusion = inclusion;
+   if (inclusion == LL_Inclusive)
+      VG_(strcat)(LL.desc_line, ", inclusive");
+   else if (inclusion == LL_Exclusive)
+      VG_(strcat)(LL.desc_line, ", exclusive");
+   if (prefetch != Pf_None) {
+      pf_model = prefetch;
+      pf_init(&pf_I1, prefetch, I1.line_size_bits);
+      pf_init(&pf_D1, prefetch, D1.line_size_bits);
+      pf_init(&pf_LL, prefetch, LL.line_size_bits);
+   }
+   if (private_caches) {
+      thread_caches = VG_(calloc)("cg.sim.ci.3", VG_N_THREADS,
+                                  sizeof(private_cache_set));
+      VG_(strcat)(I1.desc_line, ", per thread");
+      VG_(strcat)(D1.desc_line, ", per thread");
+      if (ML_enabled)
+         VG_(strcat)(ML.desc_line, ", per thread");
+      VG_(strcat)(LL.desc_line, ", shared");
+   }
+}
+
+static void cachesim_save_arrays(cache_arrays* a, const cache_t2* c)
+{
+   a->tags  = c->tags;
+   a->state = c->state;
+}
+
+static void cachesim_free_arrays(cache_arrays* a)
+{
+   if (a->tags)
+      VG_(free)(a->tags);
+   if (a->state)
+      VG_(free)(a->state);
+   a->tags  = NULL;
+   a->state = NULL;
+}
+
+/* Reset the tags and the policy state of c to an empty cache. */
+static void cachesim_clear_arrays(cache_t2* c)
+{
+   VG_(memset)(c->tags, 0, sizeof(UWord) * c->sets * c->assoc);
+   if (c->state)
+      VG_(memset)(c->state, c->policy == Repl_RRIP ? RRIP_MAX : 0,
+                  c->state_per_set * c->sets);
+}
+
+/* Install the arrays saved in 'a' into c.  A thread running for the
+   first time gets cold (empty) copies of the arrays. */
+static void cachesim_load_arrays(cache_t2* c, cache_arrays* a)
+{
+   if (a->tags == NULL) {
+      a->tags = VG_(malloc)("cg.sim.la.1",
+                            sizeof(UWord) * c->sets * c->assoc);
+      if (c->state_per_set > 0)
+         a->state = VG_(malloc)("cg.sim.la.2",
+                                c->state_per_set * c->sets);
+      c->tags  = a->tags;
+      c->state = a->state;
+      cachesim_clear_arrays(c);
+      return;
+   }
+   c->tags  = a->tags;
+   c->state = a->state;
+}
+
+/* Make the private caches of thread tid the simulated I1, D1 and ML.
+   Arrays installed while no thread owns them (initially, and after the
+   owner exited) are adopted by the next thread that runs, unless it
+   already has arrays of its own. */
+static void cachesim_switch_thread(ThreadId tid)
+{
+   private_cache_set* pc;
+   cache_arrays    orphan;
+
+   if (thread_caches == NULL || tid == caches_tid)
+      return;
+   tl_assert(tid < VG_N_THREADS);
+
+   pc = &thread_caches[tid];
+   if (caches_tid != VG_INVALID_THREADID) {
+      private_cache_set* old = &thread_caches[caches_tid];
+      cachesim_save_arrays(&old->I1, &I1);
+      cachesim_save_arrays(&old->D1, &D1);
+      if (ML_enabled)
+         cachesim_save_arrays(&old->ML, &ML);
+   } else if (pc->I1.tags == NULL) {
+      caches_tid = tid;
+      return;
+   } else {
+      cachesim_save_arrays(&orphan, &I1);
+      cachesim_free_arrays(&orphan);
+      cachesim_save_arrays(&orphan, &D1);
+      cachesim_free_arrays(&orphan);
+      if (ML_enabled) {
+         cachesim_save_arrays(&orphan, &ML);
+         cachesim_free_arrays(&orphan);
+      }
+   }
+   cachesim_load_arrays(&I1, &pc->I1);
+   cachesim_load_arrays(&D1, &pc->D1);
+   if (ML_enabled)
+      cachesim_load_arrays(&ML, &pc->ML);
+   caches_tid = tid;
+}
+
+/* Thread tid has exited: drop its private caches, so that a new thread
+   reusing tid starts with cold caches. */
+static void cachesim_thread_exit(ThreadId tid)
+{
+   private_cache_set* pc;
+
+   if (thread_caches == NULL)
+      return;
+   tl_assert(tid < VG_N_THREADS);
+
+   pc = &thread_caches[tid];
+   if (tid == caches_tid) {
+      /* The arrays are installed in the simulated caches.  Empty them in
+         place; the next thread that runs adopts them. */
+      cachesim_clear_arrays(&I1);
+      cachesim_clear_arrays(&D1);
+      if (ML_enabled)
+         cachesim_clear_arrays(&ML);
+      VG_(memset)(pc, 0, sizeof(private_cache_set));
+      caches_tid = VG_INVALID_THREADID;
+      return;
+   }
+   cachesim_free_arrays(&pc->I1);
+   cachesim_free_arrays(&pc->D1);
+   cachesim_free_arrays(&pc->ML);
+}
 
-static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc)
+/* Invalidate all lines of L1 that overlap with LL line 'LL_block'. */
+static void cachesim_back_invalidate(cache_t2* L1, UWord LL_block)
 {
-   cachesim_initcache(I1c, &I1);
-   cachesim_initcache(D1c, &D1);
-   cachesim_initcache(LLc, &LL);
+   Addr  start = LL_block << LL.line_size_bits;
+   UWord b;
+
+   for (b = start >> L1->line_size_bits;
+        b <= (start + LL.line_size - 1) >> L1->line_size_bits; b++)
+      cachesim_invalidate(L1, b);
+}
+
+/* Reference (a, size) in L1 followed by LL for an inclusive or an
+ * exclusive LL.  Unlike the non-inclusive case, LL is only referenced
+ * for the L1 lines that missed.
+ */
+__attribute__((noinline))
+static void cachesim_doref_incl(cache_t2* L1, prefetcher_t* pf1,
+                                Addr a, UChar size, CacheCC* cc)
+{
+   UWord block1 =  a         >> L1->line_size_bits;
+   UWord block2 = (a+size-1) >> L1->line_size_bits;
+   UWord b, LL_block, victim;
+   Bool  miss1 = False, missL = False;
+   Bool  covered1 = False, coveredL = False;
+
+   tl_assert(block2 - block1 <= 1);
+   for (b = block1; b <= block2; b++) {
+      victim = 0;
+      if (!cachesim_setref_is_miss_victim(L1, b & L1->sets_min_1, b,
+                                          &victim))
+         continue;
+      miss1 = True;
+      if (pf_model != Pf_None && pf_miss_is_covered(pf1, b))
+         covered1 = True;
+      if (LL_inclusion == LL_Exclusive) {
+         /* Line sizes are equal, see cg_post_clo_init(). */
+         if (!cachesim_invalidate(&LL, b)) {
+            missL = True;
+            if (pf_model != Pf_None && pf_miss_is_covered(&pf_LL, b))
+               coveredL = True;
+         }
+         if (victim != 0)
+            cachesim_setref_is_miss(&LL, victim & LL.sets_min_1, victim);
+      } else {
+         LL_block = (b << L1->line_size_bits) >> LL.line_size_bits;
+         victim = 0;
+         if (cachesim_setref_is_miss_victim(&LL, LL_block & LL.sets_min_1,
+                                            LL_block, &victim)) {
+            missL = True;
+            if (pf_model != Pf_None && pf_miss_is_covered(&pf_LL, LL_block))
+               coveredL = True;
+            if (victim != 0) {
+               cachesim_back_invalidate(&I1, victim);
+               cachesim_back_invalidate(&D1, victim);
+            }
+         }
+      }
+   }
+   if (miss1) {
+      cc->m1++;
+      if (covered1)
+         cc->p1++;
+      if (missL) {
+         cc->mL++;
+         if (coveredL)
+            cc->pL++;
+      }
+   }
+}
+
+/* Count whether the miss of (a, size) in cache c would have been covered
+ * by its prefetcher pf, and train pf.  For an access straddling two
+ * lines, the second line is the one accounted for.
+ */
+__attribute__((always_inline))
+static __inline__
+void cachesim_pf_miss(prefetcher_t* pf, const cache_t2* c, Addr a,
+                      UChar size, ULong* p)
+{
+   if (pf_model == Pf_None)
+      return;
+   if (pf_miss_is_covered(pf, (a+size-1) >> c->line_size_bits))
+      (*p)++;
+}
+
+/* Reference (a, size) in ML after an L1 miss.  Returns whether LL
+ * must be referenced, i.e. whether there is no ML or it missed.
+ */
+__attribute__((always_inline))
+static __inline__
+Bool cachesim_ML_ref_is_miss(Addr a, UChar size, CacheCC* cc)
+{
+   if (!ML_enabled)
+      return True;
+   if (!cachesim_ref_is_miss(&ML, a, size))
+      return False;
+   cc->m2++;
+   return True;
+}
+
+/* Reference (a, size) in LL after an L1 (and ML) miss. */
+__attribute__((always_inline))
+static __inline__
+void cachesim_LL_doref(Addr a, UChar size, CacheCC* cc)
+{
+   if (cachesim_ref_is_miss(&LL, a, size)) {
+      cc->mL++;
+      cachesim_pf_miss(&pf_LL, &LL, a, size, &cc->pL);
+   }
 }
 
 __attribute__((always_inline))
 static __inline__
-void cachesim_I1_doref_Gen(Addr a, UChar size, ULong* m1, ULong *mL)
+void cachesim_I1_doref_Gen(Addr a, UChar size, CacheCC* cc)
 {
+   if (LL_inclusion != LL_NonInclusive) {
+      cachesim_doref_incl(&I1, &pf_I1, a, size, cc);
+      return;
+   }
    if (cachesim_ref_is_miss(&I1, a, size)) {
-      (*m1)++;
-      if (cachesim_ref_is_miss(&LL, a, size))
-         (*mL)++;
+      cc->m1++;
+      cachesim_pf_miss(&pf_I1, &I1, a, size, &cc->p1);
+      if (cachesim_ML_ref_is_miss(a, size, cc))
+         cachesim_LL_doref(a, size, cc);
    }
 }
 
 // common special case IrNoX
 __attribute__((always_inline))
 static __inline__
-void cachesim_I1_doref_NoX(Addr a, UChar size, ULong* m1, ULong *mL)
+void cachesim_I1_doref_NoX(Addr a, UChar size, CacheCC* cc)
 {
    UWord block  = a >> I1.line_size_bits;
    UInt  I1_set = block & I1.sets_min_1;
 
+   if (LL_inclusion != LL_NonInclusive) {
+      cachesim_doref_incl(&I1, &pf_I1, a, size, cc);
+      return;
+   }
    // use block as tag
    if (cachesim_setref_is_miss(&I1, I1_set, block)) {
       UInt  LL_set = block & LL.sets_min_1;
-      (*m1)++;
-      // can use block as tag as L1I and LL cache line sizes are equal
-      if (cachesim_setref_is_miss(&LL, LL_set, block))
-         (*mL)++;
+      cc->m1++;
+      if (pf_model != Pf_None && pf_miss_is_covered(&pf_I1, block))
+         cc->p1++;
+      // can use block as tag as L1I, ML and LL cache line sizes are equal
+      if (ML_enabled) {
+         if (!cachesim_setref_is_miss(&ML, block & ML.sets_min_1, block))
+            return;
+         cc->m2++;
+      }
+      if (cachesim_setref_is_miss(&LL, LL_set, block)) {
+         cc->mL++;
+         if (pf_model != Pf_None && pf_miss_is_covered(&pf_LL, block))
+            cc->pL++;
+      }
    }
 }
 
 __attribute__((always_inline))
 static __inline__
-void cachesim_D1_doref(Addr a, UChar size, ULong* m1, ULong *mL)
+void cachesim_D1_doref(Addr a, UChar size, CacheCC* cc)
 {
+   if (LL_inclusion != LL_NonInclusive) {
+      cachesim_doref_incl(&D1, &pf_D1, a, size, cc);
+      return;
+   }
    if (cachesim_ref_is_miss(&D1, a, size)) {
-      (*m1)++;
-      if (cachesim_ref_is_miss(&LL, a, size))
-         (*mL)++;
+      cc->m1++;
+      cachesim_pf_miss(&pf_D1, &D1, a, size, &cc->p1);
+      if (cachesim_ML_ref_is_miss(a, size, cc))
+         cachesim_LL_doref(a, size, cc);
    }
 }
 
 /* Check for special case IrNoX. Called at instrumentation time.
  *
- * Does this Ir only touch one cache line, and are L1I/LL cache
+ * Does this Ir only touch one cache line, and are L1I/ML/LL cache
  * line sizes the same? This allows to get rid of a runtime check.
  *
  * Returning false is always fine, as this calls the generic case
@@ -226,6 +785,7 @@ static Bool cachesim_is_IrNoX(Addr a, UChar size)
    UWord block1, block2;
 
    if (I1.line_size_bits != LL.line_size_bits) return False;
+   if (ML_enabled && I1.line_size_bits != ML.line_size_bits) return False;
    block1 =  a         >> I1.line_size_bits;
    block2 = (a+size-1) >> I1.line_size_bits;
    if (block1 != block2) return False;
@@ -0,0 +1,19 @@
+#include <stdio.h>
+
+// Calls through a function pointer are indirect calls.  Before the bug
+// was fixed, --branch-sim=yes crashed on them unless --branch-rsb was
+// given, because the call was pushed onto a return stack of size 0.
+static int add1 ( int x ) { return x + 1; }
+static int add2 ( int x ) { return x + 2; }
+
+int main(void)
+{
+   int (* volatile fn[2])(int) = { add1, add2 };
+   int i, sum = 0;
+
+   for (i = 0; i < 1000; i++)
+      sum = fn[i & 1](sum);
+
+   printf("%d\n", sum);
+   return 0;
+}
@@ -0,0 +1,53 @@
+/* Two loops whose LL misses depend on the LL inclusion policy, for a
+   direct-mapped 4 KB D1 and a 4-way 8 KB LL (64 and 32 sets of 64 B
+   lines), as used by the policy-*.vgtest files.  Compiled with -O2 so
+   that the loops do no memory accesses besides the ones below. */
+
+#define PAGE 4096
+
+static char buf[12 * PAGE] __attribute__((aligned(PAGE)));
+
+volatile char* base = buf;
+volatile int   n_rounds = 1000;
+volatile int   sum;
+
+/* Reads 5 lines that map onto the same D1 set and the same LL set.
+   Only an exclusive LL, which holds the 4 lines that are not in D1,
+   avoids an LL miss on every read. */
+__attribute__((noinline)) void cycle(void)
+{
+   volatile char* p = base;
+   int n = 2 * n_rounds;
+   int i, j, s = 0;
+
+   for (i = 0; i < n; i++)
+      for (j = 0; j < 5; j++)
+         s += p[j * PAGE];
+   sum += s;
+}
+
+/* Reads a line that stays in D1 between reads of 8 lines that map
+   onto another D1 set but onto the same LL set.  An inclusive LL
+   evicts the first line from LL and so from D1 every few reads, which
+   the other policies don't. */
+__attribute__((noinline)) void hot_stream(void)
+{
+   volatile char* hot    = base + 10 * PAGE;
+   volatile char* stream = base + PAGE / 2;
+   int n = n_rounds;
+   int i, j, s = 0;
+
+   for (i = 0; i < n; i++)
+      for (j = 0; j < 8; j++) {
+         s += *hot;
+         s += stream[j * PAGE];
+      }
+   sum += s;
+}
+
+int main(void)
+{
+   cycle();
+   hot_stream();
+   return 0;
+}
@@ -0,0 +1,42 @@
+/* A sequential and a strided scan over memory that is not cached yet,
+   for the prefetcher tests.  Compiled with -O2 so that the loops do no
+   memory accesses besides the scans. */
+
+#define PAGE 4096
+#define SIZE (256 * PAGE)
+
+static long seq[SIZE / sizeof(long)] __attribute__((aligned(PAGE)));
+static char strided[SIZE] __attribute__((aligned(PAGE)));
+
+volatile long sum;
+
+/* Reads every word, so each line misses once, in address order. */
+__attribute__((noinline)) void seq_scan(void)
+{
+   volatile long* p = seq;
+   long s = 0;
+   int  i;
+
+   for (i = 0; i < SIZE / sizeof(long); i++)
+      s += p[i];
+   sum += s;
+}
+
+/* Reads one byte out of every four 64 B lines. */
+__attribute__((noinline)) void stride_scan(void)
+{
+   volatile char* p = strided;
+   long s = 0;
+   int  i;
+
+   for (i = 0; i < SIZE; i += 256)
+      s += p[i];
+   sum += s;
+}
+
+int main(void)
+{
+   seq_scan();
+   stride_scan();
+   return 0;
+}
@@ -120,7 +120,7 @@ static BB* new_bb(obj_node* obj, PtrdiffT offset,
 		  UInt instr_count, UInt cjmp_count, Bool cjmp_inverted)
 {
    BB* bb;
-   UInt idx, size;
+   UInt idx, size, i;
 
    /* check fill degree of bb hash table and resize if needed (>80%) */
    bbs.entries++;
@@ -146,7 +146,8 @@ static BB* new_bb(obj_node* obj, PtrdiffT offset,
    bb->line        = 0;
    bb->is_entry    = 0;
    bb->bbcc_list   = 0;
-   bb->last_bbcc   = 0;
+   for (i = 0; i < BBCC_CACHE_SIZE; i++)
+      bb->bbcc_cache[i] = 0;
 
    /* insert into BB hash table */
    idx = bb_hash_idx(obj, offset, bbs.size);
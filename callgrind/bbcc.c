@@ -151,21 +151,43 @@ UInt bbcc_hash_idx(BB* bb, Context* cxt, UInt size)
 }
  
 
-/* Lookup for a BBCC in hash.
- */ 
+/* Put a BBCC at the front of the inline cache of its BB.
+ * If it is in the cache already, entries before it move back by one,
+ * otherwise the least recently used entry is dropped.
+ */
+static __inline__
+void bbcc_cache_insert(BB* bb, BBCC* bbcc)
+{
+   BBCC** cache = bb->bbcc_cache;
+   Int i;
+
+   for (i = 0; i < BBCC_CACHE_SIZE-1; i++)
+      if (cache[i] == bbcc) break;
+   for (; i > 0; i--)
+      cache[i] = cache[i-1];
+   cache[0] = bbcc;
+}
+
+/* Lookup for a BBCC of a BB executed in context cxt.
+ * The inline cache of the BB is checked first, most recently used
+ * entry first, and the hash only on a miss.
+ */
 static
 BBCC* lookup_bbcc(BB* bb, Context* cxt)
 {
-   BBCC* bbcc = bb->last_bbcc;
+   BBCC* bbcc;
    UInt  idx;
-
-   /* check LRU */
-   if (bbcc->cxt == cxt) {
-       if (!CLG_(clo).separate_threads) {
-	   /* if we don't dump threads separate, tid doesn't have to match */
-	   return bbcc;
-       }
-       if (bbcc->tid == CLG_(current_tid)) return bbcc;
+   Int   i;
+
+   for (i = 0; i < BBCC_CACHE_SIZE; i++) {
+       bbcc = bb->bbcc_cache[i];
+       if (!bbcc) break;
+       if (bbcc->cxt != cxt) continue;
+       /* if we don't dump threads separate, tid doesn't have to match */
+       if (CLG_(clo).separate_threads && bbcc->tid != CLG_(current_tid))
+	   continue;
+       if (i > 0) bbcc_cache_insert(bb, bbcc);
+       return bbcc;
    }
 
    CLG_(stat).bbcc_lru_misses++;
@@ -177,6 +199,7 @@ BBCC* lookup_bbcc(BB* bb, Context* cxt)
 	   cxt     != bbcc->cxt)) {
        bbcc = bbcc->next;
    }
+   if (bbcc) bbcc_cache_insert(bb, bbcc);
    
    CLG_DEBUG(2,"  lookup_bbcc(BB %#lx, Cxt %u, fn '%s'): %p (tid %u)\n",
 	    bb_addr(bb), cxt->base_number, cxt->fn[0]->name, 
@@ -459,7 +482,7 @@ BBCC* CLG_(get_bbcc)(BB* bb)
 
      bbcc->next_bbcc = bb->bbcc_list;
      bb->bbcc_list = bbcc;
-     bb->last_bbcc = bbcc;
+     bbcc_cache_insert(bb, bbcc);
 
      CLG_DEBUGIF(3)
        CLG_(print_bbcc)(-2, bbcc);
@@ -814,10 +837,10 @@ void CLG_(setup_bbcc)(BB* bb)
 
     if (!bbcc)
       bbcc = lookup_bbcc(bb, CLG_(current_state).cxt);
-    if (!bbcc)
+    if (!bbcc) {
       bbcc = clone_bbcc(bb->bbcc_list, CLG_(current_state).cxt, 0);
-    
-    bb->last_bbcc = bbcc;
+      bbcc_cache_insert(bb, bbcc);
+    }
   }
 
   /* save for fast lookup */
@@ -0,0 +1,317 @@
+/*--------------------------------------------------------------------*/
+/*--- Convert binary callgrind profiles to the text format.        ---*/
+/*---                                          callgrind_bin2txt.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Callgrind, a Valgrind tool for call tracing.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* A profile written with --dump-format=binary has the text header of
+   each part, followed by the line "body: binary" and a sequence of
+   chunks of binary records, ended by an empty chunk.  Text lines are
+   copied unchanged; each record is converted into the line callgrind
+   would have written in text format.  See the comment on the binary
+   format in dump.c. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef  unsigned char Bool;
+#define True ((Bool)1)
+#define False ((Bool)0)
+typedef  signed int    Int;
+typedef  unsigned int  UInt;
+typedef  signed long long int   Long;
+typedef  unsigned long long int ULong;
+typedef  unsigned char UChar;
+typedef  size_t        SizeT;
+
+static const char* argv0 = "callgrind_bin2txt";
+static const char* in_name = "-";
+
+static const char* keys[] = {
+   "ob", "cob", "fl", "fi", "fe", "cfi", "jfi", "fn", "cfn", "jfn", "frfn"
+};
+#define N_KEYS (sizeof(keys)/sizeof(keys[0]))
+
+/* Position types of the current part, from the "positions:" line */
+#define MAX_POSITIONS 3
+static Int  n_positions = 1;
+static Bool pos_is_addr[MAX_POSITIONS] = { False };
+
+static void barf ( const char* msg )
+{
+   fprintf(stderr, "%s: %s: %s\n", argv0, in_name, msg);
+   exit(1);
+}
+
+static void usage ( void )
+{
+   fprintf(stderr, "usage: %s [-o outfile] [callgrind.out.file]\n", argv0);
+   exit(1);
+}
+
+/* The "positions:" line names the position columns of cost lines */
+static void parse_positions ( const char* line )
+{
+   const char* p = line + strlen("positions:");
+   char name[16];
+   Int  n;
+
+   n_positions = 0;
+   while (sscanf(p, " %15s%n", name, &n) == 1) {
+      if (n_positions == MAX_POSITIONS)
+         barf("too many positions");
+      pos_is_addr[n_positions++] = strcmp(name, "line") != 0;
+      p += n;
+   }
+   if (n_positions == 0)
+      barf("no positions");
+}
+
+/*------------------------------------------------------------*/
+/*--- Record decoding                                      ---*/
+/*------------------------------------------------------------*/
+
+static const UChar* rec_ptr;
+static const UChar* rec_end;
+
+static ULong get_uint ( void )
+{
+   ULong v = 0;
+   Int   shift = 0;
+
+   while (1) {
+      UChar b;
+      if (rec_ptr >= rec_end || shift > 63)
+         barf("truncated record");
+      b = *rec_ptr++;
+      v |= (ULong)(b & 0x7f) << shift;
+      if (!(b & 0x80)) return v;
+      shift += 7;
+   }
+}
+
+static UChar get_byte ( void )
+{
+   if (rec_ptr >= rec_end)
+      barf("truncated record");
+   return *rec_ptr++;
+}
+
+static void put_str ( FILE* out )
+{
+   ULong len = get_uint();
+
+   if (len > (ULong)(rec_end - rec_ptr))
+      barf("truncated string");
+   fwrite(rec_ptr, 1, len, out);
+   rec_ptr += len;
+}
+
+/* Positions are written with the compressed/absolute choice of the
+   text format in the lowest bit, see bin_position() in dump.c */
+static void put_positions ( FILE* out )
+{
+   Int i;
+
+   for (i = 0; i < n_positions; i++) {
+      ULong v = get_uint();
+      if (v & 1) {
+         ULong zz = v >> 1;
+         Long diff = (zz & 1) ? -(Long)((zz+1) >> 1) : (Long)(zz >> 1);
+         if (diff > 0)
+            fprintf(out, "+%lld ", diff);
+         else if (diff == 0)
+            fputs("* ", out);
+         else
+            fprintf(out, "%lld ", diff);
+      }
+      else if (pos_is_addr[i])
+         fprintf(out, "0x%llx ", v >> 1);
+      else
+         fprintf(out, "%llu ", v >> 1);
+   }
+}
+
+static void put_costs ( FILE* out )
+{
+   ULong n = get_uint(), i;
+
+   for (i = 0; i < n; i++)
+      fprintf(out, i ? " %llu" : "%llu", get_uint());
+}
+
+static void convert_chunk ( const UChar* chunk, SizeT len, FILE* out )
+{
+   rec_ptr = chunk;
+   rec_end = chunk + len;
+
+   while (rec_ptr < rec_end) {
+      UChar tag = *rec_ptr++;
+      switch (tag) {
+      case 'N': {
+         UChar key   = get_byte();
+         UChar flags = get_byte();
+         if (key >= N_KEYS)
+            barf("bad name key");
+         fprintf(out, "%s=", keys[key]);
+         if (flags & 1) {
+            fprintf(out, "(%llu)", get_uint());
+            if (flags & 2) fputc(' ', out);
+         }
+         if (flags & 2)
+            put_str(out);
+         break;
+      }
+      case 'C':
+         put_positions(out);
+         put_costs(out);
+         break;
+      case 'P':
+         put_positions(out);
+         break;
+      case 'A':
+         fprintf(out, "calls=%llu ", get_uint());
+         put_positions(out);
+         break;
+      case 'J':
+         fprintf(out, "jump=%llu ", get_uint());
+         put_positions(out);
+         break;
+      case 'K': {
+         ULong followed = get_uint();
+         fprintf(out, "jcnd=%llu/%llu ", followed, get_uint());
+         put_positions(out);
+         break;
+      }
+      case 'T':
+         put_str(out);
+         break;
+      default:
+         barf("unknown record type");
+      }
+      fputc('\n', out);
+   }
+}
+
+/* Convert the chunks following a "body: binary" line */
+static void convert_body ( FILE* in, FILE* out )
+{
+   static UChar* chunk = NULL;
+   static SizeT  chunk_size = 0;
+   UChar hdr[4];
+   SizeT len;
+
+   while (1) {
+      if (fread(hdr, 1, 4, in) != 4)
+         barf("truncated binary body");
+      len = (SizeT)hdr[0] | ((SizeT)hdr[1] << 8) |
+            ((SizeT)hdr[2] << 16) | ((SizeT)hdr[3] << 24);
+      if (len == 0)
+         return;
+      if (len > chunk_size) {
+         chunk_size = len;
+         chunk = realloc(chunk, chunk_size);
+         if (!chunk)
+            barf("out of memory");
+      }
+      if (fread(chunk, 1, len, in) != len)
+         barf("truncated chunk");
+      convert_chunk(chunk, len, out);
+   }
+}
+
+int main ( int argc, char** argv )
+{
+   FILE* in  = stdin;
+   FILE* out = stdout;
+   char* line = NULL;
+   SizeT line_size = 0;
+   Int   i;
+
+   if (argv[0])
+      argv0 = argv[0];
+
+   for (i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
+         usage();
+      else if (!strcmp(argv[i], "-o")) {
+         if (++i == argc)
+            usage();
+         out = fopen(argv[i], "w");
+         if (!out) {
+            perror(argv0);
+            exit(1);
+         }
+      }
+      else if (in == stdin) {
+         in_name = argv[i];
+         in = fopen(in_name, "rb");
+         if (!in) {
+            perror(argv0);
+            exit(1);
+         }
+      }
+      else
+         usage();
+   }
+
+   setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+   while (1) {
+      /* text lines, as getline() is not available everywhere */
+      SizeT len = 0;
+      Int c;
+      while ((c = getc(in)) != EOF) {
+         if (len + 2 > line_size) {
+            line_size = line_size ? 2 * line_size : 256;
+            line = realloc(line, line_size);
+            if (!line)
+               barf("out of memory");
+         }
+         line[len++] = c;
+         if (c == '\n') break;
+      }
+      if (len == 0)
+         break;
+      line[len] = 0;
+
+      if (!strcmp(line, "body: binary\n")) {
+         convert_body(in, out);
+         continue;
+      }
+      if (!strncmp(line, "positions:", 10))
+         parse_positions(line);
+      fputs(line, out);
+   }
+
+   if (fclose(out) != 0) {
+      perror(argv0);
+      exit(1);
+   }
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                      callgrind_bin2txt.c ---*/
+/*--------------------------------------------------------------------*/
@@ -422,11 +422,18 @@ Bool CLG_(process_cmd_line_option)(const HChar* arg)
 
    else if VG_BOOL_CLO(arg, "--instr-atstart", CLG_(clo).instrument_atstart) {}
 
+   else if VG_INT_CLO( arg, "--sample-every",  CLG_(clo).sample_every) {}
+   else if VG_INT_CLO( arg, "--sample-window", CLG_(clo).sample_window) {}
+   else if VG_XACT_CLO(arg, "--sample-unit=bb", CLG_(clo).sample_ms, False) {}
+   else if VG_XACT_CLO(arg, "--sample-unit=ms", CLG_(clo).sample_ms, True) {}
+
    else if VG_BOOL_CLO(arg, "--separate-threads", CLG_(clo).separate_threads) {}
 
    else if VG_BOOL_CLO(arg, "--compress-strings", CLG_(clo).compress_strings) {}
    else if VG_BOOL_CLO(arg, "--compress-mangled", CLG_(clo).compress_mangled) {}
    else if VG_BOOL_CLO(arg, "--compress-pos",     CLG_(clo).compress_pos) {}
+   else if VG_XACT_CLO(arg, "--dump-format=text",   CLG_(clo).dump_binary, False) {}
+   else if VG_XACT_CLO(arg, "--dump-format=binary", CLG_(clo).dump_binary, True) {}
 
    else if VG_STR_CLO(arg, "--fn-skip", tmp_str) {
        fn_config* fnc = get_fnc(tmp_str);
@@ -533,6 +540,10 @@ Bool CLG_(process_cmd_line_option)(const HChar* arg)
    else if VG_BOOL_CLO(arg, "--simulate-cache",  CLG_(clo).simulate_cache) {}
    /* for option compatibility with cachegrind */
    else if VG_BOOL_CLO(arg, "--branch-sim",      CLG_(clo).simulate_branch) {}
+   else if (CLG_(branch_parse_opt)(arg)) {
+       /* branch predictor is used if a predictor option is given */
+       CLG_(clo).simulate_branch = True;
+   }
    else {
        Bool isCachesimOption = (*CLG_(cachesim).parse_opt)(arg);
 
@@ -556,6 +567,7 @@ void CLG_(print_usage)(void)
 "    --compress-strings=no|yes Compress strings in profile dump? [yes]\n"
 "    --compress-pos=no|yes     Compress positions in profile dump? [yes]\n"
 "    --combine-dumps=no|yes    Concat all dumps into same file [no]\n"
+"    --dump-format=text|binary Format of the profile data in dumps [text]\n"
 #if CLG_EXPERIMENTAL
 "    --compress-events=no|yes  Compress events in profile dump? [no]\n"
 "    --dump-bb=no|yes          Dump basic block address of costs? [no]\n"
@@ -575,6 +587,11 @@ void CLG_(print_usage)(void)
 
 "\n   data collection options:\n"
 "    --instr-atstart=no|yes    Do instrumentation at callgrind start [yes]\n"
+"    --sample-every=<n>        Instrument only a window at the start of\n"
+"                              every <n> units, scaling costs [0=always];\n"
+"                              overrides --instr-atstart\n"
+"    --sample-window=<n>       Length of the instrumented window [<n>/10]\n"
+"    --sample-unit=bb|ms       Unit for the sampling options [bb]\n"
 "    --collect-atstart=no|yes  Collect at process/thread start [yes]\n"
 "    --toggle-collect=<func>   Toggle collection on enter/leave function\n"
 "    --collect-jumps=no|yes    Collect jumps? [no]\n"
@@ -601,6 +618,8 @@ void CLG_(print_usage)(void)
 "    --cache-sim=no|yes        Do cache simulation [no]\n"
     );
 
+   CLG_(branch_print_opts)();
+
    (*CLG_(cachesim).print_opts)();
 
 //   VG_(printf)("\n"
@@ -640,6 +659,7 @@ void CLG_(set_clo_defaults)(void)
   CLG_(clo).dump_instr       = False;
   CLG_(clo).dump_bb          = False;
   CLG_(clo).dump_bbs         = False;
+  CLG_(clo).dump_binary      = False;
 
   CLG_(clo).dump_every_bb    = 0;
 
@@ -658,6 +678,9 @@ void CLG_(set_clo_defaults)(void)
 
   /* Instrumentation */
   CLG_(clo).instrument_atstart = True;
+  CLG_(clo).sample_every     = 0;
+  CLG_(clo).sample_window    = 0;
+  CLG_(clo).sample_ms        = False;
   CLG_(clo).simulate_cache = False;
   CLG_(clo).simulate_branch = False;
 
@@ -112,6 +112,199 @@ void free_dump_array(void)
 }
 
 
+/*------------------------------------------------------------*/
+/*--- Binary dump format                                   ---*/
+/*------------------------------------------------------------*/
+
+/* With --dump-format=binary, the header and the "totals:" line of a
+ * dump part are written as in the text format.  The body in between is
+ * replaced by a line "body: binary", followed by chunks of records:
+ * each chunk is a 32-bit little endian length and that many bytes of
+ * records; a chunk of length 0 ends the body.  A record never spans
+ * chunks.  Records are a tag byte followed by LEB128 encoded numbers
+ * and strings (length, then bytes), and each one corresponds to one
+ * line of the text format (see docs/cl-format.xml).  Positions are
+ * encoded the way the text format would print them, with the
+ * compressed/absolute choice in the lowest bit, so callgrind_bin2txt
+ * can convert a binary dump back to text without keeping any state.
+ *
+ * Records are encoded directly into a chunk buffer, which is written out
+ * without copying as soon as it is full.
+ */
+
+#define BIN_CHUNK_SIZE  65536
+
+/* tags */
+#define BIN_NAME   'N'  /* key flags [id] [name]      -> ob=, fn=, ...   */
+#define BIN_COST   'C'  /* positions n cost[n]        -> cost line        */
+#define BIN_POS    'P'  /* positions                  -> position line    */
+#define BIN_CALLS  'A'  /* count positions            -> calls= line      */
+#define BIN_JUMP   'J'  /* count positions            -> jump= line       */
+#define BIN_JCND   'K'  /* followed count positions   -> jcnd= line       */
+#define BIN_TEXT   'T'  /* string                     -> any other line   */
+
+/* flags of BIN_NAME */
+#define BIN_NAME_ID    1
+#define BIN_NAME_STR   2
+
+/* Keys of BIN_NAME records: index into this table */
+static const HChar* bin_keys[] = {
+    "ob", "cob", "fl", "fi", "fe", "cfi", "jfi", "fn", "cfn", "jfn", "frfn",
+    0
+};
+
+static UChar bin_buf[BIN_CHUNK_SIZE];
+static Int   bin_pos = 4;
+
+/* Maximal size of a record without strings: set in bin_start() */
+static Int   bin_record_max = 0;
+
+static void bin_flush(VgFile *fp)
+{
+    UInt len = bin_pos - 4;
+
+    if (len == 0) return;
+    bin_buf[0] = len & 0xff;
+    bin_buf[1] = (len >> 8) & 0xff;
+    bin_buf[2] = (len >> 16) & 0xff;
+    bin_buf[3] = (len >> 24) & 0xff;
+    VG_(fwrite)(fp, bin_buf, bin_pos);
+    bin_pos = 4;
+}
+
+/* Start of the binary body of a dump part */
+static void bin_start(VgFile *fp)
+{
+    VG_(fprintf)(fp, "body: binary\n");
+    bin_pos = 4;
+    /* tag, 3 positions, event count and events, up to 10 bytes each */
+    bin_record_max = 1 + 10 * (3 + 1 + CLG_(dumpmap)->size);
+}
+
+/* End of the binary body: flush, and write the end mark */
+static void bin_end(VgFile *fp)
+{
+    static const UChar end_mark[4] = { 0, 0, 0, 0 };
+
+    bin_flush(fp);
+    VG_(fwrite)(fp, end_mark, 4);
+}
+
+/* Make sure that <n> bytes fit into the current chunk */
+static __inline__
+void bin_reserve(VgFile *fp, Int n)
+{
+    CLG_ASSERT(n <= BIN_CHUNK_SIZE - 4);
+    if (bin_pos + n > BIN_CHUNK_SIZE)
+	bin_flush(fp);
+}
+
+static __inline__
+void bin_byte(UChar b)
+{
+    bin_buf[bin_pos++] = b;
+}
+
+static __inline__
+void bin_uint(ULong v)
+{
+    while (v >= 0x80) {
+	bin_buf[bin_pos++] = (UChar)(v | 0x80);
+	v >>= 7;
+    }
+    bin_buf[bin_pos++] = (UChar)v;
+}
+
+/* Append a string to the record started in the chunk buffer, which
+ * then has to be complete; 10 bytes must be reserved for the length.
+ * A string not fitting into the chunk makes the chunk larger than
+ * BIN_CHUNK_SIZE: it is written out directly after the chunk buffer.
+ */
+static void bin_str_end(VgFile *fp, const HChar* str, SizeT len)
+{
+    ULong clen;
+
+    bin_uint(len);
+    if (bin_pos + len <= BIN_CHUNK_SIZE) {
+	VG_(memcpy)(bin_buf + bin_pos, str, len);
+	bin_pos += len;
+	return;
+    }
+
+    clen = (ULong)(bin_pos - 4) + len;
+    CLG_ASSERT(clen < 0xffffffffULL);
+    bin_buf[0] = clen & 0xff;
+    bin_buf[1] = (clen >> 8) & 0xff;
+    bin_buf[2] = (clen >> 16) & 0xff;
+    bin_buf[3] = (clen >> 24) & 0xff;
+    VG_(fwrite)(fp, bin_buf, bin_pos);
+    VG_(fwrite)(fp, str, len);
+    bin_pos = 4;
+}
+
+/* A line "<tag>=[(<id>)][ ][<name>]"; <tag> may end in '=' */
+static void bin_name(VgFile *fp, const HChar* tag, Bool with_id, UInt id,
+                     const HChar* name)
+{
+    Int key, len = 0;
+
+    while(tag[len] && tag[len] != '=') len++;
+    for(key=0; bin_keys[key]; key++)
+	if ((VG_(strncmp)(bin_keys[key], tag, len) == 0) &&
+	    (bin_keys[key][len] == 0)) break;
+    CLG_ASSERT(bin_keys[key] != 0);
+
+    bin_reserve(fp, 23);
+    bin_byte(BIN_NAME);
+    bin_byte(key);
+    bin_byte((with_id ? BIN_NAME_ID : 0) | (name ? BIN_NAME_STR : 0));
+    if (with_id) bin_uint(id);
+    if (name)
+	bin_str_end(fp, name, VG_(strlen)(name));
+}
+
+/* Line printing for lines not frequent enough to get their own record
+ * type.  In text mode, this is VG_(fprintf); in binary mode, the line
+ * is collected and written as a BIN_TEXT record on "\n".
+ */
+static XArray* bin_line = 0;
+
+static void bin_line_char(HChar c, void* opaque)
+{
+    VgFile* fp = (VgFile*) opaque;
+    void* line;
+    Word len;
+
+    if (c != '\n') {
+	VG_(addToXA)(bin_line, &c);
+	return;
+    }
+    VG_(getContentsXA_UNSAFE)(bin_line, &line, &len);
+    bin_reserve(fp, 11);
+    bin_byte(BIN_TEXT);
+    bin_str_end(fp, (const HChar*)line, len);
+    VG_(dropTailXA)(bin_line, len);
+}
+
+static void out_printf(VgFile *fp, const HChar *format, ...)
+                       PRINTF_CHECK(2, 3);
+static void out_printf(VgFile *fp, const HChar *format, ...)
+{
+    va_list vargs;
+    va_start(vargs, format);
+
+    if (!CLG_(clo).dump_binary)
+	VG_(vfprintf)(fp, format, vargs);
+    else {
+	if (!bin_line)
+	    bin_line = VG_(newXA)(VG_(malloc), "cl.dump.op.1", VG_(free),
+				  sizeof(HChar));
+	VG_(vcbprintf)(bin_line_char, fp, format, vargs);
+    }
+    va_end(vargs);
+}
+
+
 /* Initialize to an invalid position */
 static __inline__
 void init_fpos(FnPos* p)
@@ -126,7 +319,16 @@ void init_fpos(FnPos* p)
 
 static void print_obj(VgFile *fp, const HChar* prefix, obj_node* obj)
 {
-    if (CLG_(clo).compress_strings) {
+    if (CLG_(clo).dump_binary) {
+	if (CLG_(clo).compress_strings) {
+	    CLG_ASSERT(obj_dumped != 0);
+	    bin_name(fp, prefix, True, obj->number,
+		     obj_dumped[obj->number] ? 0 : obj->name);
+	}
+	else
+	    bin_name(fp, prefix, False, 0, obj->name);
+    }
+    else if (CLG_(clo).compress_strings) {
 	CLG_ASSERT(obj_dumped != 0);
 	if (obj_dumped[obj->number])
             VG_(fprintf)(fp, "%s(%u)\n", prefix, obj->number);
@@ -152,6 +354,18 @@ static void print_obj(VgFile *fp, const HChar* prefix, obj_node* obj)
 
 static void print_file(VgFile *fp, const char *prefix, const file_node* file)
 {
+    if (CLG_(clo).dump_binary) {
+	if (CLG_(clo).compress_strings) {
+	    CLG_ASSERT(file_dumped != 0);
+	    bin_name(fp, prefix, True, file->number,
+		     file_dumped[file->number] ? 0 : file->name);
+	    file_dumped[file->number] = True;
+	}
+	else
+	    bin_name(fp, prefix, False, 0, file->name);
+	return;
+    }
+
     if (CLG_(clo).compress_strings) {
 	CLG_ASSERT(file_dumped != 0);
 	if (file_dumped[file->number])
@@ -170,6 +384,18 @@ static void print_file(VgFile *fp, const char *prefix, const file_node* file)
  */
 static void print_fn(VgFile *fp, const HChar* tag, const fn_node* fn)
 {
+    if (CLG_(clo).dump_binary) {
+	if (CLG_(clo).compress_strings) {
+	    CLG_ASSERT(fn_dumped != 0);
+	    bin_name(fp, tag, True, fn->number,
+		     fn_dumped[fn->number] ? 0 : fn->name);
+	    fn_dumped[fn->number] = True;
+	}
+	else
+	    bin_name(fp, tag, False, 0, fn->name);
+	return;
+    }
+
     VG_(fprintf)(fp, "%s=",tag);
     if (CLG_(clo).compress_strings) {
 	CLG_ASSERT(fn_dumped != 0);
@@ -196,7 +422,7 @@ static void print_mangled_fn(VgFile *fp, const HChar* tag,
 
 	CLG_ASSERT(cxt_dumped != 0);
 	if (cxt_dumped[cxt->base_number+rec_index]) {
-            VG_(fprintf)(fp, "%s=(%u)\n",
+            out_printf(fp, "%s=(%u)\n",
 			     tag, cxt->base_number + rec_index);
 	    return;
 	}
@@ -207,7 +433,7 @@ static void print_mangled_fn(VgFile *fp, const HChar* tag,
 	    CLG_ASSERT(cxt->fn[i-1]->pure_cxt != 0);
 	    n = cxt->fn[i-1]->pure_cxt->base_number;
 	    if (cxt_dumped[n]) continue;
-	    VG_(fprintf)(fp, "%s=(%d) %s\n",
+	    out_printf(fp, "%s=(%d) %s\n",
 			     tag, n, cxt->fn[i-1]->name);
 
 	    cxt_dumped[n] = True;
@@ -216,41 +442,49 @@ static void print_mangled_fn(VgFile *fp, const HChar* tag,
 	/* If the last context was the context to print, we are finished */
 	if ((last == cxt) && (rec_index == 0)) return;
 
-	VG_(fprintf)(fp, "%s=(%u) (%u)", tag,
+	out_printf(fp, "%s=(%u) (%u)", tag,
 			 cxt->base_number + rec_index,
 			 cxt->fn[0]->pure_cxt->base_number);
 	if (rec_index >0)
-	    VG_(fprintf)(fp, "'%d", rec_index +1);
+	    out_printf(fp, "'%d", rec_index +1);
 	for(i=1;i<cxt->size;i++)
-	    VG_(fprintf)(fp, "'(%u)", 
+	    out_printf(fp, "'(%u)", 
 			      cxt->fn[i]->pure_cxt->base_number);
-	VG_(fprintf)(fp, "\n");
+	out_printf(fp, "\n");
 
 	cxt_dumped[cxt->base_number+rec_index] = True;
 	return;
     }
 
 
-    VG_(fprintf)(fp, "%s=", tag);
+    if (CLG_(clo).dump_binary && CLG_(clo).compress_strings) {
+	CLG_ASSERT(cxt_dumped != 0);
+	if (cxt_dumped[cxt->base_number+rec_index]) {
+	    bin_name(fp, tag, True, cxt->base_number + rec_index, 0);
+	    return;
+	}
+    }
+
+    out_printf(fp, "%s=", tag);
     if (CLG_(clo).compress_strings) {
 	CLG_ASSERT(cxt_dumped != 0);
 	if (cxt_dumped[cxt->base_number+rec_index]) {
-	    VG_(fprintf)(fp, "(%u)\n", cxt->base_number + rec_index);
+	    out_printf(fp, "(%u)\n", cxt->base_number + rec_index);
 	    return;
 	}
 	else {
-	    VG_(fprintf)(fp, "(%u) ", cxt->base_number + rec_index);
+	    out_printf(fp, "(%u) ", cxt->base_number + rec_index);
 	    cxt_dumped[cxt->base_number+rec_index] = True;
 	}
     }
 
-    VG_(fprintf)(fp, "%s", cxt->fn[0]->name);
+    out_printf(fp, "%s", cxt->fn[0]->name);
     if (rec_index >0)
-	VG_(fprintf)(fp, "'%d", rec_index +1);
+	out_printf(fp, "'%d", rec_index +1);
     for(i=1;i<cxt->size;i++)
-	VG_(fprintf)(fp, "'%s", cxt->fn[i]->name);
+	out_printf(fp, "'%s", cxt->fn[i]->name);
 
-    VG_(fprintf)(fp, "\n");
+    out_printf(fp, "\n");
 }
 
 
@@ -273,7 +507,7 @@ static Bool print_fn_pos(VgFile *fp, FnPos* last, BBCC* bbcc)
 
     if (!CLG_(clo).mangle_names) {
 	if (last->rec_index != bbcc->rec_index) {
-	    VG_(fprintf)(fp, "rec=%u\n\n", bbcc->rec_index);
+	    out_printf(fp, "rec=%u\n\n", bbcc->rec_index);
 	    last->rec_index = bbcc->rec_index;
 	    last->cxt = 0; /* reprint context */
 	    res = True;
@@ -287,7 +521,7 @@ static Bool print_fn_pos(VgFile *fp, FnPos* last, BBCC* bbcc)
 	    if (curr_from == 0) {
 		if (last_from != 0) {
 		    /* switch back to no context */
-		    VG_(fprintf)(fp, "frfn=(spontaneous)\n");
+		    out_printf(fp, "frfn=(spontaneous)\n");
 		    res = True;
 		}
 	    }
@@ -451,7 +685,7 @@ static void fprint_apos(VgFile *fp, AddrPos* curr, AddrPos* last,
 
     if (CLG_(clo).dump_bbs) {
 	if (curr->line != last->line) {
-	    VG_(fprintf)(fp, "ln=%u\n", curr->line);
+	    out_printf(fp, "ln=%u\n", curr->line);
 	}
     }
 }
@@ -464,9 +698,30 @@ static void fprint_apos(VgFile *fp, AddrPos* curr, AddrPos* last,
  *
  * This doesn't set last to curr afterwards!
  */
+static __inline__
+void bin_position(int diff, Bool has_last, ULong abs)
+{
+    if (CLG_(clo).compress_pos && has_last && (diff > -100) && (diff < 100))
+	bin_uint( ((ULong)(diff >= 0 ? 2*diff : -2*diff-1) << 1) | 1 );
+    else
+	bin_uint( abs << 1 );
+}
+
 static
 void fprint_pos(VgFile *fp, const AddrPos* curr, const AddrPos* last)
 {
+    if (CLG_(clo).dump_binary) {
+	/* the caller started the record */
+	if (CLG_(clo).dump_instr)
+	    bin_position(curr->addr - last->addr, last->addr >0, curr->addr);
+	if (CLG_(clo).dump_bb)
+	    bin_position(curr->bb_addr - last->bb_addr, last->bb_addr >0,
+			 curr->bb_addr);
+	if (CLG_(clo).dump_line)
+	    bin_position(curr->line - last->line, last->line >0, curr->line);
+	return;
+    }
+
     if (0) //CLG_(clo).dump_bbs)
 	VG_(fprintf)(fp, "%lu ", curr->addr - curr->bb_addr);
     else {
@@ -519,6 +774,34 @@ void fprint_pos(VgFile *fp, const AddrPos* curr, const AddrPos* last)
 }
 
 
+/* With --sample-every, costs and counts are scaled up to the full run
+ * when written, see CLG_(get_sample_factor)(). Fixed point with 1024
+ * being 1.0, or 0 for no scaling. */
+static ULong sample_factor = 0;
+
+static __inline__
+ULong sample_scaled(ULong v)
+{
+  if (sample_factor == 0) return v;
+  return (v >> 10) * sample_factor + (((v & 1023) * sample_factor) >> 10);
+}
+
+/* Returns a scaled copy of a cost of the full event set, valid up to
+ * the next call */
+static const ULong* sample_scaled_cost(const ULong* cost)
+{
+  static ULong* scaled = 0;
+  Int i, size = CLG_(sets).full->size;
+
+  if (sample_factor == 0 || cost == 0) return cost;
+
+  if (!scaled)
+    scaled = (ULong*) CLG_MALLOC("cl.dump.ssc.1", size * sizeof(ULong));
+  for(i=0; i<size; i++)
+    scaled[i] = sample_scaled(cost[i]);
+  return scaled;
+}
+
 /**
  * Print events.
  */
@@ -526,6 +809,19 @@ void fprint_pos(VgFile *fp, const AddrPos* curr, const AddrPos* last)
 static
 void fprint_cost(VgFile *fp, const EventMapping* es, const ULong* cost)
 {
+  cost = sample_scaled_cost(cost);
+
+  if (CLG_(clo).dump_binary) {
+    /* as in the text format, trailing zeros are skipped */
+    Int i, n = 1;
+    for(i=1; i<es->size; i++)
+      if (cost[es->entry[i].offset] != 0) n = i+1;
+    bin_uint(n);
+    for(i=0; i<n; i++)
+      bin_uint(cost[es->entry[i].offset]);
+    return;
+  }
+
   HChar *mcost = CLG_(mappingcost_as_string)(es, cost);
   VG_(fprintf)(fp, "%s\n", mcost);
   CLG_FREE(mcost);
@@ -546,6 +842,10 @@ static void fprint_fcost(VgFile *fp, AddrCost* c, AddrPos* last)
     CLG_(print_cost)(-5, CLG_(sets).full, c->cost);
   }
     
+  if (CLG_(clo).dump_binary) {
+    bin_reserve(fp, bin_record_max);
+    bin_byte(BIN_COST);
+  }
   fprint_pos(fp, &(c->p), last);
   copy_apos( last, &(c->p) ); /* update last to current position */
 
@@ -610,21 +910,39 @@ static void fprint_jcc(VgFile *fp, jCC* jcc, AddrPos* curr, AddrPos* last,
 		print_fn(fp, "jfn", jcc->to->cxt->fn[0]);
 	}
 	    
-	if (jcc->jmpkind == jk_CondJump) {
-	    /* format: jcnd=<followed>/<executions> <target> */
-	    VG_(fprintf)(fp, "jcnd=%llu/%llu ",
-			 jcc->call_counter, ecounter);
+	if (CLG_(clo).dump_binary) {
+	    bin_reserve(fp, 2 * bin_record_max);
+	    if (jcc->jmpkind == jk_CondJump) {
+		bin_byte(BIN_JCND);
+		bin_uint(sample_scaled(jcc->call_counter));
+		bin_uint(sample_scaled(ecounter));
+	    }
+	    else {
+		bin_byte(BIN_JUMP);
+		bin_uint(sample_scaled(jcc->call_counter));
+	    }
+	    fprint_pos(fp, &target, last);
+	    bin_byte(BIN_POS);
+	    fprint_pos(fp, curr, last);
 	}
 	else {
-	    /* format: jump=<jump count> <target> */
-	    VG_(fprintf)(fp, "jump=%llu ",
-			 jcc->call_counter);
+	    if (jcc->jmpkind == jk_CondJump) {
+		/* format: jcnd=<followed>/<executions> <target> */
+		VG_(fprintf)(fp, "jcnd=%llu/%llu ",
+			     sample_scaled(jcc->call_counter),
+			     sample_scaled(ecounter));
+	    }
+	    else {
+		/* format: jump=<jump count> <target> */
+		VG_(fprintf)(fp, "jump=%llu ",
+			     sample_scaled(jcc->call_counter));
+	    }
+
+	    fprint_pos(fp, &target, last);
+	    VG_(fprintf)(fp, "\n");
+	    fprint_pos(fp, curr, last);
+	    VG_(fprintf)(fp, "\n");
 	}
-		
-	fprint_pos(fp, &target, last);
-	VG_(fprintf)(fp, "\n");
-	fprint_pos(fp, curr, last);
-	VG_(fprintf)(fp, "\n");
 
 	jcc->call_counter = 0;
 	return;
@@ -649,11 +967,20 @@ static void fprint_jcc(VgFile *fp, jCC* jcc, AddrPos* curr, AddrPos* last,
 	print_fn(fp, "cfn", jcc->to->cxt->fn[0]);
 
     if (!CLG_(is_zero_cost)( CLG_(sets).full, jcc->cost)) {
-        VG_(fprintf)(fp, "calls=%llu ", 
-		   jcc->call_counter);
+	if (CLG_(clo).dump_binary) {
+	    bin_reserve(fp, 2 * bin_record_max);
+	    bin_byte(BIN_CALLS);
+	    bin_uint(sample_scaled(jcc->call_counter));
+	    fprint_pos(fp, &target, last);
+	    bin_byte(BIN_COST);
+	}
+	else {
+	    VG_(fprintf)(fp, "calls=%llu ", 
+			 sample_scaled(jcc->call_counter));
 
-	fprint_pos(fp, &target, last);
-        VG_(fprintf)(fp, "\n");
+	    fprint_pos(fp, &target, last);
+	    VG_(fprintf)(fp, "\n");
+	}
 	fprint_pos(fp, curr, last);
 	fprint_cost(fp, CLG_(dumpmap), jcc->cost);
 
@@ -815,7 +1142,7 @@ static Bool fprint_bbcc(VgFile *fp, BBCC* bbcc, AddrPos* last)
       fprint_apos(fp, &(currCost->p), last, bbcc->cxt->fn[0]->file);
       fprint_fcost(fp, currCost, last);
     }
-    if (CLG_(clo).dump_bbs) VG_(fprintf)(fp, "\n");
+    if (CLG_(clo).dump_bbs) out_printf(fp, "\n");
     
     /* when every cost was immediately written, we must have done so,
      * as this function is only called when there's cost in a BBCC
@@ -1144,7 +1471,7 @@ BBCC** prepare_dump(void)
 static void fprint_cost_ln(VgFile *fp, const HChar* prefix,
 			   const EventMapping* em, const ULong* cost)
 {
-    HChar *mcost = CLG_(mappingcost_as_string)(em, cost);
+    HChar *mcost = CLG_(mappingcost_as_string)(em, sample_scaled_cost(cost));
     VG_(fprintf)(fp, "%s%s\n", prefix, mcost);
     CLG_FREE(mcost);
 }
@@ -1255,6 +1582,7 @@ static VgFile *new_dumpfile(int tid, const HChar* trigger)
 #endif
 
 	(*CLG_(cachesim).dump_desc)(fp);
+	CLG_(branch_dump_desc)(fp);
     }
 
     VG_(fprintf)(fp, "\ndesc: Timerange: Basic block %llu - %llu\n",
@@ -1263,6 +1591,14 @@ static VgFile *new_dumpfile(int tid, const HChar* trigger)
     VG_(fprintf)(fp, "desc: Trigger: %s\n",
 		 trigger ? trigger : "Program termination");
 
+    if (sample_factor > 0)
+	VG_(fprintf)(fp, "desc: Sampling: %llu of every %llu %s, "
+		     "costs scaled by %llu.%03llu\n",
+		     CLG_(clo).sample_window, CLG_(clo).sample_every,
+		     CLG_(clo).sample_ms ? "ms" : "BBs",
+		     sample_factor >> 10,
+		     ((sample_factor & 1023) * 1000) >> 10);
+
 #if 0
    /* Output function specific config
     * FIXME */
@@ -1333,6 +1669,9 @@ static VgFile *new_dumpfile(int tid, const HChar* trigger)
 
    VG_(fprintf)(fp, "\n\n");
 
+   if (CLG_(clo).dump_binary)
+       bin_start(fp);
+
    if (VG_(clo_verbosity) > 1)
        VG_(message)(Vg_DebugMsg, "Dump to %s\n", filename);
 
@@ -1344,11 +1683,17 @@ static void close_dumpfile(VgFile *fp)
 {
     if (fp == NULL) return;
 
+    if (CLG_(clo).dump_binary)
+	bin_end(fp);
+
     fprint_cost_ln(fp, "totals: ", CLG_(dumpmap),
 		   dump_total_cost);
     //fprint_fcc_ln(fp, "summary: ", &dump_total_fcc);
+    /* Accumulate what was written, so that the totals on stderr match
+     * the (possibly scaled) totals in the dump files */
     CLG_(add_cost_lz)(CLG_(sets).full, 
-		     &CLG_(total_cost), dump_total_cost);
+		     &CLG_(total_cost),
+		     (ULong*)sample_scaled_cost(dump_total_cost));
 
     VG_(fclose)(fp);
 
@@ -1401,7 +1746,7 @@ static void print_bbccs_of_thread(thread_info* ti)
 	/* switch back to file of function */
 	print_file(print_fp, "fe=", lastFnPos.cxt->fn[0]->file);
       }
-      VG_(fprintf)(print_fp, "\n");
+      out_printf(print_fp, "\n");
     }
     
     if (*p == 0) break;
@@ -1419,16 +1764,16 @@ static void print_bbccs_of_thread(thread_info* ti)
 	/* FIXME: Specify Object of BB if different to object of fn */
         int i;
 	ULong ecounter = (*p)->ecounter_sum;
-        VG_(fprintf)(print_fp, "bb=%#lx ", (UWord)(*p)->bb->offset);
+        out_printf(print_fp, "bb=%#lx ", (UWord)(*p)->bb->offset);
 	for(i = 0; i<(*p)->bb->cjmp_count;i++) {
-	    VG_(fprintf)(print_fp, "%u %llu ", 
+	    out_printf(print_fp, "%u %llu ", 
 				(*p)->bb->jmp[i].instr,
-				ecounter);
+				sample_scaled(ecounter));
 	    ecounter -= (*p)->jmp[i].ecounter;
 	}
-	VG_(fprintf)(print_fp, "%u %llu\n", 
+	out_printf(print_fp, "%u %llu\n", 
 		     (*p)->bb->instr_count,
-		     ecounter);
+		     sample_scaled(ecounter));
     }
     
     fprint_bbcc(print_fp, *p, &lastAPos);
@@ -1484,6 +1829,7 @@ void CLG_(dump_profile)(const HChar* trigger, Bool only_current_thread)
 		    trigger ? trigger : "Prg.Term.");
 
    out_counter++;
+   sample_factor = CLG_(get_sample_factor)();
 
    print_bbccs(trigger, only_current_thread);
 
@@ -58,6 +58,8 @@ EventGroup* CLG_(register_event_group3)(int id, const HChar*, const HChar*,
                                         const HChar*);
 EventGroup* CLG_(register_event_group4)(int id, const HChar*, const HChar*,
                                         const HChar*, const HChar*);
+/* group with n events, names taken from the array <names> */
+EventGroup* CLG_(register_event_groupN)(int id, int n, const HChar** names);
 EventGroup* CLG_(get_event_group)(int id);
 
 /* Event sets are defined by event groups they consist of. */
@@ -87,11 +87,15 @@ struct _CommandLineOptions {
   Bool dump_instr;
   Bool dump_bb;
   Bool dump_bbs;         /* Dump basic block information? */
+  Bool dump_binary;      /* Binary body instead of text, see dump.c */
   
   /* Dump generation options */
   ULong dump_every_bb;     /* Dump every xxx BBs. */
   
   /* Collection options */
+  ULong sample_every;    /* Instrument only a window of every xxx units */
+  ULong sample_window;   /* Length of that window */
+  Bool  sample_ms;       /* Units are milliseconds instead of BBs? */
   Bool separate_threads; /* Separate threads in dump? */
   Int  separate_callers; /* Separate dependent on how many callers? */
   Int  separate_recursions; /* Max level of recursions to separate */
@@ -280,6 +284,11 @@ struct _CJmpInfo {
  * multiple cost centers for one BB (struct BBCC) exist and the according
  * BBCC is set by setup_bbcc.
  */
+/* Number of BBCCs remembered per BB for lookup without hashing.
+ * A BB executed in a few different contexts (e.g. a function called
+ * from a few call sites) gets its BBCC from this small cache. */
+#define BBCC_CACHE_SIZE 4
+
 struct _BB {
   obj_node*  obj;         /* ELF object of BB */
   PtrdiffT   offset;      /* offset of BB in ELF object file */
@@ -294,7 +303,8 @@ struct _BB {
   Bool       is_entry;    /* True if this BB is a function entry */
         
   BBCC*      bbcc_list;  /* BBCCs for same BB (see next_bbcc in BBCC) */
-  BBCC*      last_bbcc;  /* Temporary: Cached for faster access (LRU) */
+  BBCC*      bbcc_cache[BBCC_CACHE_SIZE]; /* Temporary: recently used
+                          * BBCCs, most recent first (see lookup_bbcc) */
 
   /* filled by CLG_(instrument) if not seen before */
   UInt       cjmp_count;  /* number of side exits */
@@ -631,7 +641,8 @@ struct cachesim_if
     void (*printstat)(Int,Int,Int);
     void (*add_icost)(SimCost, BBCC*, InstrInfo*, ULong);
     void (*finish)(void);
-    
+    void (*switch_thread)(ThreadId);
+
     void (*log_1I0D)(InstrInfo*) VG_REGPARM(1);
     void (*log_2I0D)(InstrInfo*, InstrInfo*) VG_REGPARM(2);
     void (*log_3I0D)(InstrInfo*, InstrInfo*, InstrInfo*) VG_REGPARM(3);
@@ -687,6 +698,10 @@ Bool CLG_(get_debug_info)(Addr, const HChar **dirname,
                           const HChar **fn_name, UInt*, DebugInfo**);
 void CLG_(collectBlockInfo)(IRSB* bbIn, UInt*, UInt*, Bool*);
 void CLG_(set_instrument_state)(const HChar*,Bool);
+ULong CLG_(get_sample_factor)(void);
+Bool CLG_(branch_parse_opt)(const HChar* arg);
+void CLG_(branch_print_opts)(void);
+void CLG_(branch_dump_desc)(VgFile *fp);
 void CLG_(dump_profile)(const HChar* trigger,Bool only_current_thread);
 void CLG_(zero_all_cost)(Bool only_current_thread);
 Int CLG_(get_dump_counter)(void);
@@ -182,11 +182,17 @@ static jCC* new_jcc(BBCC* from, UInt jmp, BBCC* to)
 }
 
 
+/* Number of jCCs of a side exit checked before falling back to the
+ * hash. The jCC list of an exit is kept in most recently used order,
+ * so for a call site with a few different targets (e.g. a virtual
+ * call), the list head acts as a small polymorphic inline cache. */
+#define JCC_SCAN_LIMIT 4
+
 /* get the jCC for a call arc (BBCC->BBCC) */
 jCC* CLG_(get_jcc)(BBCC* from, UInt jmp, BBCC* to)
 {
-    jCC* jcc;
-    UInt idx;
+    jCC *jcc, **prev;
+    UInt idx, i;
 
     CLG_DEBUG(5, "+ get_jcc(bbcc %p/%u => bbcc %p)\n",
 		from, jmp, to);
@@ -206,6 +212,22 @@ jCC* CLG_(get_jcc)(BBCC* from, UInt jmp, BBCC* to)
 	return jcc;
     }
 
+    /* check the first jCCs of the side exit, moving a hit to the front */
+    prev = &(from->jmp[jmp].jcc_list);
+    for (i = 0; i < JCC_SCAN_LIMIT && *prev; i++) {
+	jcc = *prev;
+	if (jcc->to == to) {
+	    if (i > 0) {
+		*prev = jcc->next_from;
+		jcc->next_from = from->jmp[jmp].jcc_list;
+		from->jmp[jmp].jcc_list = jcc;
+	    }
+	    CLG_DEBUG(5, "- get_jcc: [exit list] jcc %p\n", jcc);
+	    goto found;
+	}
+	prev = &(jcc->next_from);
+    }
+
     CLG_(stat).jcc_lru_misses++;
 
     idx = jcc_hash_idx(from, jmp, to, current_jccs.size);
@@ -221,6 +243,8 @@ jCC* CLG_(get_jcc)(BBCC* from, UInt jmp, BBCC* to)
     if (!jcc)
 	jcc = new_jcc(from, jmp, to);
 
+  found:
+
     /* set LRU */
     from->lru_from_jcc = jcc;
     to->lru_to_jcc = jcc;
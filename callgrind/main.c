@@ -131,7 +131,14 @@ static void log_global_event(InstrInfo* ii)
 /* For branches, we consult two different predictors, one which
    predicts taken/untaken for conditional branches, and the other
    which predicts the branch target address for indirect branches
-   (jump-to-register style ones). */
+   (jump-to-register style ones).  With --branch-rsb, returns are
+   predicted by the return stack buffer and counted as indirect
+   branches, and every call pushes its return address. */
+
+static bp_model_t branch_cond      = Bp_GSelect;
+static Int        branch_cond_bits = BP_DEFAULT_COND_BITS;
+static Int        branch_ind_bits  = BP_DEFAULT_IND_BITS;
+static Int        branch_rsb       = 0;
 
 static VG_REGPARM(2)
 void log_cond_branch(InstrInfo* ii, Word taken)
@@ -163,18 +170,12 @@ void log_cond_branch(InstrInfo* ii, Word taken)
     }
 }
 
-static VG_REGPARM(2)
-void log_ind_branch(InstrInfo* ii, UWord actual_dst)
+static __inline__
+void count_Bi(InstrInfo* ii, Bool miss)
 {
-    Bool miss;
     Int fullOffset_Bi;
     ULong* cost_Bi;
 
-    CLG_DEBUG(6, "log_ind_branch:  Ir  %#lx, dst %#lx\n",
-              CLG_(bb_base) + ii->instr_offset, actual_dst);
-
-    miss = 1 & do_ind_branch_predict(CLG_(bb_base) + ii->instr_offset, actual_dst);
-
     if (!CLG_(current_state).collect) return;
 
     CLG_ASSERT( (ii->eventset->mask & (1u<<EG_BI))>0 );
@@ -193,6 +194,80 @@ void log_ind_branch(InstrInfo* ii, UWord actual_dst)
     }
 }
 
+static VG_REGPARM(2)
+void log_ind_branch(InstrInfo* ii, UWord actual_dst)
+{
+    Addr instr_addr = CLG_(bb_base) + ii->instr_offset;
+
+    CLG_DEBUG(6, "log_ind_branch:  Ir  %#lx, dst %#lx\n",
+              instr_addr, actual_dst);
+
+    count_Bi(ii, 1 & do_ind_branch_predict(instr_addr, actual_dst));
+}
+
+static VG_REGPARM(2)
+void log_ind_call(InstrInfo* ii, UWord actual_dst)
+{
+    Addr instr_addr = CLG_(bb_base) + ii->instr_offset;
+
+    CLG_DEBUG(6, "log_ind_call:    Ir  %#lx, dst %#lx\n",
+              instr_addr, actual_dst);
+
+    do_call_push(instr_addr + ii->instr_size);
+    count_Bi(ii, 1 & do_ind_branch_predict(instr_addr, actual_dst));
+}
+
+static VG_REGPARM(2)
+void log_direct_call(InstrInfo* ii, UWord actual_dst)
+{
+    do_call_push(CLG_(bb_base) + ii->instr_offset + ii->instr_size);
+}
+
+static VG_REGPARM(2)
+void log_ret_branch(InstrInfo* ii, UWord actual_dst)
+{
+    CLG_DEBUG(6, "log_ret_branch:  Ir  %#lx, dst %#lx\n",
+              CLG_(bb_base) + ii->instr_offset, actual_dst);
+
+    count_Bi(ii, 1 & do_ret_predict(actual_dst));
+}
+
+Bool CLG_(branch_parse_opt)(const HChar* arg)
+{
+   if      VG_XACT_CLO(arg, "--branch-cond=gselect", branch_cond, Bp_GSelect) {}
+   else if VG_XACT_CLO(arg, "--branch-cond=gshare",  branch_cond, Bp_GShare) {}
+   else if VG_XACT_CLO(arg, "--branch-cond=tage",    branch_cond, Bp_Tage) {}
+   else if VG_BINT_CLO(arg, "--branch-cond-bits", branch_cond_bits,
+                            BP_MIN_BITS, BP_MAX_BITS) {}
+   else if VG_BINT_CLO(arg, "--branch-ind-bits", branch_ind_bits,
+                            BP_MIN_BITS, BP_MAX_BITS) {}
+   else if VG_BINT_CLO(arg, "--branch-rsb", branch_rsb, 0, BP_MAX_RSB) {}
+   else
+      return False;
+
+   return True;
+}
+
+void CLG_(branch_print_opts)(void)
+{
+   VG_(printf)(
+"    --branch-cond=gselect|gshare|tage  Conditional branch predictor [gselect]\n"
+"    --branch-cond-bits=<n>    log2 of the conditional predictor size [14]\n"
+"    --branch-ind-bits=<n>     log2 of the indirect branch BTB size [9]\n"
+"    --branch-rsb=<n>          Return stack entries, 0 = no returns [0]\n"
+   );
+}
+
+void CLG_(branch_dump_desc)(VgFile *fp)
+{
+   HChar buf[128];
+
+   if (!CLG_(clo).simulate_branch || bp_is_default()) return;
+
+   bp_desc(buf);
+   VG_(fprintf)(fp, "desc: Branch predictor: %s\n", buf);
+}
+
 /*------------------------------------------------------------*/
 /*--- Instrumentation structures and event queue handling  ---*/
 /*------------------------------------------------------------*/
@@ -237,7 +312,8 @@ typedef
       Ev_Dw,  // Data write
       Ev_Dm,  // Data modify (read then write)
       Ev_Bc,  // branch conditional
-      Ev_Bi,  // branch indirect (to unknown destination)
+      Ev_Bi,  // branch indirect (to unknown destination), or any
+              // call or return if the return stack is modelled
       Ev_G    // Global bus event
    }
    EventTag;
@@ -265,7 +341,8 @@ typedef
             IRAtom* taken; /* :: Ity_I1 */
          } Bc;
          struct {
-            IRAtom* dst;
+            IRAtom*     dst;
+            IRJumpKind  jk;   /* Ijk_Boring, Ijk_Call or Ijk_Ret */
          } Bi;
 	 struct {
 	 } G;
@@ -277,6 +354,13 @@ static void init_Event ( Event* ev ) {
    VG_(memset)(ev, 0, sizeof(Event));
 }
 
+/* A call to a known address is only there to push the return address
+   onto the return stack. */
+static Bool is_direct_call ( Event* ev ) {
+   return ev->tag == Ev_Bi && ev->Ev.Bi.jk == Ijk_Call
+          && ev->Ev.Bi.dst->tag == Iex_Const;
+}
+
 static IRAtom* get_Event_dea ( Event* ev ) {
    switch (ev->tag) {
       case Ev_Dr: return ev->Ev.Dr.ea;
@@ -358,7 +442,9 @@ static void showEvent ( Event* ev )
          VG_(printf)("\n");
          break;
       case Ev_Bi:
-         VG_(printf)("Bi %p  DST=", ev->inode);
+         VG_(printf)("Bi %p  ", ev->inode);
+         ppIRJumpKind(ev->Ev.Bi.jk);
+         VG_(printf)(" DST=");
          ppIRExpr(ev->Ev.Bi.dst);
          VG_(printf)("\n");
          break;
@@ -415,9 +501,11 @@ static void flushEvents ( ClgState* clgs )
                                                            EG_BC);
                break;
            case Ev_Bi:
-               // extend event set by Bi counters
-               ev->inode->eventset = CLG_(add_event_group)(ev->inode->eventset,
-                                                           EG_BI);
+               // extend event set by Bi counters, unless only
+               // pushing a return address
+               if (!is_direct_call(ev))
+                   ev->inode->eventset = CLG_(add_event_group)(ev->inode->eventset,
+                                                               EG_BI);
                break;
 	   case Ev_G:
                // extend event set by Bus counter
@@ -548,9 +636,22 @@ static void flushEvents ( ClgState* clgs )
             inew = i+1;
             break;
          case Ev_Bi:
-            /* Branch to an unknown destination */
-            helperName = "log_ind_branch";
-            helperAddr = &log_ind_branch;
+            /* Branch to an unknown destination, call or return */
+            if (ev->Ev.Bi.jk == Ijk_Ret) {
+               helperName = "log_ret_branch";
+               helperAddr = &log_ret_branch;
+            } else if (is_direct_call(ev)) {
+               helperName = "log_direct_call";
+               helperAddr = &log_direct_call;
+            } else if (ev->Ev.Bi.jk == Ijk_Call && branch_rsb > 0) {
+               /* without a return stack, a call is just an
+                  indirect branch */
+               helperName = "log_ind_call";
+               helperAddr = &log_ind_call;
+            } else {
+               helperName = "log_ind_branch";
+               helperAddr = &log_ind_branch;
+            }
             argv = mkIRExprVec_2( i_node_expr, ev->Ev.Bi.dst );
             regparms = 2;
             inew = i+1;
@@ -734,7 +835,8 @@ void addEvent_Bc ( ClgState* clgs, InstrInfo* inode, IRAtom* guard )
 }
 
 static
-void addEvent_Bi ( ClgState* clgs, InstrInfo* inode, IRAtom* whereTo )
+void addEvent_Bi ( ClgState* clgs, InstrInfo* inode, IRAtom* whereTo,
+                   IRJumpKind jk )
 {
    Event* evt;
    tl_assert(isIRAtom(whereTo));
@@ -750,6 +852,7 @@ void addEvent_Bi ( ClgState* clgs, InstrInfo* inode, IRAtom* whereTo )
    evt->tag       = Ev_Bi;
    evt->inode     = inode;
    evt->Ev.Bi.dst = whereTo;
+   evt->Ev.Bi.jk  = jk;
    clgs->events_used++;
 }
 
@@ -1269,16 +1372,22 @@ IRSB* CLG_(instrument)( VgCallbackClosure* closure,
    }
 
    /* Deal with branches to unknown destinations.  Except ignore ones
-      which are function returns as we assume the return stack
-      predictor never mispredicts. */
-   if ((sbIn->jumpkind == Ijk_Boring) || (sbIn->jumpkind == Ijk_Call)) {
+      which are function returns, unless the return stack is modelled;
+      otherwise we assume the return stack predictor never
+      mispredicts.  With the return stack, calls to known addresses
+      are needed too, to push the return address. */
+   if ((sbIn->jumpkind == Ijk_Boring) || (sbIn->jumpkind == Ijk_Call)
+       || (sbIn->jumpkind == Ijk_Ret && branch_rsb > 0)) {
       if (0) { ppIRExpr( sbIn->next ); VG_(printf)("\n"); }
       switch (sbIn->next->tag) {
          case Iex_Const:
-            break; /* boring - branch to known address */
+            /* boring - branch to known address */
+            if (sbIn->jumpkind == Ijk_Call && branch_rsb > 0)
+               addEvent_Bi( &clgs, curr_inode, sbIn->next, Ijk_Call );
+            break;
          case Iex_RdTmp:
             /* looks like an indirect branch (branch to unknown) */
-            addEvent_Bi( &clgs, curr_inode, sbIn->next );
+            addEvent_Bi( &clgs, curr_inode, sbIn->next, sbIn->jumpkind );
             break;
          default:
             /* shouldn't happen - if the incoming IR is properly
@@ -1472,6 +1581,67 @@ void CLG_(set_instrument_state)(const HChar* reason, Bool state)
 		 reason, state ? "ON" : "OFF");
 }
 
+
+/*------------------------------------------------------------*/
+/*--- Sampled instrumentation                              ---*/
+/*------------------------------------------------------------*/
+
+/* With --sample-every, instrumentation is switched on for the first
+ * --sample-window units of every period, and off for the rest of it.
+ * Time is measured in BBs executed as counted by the core (which also
+ * counts uninstrumented BBs) or in milliseconds. It is checked when
+ * the scheduler runs a thread, i.e. every few thousand BBs, which gives
+ * the granularity of the windows.
+ *
+ * The time spent inside and outside of windows since the last dump
+ * gives the factor by which dumped costs are scaled up. */
+static ULong sample_last         = 0; /* time of the last check */
+static ULong sample_period_start = 0;
+static ULong sample_time_total   = 0; /* since the last dump */
+static ULong sample_time_in      = 0; /* ... of that inside of windows */
+
+static void sample_check(ULong blocks_done)
+{
+  ULong now, delta;
+  Bool in_window;
+
+  if (CLG_(clo).sample_every == 0) return;
+
+  now = CLG_(clo).sample_ms ? VG_(read_millisecond_timer)() : blocks_done;
+  delta = now - sample_last;
+  sample_last = now;
+  sample_time_total += delta;
+  if (CLG_(instrument_state))
+    sample_time_in += delta;
+
+  /* periods completely passed in between are skipped */
+  if (now - sample_period_start >= CLG_(clo).sample_every)
+    sample_period_start = now - (now - sample_period_start)
+                                % CLG_(clo).sample_every;
+
+  in_window = (now - sample_period_start) < CLG_(clo).sample_window;
+  CLG_(set_instrument_state)("Sampling", in_window);
+}
+
+/* Factor to scale costs collected since the last dump with, in 1/1024
+ * units, or 0 if not sampling. Resets the time accounting, as a dump
+ * zeroes the costs. */
+ULong CLG_(get_sample_factor)(void)
+{
+  ULong factor;
+
+  if (CLG_(clo).sample_every == 0) return 0;
+
+  if (sample_time_in == 0)
+    factor = 1024;
+  else
+    factor = (sample_time_total << 10) / sample_time_in;
+  sample_time_total = 0;
+  sample_time_in    = 0;
+
+  return factor;
+}
+
 /* helper for dump_state_togdb */
 static void dump_state_of_thread_togdb(thread_info* ti)
 {
@@ -1906,6 +2076,11 @@ void finish(void)
   HChar *mcost = CLG_(mappingcost_as_string)(CLG_(dumpmap), CLG_(total_cost));
   VG_(message)(Vg_UserMsg, "Collected : %s\n", mcost);
   VG_(free)(mcost);
+  if (CLG_(clo).sample_every > 0)
+    VG_(message)(Vg_UserMsg,
+		 "Sampling  : %llu of every %llu %s, costs above are scaled\n",
+		 CLG_(clo).sample_window, CLG_(clo).sample_every,
+		 CLG_(clo).sample_ms ? "ms" : "BBs");
   VG_(message)(Vg_UserMsg, "\n");
 
   /* determine value widths for statistics */
@@ -1959,6 +2134,7 @@ static void clg_start_client_code_callback ( ThreadId tid, ULong blocks_done )
    if (blocks_done - last_blocks_done < 5000) return;
    last_blocks_done = blocks_done;
 
+   sample_check(blocks_done);
    CLG_(run_thread)( tid );
 }
 
@@ -2001,6 +2177,15 @@ void CLG_(post_clo_init)(void)
    CLG_DEBUG(1, "  call sep. : %d\n", CLG_(clo).separate_callers);
    CLG_DEBUG(1, "  rec. sep. : %d\n", CLG_(clo).separate_recursions);
 
+   if (CLG_(clo).sample_every > 0) {
+      if (CLG_(clo).sample_window == 0)
+         CLG_(clo).sample_window = CLG_(clo).sample_every / 10;
+      if (CLG_(clo).sample_window == 0 ||
+          CLG_(clo).sample_window >= CLG_(clo).sample_every)
+         VG_(fmsg_bad_option)("--sample-window",
+            "must be at least 1 and smaller than --sample-every\n");
+   }
+
    if (!CLG_(clo).dump_line && !CLG_(clo).dump_instr && !CLG_(clo).dump_bb) {
        VG_(message)(Vg_UserMsg, "Using source line as position.\n");
        CLG_(clo).dump_line = True;
@@ -2010,6 +2195,9 @@ void CLG_(post_clo_init)(void)
 
    (*CLG_(cachesim).post_clo_init)();
 
+   if (CLG_(clo).simulate_branch)
+      bp_init(branch_cond, branch_cond_bits, branch_ind_bits, branch_rsb);
+
    CLG_(init_eventsets)();
    CLG_(init_statistics)(& CLG_(stat));
    CLG_(init_cost_lz)( CLG_(sets).full, &CLG_(total_cost) );
@@ -2023,6 +2211,12 @@ void CLG_(post_clo_init)(void)
    CLG_(run_thread)(1);
 
    CLG_(instrument_state) = CLG_(clo).instrument_atstart;
+   /* the first sampling window starts with the program */
+   if (CLG_(clo).sample_every > 0) {
+      CLG_(instrument_state) = True;
+      if (CLG_(clo).sample_ms)
+         sample_last = sample_period_start = VG_(read_millisecond_timer)();
+   }
 
    if (VG_(clo_verbosity) > 0) {
       VG_(message)(Vg_UserMsg,
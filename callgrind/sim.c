@@ -31,6 +31,7 @@
 */
 
 #include "global.h"
+#include "pub_tool_threadstate.h"
 
 
 /* Notes:
@@ -41,11 +42,21 @@
       - both blocks hit                  --> one hit
       - one block hits, the other misses --> one miss
       - both blocks miss                 --> one miss (not two)
+  - optionally, a unified mid-level (ML) cache sits between the L1
+    caches and LL; LL is then only accessed on an ML miss.
+  - optionally, I1, D1 and ML are private to each thread, with a
+    shared LL.  Switching threads swaps the tag arrays of the private
+    caches (see cachesim_switch_thread).
+  - optionally, a prefetcher model (cg_prefetch.c) reports which L1
+    and LL misses it would have covered, without changing the caches.
 */
 
 /* Cache configuration */
 #include "cg_arch.c"
 
+/* Prefetcher model */
+#include "cg_prefetch.c"
+
 /* additional structures for cache use info, separated
  * according usage frequency:
  * - line_loaded : pointer to cost center of instruction 
@@ -89,9 +100,11 @@ typedef struct {
 
 /*
  * States of flat caches in our model.
- * We use a 2-level hierarchy, 
+ * We use a 2-level hierarchy, or a 3-level one if ML is enabled.
  */
 static cache_t2 I1, D1, LL;
+static cache_t2 ML;
+static Bool ML_enabled = False;
 
 /* Lower bits of cache tags are used as flags for a cache line */
 #define CACHELINE_FLAGMASK (MIN_LINE_SIZE-1)
@@ -103,6 +116,7 @@ static Bool clo_simulate_writeback = False;
 static Bool clo_simulate_hwpref = False;
 static Bool clo_simulate_sectors = False;
 static Bool clo_collect_cacheuse = False;
+static Bool clo_private_caches = False;
 
 /* Following global vars are setup before by setup_bbcc():
  *
@@ -126,6 +140,18 @@ static Int off_D1_SpLoss  = 1;
 static Int off_LL_AcCost  = 2;
 static Int off_LL_SpLoss  = 3;
 
+/* Offset of the ML miss counter in the Ir/Dr/Dw event groups: the ML
+ * events are appended after the LL (and write-back) events so that
+ * the other offsets stay the same with and without ML.
+ */
+static Int off_ML_Miss    = 3;
+
+/* Offsets of the prefetch-covered miss counters, appended after all
+ * the above when a prefetcher model is enabled.
+ */
+static Int off_PF_L1      = 3;
+static Int off_PF_LL      = 4;
+
 /* Cache access types */
 typedef enum { Read = 0, Write = CACHELINE_DIRTY } RefType;
 
@@ -135,17 +161,25 @@ typedef enum { Hit  = 0, Miss, MissDirty } CacheResult;
 /* Result of a reference into a hierarchical cache model */
 typedef enum {
     L1_Hit, 
+    ML_Hit,
     LL_Hit,
     MemAccess,
     WriteBackMemAccess } CacheModelResult;
 
+/* Flags or'ed into a CacheModelResult by the prefetcher model */
+#define PF_COVERED_L1   0x10
+#define PF_COVERED_LL   0x20
+#define PF_COVERED_MASK (PF_COVERED_L1 | PF_COVERED_LL)
+
 typedef CacheModelResult (*simcall_type)(Addr, UChar);
 
+/* With a prefetcher model, <simulator> holds the prefetch_* wrappers
+ * and <pf_simulator> the wrapped functions. */
 static struct {
     simcall_type I1_Read;
     simcall_type D1_Read;
     simcall_type D1_Write;
-} simulator;
+} simulator, pf_simulator;
 
 /*------------------------------------------------------------*/
 /*--- Cache Simulator Initialization                       ---*/
@@ -464,6 +498,176 @@ CacheModelResult cachesim_D1_Write(Addr a, UChar size)
 }
 
 
+/*------------------------------------------------------------*/
+/*--- Mid-Level Cache Simulation                           ---*/
+/*------------------------------------------------------------*/
+
+/*
+ * Model: 3-level hierarchy (L1/ML/LL), where ML is only accessed on an
+ * L1 miss. As L1, ML is write-through when simulating write-back.
+ *
+ * Simulator functions:
+ *  CacheModelResult cachesim_I1_ref_ML(Addr a, UChar size)
+ *  CacheModelResult cachesim_D1_ref_ML(Addr a, UChar size)
+ *  CacheModelResult cachesim_I1_Read_ML(Addr a, UChar size)
+ *  CacheModelResult cachesim_D1_Read_ML(Addr a, UChar size)
+ *  CacheModelResult cachesim_D1_Write_ML(Addr a, UChar size)
+ */
+
+static
+CacheModelResult cachesim_I1_ref_ML(Addr a, UChar size)
+{
+    if ( cachesim_ref( &I1, a, size) == Hit ) return L1_Hit;
+    if ( cachesim_ref( &ML, a, size) == Hit ) return ML_Hit;
+    if ( cachesim_ref( &LL, a, size) == Hit ) return LL_Hit;
+    return MemAccess;
+}
+
+static
+CacheModelResult cachesim_D1_ref_ML(Addr a, UChar size)
+{
+    if ( cachesim_ref( &D1, a, size) == Hit ) return L1_Hit;
+    if ( cachesim_ref( &ML, a, size) == Hit ) return ML_Hit;
+    if ( cachesim_ref( &LL, a, size) == Hit ) return LL_Hit;
+    return MemAccess;
+}
+
+static
+CacheModelResult cachesim_I1_Read_ML(Addr a, UChar size)
+{
+    if ( cachesim_ref( &I1, a, size) == Hit ) return L1_Hit;
+    if ( cachesim_ref( &ML, a, size) == Hit ) return ML_Hit;
+    switch( cachesim_ref_wb( &LL, Read, a, size) ) {
+	case Hit: return LL_Hit;
+	case Miss: return MemAccess;
+	default: break;
+    }
+    return WriteBackMemAccess;
+}
+
+static
+CacheModelResult cachesim_D1_Read_ML(Addr a, UChar size)
+{
+    if ( cachesim_ref( &D1, a, size) == Hit ) return L1_Hit;
+    if ( cachesim_ref( &ML, a, size) == Hit ) return ML_Hit;
+    switch( cachesim_ref_wb( &LL, Read, a, size) ) {
+	case Hit: return LL_Hit;
+	case Miss: return MemAccess;
+	default: break;
+    }
+    return WriteBackMemAccess;
+}
+
+static
+CacheModelResult cachesim_D1_Write_ML(Addr a, UChar size)
+{
+    CacheResult res;
+
+    if ( cachesim_ref( &D1, a, size) == Hit ) {
+	/* see cachesim_D1_Write */
+	cachesim_ref_wb( &LL, Write, a, size);
+	return L1_Hit;
+    }
+    if ( cachesim_ref( &ML, a, size) == Hit ) {
+	cachesim_ref_wb( &LL, Write, a, size);
+	return ML_Hit;
+    }
+    res = cachesim_ref_wb( &LL, Write, a, size);
+    if (res == Hit) return LL_Hit;
+    if (res == Miss) return MemAccess;
+    return WriteBackMemAccess;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Private Caches per Thread                            ---*/
+/*------------------------------------------------------------*/
+
+/* Tag arrays of the private caches of every thread (indexed by
+ * ThreadId), when --private-caches=yes. The arrays of the running
+ * thread are the ones installed in I1, D1 and ML.
+ */
+typedef struct {
+    UWord* I1_tags;
+    UWord* D1_tags;
+    UWord* ML_tags;
+} private_tags;
+
+static private_tags* thread_tags = 0;
+static ThreadId      tags_tid = VG_INVALID_THREADID;
+
+static UWord* new_tags(cache_t2* c)
+{
+    UWord* tags = (UWord*) CLG_MALLOC("cl.sim.nt.1",
+                                      sizeof(UWord) * c->sets * c->assoc);
+    VG_(memset)(tags, 0, sizeof(UWord) * c->sets * c->assoc);
+    return tags;
+}
+
+/* Make the private caches of thread tid the simulated I1, D1 and ML.
+ * Tag arrays without owner (initially, and after their owner exited)
+ * are adopted by the next thread without arrays of its own.
+ */
+static void cachesim_switch_thread(ThreadId tid)
+{
+    private_tags* pt;
+
+    if (!thread_tags || tid == tags_tid || tid == VG_INVALID_THREADID)
+	return;
+    CLG_ASSERT(tid < VG_N_THREADS);
+
+    pt = &thread_tags[tid];
+    if (tags_tid != VG_INVALID_THREADID) {
+	private_tags* old = &thread_tags[tags_tid];
+	old->I1_tags = I1.tags;
+	old->D1_tags = D1.tags;
+	old->ML_tags = ML.tags;
+    }
+    else if (pt->I1_tags == 0) {
+	tags_tid = tid;
+	return;
+    }
+    else {
+	CLG_FREE(I1.tags);
+	CLG_FREE(D1.tags);
+	if (ML_enabled) CLG_FREE(ML.tags);
+    }
+
+    if (pt->I1_tags == 0) {
+	pt->I1_tags = new_tags(&I1);
+	pt->D1_tags = new_tags(&D1);
+	if (ML_enabled) pt->ML_tags = new_tags(&ML);
+    }
+    I1.tags = pt->I1_tags;
+    D1.tags = pt->D1_tags;
+    ML.tags = pt->ML_tags;
+    tags_tid = tid;
+}
+
+/* Thread tid exited: a new thread reusing tid starts with cold caches */
+static void cachesim_thread_exit(ThreadId tid)
+{
+    private_tags* pt;
+
+    CLG_ASSERT(tid < VG_N_THREADS);
+    pt = &thread_tags[tid];
+
+    if (tid == tags_tid) {
+	/* the arrays are installed: empty them for the next thread */
+	cachesim_clearcache(&I1);
+	cachesim_clearcache(&D1);
+	if (ML_enabled) cachesim_clearcache(&ML);
+	tags_tid = VG_INVALID_THREADID;
+    }
+    else if (pt->I1_tags) {
+	CLG_FREE(pt->I1_tags);
+	CLG_FREE(pt->D1_tags);
+	if (ML_enabled) CLG_FREE(pt->ML_tags);
+    }
+    pt->I1_tags = pt->D1_tags = pt->ML_tags = 0;
+}
+
+
 /*------------------------------------------------------------*/
 /*--- Hardware Prefetch Simulation                         ---*/
 /*------------------------------------------------------------*/
@@ -595,6 +799,67 @@ CacheModelResult prefetch_D1_Write(Addr a, UChar size)
 }
 
 
+/*------------------------------------------------------------*/
+/*--- Prefetcher Model                                     ---*/
+/*------------------------------------------------------------*/
+
+/* Unlike the hardware prefetch simulation above, which loads lines
+ * into LL, the prefetcher model of cg_prefetch.c only observes the
+ * misses: a miss to a line a prefetcher requested before is flagged
+ * as covered in the result, and counted by inc_costs().
+ */
+
+static prefetch_model_t pf_model = Pf_None;
+static prefetcher_t     pf_I1, pf_D1, pf_LL;
+
+static
+void prefetch_model_clear(void)
+{
+  if (pf_model == Pf_None) return;
+  pf_init(&pf_I1, pf_model, I1.line_size_bits);
+  pf_init(&pf_D1, pf_model, D1.line_size_bits);
+  pf_init(&pf_LL, pf_model, LL.line_size_bits);
+}
+
+/* For an access straddling two lines, the second line is accounted. */
+static __inline__
+CacheModelResult prefetch_model_check(CacheModelResult r,
+				      prefetcher_t* pf1, cache_t2* L1,
+				      Addr a, UChar size)
+{
+    UInt res = r;
+
+    if (r == L1_Hit) return r;
+    if (pf_miss_is_covered(pf1, (a+size-1) >> L1->line_size_bits))
+	res |= PF_COVERED_L1;
+    if (r >= MemAccess &&
+	pf_miss_is_covered(&pf_LL, (a+size-1) >> LL.line_size_bits))
+	res |= PF_COVERED_LL;
+    return (CacheModelResult) res;
+}
+
+static
+CacheModelResult prefetch_model_I1_Read(Addr a, UChar size)
+{
+    return prefetch_model_check( (*pf_simulator.I1_Read)(a, size),
+				 &pf_I1, &I1, a, size);
+}
+
+static
+CacheModelResult prefetch_model_D1_Read(Addr a, UChar size)
+{
+    return prefetch_model_check( (*pf_simulator.D1_Read)(a, size),
+				 &pf_D1, &D1, a, size);
+}
+
+static
+CacheModelResult prefetch_model_D1_Write(Addr a, UChar size)
+{
+    return prefetch_model_check( (*pf_simulator.D1_Write)(a, size),
+				 &pf_D1, &D1, a, size);
+}
+
+
 /*------------------------------------------------------------*/
 /*--- Cache Simulation with use metric collection          ---*/
 /*------------------------------------------------------------*/
@@ -1021,6 +1286,18 @@ void cacheuse_finish(void)
 static __inline__
 void inc_costs(CacheModelResult r, ULong* c1, ULong* c2)
 {
+    if (r & PF_COVERED_MASK) {
+	if (r & PF_COVERED_L1) {
+	    c1[off_PF_L1]++;
+	    c2[off_PF_L1]++;
+	}
+	if (r & PF_COVERED_LL) {
+	    c1[off_PF_LL]++;
+	    c2[off_PF_LL]++;
+	}
+	r &= ~PF_COVERED_MASK;
+    }
+
     switch(r) {
 	case WriteBackMemAccess:
 	    if (clo_simulate_writeback) {
@@ -1035,6 +1312,13 @@ void inc_costs(CacheModelResult r, ULong* c1, ULong* c2)
 	    // fall through
 
 	case LL_Hit:
+	    if (ML_enabled) {
+		c1[off_ML_Miss]++;
+		c2[off_ML_Miss]++;
+	    }
+	    // fall through
+
+	case ML_Hit:
 	    c1[1]++;
 	    c2[1]++;
 	    // fall through
@@ -1048,8 +1332,9 @@ void inc_costs(CacheModelResult r, ULong* c1, ULong* c2)
 static
 const HChar* cacheRes(CacheModelResult r)
 {
-    switch(r) {
+    switch(r & ~PF_COVERED_MASK) {
     case L1_Hit:    return "L1 Hit ";
+    case ML_Hit:    return "ML Hit ";
     case LL_Hit:    return "LL Hit ";
     case MemAccess: return "LL Miss";
     case WriteBackMemAccess: return "LL Miss (dirty)";
@@ -1285,6 +1570,7 @@ static void log_0I1Dw(InstrInfo* ii, Addr data_addr, Word data_size)
 static cache_t clo_I1_cache = UNDEFINED_CACHE;
 static cache_t clo_D1_cache = UNDEFINED_CACHE;
 static cache_t clo_LL_cache = UNDEFINED_CACHE;
+static cache_t clo_ML_cache = UNDEFINED_CACHE;
 
 /* Initialize and clear simulator state */
 static void cachesim_post_clo_init(void)
@@ -1313,6 +1599,21 @@ static void cachesim_post_clo_init(void)
     return;
   }
 
+  ML_enabled = clo_ML_cache.size != -1;
+  if (clo_collect_cacheuse && (ML_enabled || clo_private_caches)) {
+      VG_(message)(Vg_DebugMsg,
+		   "warning: mid-level and private caches can not be "
+		   "used with cache usage\n");
+      ML_enabled = False;
+      clo_private_caches = False;
+  }
+  if (clo_collect_cacheuse && pf_model != Pf_None) {
+      VG_(message)(Vg_DebugMsg,
+		   "warning: prefetcher model can not be "
+		   "used with cache usage\n");
+      pf_model = Pf_None;
+  }
+
   /* Configuration of caches only needed with real cache simulation */
   VG_(post_clo_init_configure_caches)(&I1c, &D1c, &LLc,
                                       &clo_I1_cache,
@@ -1330,6 +1631,8 @@ static void cachesim_post_clo_init(void)
                            ? I1c.line_size : D1c.line_size;
   CLG_(min_line_size) = (LLc.line_size < CLG_(min_line_size))
                            ? LLc.line_size : CLG_(min_line_size);
+  if (ML_enabled && clo_ML_cache.line_size < CLG_(min_line_size))
+     CLG_(min_line_size) = clo_ML_cache.line_size;
 
   Int largest_load_or_store_size
      = VG_(machine_get_size_of_largest_guest_register)();
@@ -1348,6 +1651,17 @@ static void cachesim_post_clo_init(void)
   cachesim_initcache(I1c, &I1);
   cachesim_initcache(D1c, &D1);
   cachesim_initcache(LLc, &LL);
+  if (ML_enabled) {
+    ML.name = "ML";
+    cachesim_initcache(clo_ML_cache, &ML);
+  }
+
+  if (clo_private_caches) {
+    thread_tags = (private_tags*) CLG_MALLOC("cl.sim.cpci.1",
+                                             VG_N_THREADS * sizeof(private_tags));
+    VG_(memset)(thread_tags, 0, VG_N_THREADS * sizeof(private_tags));
+    VG_(track_pre_thread_ll_exit)(cachesim_thread_exit);
+  }
 
   /* the other cache simulators use the standard helpers
    * with dispatching via simulator struct */
@@ -1392,7 +1706,26 @@ static void cachesim_post_clo_init(void)
       return;
   }
 
-  if (clo_simulate_hwpref) {
+  if (clo_simulate_hwpref && ML_enabled) {
+      VG_(message)(Vg_DebugMsg,
+		   "warning: prefetch simulation can not be "
+		   "used with a mid-level cache\n");
+      clo_simulate_hwpref = False;
+  }
+
+  if (ML_enabled) {
+    if (clo_simulate_writeback) {
+      simulator.I1_Read  = cachesim_I1_Read_ML;
+      simulator.D1_Read  = cachesim_D1_Read_ML;
+      simulator.D1_Write = cachesim_D1_Write_ML;
+    }
+    else {
+      simulator.I1_Read  = cachesim_I1_ref_ML;
+      simulator.D1_Read  = cachesim_D1_ref_ML;
+      simulator.D1_Write = cachesim_D1_ref_ML;
+    }
+  }
+  else if (clo_simulate_hwpref) {
     prefetch_clear();
 
     if (clo_simulate_writeback) {
@@ -1405,11 +1738,8 @@ static void cachesim_post_clo_init(void)
       simulator.D1_Read  = prefetch_D1_ref;
       simulator.D1_Write = prefetch_D1_ref;
     }
-
-    return;
   }
-
-  if (clo_simulate_writeback) {
+  else if (clo_simulate_writeback) {
       simulator.I1_Read  = cachesim_I1_Read;
       simulator.D1_Read  = cachesim_D1_Read;
       simulator.D1_Write = cachesim_D1_Write;
@@ -1419,6 +1749,14 @@ static void cachesim_post_clo_init(void)
       simulator.D1_Read  = cachesim_D1_ref;
       simulator.D1_Write = cachesim_D1_ref;
   }
+
+  if (pf_model != Pf_None) {
+      prefetch_model_clear();
+      pf_simulator = simulator;
+      simulator.I1_Read  = prefetch_model_I1_Read;
+      simulator.D1_Read  = prefetch_model_D1_Read;
+      simulator.D1_Write = prefetch_model_D1_Write;
+  }
 }
 
 
@@ -1426,11 +1764,30 @@ static void cachesim_post_clo_init(void)
 static
 void cachesim_clear(void)
 {
+  ThreadId tid;
+
   cachesim_clearcache(&I1);
   cachesim_clearcache(&D1);
   cachesim_clearcache(&LL);
+  if (ML_enabled)
+    cachesim_clearcache(&ML);
+
+  /* private caches of the threads not running */
+  if (thread_tags) {
+    for (tid = 1; tid < VG_N_THREADS; tid++) {
+      if (tid == tags_tid || thread_tags[tid].I1_tags == 0) continue;
+      VG_(memset)(thread_tags[tid].I1_tags, 0,
+                  sizeof(UWord) * I1.sets * I1.assoc);
+      VG_(memset)(thread_tags[tid].D1_tags, 0,
+                  sizeof(UWord) * D1.sets * D1.assoc);
+      if (ML_enabled)
+        VG_(memset)(thread_tags[tid].ML_tags, 0,
+                    sizeof(UWord) * ML.sets * ML.assoc);
+    }
+  }
 
   prefetch_clear();
+  prefetch_model_clear();
 }
 
 
@@ -1439,6 +1796,10 @@ static void cachesim_dump_desc(VgFile *fp)
   VG_(fprintf)(fp, "\ndesc: I1 cache: %s\n", I1.desc_line);
   VG_(fprintf)(fp, "desc: D1 cache: %s\n", D1.desc_line);
   VG_(fprintf)(fp, "desc: LL cache: %s\n", LL.desc_line);
+  if (ML_enabled)
+    VG_(fprintf)(fp, "desc: ML cache: %s\n", ML.desc_line);
+  if (pf_model != Pf_None)
+    VG_(fprintf)(fp, "desc: Prefetcher: %s\n", pf_model_name(pf_model));
 }
 
 static
@@ -1448,10 +1809,13 @@ void cachesim_print_opts(void)
 "\n   cache simulator options (does cache simulation if used):\n"
 "    --simulate-wb=no|yes      Count write-back events [no]\n"
 "    --simulate-hwpref=no|yes  Simulate hardware prefetch [no]\n"
+"    --prefetcher=none|next-line|stride  Count L1/LL misses covered\n"
+"                              by this prefetcher model [none]\n"
 #if CLG_EXPERIMENTAL
 "    --simulate-sectors=no|yes Simulate sectored behaviour [no]\n"
 #endif
-"    --cacheuse=no|yes         Collect cache block use [no]\n");
+"    --cacheuse=no|yes         Collect cache block use [no]\n"
+"    --private-caches=no|yes   Per-thread I1/D1/ML caches, shared LL [no]\n");
   VG_(print_cache_clo_opts)();
 }
 
@@ -1465,6 +1829,10 @@ static Bool cachesim_parse_opt(const HChar* arg)
    if      VG_BOOL_CLO(arg, "--simulate-wb",      clo_simulate_writeback) {}
    else if VG_BOOL_CLO(arg, "--simulate-hwpref",  clo_simulate_hwpref)    {}
    else if VG_BOOL_CLO(arg, "--simulate-sectors", clo_simulate_sectors)   {}
+   else if VG_BOOL_CLO(arg, "--private-caches",   clo_private_caches)     {}
+   else if VG_XACT_CLO(arg, "--prefetcher=none",      pf_model, Pf_None)     {}
+   else if VG_XACT_CLO(arg, "--prefetcher=next-line", pf_model, Pf_NextLine) {}
+   else if VG_XACT_CLO(arg, "--prefetcher=stride",    pf_model, Pf_Stride)   {}
 
    else if VG_BOOL_CLO(arg, "--cacheuse", clo_collect_cacheuse) {
       if (clo_collect_cacheuse) {
@@ -1477,6 +1845,7 @@ static Bool cachesim_parse_opt(const HChar* arg)
                                    &clo_I1_cache,
                                    &clo_D1_cache,
                                    &clo_LL_cache)) {}
+   else if (VG_(str_clo_ML_cache_opt)(arg, &clo_ML_cache)) {}
 
    else
      return False;
@@ -1490,6 +1859,8 @@ void cachesim_printstat(Int l1, Int l2, Int l3)
   FullCost total = CLG_(total_cost), D_total = 0;
   ULong LL_total_m, LL_total_mr, LL_total_mw,
     LL_total, LL_total_r, LL_total_w;
+  ULong ML_total_m = 0, ML_total_mr = 0, ML_total_mw = 0,
+    ML_total, ML_total_r, ML_total_w;
 
   if ((VG_(clo_verbosity) >1) && clo_simulate_hwpref) {
     VG_(message)(Vg_DebugMsg, "Prefetch Up:       %llu\n", 
@@ -1499,17 +1870,43 @@ void cachesim_printstat(Int l1, Int l2, Int l3)
     VG_(message)(Vg_DebugMsg, "\n");
   }
 
+  if ((VG_(clo_verbosity) >1) && pf_model != Pf_None) {
+    VG_(message)(Vg_DebugMsg, "Prefetches I1:     %llu (%llu used)\n",
+		 pf_I1.issued, pf_I1.covered);
+    VG_(message)(Vg_DebugMsg, "Prefetches D1:     %llu (%llu used)\n",
+		 pf_D1.issued, pf_D1.covered);
+    VG_(message)(Vg_DebugMsg, "Prefetches LL:     %llu (%llu used)\n",
+		 pf_LL.issued, pf_LL.covered);
+    VG_(message)(Vg_DebugMsg, "\n");
+  }
+
   VG_(message)(Vg_UserMsg, "I1  misses:    %'*llu\n", l1,
                total[fullOffset(EG_IR) +1]);
 
+  if (ML_enabled)
+    VG_(message)(Vg_UserMsg, "MLi misses:    %'*llu\n", l1,
+                 total[fullOffset(EG_IR) + off_ML_Miss]);
+
   VG_(message)(Vg_UserMsg, "LLi misses:    %'*llu\n", l1,
                total[fullOffset(EG_IR) +2]);
 
+  if (pf_model != Pf_None) {
+    VG_(message)(Vg_UserMsg, "I1  covered:   %'*llu\n", l1,
+                 total[fullOffset(EG_IR) + off_PF_L1]);
+    VG_(message)(Vg_UserMsg, "LLi covered:   %'*llu\n", l1,
+                 total[fullOffset(EG_IR) + off_PF_LL]);
+  }
+
   if (0 == total[fullOffset(EG_IR)])
     total[fullOffset(EG_IR)] = 1;
 
   VG_(message)(Vg_UserMsg, "I1  miss rate: %*.2f%%\n", l1,
                total[fullOffset(EG_IR)+1] * 100.0 / total[fullOffset(EG_IR)]);
+
+  if (ML_enabled)
+    VG_(message)(Vg_UserMsg, "MLi miss rate: %*.2f%%\n", l1,
+                 total[fullOffset(EG_IR) + off_ML_Miss] * 100.0
+                 / total[fullOffset(EG_IR)]);
        
   VG_(message)(Vg_UserMsg, "LLi miss rate: %*.2f%%\n", l1,
                total[fullOffset(EG_IR)+2] * 100.0 / total[fullOffset(EG_IR)]);
@@ -1522,7 +1919,7 @@ void cachesim_printstat(Int l1, Int l2, Int l3)
 
   D_total = CLG_(get_eventset_cost)( CLG_(sets).full );
   CLG_(init_cost)( CLG_(sets).full, D_total);
-  // we only use the first 3 values of D_total, adding up Dr and Dw costs
+  // we only use the first values of D_total, adding up Dr and Dw costs
   CLG_(copy_cost)( CLG_(get_event_set)(EG_DR), D_total, total + fullOffset(EG_DR) );
   CLG_(add_cost) ( CLG_(get_event_set)(EG_DW), D_total, total + fullOffset(EG_DW) );
 
@@ -1536,11 +1933,31 @@ void cachesim_printstat(Int l1, Int l2, Int l3)
                l2, total[fullOffset(EG_DR)+1],
                l3, total[fullOffset(EG_DW)+1]);
 
+  if (ML_enabled)
+    VG_(message)(Vg_UserMsg,
+                 "MLd misses:    %'*llu  (%'*llu rd + %'*llu wr)\n",
+                 l1, D_total[off_ML_Miss],
+                 l2, total[fullOffset(EG_DR) + off_ML_Miss],
+                 l3, total[fullOffset(EG_DW) + off_ML_Miss]);
+
   VG_(message)(Vg_UserMsg, "LLd misses:    %'*llu  (%'*llu rd + %'*llu wr)\n",
                l1, D_total[2],
                l2, total[fullOffset(EG_DR)+2],
                l3, total[fullOffset(EG_DW)+2]);
 
+  if (pf_model != Pf_None) {
+    VG_(message)(Vg_UserMsg,
+                 "D1  covered:   %'*llu  (%'*llu rd + %'*llu wr)\n",
+                 l1, D_total[off_PF_L1],
+                 l2, total[fullOffset(EG_DR) + off_PF_L1],
+                 l3, total[fullOffset(EG_DW) + off_PF_L1]);
+    VG_(message)(Vg_UserMsg,
+                 "LLd covered:   %'*llu  (%'*llu rd + %'*llu wr)\n",
+                 l1, D_total[off_PF_LL],
+                 l2, total[fullOffset(EG_DR) + off_PF_LL],
+                 l3, total[fullOffset(EG_DW) + off_PF_LL]);
+  }
+
   if (0 == D_total[0])   D_total[0] = 1;
   if (0 == total[fullOffset(EG_DR)]) total[fullOffset(EG_DR)] = 1;
   if (0 == total[fullOffset(EG_DW)]) total[fullOffset(EG_DW)] = 1;
@@ -1550,6 +1967,15 @@ void cachesim_printstat(Int l1, Int l2, Int l3)
            l2, total[fullOffset(EG_DR)+1] * 100.0 / total[fullOffset(EG_DR)],
            l3, total[fullOffset(EG_DW)+1] * 100.0 / total[fullOffset(EG_DW)]);
   
+  if (ML_enabled)
+    VG_(message)(Vg_UserMsg,
+                 "MLd miss rate: %*.1f%% (%*.1f%%   + %*.1f%%  )\n",
+                 l1, D_total[off_ML_Miss] * 100.0 / D_total[0],
+                 l2, total[fullOffset(EG_DR) + off_ML_Miss] * 100.0
+                     / total[fullOffset(EG_DR)],
+                 l3, total[fullOffset(EG_DW) + off_ML_Miss] * 100.0
+                     / total[fullOffset(EG_DW)]);
+
   VG_(message)(Vg_UserMsg, "LLd miss rate: %*.1f%% (%*.1f%%   + %*.1f%%  )\n", 
            l1, D_total[2] * 100.0 / D_total[0],
            l2, total[fullOffset(EG_DR)+2] * 100.0 / total[fullOffset(EG_DR)],
@@ -1558,16 +1984,55 @@ void cachesim_printstat(Int l1, Int l2, Int l3)
 
 
   
+  /* ML overall results: ML is referenced on L1 misses, LL on ML misses */
+
+  if (ML_enabled) {
+    ML_total   =
+      total[fullOffset(EG_DR) +1] +
+      total[fullOffset(EG_DW) +1] +
+      total[fullOffset(EG_IR) +1];
+    ML_total_r =
+      total[fullOffset(EG_DR) +1] +
+      total[fullOffset(EG_IR) +1];
+    ML_total_w = total[fullOffset(EG_DW) +1];
+    VG_(message)(Vg_UserMsg, "ML refs:       %'*llu  (%'*llu rd + %'*llu wr)\n",
+                 l1, ML_total, l2, ML_total_r, l3, ML_total_w);
+
+    ML_total_m  =
+      total[fullOffset(EG_DR) + off_ML_Miss] +
+      total[fullOffset(EG_DW) + off_ML_Miss] +
+      total[fullOffset(EG_IR) + off_ML_Miss];
+    ML_total_mr =
+      total[fullOffset(EG_DR) + off_ML_Miss] +
+      total[fullOffset(EG_IR) + off_ML_Miss];
+    ML_total_mw = total[fullOffset(EG_DW) + off_ML_Miss];
+    VG_(message)(Vg_UserMsg, "ML misses:     %'*llu  (%'*llu rd + %'*llu wr)\n",
+                 l1, ML_total_m, l2, ML_total_mr, l3, ML_total_mw);
+
+    VG_(message)(Vg_UserMsg, "ML miss rate:  %*.1f%% (%*.1f%%   + %*.1f%%  )\n",
+          l1, ML_total_m  * 100.0 / (total[fullOffset(EG_IR)] + D_total[0]),
+          l2, ML_total_mr * 100.0 / (total[fullOffset(EG_IR)] + total[fullOffset(EG_DR)]),
+          l3, ML_total_mw * 100.0 / total[fullOffset(EG_DW)]);
+    VG_(message)(Vg_UserMsg, "\n");
+  }
+
   /* LL overall results */
   
-  LL_total   =
-    total[fullOffset(EG_DR) +1] +
-    total[fullOffset(EG_DW) +1] +
-    total[fullOffset(EG_IR) +1];
-  LL_total_r =
-    total[fullOffset(EG_DR) +1] +
-    total[fullOffset(EG_IR) +1];
-  LL_total_w = total[fullOffset(EG_DW) +1];
+  if (ML_enabled) {
+    LL_total   = ML_total_m;
+    LL_total_r = ML_total_mr;
+    LL_total_w = ML_total_mw;
+  }
+  else {
+    LL_total   =
+      total[fullOffset(EG_DR) +1] +
+      total[fullOffset(EG_DW) +1] +
+      total[fullOffset(EG_IR) +1];
+    LL_total_r =
+      total[fullOffset(EG_DR) +1] +
+      total[fullOffset(EG_IR) +1];
+    LL_total_w = total[fullOffset(EG_DW) +1];
+  }
   VG_(message)(Vg_UserMsg, "LL refs:       %'*llu  (%'*llu rd + %'*llu wr)\n",
                l1, LL_total, l2, LL_total_r, l3, LL_total_w);
   
@@ -1581,6 +2046,16 @@ void cachesim_printstat(Int l1, Int l2, Int l3)
   LL_total_mw = total[fullOffset(EG_DW) +2];
   VG_(message)(Vg_UserMsg, "LL misses:     %'*llu  (%'*llu rd + %'*llu wr)\n",
                l1, LL_total_m, l2, LL_total_mr, l3, LL_total_mw);
+
+  if (pf_model != Pf_None)
+    VG_(message)(Vg_UserMsg,
+                 "LL covered:    %'*llu  (%'*llu rd + %'*llu wr)\n",
+                 l1, total[fullOffset(EG_DR) + off_PF_LL] +
+                     total[fullOffset(EG_DW) + off_PF_LL] +
+                     total[fullOffset(EG_IR) + off_PF_LL],
+                 l2, total[fullOffset(EG_DR) + off_PF_LL] +
+                     total[fullOffset(EG_IR) + off_PF_LL],
+                 l3, total[fullOffset(EG_DW) + off_PF_LL]);
   
   VG_(message)(Vg_UserMsg, "LL miss rate:  %*.1f%% (%*.1f%%   + %*.1f%%  )\n",
           l1, LL_total_m  * 100.0 / (total[fullOffset(EG_IR)] + D_total[0]),
@@ -1605,15 +2080,34 @@ void CLG_(init_eventsets)()
 
     if (!CLG_(clo).simulate_cache)
 	CLG_(register_event_group)(EG_IR, "Ir");
-    else if (!clo_simulate_writeback) {
-	CLG_(register_event_group3)(EG_IR, "Ir", "I1mr", "ILmr");
-	CLG_(register_event_group3)(EG_DR, "Dr", "D1mr", "DLmr");
-	CLG_(register_event_group3)(EG_DW, "Dw", "D1mw", "DLmw");
-    }
-    else { // clo_simulate_writeback
-	CLG_(register_event_group4)(EG_IR, "Ir", "I1mr", "ILmr", "ILdmr");
-        CLG_(register_event_group4)(EG_DR, "Dr", "D1mr", "DLmr", "DLdmr");
-        CLG_(register_event_group4)(EG_DW, "Dw", "D1mw", "DLmw", "DLdmw");
+    else {
+	/* Write-back, ML and prefetcher events are appended in this
+	 * order; the offsets used in inc_costs() follow from that. */
+	const HChar *ir[7] = { "Ir", "I1mr", "ILmr" };
+	const HChar *dr[7] = { "Dr", "D1mr", "DLmr" };
+	const HChar *dw[7] = { "Dw", "D1mw", "DLmw" };
+	Int n = 3;
+
+	if (clo_simulate_writeback) {
+	    ir[n] = "ILdmr"; dr[n] = "DLdmr"; dw[n] = "DLdmw";
+	    n++;
+	}
+	if (ML_enabled) {
+	    off_ML_Miss = n;
+	    ir[n] = "IMmr"; dr[n] = "DMmr"; dw[n] = "DMmw";
+	    n++;
+	}
+	if (pf_model != Pf_None) {
+	    off_PF_L1 = n;
+	    ir[n] = "I1pmr"; dr[n] = "D1pmr"; dw[n] = "D1pmw";
+	    n++;
+	    off_PF_LL = n;
+	    ir[n] = "ILpmr"; dr[n] = "DLpmr"; dw[n] = "DLpmw";
+	    n++;
+	}
+	CLG_(register_event_groupN)(EG_IR, n, ir);
+	CLG_(register_event_groupN)(EG_DR, n, dr);
+	CLG_(register_event_groupN)(EG_DW, n, dw);
     }
 
     if (CLG_(clo).simulate_branch) {
@@ -1653,12 +2147,21 @@ void CLG_(init_eventsets)()
     CLG_(append_event)(CLG_(dumpmap), "I1mr");
     CLG_(append_event)(CLG_(dumpmap), "D1mr");
     CLG_(append_event)(CLG_(dumpmap), "D1mw");
+    CLG_(append_event)(CLG_(dumpmap), "IMmr");
+    CLG_(append_event)(CLG_(dumpmap), "DMmr");
+    CLG_(append_event)(CLG_(dumpmap), "DMmw");
     CLG_(append_event)(CLG_(dumpmap), "ILmr");
     CLG_(append_event)(CLG_(dumpmap), "DLmr");
     CLG_(append_event)(CLG_(dumpmap), "DLmw");
     CLG_(append_event)(CLG_(dumpmap), "ILdmr");
     CLG_(append_event)(CLG_(dumpmap), "DLdmr");
     CLG_(append_event)(CLG_(dumpmap), "DLdmw");
+    CLG_(append_event)(CLG_(dumpmap), "I1pmr");
+    CLG_(append_event)(CLG_(dumpmap), "D1pmr");
+    CLG_(append_event)(CLG_(dumpmap), "D1pmw");
+    CLG_(append_event)(CLG_(dumpmap), "ILpmr");
+    CLG_(append_event)(CLG_(dumpmap), "DLpmr");
+    CLG_(append_event)(CLG_(dumpmap), "DLpmw");
     CLG_(append_event)(CLG_(dumpmap), "Bc");
     CLG_(append_event)(CLG_(dumpmap), "Bcm");
     CLG_(append_event)(CLG_(dumpmap), "Bi");
@@ -1707,6 +2210,7 @@ struct cachesim_if CLG_(cachesim) = {
   .printstat     = cachesim_printstat,
   .add_icost     = cachesim_add_icost,
   .finish        = cachesim_finish,
+  .switch_thread = cachesim_switch_thread,
 
   /* these will be set by cachesim_post_clo_init */
   .log_1I0D        = 0,
@@ -0,0 +1,30 @@
+# Prints the calls between polycall.c's functions from the output of
+# "callgrind_annotate --tree=calling", as "<caller> > <callee> <n>x",
+# without costs, file names and objects.
+
+function fn_name(s)
+{
+   sub(/ \[.*\]$/, "", s)
+   sub(/^.*:/, "", s)
+   return s
+}
+
+BEGIN { re = "^(t[0-5]|dispatch|caller_[ab])('|$)" }
+
+/ \* / {
+   s = $0
+   sub(/^.* \* +/, "", s)
+   caller = fn_name(s)
+}
+
+/ >   / {
+   s = $0
+   sub(/^.* >   /, "", s)
+   n = s
+   sub(/^.* \(/, "", n)
+   sub(/x\).*$/, "", n)
+   sub(/ \([0-9]+x\).*$/, "", s)
+   callee = fn_name(s)
+   if (caller ~ re && callee ~ re)
+      print caller " > " callee " " n "x"
+}
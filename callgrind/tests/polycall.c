@@ -0,0 +1,44 @@
+// Calls six functions through one call site, from two callers.  With
+// --separate-callers=1 the call site's BB runs in two contexts, and each
+// of its side exits gets more call targets than Callgrind checks before
+// falling back to the jCC hash, so the BBCC caches and the reordering of
+// the jCC lists are exercised.
+
+#include <stdio.h>
+
+typedef int (*fn_t)(int);
+
+#define NOINLINE __attribute__((noinline))
+
+static NOINLINE int t0(int x) { return x + 0; }
+static NOINLINE int t1(int x) { return x + 1; }
+static NOINLINE int t2(int x) { return x + 2; }
+static NOINLINE int t3(int x) { return x + 3; }
+static NOINLINE int t4(int x) { return x + 4; }
+static NOINLINE int t5(int x) { return x + 5; }
+
+static fn_t volatile targets[6] = { t0, t1, t2, t3, t4, t5 };
+
+// No tail calls, so that these are calls, not jumps.
+static NOINLINE int dispatch(int i)
+{
+   return targets[i % 6](i) * 2;
+}
+
+static NOINLINE int caller_a(int i) { return dispatch(i) + 1; }
+static NOINLINE int caller_b(int i) { return dispatch(i) + 2; }
+
+int main(void)
+{
+   long sum = 0;
+   int  i;
+
+   for (i = 0; i < 6000; i++) {
+      if (i % 2)
+         sum += caller_a(i / 2);
+      else
+         sum += caller_b(i / 2);
+   }
+   printf("Sum: %ld\n", sum);
+   return 0;
+}
@@ -174,6 +174,9 @@ void CLG_(switch_thread)(ThreadId tid)
     if (!CLG_(clo).separate_threads) t = thread[1];
     CLG_(set_current_bbcc_hash) ( &(t->bbccs) );
     CLG_(set_current_jcc_hash)  ( &(t->jccs) );
+
+    /* private caches of the simulator, if any */
+    (*CLG_(cachesim).switch_thread)(tid);
   }
 }
 
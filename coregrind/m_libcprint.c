@@ -353,11 +353,43 @@ UInt VG_(fprintf) ( VgFile *fp, const HChar *format, ... )
    return ret;
 }
 
+void VG_(fwrite) ( VgFile *fp, const void *buf, SizeT n )
+{
+   if (fp->num_chars + n <= VGFILE_BUFSIZE) {
+      VG_(memcpy)(fp->buf + fp->num_chars, buf, n);
+      fp->num_chars += n;
+      if (fp->num_chars == VGFILE_BUFSIZE) {
+         VG_(write)(fp->fd, fp->buf, fp->num_chars);
+         fp->num_chars = 0;
+      }
+      return;
+   }
+
+   // Does not fit: flush, and write large blocks without copying them.
+   if (fp->num_chars) {
+      VG_(write)(fp->fd, fp->buf, fp->num_chars);
+      fp->num_chars = 0;
+   }
+   if (n >= VGFILE_BUFSIZE) {
+      VG_(write)(fp->fd, buf, n);
+   } else {
+      VG_(memcpy)(fp->buf, buf, n);
+      fp->num_chars = n;
+   }
+}
+
+void VG_(fflush)( VgFile *fp )
+{
+   if (fp->num_chars) {
+      VG_(write)(fp->fd, fp->buf, fp->num_chars);
+      fp->num_chars = 0;
+   }
+}
+
 void VG_(fclose)( VgFile *fp )
 {
    // Flush the buffer.
-   if (fp->num_chars)
-      VG_(write)(fp->fd, fp->buf, fp->num_chars);
+   VG_(fflush)(fp);
 
    VG_(close)(fp->fd);
    VG_(free)(fp);
@@ -898,10 +898,10 @@ Int VG_(fork) ( void )
    Timing stuff
    ------------------------------------------------------------------ */
 
-UInt VG_(read_millisecond_timer) ( void )
+/* Microseconds since some arbitrary point, from a monotonic clock if
+   there is one. */
+static ULong read_microsecond_clock ( void )
 {
-   /* 'now' and 'base' are in microseconds */
-   static ULong base = 0;
    ULong  now;
 
 #  if defined(VGO_linux) || defined(VGO_solaris)
@@ -937,13 +937,61 @@ UInt VG_(read_millisecond_timer) ( void )
 #    error "Unknown OS"
 #  endif
 
-   /* COMMON CODE */  
+   return now;
+}
+
+UInt VG_(read_millisecond_timer) ( void )
+{
+   /* 'now' and 'base' are in microseconds */
+   static ULong base = 0;
+   ULong  now = read_microsecond_clock();
+
    if (base == 0)
       base = now;
 
    return (now - base) / 1000;
 }
 
+/* Where the CPU has a counter that can be read cheaply from user
+   space, return it, else fall back to microseconds.  The counters do
+   not necessarily count cycles, nor at the same rate on all CPUs, so
+   only differences taken on the same thread are meaningful; they are
+   meant for comparing the times of activities with each other. */
+ULong VG_(read_cycle_counter) ( void )
+{
+#  if defined(VGA_x86) || defined(VGA_amd64)
+   UInt lo, hi;
+   __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+   return ((ULong)hi << 32) | lo;
+#  elif defined(VGA_arm64)
+   ULong v;
+   __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+   return v;
+#  elif defined(VGA_ppc64be) || defined(VGA_ppc64le)
+   ULong v;
+   __asm__ __volatile__("mftb %0" : "=r"(v));
+   return v;
+#  elif defined(VGA_s390x)
+   ULong v;
+   __asm__ __volatile__("stckf %0" : "=Q"(v) : : "cc");
+   return v;
+#  else
+   return read_microsecond_clock();
+#  endif
+}
+
+const HChar* VG_(cycle_counter_unit) ( void )
+{
+#  if defined(VGA_x86) || defined(VGA_amd64)
+   return "tsc ticks";
+#  elif defined(VGA_arm64) || defined(VGA_ppc64be) || defined(VGA_ppc64le) \
+        || defined(VGA_s390x)
+   return "timer ticks";
+#  else
+   return "microseconds";
+#  endif
+}
+
 Int VG_(gettimeofday)(struct vki_timeval *tv, struct vki_timezone *tz)
 {
    SysRes res;
@@ -226,6 +226,8 @@ static void usage_NORETURN ( Bool debug_help )
 "  debugging options for all Valgrind tools:\n"
 "    -d                        show verbose debugging output\n"
 "    --stats=no|yes            show tool and core statistics [no]\n"
+"    --stats-timers=no|yes     with --stats=yes, show the time the scheduler\n"
+"                              spends on its main activities [no]\n"
 "    --sanity-level=<number>   level of sanity checking to do [1]\n"
 "    --trace-flags=<XXXXXXXX>   show generated code? (X = 0|1) [00000000]\n"
 "    --profile-flags=<XXXXXXXX> ditto, but for profiling (X = 0|1) [00000000]\n"
@@ -666,6 +668,7 @@ void main_process_cmd_line_options ( /*OUT*/Bool* logging_to_fd,
                "Bad argument, should be 'yes', 'try' or 'no'\n");
       }
       else if VG_BOOL_CLO(arg, "--trace-sched",      VG_(clo_trace_sched)) {}
+      else if VG_BOOL_CLO(arg, "--stats-timers",     VG_(clo_stats_timers)) {}
       else if VG_BOOL_CLO(arg, "--trace-signals",    VG_(clo_trace_signals)) {}
       else if VG_BOOL_CLO(arg, "--trace-symtab",     VG_(clo_trace_symtab)) {}
       else if VG_STR_CLO (arg, "--trace-symtab-patt", VG_(clo_trace_symtab_patt)) {}
@@ -145,6 +145,108 @@ static ULong stats__n_xindir_misses = 0;
 static UInt sanity_fast_count = 0;
 static UInt sanity_slow_count = 0;
 
+/* Stats: for each thread slot, how often the scheduler did each of its
+   main activities for that thread and, with --stats-timers=yes, how
+   long that took, in VG_(read_cycle_counter) units.  A slot reused by a
+   later thread adds to the numbers of the earlier ones. */
+typedef
+   enum {
+      SA_RunCode,      /* dispatcher and generated code */
+      SA_TTMiss,       /* handle_tt_miss, including translating */
+      SA_ChainMe,      /* handle_chain_me, including translating */
+      SA_Syscall,      /* VG_(client_syscall), including blocking */
+      SA_PollSignals,  /* VG_(poll_signals) at the end of a timeslice */
+      SA_NUMBER
+   }
+   SchedActivity;
+
+static const HChar* const sched_activity_name[SA_NUMBER] = {
+   "run-code", "tt-miss", "chain-me", "syscall", "poll-signals"
+};
+
+typedef
+   struct {
+      ULong n[SA_NUMBER];
+      ULong ticks[SA_NUMBER];
+      ULong bbs;      /* blocks run */
+      ULong faults;   /* runs ended by a fault turned into a signal */
+   }
+   SchedStats;
+
+static SchedStats* sched_stats = NULL;   /* [VG_N_THREADS] */
+
+static __inline__ ULong sched_activity_start ( void )
+{
+   return UNLIKELY(VG_(clo_stats_timers)) ? VG_(read_cycle_counter)() : 0;
+}
+
+static __inline__
+void sched_activity_end ( ThreadId tid, SchedActivity sa, ULong start )
+{
+   sched_stats[tid].n[sa]++;
+   if (UNLIKELY(VG_(clo_stats_timers)))
+      sched_stats[tid].ticks[sa] += VG_(read_cycle_counter)() - start;
+}
+
+static void print_sched_activity ( const HChar* who, const SchedStats* ss )
+{
+   ULong total = 0;
+   Int   sa;
+
+   for (sa = 0; sa < SA_NUMBER; sa++)
+      total += ss->ticks[sa];
+
+   VG_(message)(Vg_DebugMsg,
+                "sched-stats: %-9s %'llu blocks, %'llu faults\n",
+                who, ss->bbs, ss->faults);
+   for (sa = 0; sa < SA_NUMBER; sa++) {
+      if (VG_(clo_stats_timers))
+         VG_(message)(Vg_DebugMsg,
+                      "sched-stats: %-9s %-12s %'12llu calls %'18llu %s "
+                      "%5.1f%%\n",
+                      who, sched_activity_name[sa], ss->n[sa], ss->ticks[sa],
+                      VG_(cycle_counter_unit)(),
+                      total ? ss->ticks[sa] * 100.0 / total : 0.0);
+      else
+         VG_(message)(Vg_DebugMsg,
+                      "sched-stats: %-9s %-12s %'12llu calls\n",
+                      who, sched_activity_name[sa], ss->n[sa]);
+   }
+}
+
+/* Shows the totals, and the numbers of each thread slot if more than
+   one was used. */
+static void print_sched_activities ( void )
+{
+   SchedStats total;
+   HChar      who[16];
+   Int        tid, sa, n_used = 0;
+
+   VG_(memset)(&total, 0, sizeof(total));
+   for (tid = 1; tid < VG_N_THREADS; tid++) {
+      const SchedStats* ss = &sched_stats[tid];
+      if (ss->n[SA_RunCode] == 0)
+         continue;
+      n_used++;
+      for (sa = 0; sa < SA_NUMBER; sa++) {
+         total.n[sa]     += ss->n[sa];
+         total.ticks[sa] += ss->ticks[sa];
+      }
+      total.bbs    += ss->bbs;
+      total.faults += ss->faults;
+   }
+
+   print_sched_activity("total", &total);
+   if (n_used > 1) {
+      for (tid = 1; tid < VG_N_THREADS; tid++) {
+         if (sched_stats[tid].n[SA_RunCode] == 0)
+            continue;
+         VG_(sprintf)(who, "tid %d", tid);
+         print_sched_activity(who, &sched_stats[tid]);
+      }
+   }
+}
+
 void VG_(print_scheduler_stats)(void)
 {
    VG_(message)(Vg_DebugMsg,
@@ -160,6 +262,7 @@ void VG_(print_scheduler_stats)(void)
    VG_(message)(Vg_DebugMsg, 
                 "   sanity: %u cheap, %u expensive checks.\n",
                 sanity_fast_count, sanity_slow_count );
+   print_sched_activities();
 }
 
 /*
@@ -624,6 +727,9 @@ ThreadId VG_(scheduler_init_phase1) ( void )
 
    init_BigLock();
 
+   sched_stats = VG_(calloc)("sched.init_phase1.1",
+                             VG_N_THREADS, sizeof(SchedStats));
+
    for (i = 0 /* NB; not 1 */; i < VG_N_THREADS; i++) {
       /* Paranoia .. completely zero it out. */
       VG_(memset)( & VG_(threads)[i], 0, sizeof( VG_(threads)[i] ) );
@@ -866,6 +972,7 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
    volatile ThreadState* tst            = NULL; /* stop gcc complaining */
    volatile Int          done_this_time = 0;
    volatile HWord        host_code_addr = 0;
+   volatile ULong        start_ticks    = 0;
 
    /* Paranoia */
    vg_assert(VG_(is_valid_tid)(tid));
@@ -944,6 +1051,8 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
    vg_assert(VG_(in_generated_code) == False);
    VG_(in_generated_code) = True;
 
+   start_ticks = sched_activity_start();
+
    SCHEDSETJMP(
       tid, 
       jumped, 
@@ -954,6 +1063,8 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
       )
    );
 
+   sched_activity_end(tid, SA_RunCode, start_ticks);
+
    vg_assert(VG_(in_generated_code) == True);
    VG_(in_generated_code) = False;
 
@@ -1000,6 +1111,7 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
 
    vg_assert(done_this_time >= 0);
    bbs_done += (ULong)done_this_time;
+   sched_stats[tid].bbs += (ULong)done_this_time;
 
    *dispatchCtrP -= done_this_time;
    vg_assert(*dispatchCtrP >= 0);
@@ -1102,6 +1214,7 @@ static void handle_syscall(ThreadId tid, UInt trc)
 {
    ThreadState * volatile tst = VG_(get_ThreadState)(tid);
    volatile UWord jumped; 
+   volatile ULong start_ticks;
 
    /* Syscall may or may not block; either way, it will be
       complete by the time this call returns, and we'll be
@@ -1115,7 +1228,9 @@ static void handle_syscall(ThreadId tid, UInt trc)
       vg_assert(ok);
    }
 
+   start_ticks = sched_activity_start();
    SCHEDSETJMP(tid, jumped, VG_(client_syscall)(tid, trc));
+   sched_activity_end(tid, SA_Syscall, start_ticks);
 
    if (VG_(clo_sanity_level) >= 3) {
       HChar buf[50];    // large enough
@@ -1189,6 +1304,7 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 {
    /* Holds the remaining size of this thread's "timeslice". */
    Int dispatch_ctr = 0;
+   ULong start_ticks;
 
    ThreadState *tst = VG_(get_ThreadState)(tid);
    static Bool vgdb_startup_action_done = False;
@@ -1309,7 +1425,9 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 
 	 /* Look for any pending signals for this thread, and set them up
 	    for delivery */
+	 start_ticks = sched_activity_start();
 	 VG_(poll_signals)(tid);
+	 sched_activity_end(tid, SA_PollSignals, start_ticks);
 
 	 if (VG_(is_exiting)(tid))
 	    break;		/* poll_signals picked up a fatal signal */
@@ -1406,18 +1524,24 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 
       case VG_TRC_INNER_FASTMISS:
 	 vg_assert(dispatch_ctr >= 0);
+	 start_ticks = sched_activity_start();
 	 handle_tt_miss(tid);
+	 sched_activity_end(tid, SA_TTMiss, start_ticks);
 	 break;
 
       case VG_TRC_CHAIN_ME_TO_SLOW_EP: {
          if (0) VG_(printf)("sched: CHAIN_TO_SLOW_EP: %p\n", (void*)trc[1] );
+         start_ticks = sched_activity_start();
          handle_chain_me(tid, (void*)trc[1], False);
+         sched_activity_end(tid, SA_ChainMe, start_ticks);
          break;
       }
 
       case VG_TRC_CHAIN_ME_TO_FAST_EP: {
          if (0) VG_(printf)("sched: CHAIN_TO_FAST_EP: %p\n", (void*)trc[1] );
+         start_ticks = sched_activity_start();
          handle_chain_me(tid, (void*)trc[1], True);
+         sched_activity_end(tid, SA_ChainMe, start_ticks);
          break;
       }
 
@@ -1457,6 +1581,7 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
       case VG_TRC_FAULT_SIGNAL:
 	 /* Everything should be set up (either we're exiting, or
 	    about to start in a signal handler). */
+	 sched_stats[tid].faults++;
 	 break;
 
       case VEX_TRC_JMP_MAPFAIL:
@@ -142,13 +142,6 @@ extern Bool VG_(use_CF_info) ( /*MOD*/D3UnwindRegs* uregs,
                                Addr min_accessible,
                                Addr max_accessible );
 
-/* returns the "generation" of the debug info.
-   Each time some debuginfo is changed (e.g. loaded or unloaded),
-   the VG_(debuginfo_generation)() value returned will be increased.
-   This can be used to flush cached information derived from debug
-   info (e.g. CFI info or FPO info or ...). */
-extern UInt VG_(debuginfo_generation) (void);
-
 
 
 /* True if some FPO information is loaded.
@@ -82,6 +82,10 @@ extern HChar **VG_(env_clone)    ( HChar **env_clone );
 extern Int  VG_(getgroups)( Int size, UInt* list );
 extern Int  VG_(ptrace)( Int request, Int pid, void *addr, void *data );
 
+// A cheap, fine-grained clock, and the name of its unit
+extern ULong        VG_(read_cycle_counter) ( void );
+extern const HChar* VG_(cycle_counter_unit) ( void );
+
 // atfork
 extern void VG_(do_atfork_pre)    ( ThreadId tid );
 extern void VG_(do_atfork_parent) ( ThreadId tid );
@@ -194,6 +194,8 @@ enum FairSchedType { disable_fair_sched, enable_fair_sched, try_fair_sched };
 extern enum FairSchedType VG_(clo_fair_sched);
 /* DEBUG: print thread scheduling events?  default: NO */
 extern Bool  VG_(clo_trace_sched);
+/* DEBUG: with --stats=yes, time the scheduler's activities?  default: NO */
+extern Bool  VG_(clo_stats_timers);
 /* DEBUG: do heap profiling?  default: NO */
 extern Bool  VG_(clo_profile_heap);
 #define MAX_REDZONE_SZB 128
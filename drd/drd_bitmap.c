@@ -47,6 +47,10 @@ static OSet* s_bm2_set_template;
 static ULong s_bitmap_creation_count;
 static ULong s_bitmap_merge_count;
 static ULong s_bitmap2_merge_count;
+static ULong s_bitmap2_lazy_compute_count;
+static ULong s_cache2_hit_count;
+static ULong s_cache2_miss_count;
+static ULong s_cache2_resize_count;
 
 
 /* Function definitions. */
@@ -88,23 +92,43 @@ void DRD_(bm_delete)(struct bitmap* const bm)
    VG_(free)(bm);
 }
 
-/** Initialize *bm. */
-void DRD_(bm_init)(struct bitmap* const bm)
+/** Invalidate all entries of the lookup cache of *bm. */
+static void bm_cache_init(struct bitmap* const bm)
 {
    unsigned i;
 
-   tl_assert(bm);
    /*
-    * Cache initialization. a1 is initialized with a value that never can
-    * match any valid address: the upper (ADDR_LSB_BITS + ADDR_IGNORED_BITS)
-    * bits of a1 are always zero for a valid cache entry.
+    * a1 is initialized with a value that never can match any valid
+    * address: the upper (ADDR_LSB_BITS + ADDR_IGNORED_BITS) bits of a1 are
+    * always zero for a valid cache entry.
     */
    for (i = 0; i < DRD_BITMAP_N_CACHE_ELEM; i++)
    {
       bm->cache[i].a1  = ~(UWord)1;
       bm->cache[i].bm2 = 0;
    }
+   if (bm->cache2)
+   {
+      for (i = 0; i <= bm->cache2_mask; i++)
+      {
+         bm->cache2[i].a1  = ~(UWord)1;
+         bm->cache2[i].bm2 = 0;
+      }
+   }
+   bm->cache2_lookups = 0;
+   bm->cache2_misses  = 0;
+}
+
+/** Initialize *bm. */
+void DRD_(bm_init)(struct bitmap* const bm)
+{
+   tl_assert(bm);
+   bm->cache2 = NULL;
+   bm->cache2_mask = 0;
+   bm_cache_init(bm);
    bm->oset = VG_(OSetGen_EmptyClone)(s_bm2_set_template);
+   bm->lazy_compute = NULL;
+   bm->epoch = 1;
 
    s_bitmap_creation_count++;
 }
@@ -113,6 +137,138 @@ void DRD_(bm_init)(struct bitmap* const bm)
 void DRD_(bm_cleanup)(struct bitmap* const bm)
 {
    VG_(OSetGen_Destroy)(bm->oset);
+   if (bm->cache2)
+      VG_(free)(bm->cache2);
+}
+
+/*
+ * Adaptive lookup cache.
+ *
+ * Lookups that miss the few most recently used entries in bitmap::cache[]
+ * are looked up in the direct-mapped cache bitmap::cache2[] before falling
+ * back to the OSet. The hit rate of cache2[] is evaluated every
+ * BM_CACHE2_WINDOW such lookups: if cache2[] hardly ever hits it is shrunk
+ * and eventually freed, and if it misses often it is grown. Since the most
+ * frequently accessed bitmap of a thread is the bitmap of its latest
+ * segment, the cache size is handed over from segment to segment via
+ * DRD_(bm_get_cache2_size)() and DRD_(bm_set_cache2_size)().
+ */
+
+#define BM_CACHE2_WINDOW 1024
+
+/** Return the number of elements of the direct-mapped cache of *bm. */
+UWord DRD_(bm_get_cache2_size)(const struct bitmap* const bm)
+{
+   return bm->cache2 ? bm->cache2_mask + 1 : 0;
+}
+
+/**
+ * Resize the direct-mapped cache of *bm to size elements. size must be
+ * zero or a power of two between DRD_BITMAP_MIN_CACHE2_ELEM and
+ * DRD_BITMAP_MAX_CACHE2_ELEM. Zero means that no direct-mapped cache is
+ * used.
+ */
+void DRD_(bm_set_cache2_size)(struct bitmap* const bm, const UWord size)
+{
+   unsigned i;
+
+   tl_assert(size == 0
+             || (DRD_BITMAP_MIN_CACHE2_ELEM <= size
+                 && size <= DRD_BITMAP_MAX_CACHE2_ELEM
+                 && (size & (size - 1)) == 0));
+
+   if (size == DRD_(bm_get_cache2_size)(bm))
+      return;
+
+   s_cache2_resize_count++;
+   if (bm->cache2)
+   {
+      VG_(free)(bm->cache2);
+      bm->cache2 = NULL;
+      bm->cache2_mask = 0;
+   }
+   if (size)
+   {
+      bm->cache2 = VG_(malloc)("drd.bitmap.bsc2.1",
+                               size * sizeof(bm->cache2[0]));
+      bm->cache2_mask = size - 1;
+   }
+   bm->cache2_lookups = 0;
+   bm->cache2_misses  = 0;
+   if (bm->cache2)
+   {
+      for (i = 0; i < size; i++)
+      {
+         bm->cache2[i].a1  = ~(UWord)1;
+         bm->cache2[i].bm2 = 0;
+      }
+      /* Seed the new cache with the most recently used entries. */
+      for (i = DRD_BITMAP_N_CACHE_ELEM; i > 0; i--)
+      {
+         const struct bm_cache_elem* const e = &bm->cache[i - 1];
+         if (e->a1 != ~(UWord)1)
+            bm->cache2[e->a1 & bm->cache2_mask] = *e;
+      }
+   }
+}
+
+/**
+ * Grow or shrink the direct-mapped cache of *bm based on its hit rate. The
+ * cache is only grown while it is smaller than twice the number of
+ * second-level bitmaps since a larger cache would mainly hold entries for
+ * addresses for which no second-level bitmap exists.
+ */
+static void bm_cache2_adapt(struct bitmap* const bm)
+{
+   const UWord size = DRD_(bm_get_cache2_size)(bm);
+   const UInt hits = bm->cache2_lookups - bm->cache2_misses;
+
+   if (bm->cache2_misses * 4 > bm->cache2_lookups
+       && size < DRD_BITMAP_MAX_CACHE2_ELEM
+       && size < 2 * VG_(OSetGen_Size)(bm->oset))
+   {
+      DRD_(bm_set_cache2_size)(bm, size ? size * 2
+                               : DRD_BITMAP_MIN_CACHE2_ELEM);
+   }
+   else if (size && hits * 16 < bm->cache2_lookups)
+   {
+      /* Streaming or very sparse access pattern: cache2[] does not help. */
+      DRD_(bm_set_cache2_size)(bm, size > DRD_BITMAP_MIN_CACHE2_ELEM
+                               ? size / 2 : 0);
+   }
+   else
+   {
+      bm->cache2_lookups = 0;
+      bm->cache2_misses  = 0;
+   }
+}
+
+/**
+ * Look up a1 in the direct-mapped cache of *bm. Called by bm_cache_lookup()
+ * for lookups that missed bitmap::cache[].
+ */
+Bool DRD_(bm_cache2_lookup)(struct bitmap* const bm, const UWord a1,
+                            struct bitmap2** bm2)
+{
+   if (bm->cache2)
+   {
+      const struct bm_cache_elem* const e = &bm->cache2[a1 & bm->cache2_mask];
+      if (e->a1 == a1)
+      {
+         s_cache2_hit_count++;
+         *bm2 = e->bm2;
+         bm_update_mru_cache(bm, a1, e->bm2);
+         if (UNLIKELY(++bm->cache2_lookups >= BM_CACHE2_WINDOW))
+            bm_cache2_adapt(bm);
+         return True;
+      }
+   }
+   s_cache2_miss_count++;
+   bm->cache2_misses++;
+   if (UNLIKELY(++bm->cache2_lookups >= BM_CACHE2_WINDOW))
+      bm_cache2_adapt(bm);
+   *bm2 = 0;
+   return False;
 }
 
 /**
@@ -1009,9 +1165,10 @@ Bool DRD_(bm_equal)(struct bitmap* const lhs, struct bitmap* const rhs)
 
 void DRD_(bm_swap)(struct bitmap* const bm1, struct bitmap* const bm2)
 {
-   OSet* const tmp = bm1->oset;
-   bm1->oset = bm2->oset;
-   bm2->oset = tmp;
+   /* Swap the lookup caches too since these point into the OSets. */
+   const struct bitmap tmp = *bm1;
+   *bm1 = *bm2;
+   *bm2 = tmp;
 }
 
 /** Merge bitmaps *lhs and *rhs into *lhs. */
@@ -1187,16 +1344,18 @@ int DRD_(bm_has_races)(struct bitmap* const lhs, struct bitmap* const rhs)
 
       for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
       {
+         /*
+          * Compute HAS_RACE() for all bits of a word at once, and only
+          * examine individual bits of words in which a race was found.
+          */
+         UWord races = (bm1r->bm0_w[k] & (bm1l->bm0_r[k] | bm1l->bm0_w[k]))
+                       | (bm1l->bm0_w[k] & (bm1r->bm0_r[k] | bm1r->bm0_w[k]));
          unsigned b;
-         for (b = 0; b < BITS_PER_UWORD; b++)
+
+         for (b = 0; races; b++, races >>= 1)
          {
-            UWord const access_mask
-               = ((bm1l->bm0_r[k] & bm0_mask(b)) ? LHS_R : 0)
-               | ((bm1l->bm0_w[k] & bm0_mask(b)) ? LHS_W : 0)
-               | ((bm1r->bm0_r[k] & bm0_mask(b)) ? RHS_R : 0)
-               | ((bm1r->bm0_w[k] & bm0_mask(b)) ? RHS_W : 0);
             Addr const a = make_address(bm2l->addr, k * BITS_PER_UWORD | b);
-            if (HAS_RACE(access_mask) && ! DRD_(is_suppressed)(a, a + 1))
+            if ((races & 1) && ! DRD_(is_suppressed)(a, a + 1))
             {
                return 1;
             }
@@ -1206,6 +1365,150 @@ int DRD_(bm_has_races)(struct bitmap* const lhs, struct bitmap* const rhs)
    return 0;
 }
 
+/*
+ * Lazy bitmaps.
+ *
+ * The second-level bitmaps of a lazy bitmap are not computed when the
+ * bitmap's content changes but the first time they are looked up via
+ * bm2_lookup() afterwards, by calling bitmap::lazy_compute. A second-level
+ * bitmap is up to date if its epoch equals the epoch of the bitmap it
+ * belongs to. Out of date second-level bitmaps are recomputed in place,
+ * such that they are reused instead of reallocated.
+ */
+
+/**
+ * Maximum number of second-level bitmaps a lazy bitmap may hold before
+ * DRD_(bm_lazy_invalidate_all)() frees them instead of reusing them.
+ */
+#define BM_LAZY_MAX_BITMAP2_COUNT 4096
+
+/** Make *bm, which must be empty, a lazy bitmap. */
+void DRD_(bm_set_lazy)(struct bitmap* const bm, BmLazyComputeT compute)
+{
+   tl_assert(bm);
+   tl_assert(compute);
+   tl_assert(VG_(OSetGen_Size)(bm->oset) == 0);
+
+   bm->lazy_compute = compute;
+}
+
+/** Mark all second-level bitmaps of lazy bitmap *bm as out of date. */
+void DRD_(bm_lazy_invalidate_all)(struct bitmap* const bm)
+{
+   struct bitmap2* bm2;
+
+   tl_assert(bm);
+   tl_assert(bm->lazy_compute);
+
+   if (VG_(OSetGen_Size)(bm->oset) > BM_LAZY_MAX_BITMAP2_COUNT)
+   {
+      VG_(OSetGen_Destroy)(bm->oset);
+      bm->oset = VG_(OSetGen_EmptyClone)(s_bm2_set_template);
+      bm_cache_init(bm);
+   }
+
+   if (++bm->epoch == 0)
+   {
+      /* Epoch wrap-around. Epoch zero never matches an up to date bitmap2. */
+      bm->epoch = 1;
+      for (VG_(OSetGen_ResetIter)(bm->oset);
+           (bm2 = VG_(OSetGen_Next)(bm->oset)) != 0;
+           )
+      {
+         bm2->epoch = 0;
+      }
+   }
+}
+
+/**
+ * Mark those second-level bitmaps of lazy bitmap *lhs as out of date for
+ * which *rhs has a second-level bitmap.
+ */
+void DRD_(bm_lazy_invalidate)(struct bitmap* const lhs,
+                              struct bitmap* const rhs)
+{
+   struct bitmap2* bm2l;
+   struct bitmap2* bm2r;
+
+   tl_assert(lhs->lazy_compute);
+   tl_assert(lhs != rhs);
+
+   for (VG_(OSetGen_ResetIter)(rhs->oset);
+        (bm2r = VG_(OSetGen_Next)(rhs->oset)) != 0;
+        )
+   {
+      bm2l = VG_(OSetGen_Lookup)(lhs->oset, &bm2r->addr);
+      if (bm2l)
+         bm2l->epoch = 0;
+   }
+}
+
+/**
+ * Merge the second-level bitmap for address a1 of *rhs into the one of lazy
+ * bitmap *lhs. May only be called from inside bitmap::lazy_compute.
+ */
+void DRD_(bm_lazy_merge2)(struct bitmap* const lhs, struct bitmap* const rhs,
+                          const UWord a1)
+{
+   struct bitmap2* bm2l;
+   const struct bitmap2* bm2r;
+
+#ifdef ENABLE_DRD_CONSISTENCY_CHECKS
+   tl_assert(lhs->lazy_compute);
+   tl_assert(lhs != rhs);
+#endif
+
+   bm2r = VG_(OSetGen_Lookup)(rhs->oset, &a1);
+   if (bm2r)
+   {
+      bm2l = bm2_lookup_exclusive(lhs, a1);
+      tl_assert(bm2l);
+      bm2_merge(bm2l, bm2r);
+   }
+}
+
+/**
+ * Bring those second-level bitmaps of lazy bitmap *lhs up to date for which
+ * *rhs has a second-level bitmap.
+ */
+void DRD_(bm_lazy_compute_all)(struct bitmap* const lhs,
+                               struct bitmap* const rhs)
+{
+   struct bitmap2* bm2r;
+
+   tl_assert(lhs->lazy_compute);
+   tl_assert(lhs != rhs);
+
+   for (VG_(OSetGen_ResetIter)(rhs->oset);
+        (bm2r = VG_(OSetGen_Next)(rhs->oset)) != 0;
+        )
+   {
+      bm2_lookup(lhs, bm2r->addr);
+   }
+}
+
+/**
+ * Compute the second-level bitmap for address a1 of lazy bitmap *bm. bm2
+ * is the out of date second-level bitmap for a1, or NULL if there is none.
+ */
+struct bitmap2* DRD_(bm2_lazy_compute)(struct bitmap* const bm,
+                                       const UWord a1,
+                                       struct bitmap2* const bm2)
+{
+   struct bitmap2* result = bm2;
+
+   tl_assert(bm->lazy_compute);
+
+   if (! result)
+      result = bm2_insert(bm, a1);
+   bm2_clear(result);
+   result->recalc = False;
+   result->epoch = bm->epoch;
+   s_bitmap2_lazy_compute_count++;
+   (*bm->lazy_compute)(bm, a1);
+   return result;
+}
+
 void DRD_(bm_print)(struct bitmap* const bm)
 {
    struct bitmap2* bm2;
@@ -1242,6 +1545,12 @@ static void bm2_print(const struct bitmap2* const bm2)
    }
 }
 
+/** Return the number of second-level bitmaps of bitmap *bm. */
+ULong DRD_(bm_get_bitmap2_count)(struct bitmap* const bm)
+{
+   return VG_(OSetGen_Size)(bm->oset);
+}
+
 ULong DRD_(bm_get_bitmap_creation_count)(void)
 {
    return s_bitmap_creation_count;
@@ -1257,10 +1566,34 @@ ULong DRD_(bm_get_bitmap2_merge_count)(void)
    return s_bitmap2_merge_count;
 }
 
+ULong DRD_(bm_get_bitmap2_lazy_compute_count)(void)
+{
+   return s_bitmap2_lazy_compute_count;
+}
+
+ULong DRD_(bm_get_cache2_hit_count)(void)
+{
+   return s_cache2_hit_count;
+}
+
+ULong DRD_(bm_get_cache2_miss_count)(void)
+{
+   return s_cache2_miss_count;
+}
+
+ULong DRD_(bm_get_cache2_resize_count)(void)
+{
+   return s_cache2_resize_count;
+}
+
 /** Compute *bm2l |= *bm2r. */
 static
 void bm2_merge(struct bitmap2* const bm2l, const struct bitmap2* const bm2r)
 {
+   UWord* const l_r = bm2l->bm1.bm0_r;
+   UWord* const l_w = bm2l->bm1.bm0_w;
+   const UWord* const r_r = bm2r->bm1.bm0_r;
+   const UWord* const r_w = bm2r->bm1.bm0_w;
    unsigned k;
 
    tl_assert(bm2l);
@@ -1269,12 +1602,21 @@ void bm2_merge(struct bitmap2* const bm2l, const struct bitmap2* const bm2r)
 
    s_bitmap2_merge_count++;
 
-   for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
-   {
-      bm2l->bm1.bm0_r[k] |= bm2r->bm1.bm0_r[k];
-   }
-   for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+   /*
+    * Merge four words of each array per iteration. The loads of all eight
+    * source words are independent, which keeps multiple loads in flight and
+    * allows the compiler to use vector instructions where available.
+    */
+   STATIC_ASSERT(BITMAP1_UWORD_COUNT % 4 == 0);
+   for (k = 0; k < BITMAP1_UWORD_COUNT; k += 4)
    {
-      bm2l->bm1.bm0_w[k] |= bm2r->bm1.bm0_w[k];
+      l_r[k]     |= r_r[k];
+      l_r[k + 1] |= r_r[k + 1];
+      l_r[k + 2] |= r_r[k + 2];
+      l_r[k + 3] |= r_r[k + 3];
+      l_w[k]     |= r_w[k];
+      l_w[k + 1] |= r_w[k + 1];
+      l_w[k + 2] |= r_w[k + 2];
+      l_w[k + 3] |= r_w[k + 3];
    }
 }
@@ -335,11 +335,17 @@ struct bitmap2
 {
    Addr           addr;   ///< address_msb(...)
    Bool           recalc;
+   UInt           epoch;  ///< Only used for lazy bitmaps.
    struct bitmap1 bm1;
 };
 
 
 static void bm2_clear(struct bitmap2* const bm2);
+struct bitmap2* DRD_(bm2_lazy_compute)(struct bitmap* const bm,
+                                       const UWord a1,
+                                       struct bitmap2* const bm2);
+Bool DRD_(bm_cache2_lookup)(struct bitmap* const bm, const UWord a1,
+                            struct bitmap2** bm2);
 static __inline__
 struct bitmap2* bm2_insert(struct bitmap* const bm, const UWord a1);
 
@@ -450,14 +456,17 @@ Bool bm_cache_lookup(struct bitmap* const bm, const UWord a1,
       return True;
    }
 #endif
-   *bm2 = 0;
-   return False;
+   return DRD_(bm_cache2_lookup)(bm, a1, bm2);
 }
 
+/**
+ * Insert (a1, bm2) at the front of bm->cache[] without updating
+ * bm->cache2[].
+ */
 static __inline__
-void bm_update_cache(struct bitmap* const bm,
-                     const UWord a1,
-                     struct bitmap2* const bm2)
+void bm_update_mru_cache(struct bitmap* const bm,
+                         const UWord a1,
+                         struct bitmap2* const bm2)
 {
 #ifdef ENABLE_DRD_CONSISTENCY_CHECKS
    tl_assert(bm);
@@ -491,10 +500,30 @@ void bm_update_cache(struct bitmap* const bm,
    bm->cache[0].bm2 = bm2;
 }
 
+/**
+ * Record that a1 maps to bm2 in all lookup caches of bm. Since every change
+ * of the mapping of a1 passes through this function, bm->cache2[] never
+ * holds a stale entry.
+ */
+static __inline__
+void bm_update_cache(struct bitmap* const bm,
+                     const UWord a1,
+                     struct bitmap2* const bm2)
+{
+   bm_update_mru_cache(bm, a1, bm2);
+   if (bm->cache2)
+   {
+      struct bm_cache_elem* const e = &bm->cache2[a1 & bm->cache2_mask];
+      e->a1  = a1;
+      e->bm2 = bm2;
+   }
+}
+
 /**
  * Look up the address a1 in bitmap bm and return a pointer to a potentially
  * shared second level bitmap. The bitmap where the returned pointer points
- * at may not be modified by the caller.
+ * at may not be modified by the caller. For a lazy bitmap, the second level
+ * bitmap is (re)computed first if it is missing or out of date.
  *
  * @param a1 client address shifted right by ADDR_LSB_BITS.
  * @param bm bitmap pointer.
@@ -513,6 +542,11 @@ const struct bitmap2* bm2_lookup(struct bitmap* const bm, const UWord a1)
       bm2 = VG_(OSetGen_Lookup)(bm->oset, &a1);
       bm_update_cache(bm, a1, bm2);
    }
+   if (UNLIKELY(bm->lazy_compute != NULL)
+       && (bm2 == NULL || bm2->epoch != bm->epoch))
+   {
+      bm2 = DRD_(bm2_lazy_compute)(bm, a1, bm2);
+   }
    return bm2;
 }
 
@@ -33,6 +33,15 @@
 #include "pub_tool_threadstate.h" /* VG_(get_running_tid)()    */
 
 
+/* Local constants. */
+
+/**
+ * Number of entries in the direct-mapped cache in front of the client
+ * object set. Must be a power of two.
+ */
+#define DRD_HB_CACHE_SIZE 1024
+
+
 /* Type definitions. */
 
 /** Per-thread hb information. */
@@ -53,6 +62,21 @@ static void DRD_(hb_cleanup)(struct hb_info* p);
 /* Local variables. */
 
 static Bool DRD_(s_trace_hb);
+/**
+ * Direct-mapped cache that maps the address of a happens-before / after
+ * annotation onto its client object. Lock-free code tends to annotate the
+ * same few addresses over and over again, and a lookup in the client object
+ * set is much more expensive than a lookup in this cache. Entries are
+ * invalidated from inside hb_cleanup().
+ */
+static struct
+{
+   Addr            a1;
+   struct hb_info* p;
+} s_hb_cache[DRD_HB_CACHE_SIZE];
+static ULong s_hb_cache_hit_count;
+static ULong s_hb_cache_miss_count;
+static ULong s_happens_after_skipped_count;
 
 
 /* Function definitions. */
@@ -62,6 +86,32 @@ void DRD_(hb_set_trace)(const Bool trace_hb)
    DRD_(s_trace_hb) = trace_hb;
 }
 
+static __inline__ UInt hb_cache_index(const Addr hb)
+{
+   return (hb >> 2) & (DRD_HB_CACHE_SIZE - 1);
+}
+
+static __inline__ struct hb_info* hb_cache_lookup(const Addr hb)
+{
+   const UInt i = hb_cache_index(hb);
+
+   if (s_hb_cache[i].a1 == hb && s_hb_cache[i].p)
+   {
+      s_hb_cache_hit_count++;
+      return s_hb_cache[i].p;
+   }
+   s_hb_cache_miss_count++;
+   return 0;
+}
+
+static __inline__ void hb_cache_insert(struct hb_info* const p)
+{
+   const UInt i = hb_cache_index(p->a1);
+
+   s_hb_cache[i].a1 = p->a1;
+   s_hb_cache[i].p  = p;
+}
+
 /**
  * Initialize the structure *p with the specified thread ID.
  */
@@ -102,8 +152,15 @@ void DRD_(hb_initialize)(struct hb_info* const p, const Addr hb)
 static void DRD_(hb_cleanup)(struct hb_info* p)
 {
    struct hb_thread_info* r;
+   UInt i;
 
    tl_assert(p);
+   i = hb_cache_index(p->a1);
+   if (s_hb_cache[i].p == p)
+   {
+      s_hb_cache[i].a1 = 0;
+      s_hb_cache[i].p  = 0;
+   }
    VG_(OSetGen_ResetIter)(p->oset);
    for ( ; (r = VG_(OSetGen_Next)(p->oset)) != 0; )
       DRD_(hb_thread_destroy)(r);
@@ -130,27 +187,49 @@ static void wrong_type(const Addr addr)
 struct hb_info* DRD_(hb_get_or_allocate)(const Addr hb)
 {
    struct hb_info *p;
+   DrdClientobj* q;
 
    tl_assert(offsetof(DrdClientobj, hb) == 0);
-   p = &(DRD_(clientobj_get)(hb, ClientHbvar)->hb);
+   p = hb_cache_lookup(hb);
    if (p)
       return p;
 
-   if (DRD_(clientobj_present)(hb, hb + 1))
+   /*
+    * A client object that is present in the range [ hb, hb + 1 [ must start
+    * at address hb, so a single lookup suffices to find out whether an
+    * object of another type is present at this address.
+    */
+   q = DRD_(clientobj_get_any)(hb);
+   if (q)
    {
-      wrong_type(hb);
-      return 0;
+      if (q->any.type != ClientHbvar)
+      {
+         wrong_type(hb);
+         return 0;
+      }
+      p = &q->hb;
    }
-
-   p = &(DRD_(clientobj_add)(hb, ClientHbvar)->hb);
-   DRD_(hb_initialize)(p, hb);
+   else
+   {
+      p = &(DRD_(clientobj_add)(hb, ClientHbvar)->hb);
+      DRD_(hb_initialize)(p, hb);
+   }
+   hb_cache_insert(p);
    return p;
 }
 
 struct hb_info* DRD_(hb_get)(const Addr hb)
 {
+   struct hb_info *p;
+
    tl_assert(offsetof(DrdClientobj, hb) == 0);
-   return &(DRD_(clientobj_get)(hb, ClientHbvar)->hb);
+   p = hb_cache_lookup(hb);
+   if (p)
+      return p;
+   p = &(DRD_(clientobj_get)(hb, ClientHbvar)->hb);
+   if (p)
+      hb_cache_insert(p);
+   return p;
 }
 
 /** Called because of a happens-before annotation. */
@@ -204,21 +283,43 @@ void DRD_(hb_happens_after)(const DrdThreadId tid, const Addr hb)
    if (!p)
       return;
 
+   /*
+    * If the vector clock of the current thread already includes all vector
+    * clocks stored because of happens-before annotations, e.g. because this
+    * thread already observed the most recent happens-before annotation of
+    * every other thread, then the happens-after annotation does not add any
+    * ordering information. Skip it instead of creating a new segment and
+    * updating the conflict set.
+    */
+   VG_(OSetGen_ResetIter)(p->oset);
+   for ( ; (q = VG_(OSetGen_Next)(p->oset)) != 0; )
+   {
+      if (q->tid != tid)
+      {
+         tl_assert(q->sg);
+         if (!DRD_(vc_lte)(&q->sg->vc, DRD_(thread_get_vc)(tid)))
+            break;
+      }
+   }
+   if (!q)
+   {
+      s_happens_after_skipped_count++;
+      return;
+   }
+
    DRD_(thread_new_segment)(tid);
 
    /*
     * Combine all vector clocks that were stored because of happens-before
-    * annotations with the vector clock of the current thread.
+    * annotations with the vector clock of the current thread. Clocks that
+    * are already included in that of the current thread are skipped.
     */
    DRD_(vc_copy)(&old_vc, DRD_(thread_get_vc)(tid));
    VG_(OSetGen_ResetIter)(p->oset);
    for ( ; (q = VG_(OSetGen_Next)(p->oset)) != 0; )
    {
-      if (q->tid != tid)
-      {
-         tl_assert(q->sg);
+      if (q->tid != tid && !DRD_(vc_lte)(&q->sg->vc, &old_vc))
          DRD_(vc_combine)(DRD_(thread_get_vc)(tid), &q->sg->vc);
-      }
    }
    DRD_(thread_update_conflict_set)(tid, &old_vc);
    DRD_(vc_cleanup)(&old_vc);
@@ -250,3 +351,18 @@ void DRD_(hb_happens_done)(const DrdThreadId tid, const Addr hb)
 
    DRD_(clientobj_remove)(p->a1, ClientHbvar);
 }
+
+ULong DRD_(hb_get_cache_hit_count)(void)
+{
+   return s_hb_cache_hit_count;
+}
+
+ULong DRD_(hb_get_cache_miss_count)(void)
+{
+   return s_hb_cache_miss_count;
+}
+
+ULong DRD_(hb_get_happens_after_skipped_count)(void)
+{
+   return s_happens_after_skipped_count;
+}
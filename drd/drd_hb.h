@@ -45,6 +45,9 @@ void DRD_(hb_destroy)(const Addr hb);
 void DRD_(hb_happens_after)(const DrdThreadId tid, const Addr hb);
 void DRD_(hb_happens_before)(const DrdThreadId tid, const Addr hb);
 void DRD_(hb_happens_done)(const DrdThreadId tid, const Addr hb);
+ULong DRD_(hb_get_cache_hit_count)(void);
+ULong DRD_(hb_get_cache_miss_count)(void);
+ULong DRD_(hb_get_happens_after_skipped_count)(void);
 
 
 #endif /* __DRD_HB_H */
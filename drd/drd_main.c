@@ -69,6 +69,7 @@ static Bool DRD_(process_cmd_line_option)(const HChar* arg)
 {
    int check_stack_accesses   = -1;
    int join_list_vol          = -1;
+   int lazy_conflict_set      = -1;
    int exclusive_threshold_ms = -1;
    int first_race_only        = -1;
    int report_signal_unlocked = -1;
@@ -97,6 +98,7 @@ static Bool DRD_(process_cmd_line_option)(const HChar* arg)
    else if VG_BOOL_CLO(arg, "--drd-stats",           s_print_stats) {}
    else if VG_BOOL_CLO(arg, "--first-race-only",     first_race_only) {}
    else if VG_BOOL_CLO(arg, "--free-is-write",       DRD_(g_free_is_write)) {}
+   else if VG_BOOL_CLO(arg, "--lazy-conflict-set",   lazy_conflict_set) {}
    else if VG_BOOL_CLO(arg,"--report-signal-unlocked",report_signal_unlocked)
    {}
    else if VG_BOOL_CLO(arg, "--segment-merging",     segment_merging) {}
@@ -187,6 +189,8 @@ static Bool DRD_(process_cmd_line_option)(const HChar* arg)
       DRD_(thread_trace_conflict_set)(trace_conflict_set);
    if (trace_conflict_set_bm != -1)
       DRD_(thread_trace_conflict_set_bm)(trace_conflict_set_bm);
+   if (lazy_conflict_set != -1)
+      DRD_(thread_set_lazy_conflict_set)(lazy_conflict_set);
    if (trace_mutex != -1)
       DRD_(mutex_set_trace)(trace_mutex);
    if (trace_rwlock != -1)
@@ -258,6 +262,8 @@ static void DRD_(print_debug_usage)(void)
 {
    VG_(printf)(
 "    --drd-stats=yes|no        Print statistics about DRD activity [no].\n"
+"    --lazy-conflict-set=yes|no Compute conflict set second-level bitmaps\n"
+"                              on first access [yes].\n"
 "    --trace-clientobj=yes|no  Trace all client object activity [no].\n"
 "    --trace-csw=yes|no        Trace all scheduler context switches [no].\n"
 "    --trace-conflict-set=yes|no Trace all conflict set updates [no].\n"
@@ -793,6 +799,15 @@ static void DRD_(fini)(Int exitcode)
                    "           %llu partial updates because of thread join"
                    " operations.\n",
                    pu_join);
+      VG_(message)(Vg_UserMsg,
+                   "           %llu level two bitmaps deferred, %llu computed"
+                   " on demand\n",
+                   DRD_(thread_get_conflict_set_bitmap2_deferred_count)(),
+                   DRD_(bm_get_bitmap2_lazy_compute_count)());
+      VG_(message)(Vg_UserMsg,
+                   "           (%llu merges) and %llu invalidated.\n",
+                   DRD_(thread_get_conflict_set_bitmap2_merge_count)(),
+                   DRD_(thread_get_conflict_set_bitmap2_invalidated_count)());
       VG_(message)(Vg_UserMsg,
                    " segments: created %llu segments, max %llu alive,\n",
                    DRD_(sg_get_segments_created_count)(),
@@ -801,6 +816,15 @@ static void DRD_(fini)(Int exitcode)
                    "           %llu discard points and %llu merges.\n",
                    DRD_(thread_get_discard_ordered_segments_count)(),
                    DRD_(sg_get_segment_merge_count)());
+      VG_(message)(Vg_UserMsg,
+                   "   vclock: %llu copies shared, %llu copied on write,\n",
+                   DRD_(vc_get_shared_copy_count)(),
+                   DRD_(vc_get_unshare_count)());
+      VG_(message)(Vg_UserMsg,
+                   "           %llu exited thread entries removed in %llu"
+                   " passes.\n",
+                   DRD_(thread_get_vc_gc_removed_count)(),
+                   DRD_(thread_get_vc_gc_count)());
       VG_(message)(Vg_UserMsg,
                    "segmnt cr: %llu mutex, %llu rwlock, %llu semaphore and"
                    " %llu barrier.\n",
@@ -813,9 +837,21 @@ static void DRD_(fini)(Int exitcode)
                    " and %llu level two bitmaps were allocated.\n",
                    DRD_(bm_get_bitmap_creation_count)(),
                    DRD_(bm_get_bitmap2_creation_count)());
+      VG_(message)(Vg_UserMsg,
+                   "           lookup cache: %llu hits, %llu misses and"
+                   " %llu resizes.\n",
+                   DRD_(bm_get_cache2_hit_count)(),
+                   DRD_(bm_get_cache2_miss_count)(),
+                   DRD_(bm_get_cache2_resize_count)());
       VG_(message)(Vg_UserMsg,
                    "    mutex: %llu non-recursive lock/unlock events.\n",
                    DRD_(get_mutex_lock_count)());
+      VG_(message)(Vg_UserMsg,
+                   "    hbvar: %llu lookup cache hits, %llu misses and"
+                   " %llu redundant happens-after annotations.\n",
+                   DRD_(hb_get_cache_hit_count)(),
+                   DRD_(hb_get_cache_miss_count)(),
+                   DRD_(hb_get_happens_after_skipped_count)());
       DRD_(print_malloc_stats)();
    }
 
@@ -91,6 +91,16 @@ static void sg_init(Segment* const sg,
       DRD_(vc_init)(&sg->vc, 0, 0);
    DRD_(vc_increment)(&sg->vc, created);
    DRD_(bm_init)(&sg->bm);
+   if (creator_sg && creator == created)
+   {
+      /*
+       * The new segment becomes the one this thread accesses most, so hand
+       * over the lookup cache size tuned for the previous segment.
+       */
+      DRD_(bm_set_cache2_size)(&sg->bm,
+                               DRD_(bm_get_cache2_size)(&creator_sg->bm));
+      DRD_(bm_set_cache2_size)(&creator_sg->bm, 0);
+   }
 
    if (s_trace_segment)
    {
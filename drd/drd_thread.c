@@ -43,13 +43,25 @@
 
 
 
+/* Defines. */
+
+/**
+ * Number of deleted threads after which their thread IDs are removed from
+ * all vector clocks.
+ */
+#define VC_GC_INTERVAL 8
+
+
 /* Local functions. */
 
 static void thread_append_segment(const DrdThreadId tid, Segment* const sg);
 static void thread_discard_segment(const DrdThreadId tid, Segment* const sg);
 static void thread_compute_conflict_set(struct bitmap** conflict_set,
                                         const DrdThreadId tid);
+static void thread_compute_conflict_set_bm2(struct bitmap* const bm,
+                                            const UWord a1);
 static Bool thread_conflict_set_up_to_date(const DrdThreadId tid);
+static void thread_vc_gc(void);
 
 
 /* Local variables. */
@@ -63,6 +75,12 @@ static ULong    s_update_conflict_set_sync_count;
 static ULong    s_update_conflict_set_join_count;
 static ULong    s_conflict_set_bitmap_creation_count;
 static ULong    s_conflict_set_bitmap2_creation_count;
+static ULong    s_conflict_set_bitmap2_deferred_count;
+static ULong    s_conflict_set_bitmap2_merge_count;
+static ULong    s_conflict_set_bitmap2_invalidated_count;
+static ULong    s_vc_gc_count;
+static ULong    s_vc_gc_removed_count;
+static unsigned s_vc_gc_pending_count;
 static ThreadId s_vg_running_tid  = VG_INVALID_THREADID;
 DrdThreadId     DRD_(g_drd_running_tid) = DRD_INVALID_THREADID;
 ThreadInfo*     DRD_(g_threadinfo);
@@ -71,6 +89,18 @@ Bool DRD_(verify_conflict_set);
 static Bool     s_trace_context_switches = False;
 static Bool     s_trace_conflict_set = False;
 static Bool     s_trace_conflict_set_bm = False;
+static Bool     s_lazy_conflict_set = True;
+/*
+ * Segments that are unordered to the latest segment of the running thread,
+ * i.e. the segments from which the second-level bitmaps of the conflict set
+ * are computed if s_lazy_conflict_set == True. s_conflict_sg_stale is set
+ * when a segment is discarded, after which s_conflict_sg[] must be
+ * collected again before it is used.
+ */
+static Segment** s_conflict_sg;
+static unsigned s_conflict_sg_count;
+static unsigned s_conflict_sg_size;
+static Bool     s_conflict_sg_stale;
 static Bool     s_trace_fork_join = False;
 static Bool     s_segment_merging = True;
 static Bool     s_new_segments_since_last_merge;
@@ -108,6 +138,14 @@ void DRD_(thread_trace_conflict_set_bm)(const Bool t)
    s_trace_conflict_set_bm = t;
 }
 
+/** Enables/disables computing the conflict set lazily. */
+void DRD_(thread_set_lazy_conflict_set)(const Bool l)
+{
+   tl_assert(l == False || l == True);
+   tl_assert(DRD_(g_conflict_set) == NULL);
+   s_lazy_conflict_set = l;
+}
+
 /** Report whether fork/join tracing is enabled. */
 Bool DRD_(thread_get_trace_fork_join)(void)
 {
@@ -193,6 +231,22 @@ static DrdThreadId DRD_(VgThreadIdToNewDrdThreadId)(const ThreadId tid)
       {
          tl_assert(! DRD_(IsValidDrdThreadId)(i));
 
+         /*
+          * Remove the previous user of this thread ID from all vector
+          * clocks such that the new thread starts with a fresh clock. If
+          * that is not yet possible, the new thread continues the clock of
+          * the previous one.
+          */
+         if (DRD_(g_threadinfo)[i].vc_gc_pending)
+         {
+            thread_vc_gc();
+            if (DRD_(g_threadinfo)[i].vc_gc_pending)
+            {
+               DRD_(g_threadinfo)[i].vc_gc_pending = False;
+               s_vc_gc_pending_count--;
+            }
+         }
+
          DRD_(g_threadinfo)[i].valid         = True;
          DRD_(g_threadinfo)[i].vg_thread_exists = True;
          DRD_(g_threadinfo)[i].vg_threadid   = tid;
@@ -526,7 +580,12 @@ void DRD_(thread_delete)(const DrdThreadId tid, const Bool detached)
       sg->thr_prev = NULL;
       DRD_(sg_put)(sg);
    }
+   s_conflict_sg_stale = True;
    DRD_(g_threadinfo)[tid].valid = False;
+   tl_assert(!DRD_(g_threadinfo)[tid].vc_gc_pending);
+   DRD_(g_threadinfo)[tid].vc_gc_pending = True;
+   if (++s_vc_gc_pending_count >= VC_GC_INTERVAL)
+      thread_vc_gc();
    DRD_(g_threadinfo)[tid].vg_thread_exists = False;
    DRD_(g_threadinfo)[tid].posix_thread_exists = False;
    if (detached)
@@ -539,6 +598,56 @@ void DRD_(thread_delete)(const DrdThreadId tid, const Bool detached)
    tl_assert(!DRD_(IsValidDrdThreadId)(tid));
 }
 
+/**
+ * Remove the thread IDs of deleted threads from all vector clocks once no
+ * segment of these threads exists anymore.
+ *
+ * Removing the entry of such a thread from all vector clocks at once does not
+ * change the outcome of any comparison between the remaining segments: the
+ * order of two segments is determined by the clock of the thread that
+ * created the first of these two segments.
+ */
+static void thread_vc_gc(void)
+{
+   Bool* has_segments;
+   DrdThreadId* tids;
+   unsigned n;
+   unsigned i;
+   Segment* sg;
+
+   if (s_vc_gc_pending_count == 0)
+      return;
+
+   s_vc_gc_count++;
+
+   has_segments = VG_(calloc)("drd.thread.tvg.1", DRD_N_THREADS,
+                              sizeof(has_segments[0]));
+   for (sg = DRD_(g_sg_list); sg; sg = sg->g_next)
+      has_segments[sg->tid] = True;
+
+   tids = VG_(malloc)("drd.thread.tvg.2", DRD_N_THREADS * sizeof(tids[0]));
+   n = 0;
+   for (i = 1; i < DRD_N_THREADS; i++)
+   {
+      if (DRD_(g_threadinfo)[i].vc_gc_pending && !has_segments[i])
+      {
+         tl_assert(!DRD_(g_threadinfo)[i].valid);
+         DRD_(g_threadinfo)[i].vc_gc_pending = False;
+         s_vc_gc_pending_count--;
+         tids[n++] = i;
+      }
+   }
+
+   if (n > 0)
+   {
+      for (sg = DRD_(g_sg_list); sg; sg = sg->g_next)
+         s_vc_gc_removed_count += DRD_(vc_remove_threads)(&sg->vc, tids, n);
+   }
+
+   VG_(free)(tids);
+   VG_(free)(has_segments);
+}
+
 /**
  * Called after a thread performed its last memory access and before
  * thread_delete() is called. Note: thread_delete() is only called for
@@ -585,6 +694,8 @@ void DRD_(drd_thread_atfork_child)(const DrdThreadId tid)
 
    DRD_(bm_cleanup)(DRD_(g_conflict_set));
    DRD_(bm_init)(DRD_(g_conflict_set));
+   if (s_lazy_conflict_set)
+      DRD_(bm_set_lazy)(DRD_(g_conflict_set), thread_compute_conflict_set_bm2);
 }
 
 /** Called just before pthread_cancel(). */
@@ -865,6 +976,7 @@ void thread_discard_segment(const DrdThreadId tid, Segment* const sg)
    if (sg == DRD_(g_threadinfo)[tid].sg_last)
       DRD_(g_threadinfo)[tid].sg_last = sg->thr_prev;
    DRD_(sg_put)(sg);
+   s_conflict_sg_stale = True;
 
 #ifdef ENABLE_DRD_CONSISTENCY_CHECKS
    tl_assert(DRD_(sane_ThreadInfo)(&DRD_(g_threadinfo)[tid]));
@@ -1431,6 +1543,8 @@ static Bool thread_conflict_set_up_to_date(const DrdThreadId tid)
       return True;
 
    thread_compute_conflict_set(&computed_conflict_set, tid);
+   if (s_lazy_conflict_set)
+      DRD_(bm_lazy_compute_all)(DRD_(g_conflict_set), computed_conflict_set);
    result = DRD_(bm_equal)(DRD_(g_conflict_set), computed_conflict_set);
    if (! result)
    {
@@ -1445,15 +1559,88 @@ static Bool thread_conflict_set_up_to_date(const DrdThreadId tid)
    return result;
 }
 
+/** Append segment sg to s_conflict_sg[]. */
+static void thread_append_conflict_segment(Segment* const sg)
+{
+   if (s_conflict_sg_count >= s_conflict_sg_size) {
+      s_conflict_sg_size = s_conflict_sg_size ? 2 * s_conflict_sg_size : 16;
+      s_conflict_sg = VG_(realloc)("drd.thread.tacs.1", s_conflict_sg,
+                                   s_conflict_sg_size * sizeof(s_conflict_sg[0]));
+   }
+   s_conflict_sg[s_conflict_sg_count++] = sg;
+}
+
+/**
+ * Store in s_conflict_sg[] all segments of threads other than tid that are
+ * unordered to the latest segment of thread tid.
+ */
+static void thread_collect_conflict_segments(const DrdThreadId tid)
+{
+   Segment* p;
+   unsigned j;
+
+   s_conflict_sg_count = 0;
+   s_conflict_sg_stale = False;
+
+   p = DRD_(g_threadinfo)[tid].sg_last;
+
+   if (s_trace_conflict_set) {
+      HChar* vc;
+
+      vc = DRD_(vc_aprint)(&p->vc);
+      VG_(message)(Vg_DebugMsg, "conflict set: thread [%u] at vc %s\n",
+                   tid, vc);
+      VG_(free)(vc);
+   }
+
+   for (j = 0; j < DRD_N_THREADS; j++) {
+      if (j != tid && DRD_(IsValidDrdThreadId)(j)) {
+         Segment* q;
+
+         for (q = DRD_(g_threadinfo)[j].sg_last; q; q = q->thr_prev) {
+            if (!DRD_(vc_lte)(&q->vc, &p->vc)
+                && !DRD_(vc_lte)(&p->vc, &q->vc)) {
+               if (s_trace_conflict_set) {
+                  HChar* str;
+
+                  str = DRD_(vc_aprint)(&q->vc);
+                  VG_(message)(Vg_DebugMsg,
+                               "conflict set: [%u] merging segment %s\n",
+                               j, str);
+                  VG_(free)(str);
+               }
+               thread_append_conflict_segment(q);
+            } else {
+               if (s_trace_conflict_set) {
+                  HChar* str;
+
+                  str = DRD_(vc_aprint)(&q->vc);
+                  VG_(message)(Vg_DebugMsg,
+                               "conflict set: [%u] ignoring segment %s\n",
+                               j, str);
+                  VG_(free)(str);
+               }
+            }
+         }
+      }
+   }
+}
+
 /**
  * Compute the conflict set: a bitmap that represents the union of all memory
  * accesses of all segments that are unordered to the current segment of the
  * thread tid.
+ *
+ * If the conflict set is computed lazily, only the list of unordered
+ * segments is computed here, and the second-level bitmaps of the conflict
+ * set are computed on first access by thread_compute_conflict_set_bm2().
  */
 static void thread_compute_conflict_set(struct bitmap** conflict_set,
                                         const DrdThreadId tid)
 {
-   Segment* p;
+   const Bool lazy = s_lazy_conflict_set
+                     && conflict_set == &DRD_(g_conflict_set);
+   unsigned i;
 
    tl_assert(0 <= (int)tid && tid < DRD_N_THREADS
              && tid != DRD_INVALID_THREADID);
@@ -1466,10 +1653,16 @@ static void thread_compute_conflict_set(struct bitmap** conflict_set,
       -= DRD_(bm_get_bitmap2_creation_count)();
 
    if (*conflict_set) {
-      DRD_(bm_cleanup)(*conflict_set);
-      DRD_(bm_init)(*conflict_set);
+      if (lazy) {
+         DRD_(bm_lazy_invalidate_all)(*conflict_set);
+      } else {
+         DRD_(bm_cleanup)(*conflict_set);
+         DRD_(bm_init)(*conflict_set);
+      }
    } else {
       *conflict_set = DRD_(bm_new)();
+      if (lazy)
+         DRD_(bm_set_lazy)(*conflict_set, thread_compute_conflict_set_bm2);
    }
 
    if (s_trace_conflict_set) {
@@ -1482,50 +1675,14 @@ static void thread_compute_conflict_set(struct bitmap** conflict_set,
       VG_(free)(str);
    }
 
-   p = DRD_(g_threadinfo)[tid].sg_last;
-   {
-      unsigned j;
-
-      if (s_trace_conflict_set) {
-         HChar* vc;
+   thread_collect_conflict_segments(tid);
 
-         vc = DRD_(vc_aprint)(&p->vc);
-         VG_(message)(Vg_DebugMsg, "conflict set: thread [%u] at vc %s\n",
-                      tid, vc);
-         VG_(free)(vc);
-      }
-
-      for (j = 0; j < DRD_N_THREADS; j++) {
-         if (j != tid && DRD_(IsValidDrdThreadId)(j)) {
-            Segment* q;
-
-            for (q = DRD_(g_threadinfo)[j].sg_last; q; q = q->thr_prev) {
-               if (!DRD_(vc_lte)(&q->vc, &p->vc)
-                   && !DRD_(vc_lte)(&p->vc, &q->vc)) {
-                  if (s_trace_conflict_set) {
-                     HChar* str;
-
-                     str = DRD_(vc_aprint)(&q->vc);
-                     VG_(message)(Vg_DebugMsg,
-                                  "conflict set: [%u] merging segment %s\n",
-                                  j, str);
-                     VG_(free)(str);
-                  }
-                  DRD_(bm_merge2)(*conflict_set, DRD_(sg_bm)(q));
-               } else {
-                  if (s_trace_conflict_set) {
-                     HChar* str;
-
-                     str = DRD_(vc_aprint)(&q->vc);
-                     VG_(message)(Vg_DebugMsg,
-                                  "conflict set: [%u] ignoring segment %s\n",
-                                  j, str);
-                     VG_(free)(str);
-                  }
-               }
-            }
-         }
-      }
+   for (i = 0; i < s_conflict_sg_count; i++) {
+      struct bitmap* const bm = DRD_(sg_bm)(s_conflict_sg[i]);
+      if (lazy)
+         s_conflict_set_bitmap2_deferred_count += DRD_(bm_get_bitmap2_count)(bm);
+      else
+         DRD_(bm_merge2)(*conflict_set, bm);
    }
 
    s_conflict_set_bitmap_creation_count
@@ -1540,10 +1697,49 @@ static void thread_compute_conflict_set(struct bitmap** conflict_set,
    }
 }
 
+/**
+ * Compute the second-level bitmap for address a1 of the conflict set by
+ * merging the corresponding second-level bitmaps of all segments that are
+ * unordered to the latest segment of the running thread.
+ */
+static void thread_compute_conflict_set_bm2(struct bitmap* const bm,
+                                            const UWord a1)
+{
+   unsigned i;
+
+   tl_assert(bm == DRD_(g_conflict_set));
+
+   if (s_conflict_sg_stale)
+      thread_collect_conflict_segments(DRD_(g_drd_running_tid));
+
+   for (i = 0; i < s_conflict_sg_count; i++)
+      DRD_(bm_lazy_merge2)(bm, DRD_(sg_bm)(s_conflict_sg[i]), a1);
+   s_conflict_set_bitmap2_merge_count += s_conflict_sg_count;
+}
+
+/**
+ * Mark the second-level bitmaps of the conflict set for which segment
+ * bitmap bm has a second-level bitmap as to be recomputed.
+ */
+static void thread_mark_conflict_set(struct bitmap* const bm)
+{
+   if (s_lazy_conflict_set) {
+      s_conflict_set_bitmap2_invalidated_count
+         += DRD_(bm_get_bitmap2_count)(bm);
+      DRD_(bm_lazy_invalidate)(DRD_(g_conflict_set), bm);
+   } else {
+      DRD_(bm_mark)(DRD_(g_conflict_set), bm);
+   }
+}
+
 /**
  * Update the conflict set after the vector clock of thread tid has been
  * updated from old_vc to its current value, either because a new segment has
  * been created or because of a synchronization operation.
+ *
+ * If the conflict set is computed lazily, the second-level bitmaps that are
+ * affected by the update are marked as out of date and all others are
+ * reused as-is.
  */
 void DRD_(thread_update_conflict_set)(const DrdThreadId tid,
                                       const VectorClock* const old_vc)
@@ -1571,7 +1767,8 @@ void DRD_(thread_update_conflict_set)(const DrdThreadId tid,
    new_vc = DRD_(thread_get_vc)(tid);
    tl_assert(DRD_(vc_lte)(old_vc, new_vc));
 
-   DRD_(bm_unmark)(DRD_(g_conflict_set));
+   if (!s_lazy_conflict_set)
+      DRD_(bm_unmark)(DRD_(g_conflict_set));
 
    for (j = 0; j < DRD_N_THREADS; j++)
    {
@@ -1600,7 +1797,7 @@ void DRD_(thread_update_conflict_set)(const DrdThreadId tid,
             VG_(free)(str);
          }
          if (included_in_old_conflict_set != included_in_new_conflict_set)
-            DRD_(bm_mark)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
+            thread_mark_conflict_set(DRD_(sg_bm)(q));
       }
 
       for ( ; q && !DRD_(vc_lte)(&q->vc, old_vc); q = q->thr_prev) {
@@ -1622,26 +1819,31 @@ void DRD_(thread_update_conflict_set)(const DrdThreadId tid,
             VG_(free)(str);
          }
          if (included_in_old_conflict_set != included_in_new_conflict_set)
-            DRD_(bm_mark)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
+            thread_mark_conflict_set(DRD_(sg_bm)(q));
       }
    }
 
-   DRD_(bm_clear_marked)(DRD_(g_conflict_set));
+   if (s_lazy_conflict_set) {
+      thread_collect_conflict_segments(tid);
+   } else {
+      DRD_(bm_clear_marked)(DRD_(g_conflict_set));
 
-   p = DRD_(g_threadinfo)[tid].sg_last;
-   for (j = 0; j < DRD_N_THREADS; j++) {
-      if (j != tid && DRD_(IsValidDrdThreadId)(j)) {
-         Segment* q;
-         for (q = DRD_(g_threadinfo)[j].sg_last;
-              q && !DRD_(vc_lte)(&q->vc, &p->vc);
-              q = q->thr_prev) {
-            if (!DRD_(vc_lte)(&p->vc, &q->vc))
-               DRD_(bm_merge2_marked)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
+      p = DRD_(g_threadinfo)[tid].sg_last;
+      for (j = 0; j < DRD_N_THREADS; j++) {
+         if (j != tid && DRD_(IsValidDrdThreadId)(j)) {
+            Segment* q;
+            for (q = DRD_(g_threadinfo)[j].sg_last;
+                 q && !DRD_(vc_lte)(&q->vc, &p->vc);
+                 q = q->thr_prev) {
+               if (!DRD_(vc_lte)(&p->vc, &q->vc))
+                  DRD_(bm_merge2_marked)(DRD_(g_conflict_set),
+                                         DRD_(sg_bm)(q));
+            }
          }
       }
-   }
 
-   DRD_(bm_remove_cleared_marked)(DRD_(g_conflict_set));
+      DRD_(bm_remove_cleared_marked)(DRD_(g_conflict_set));
+   }
 
    s_update_conflict_set_count++;
 
@@ -1724,3 +1926,47 @@ ULong DRD_(thread_get_conflict_set_bitmap2_creation_count)(void)
 {
    return s_conflict_set_bitmap2_creation_count;
 }
+
+/**
+ * Return the number of segment second-level bitmaps that would have been
+ * merged into the conflict set by full conflict set computations, had the
+ * conflict set not been computed lazily.
+ */
+ULong DRD_(thread_get_conflict_set_bitmap2_deferred_count)(void)
+{
+   return s_conflict_set_bitmap2_deferred_count;
+}
+
+/**
+ * Return the number of segment second-level bitmap lookups performed while
+ * computing conflict set second-level bitmaps on first access.
+ */
+ULong DRD_(thread_get_conflict_set_bitmap2_merge_count)(void)
+{
+   return s_conflict_set_bitmap2_merge_count;
+}
+
+/**
+ * Return the number of segment second-level bitmaps for which the
+ * corresponding conflict set second-level bitmap has been marked out of date
+ * by partial conflict set updates.
+ */
+ULong DRD_(thread_get_conflict_set_bitmap2_invalidated_count)(void)
+{
+   return s_conflict_set_bitmap2_invalidated_count;
+}
+
+/** Return the number of vector clock garbage collection passes. */
+ULong DRD_(thread_get_vc_gc_count)(void)
+{
+   return s_vc_gc_count;
+}
+
+/**
+ * Return the number of vector clock elements of deleted threads that have
+ * been removed.
+ */
+ULong DRD_(thread_get_vc_gc_removed_count)(void)
+{
+   return s_vc_gc_removed_count;
+}
@@ -98,6 +98,11 @@ typedef struct
    Int       synchr_nesting;
    /** Delayed thread deletion sequence number. */
    unsigned  deletion_seq;
+   /**
+    * Whether this thread has been deleted but its thread ID has not yet been
+    * removed from all vector clocks.
+    */
+   Bool      vc_gc_pending;
    /**
     * ID of the creator thread. It can be safely accessed only until the
     * thread is fully created. Then the creator thread lives its own life again.
@@ -135,6 +140,7 @@ extern Bool           DRD_(ignore_thread_creation);
 void DRD_(thread_trace_context_switches)(const Bool t);
 void DRD_(thread_trace_conflict_set)(const Bool t);
 void DRD_(thread_trace_conflict_set_bm)(const Bool t);
+void DRD_(thread_set_lazy_conflict_set)(const Bool l);
 Bool DRD_(thread_get_trace_fork_join)(void);
 void DRD_(thread_set_trace_fork_join)(const Bool t);
 void DRD_(thread_set_segment_merging)(const Bool m);
@@ -214,6 +220,11 @@ ULong DRD_(thread_get_update_conflict_set_sync_count)(void);
 ULong DRD_(thread_get_update_conflict_set_join_count)(void);
 ULong DRD_(thread_get_conflict_set_bitmap_creation_count)(void);
 ULong DRD_(thread_get_conflict_set_bitmap2_creation_count)(void);
+ULong DRD_(thread_get_conflict_set_bitmap2_deferred_count)(void);
+ULong DRD_(thread_get_conflict_set_bitmap2_merge_count)(void);
+ULong DRD_(thread_get_conflict_set_bitmap2_invalidated_count)(void);
+ULong DRD_(thread_get_vc_gc_count)(void);
+ULong DRD_(thread_get_vc_gc_removed_count)(void);
 
 
 /* Inline function definitions. */
@@ -34,6 +34,49 @@
 
 static
 void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity);
+static void DRD_(vc_unshare)(VectorClock* const vc);
+
+
+/* Local variables. */
+
+static ULong s_vc_shared_copy_count;
+static ULong s_vc_unshare_count;
+
+
+/*
+ * Vector clock element arrays that do not fit in VectorClock::preallocated
+ * are allocated on the heap and are shared between copies of a vector
+ * clock (copy-on-write). The element just before the first element of such
+ * an array holds the number of vector clocks that share it in its count
+ * field.
+ */
+
+/** Reference count of the heap-allocated element array vc->vc. */
+static __inline__ UInt* DRD_(vc_refcnt)(const VectorClock* const vc)
+{
+   return &vc->vc[-1].count;
+}
+
+/** Allocate an element array for capacity elements with refcount one. */
+static VCElem* DRD_(vc_alloc)(const HChar* const cc, const unsigned capacity)
+{
+   VCElem* block;
+
+   block = VG_(malloc)(cc, (capacity + 1) * sizeof(block[0]));
+   block[0].threadid = 0;
+   block[0].count = 1;
+   return block + 1;
+}
+
+/** Drop a reference to the heap-allocated element array of *vc. */
+static void DRD_(vc_release)(VectorClock* const vc)
+{
+   UInt* const refcnt = DRD_(vc_refcnt)(vc);
+
+   tl_assert(*refcnt >= 1);
+   if (--*refcnt == 0)
+      VG_(free)(vc->vc - 1);
+}
 
 
 /* Function definitions. */
@@ -69,10 +112,24 @@ void DRD_(vc_cleanup)(VectorClock* const vc)
    DRD_(vc_reserve)(vc, 0);
 }
 
-/** Copy constructor -- initializes *new. */
+/**
+ * Copy constructor -- initializes *new. A heap-allocated element array is
+ * shared with *rhs instead of being copied.
+ */
 void DRD_(vc_copy)(VectorClock* const new, const VectorClock* const rhs)
 {
-   DRD_(vc_init)(new, rhs->vc, rhs->size);
+   if (rhs->capacity > VC_PREALLOCATED)
+   {
+      s_vc_shared_copy_count++;
+      (*DRD_(vc_refcnt)(rhs))++;
+      new->vc = rhs->vc;
+      new->capacity = rhs->capacity;
+      new->size = rhs->size;
+   }
+   else
+   {
+      DRD_(vc_init)(new, rhs->vc, rhs->size);
+   }
 }
 
 /** Assignment operator -- *lhs is already a valid vector clock. */
@@ -90,7 +147,10 @@ void DRD_(vc_increment)(VectorClock* const vc, DrdThreadId const tid)
    {
       if (vc->vc[i].threadid == tid)
       {
-         typeof(vc->vc[i].count) const oldcount = vc->vc[i].count;
+         typeof(vc->vc[i].count) oldcount;
+
+         DRD_(vc_unshare)(vc);
+         oldcount = vc->vc[i].count;
          vc->vc[i].count++;
          // Check for integer overflow.
          tl_assert(oldcount < vc->vc[i].count);
@@ -131,6 +191,7 @@ void DRD_(vc_min)(VectorClock* const result, const VectorClock* const rhs)
    tl_assert(rhs);
 
    DRD_(vc_check)(result);
+   DRD_(vc_unshare)(result);
 
    /* Next, combine both vector clocks into one. */
    i = 0;
@@ -173,6 +234,19 @@ void DRD_(vc_combine)(VectorClock* const result, const VectorClock* const rhs)
    tl_assert(result);
    tl_assert(rhs);
 
+   /*
+    * Avoid copying if the result is one of the two operands, which is the
+    * case e.g. when acquiring a lock that has last been released by the
+    * same thread.
+    */
+   if (DRD_(vc_lte)(rhs, result))
+      return;
+   if (DRD_(vc_lte)(result, rhs))
+   {
+      DRD_(vc_assign)(result, rhs);
+      return;
+   }
+
    // First count the number of shared thread id's.
    j = 0;
    shared = 0;
@@ -189,6 +263,7 @@ void DRD_(vc_combine)(VectorClock* const result, const VectorClock* const rhs)
    DRD_(vc_check)(result);
 
    new_size = result->size + rhs->size - shared;
+   DRD_(vc_unshare)(result);
    if (new_size > result->capacity)
       DRD_(vc_reserve)(result, new_size);
 
@@ -236,6 +311,64 @@ void DRD_(vc_combine)(VectorClock* const result, const VectorClock* const rhs)
    tl_assert(result->size == new_size);
 }
 
+/**
+ * Remove the elements of the n threads in the array tids[], which must be
+ * sorted in increasing order, from vector clock vc.
+ *
+ * @return Number of elements removed.
+ */
+unsigned DRD_(vc_remove_threads)(VectorClock* const vc,
+                                 const DrdThreadId* const tids,
+                                 const unsigned n)
+{
+   unsigned i;
+   unsigned j;
+   unsigned k;
+
+   tl_assert(vc);
+   tl_assert(n == 0 || tids);
+
+   /* Find the first element to be removed. */
+   j = 0;
+   for (i = 0; i < vc->size; i++)
+   {
+      while (j < n && tids[j] < vc->vc[i].threadid)
+         j++;
+      if (j >= n)
+         return 0;
+      if (tids[j] == vc->vc[i].threadid)
+         break;
+   }
+   if (i >= vc->size)
+      return 0;
+
+   DRD_(vc_unshare)(vc);
+   for (k = i; i < vc->size; i++)
+   {
+      while (j < n && tids[j] < vc->vc[i].threadid)
+         j++;
+      if (j < n && tids[j] == vc->vc[i].threadid)
+         continue;
+      vc->vc[k++] = vc->vc[i];
+   }
+   i = vc->size - k;
+   vc->size = k;
+   DRD_(vc_check)(vc);
+   return i;
+}
+
+/** Number of times a vector clock element array was shared by vc_copy(). */
+ULong DRD_(vc_get_shared_copy_count)(void)
+{
+   return s_vc_shared_copy_count;
+}
+
+/** Number of times a shared element array was copied before modifying it. */
+ULong DRD_(vc_get_unshare_count)(void)
+{
+   return s_vc_unshare_count;
+}
+
 /** Print the contents of vector clock 'vc'. */
 void DRD_(vc_print)(const VectorClock* const vc)
 {
@@ -293,6 +426,8 @@ HChar* DRD_(vc_aprint)(const VectorClock* const vc)
  * - size <= capacity.
  * - Vector clock elements are stored in thread ID order.
  *
+ * - A heap-allocated element array is referenced at least once.
+ *
  * If one of these conditions is not met, an assertion failure is triggered.
  */
 void DRD_(vc_check)(const VectorClock* const vc)
@@ -300,6 +435,7 @@ void DRD_(vc_check)(const VectorClock* const vc)
    unsigned i;
 
    tl_assert(vc->size <= vc->capacity);
+   tl_assert(vc->capacity <= VC_PREALLOCATED || *DRD_(vc_refcnt)(vc) >= 1);
 
    for (i = 1; i < vc->size; i++)
       tl_assert(vc->vc[i-1].threadid < vc->vc[i].threadid);
@@ -320,21 +456,31 @@ void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity)
 
    if (new_capacity > vc->capacity)
    {
-      if (vc->vc && vc->capacity > VC_PREALLOCATED)
+      if (vc->vc && vc->capacity > VC_PREALLOCATED
+          && *DRD_(vc_refcnt)(vc) == 1)
       {
          tl_assert(vc->vc
                    && vc->vc != vc->preallocated
                    && vc->capacity > VC_PREALLOCATED);
-         vc->vc = VG_(realloc)("drd.vc.vr.1",
-                               vc->vc, new_capacity * sizeof(vc->vc[0]));
+         vc->vc = (VCElem*)VG_(realloc)("drd.vc.vr.1", vc->vc - 1,
+                                        (new_capacity + 1)
+                                        * sizeof(vc->vc[0])) + 1;
+      }
+      else if (vc->vc && vc->capacity > VC_PREALLOCATED)
+      {
+         VCElem* const new_vc = DRD_(vc_alloc)("drd.vc.vr.4", new_capacity);
+
+         VG_(memcpy)(new_vc, vc->vc, vc->size * sizeof(vc->vc[0]));
+         DRD_(vc_release)(vc);
+         vc->vc = new_vc;
+         s_vc_unshare_count++;
       }
       else if (vc->vc && new_capacity > VC_PREALLOCATED)
       {
          tl_assert((vc->vc == 0 || vc->vc == vc->preallocated)
                    && new_capacity > VC_PREALLOCATED
                    && vc->capacity <= VC_PREALLOCATED);
-         vc->vc = VG_(malloc)("drd.vc.vr.2",
-                              new_capacity * sizeof(vc->vc[0]));
+         vc->vc = DRD_(vc_alloc)("drd.vc.vr.2", new_capacity);
          VG_(memcpy)(vc->vc, vc->preallocated,
                      vc->capacity * sizeof(vc->vc[0]));
       }
@@ -349,8 +495,7 @@ void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity)
          tl_assert(vc->vc == 0
                    && new_capacity > VC_PREALLOCATED
                    && vc->capacity == 0);
-         vc->vc = VG_(malloc)("drd.vc.vr.3",
-                              new_capacity * sizeof(vc->vc[0]));
+         vc->vc = DRD_(vc_alloc)("drd.vc.vr.3", new_capacity);
       }
       else
       {
@@ -364,7 +509,7 @@ void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity)
    else if (new_capacity == 0 && vc->vc)
    {
       if (vc->capacity > VC_PREALLOCATED)
-         VG_(free)(vc->vc);
+         DRD_(vc_release)(vc);
       vc->vc = 0;
       vc->capacity = 0;
    }
@@ -374,3 +519,20 @@ void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity)
              || vc->vc == 0
              || vc->vc == vc->preallocated);
 }
+
+/**
+ * Make sure that the element array of vc is not shared with any other
+ * vector clock, such that it may be modified.
+ */
+static void DRD_(vc_unshare)(VectorClock* const vc)
+{
+   if (vc->capacity > VC_PREALLOCATED && *DRD_(vc_refcnt)(vc) > 1)
+   {
+      VCElem* const new_vc = DRD_(vc_alloc)("drd.vc.vu.1", vc->capacity);
+
+      VG_(memcpy)(new_vc, vc->vc, vc->size * sizeof(vc->vc[0]));
+      DRD_(vc_release)(vc);
+      vc->vc = new_vc;
+      s_vc_unshare_count++;
+   }
+}
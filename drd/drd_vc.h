@@ -31,6 +31,8 @@
  * - One counter per thread.
  * - A vector clock is implemented as multiple pairs of (thread id, counter).
  * - Pairs are stored in an array sorted by thread id.
+ * - Arrays that do not fit in the preallocated space are shared between
+ *   copies of a vector clock and are only copied when modified.
  *
  * Semantics:
  * - Each time a thread performs an action that implies an ordering between
@@ -86,6 +88,11 @@ void DRD_(vc_min)(VectorClock* const result,
                   const VectorClock* const rhs);
 void DRD_(vc_combine)(VectorClock* const result,
                       const VectorClock* const rhs);
+unsigned DRD_(vc_remove_threads)(VectorClock* const vc,
+                                 const DrdThreadId* const tids,
+                                 const unsigned n);
+ULong DRD_(vc_get_shared_copy_count)(void);
+ULong DRD_(vc_get_unshare_count)(void);
 void DRD_(vc_print)(const VectorClock* const vc);
 HChar* DRD_(vc_aprint)(const VectorClock* const vc);
 void DRD_(vc_check)(const VectorClock* const vc);
@@ -65,11 +65,45 @@ struct bm_cache_elem
 
 #define DRD_BITMAP_N_CACHE_ELEM 4
 
+/*
+ * Minimum and maximum number of elements of the direct-mapped lookup cache
+ * that backs the DRD_BITMAP_N_CACHE_ELEM most recently used elements. Must
+ * be powers of two.
+ */
+#define DRD_BITMAP_MIN_CACHE2_ELEM 64
+#define DRD_BITMAP_MAX_CACHE2_ELEM 1024
+
+/*
+ * Callback that computes the second-level bitmap for address a1 (a client
+ * address shifted right by ADDR_LSB_BITS) of a lazy bitmap, by calling
+ * DRD_(bm_lazy_merge2)() for each bitmap that contributes to it.
+ */
+typedef void (*BmLazyComputeT)(struct bitmap* const bm, const UWord a1);
+
 /* Complete bitmap. */
 struct bitmap
 {
    struct bm_cache_elem cache[DRD_BITMAP_N_CACHE_ELEM];
+   /*
+    * Direct-mapped lookup cache, indexed by (a1 & cache2_mask). Allocated
+    * and resized on demand based on the hit rate of this bitmap, such that
+    * only bitmaps with a footprint wider than cache[] pay for it. NULL if
+    * not in use.
+    */
+   struct bm_cache_elem* cache2;
+   UWord                cache2_mask;
+   /* Lookups that missed cache[] and lookups that also missed cache2[]. */
+   UInt                 cache2_lookups;
+   UInt                 cache2_misses;
    OSet*                oset;
+   /*
+    * For a lazy bitmap, the function that computes a second-level bitmap
+    * the first time it is looked up after having been invalidated. NULL for
+    * regular bitmaps.
+    */
+   BmLazyComputeT       lazy_compute;
+   /* Second-level bitmaps with bitmap2::epoch != epoch are out of date. */
+   UInt                 epoch;
 };
 
 
@@ -146,8 +180,23 @@ void DRD_(bm_report_races)(ThreadId const tid1, ThreadId const tid2,
                            struct bitmap* const bm1,
                            struct bitmap* const bm2);
 void DRD_(bm_print)(struct bitmap* bm);
+void DRD_(bm_set_lazy)(struct bitmap* const bm, BmLazyComputeT compute);
+void DRD_(bm_lazy_invalidate_all)(struct bitmap* const bm);
+void DRD_(bm_lazy_invalidate)(struct bitmap* const lhs,
+                              struct bitmap* const rhs);
+void DRD_(bm_lazy_merge2)(struct bitmap* const lhs, struct bitmap* const rhs,
+                          const UWord a1);
+void DRD_(bm_lazy_compute_all)(struct bitmap* const lhs,
+                               struct bitmap* const rhs);
+ULong DRD_(bm_get_bitmap2_count)(struct bitmap* const bm);
 ULong DRD_(bm_get_bitmap_creation_count)(void);
 ULong DRD_(bm_get_bitmap2_creation_count)(void);
 ULong DRD_(bm_get_bitmap2_merge_count)(void);
+ULong DRD_(bm_get_bitmap2_lazy_compute_count)(void);
+ULong DRD_(bm_get_cache2_hit_count)(void);
+ULong DRD_(bm_get_cache2_miss_count)(void);
+ULong DRD_(bm_get_cache2_resize_count)(void);
+UWord DRD_(bm_get_cache2_size)(const struct bitmap* const bm);
+void DRD_(bm_set_cache2_size)(struct bitmap* const bm, const UWord size);
 
 #endif /* __PUB_DRD_BITMAP_H */
@@ -317,6 +317,110 @@ void bm_test3(const int outer_loop_step, const int inner_loop_step)
   DRD_(bm_delete)(bm1);
 }
 
+static struct bitmap* s_test4_src[2];
+
+/** Lazy bitmap callback: merge the second-level bitmaps of s_test4_src[]. */
+static void bm_test4_compute(struct bitmap* const bm, const UWord a1)
+{
+  unsigned i;
+
+  for (i = 0; i < sizeof(s_test4_src)/sizeof(s_test4_src[0]); i++)
+    DRD_(bm_lazy_merge2)(bm, s_test4_src[i], a1);
+}
+
+/** Verify that a lazily computed bitmap matches an eagerly merged bitmap. */
+static void bm_test4_verify(struct bitmap* const lazy)
+{
+  struct bitmap* eager;
+  unsigned i;
+
+  eager = DRD_(bm_new)();
+  for (i = 0; i < sizeof(s_test4_src)/sizeof(s_test4_src[0]); i++)
+    DRD_(bm_merge2)(eager, s_test4_src[i]);
+  DRD_(bm_lazy_compute_all)(lazy, eager);
+  assert(bm_equal_print_diffs(lazy, eager));
+  DRD_(bm_delete)(eager);
+}
+
+/** Test whether lazy bitmaps are computed and invalidated correctly. */
+void bm_test4(void)
+{
+  struct bitmap* lazy;
+
+  s_test4_src[0] = DRD_(bm_new)();
+  s_test4_src[1] = DRD_(bm_new)();
+  DRD_(bm_access_load_1)(s_test4_src[0], 7);
+  DRD_(bm_access_store_1)(s_test4_src[1], make_address(1, 0) + 7);
+  DRD_(bm_access_range_load)(s_test4_src[1], make_address(2, 0) + 3,
+                             make_address(3, 0) + 5);
+
+  lazy = DRD_(bm_new)();
+  DRD_(bm_set_lazy)(lazy, bm_test4_compute);
+  assert(DRD_(bm_has_1)(lazy, 7, eLoad));
+  assert(! DRD_(bm_has_1)(lazy, 7, eStore));
+  assert(DRD_(bm_has_1)(lazy, make_address(1, 0) + 7, eStore));
+  assert(DRD_(bm_has_1)(lazy, make_address(3, 0) + 4, eLoad));
+  bm_test4_verify(lazy);
+
+  /* Partial invalidation: only the regions touched by s_test4_src[0]. */
+  DRD_(bm_access_store_1)(s_test4_src[0], 7);
+  DRD_(bm_access_store_1)(s_test4_src[0], make_address(4, 0));
+  DRD_(bm_lazy_invalidate)(lazy, s_test4_src[0]);
+  assert(DRD_(bm_has_1)(lazy, 7, eStore));
+  bm_test4_verify(lazy);
+
+  /* Full invalidation after the set of source bitmaps changed. */
+  DRD_(bm_delete)(s_test4_src[1]);
+  s_test4_src[1] = DRD_(bm_new)();
+  DRD_(bm_lazy_invalidate_all)(lazy);
+  assert(! DRD_(bm_has_1)(lazy, make_address(1, 0) + 7, eStore));
+  bm_test4_verify(lazy);
+
+  DRD_(bm_delete)(lazy);
+  DRD_(bm_delete)(s_test4_src[1]);
+  DRD_(bm_delete)(s_test4_src[0]);
+}
+
+/**
+ * Test the adaptive lookup cache with a footprint that is wider than
+ * bitmap::cache[], including removal of second-level bitmaps.
+ */
+void bm_test5(void)
+{
+  struct bitmap* bm;
+  struct bitmap* marks;
+  unsigned i, j;
+
+  bm = DRD_(bm_new)();
+  for (j = 0; j < 16; j++)
+    for (i = 0; i < 256; i++)
+      DRD_(bm_access_store_1)(bm, make_address(i, 0) + j);
+  assert(DRD_(bm_get_cache2_size)(bm) > 0);
+  for (i = 0; i < 256; i++)
+    for (j = 0; j < 16; j++)
+      assert(DRD_(bm_has_1)(bm, make_address(i, 0) + j, eStore));
+  assert(! DRD_(bm_has_1)(bm, make_address(256, 0), eStore));
+
+  /* Remove the even second-level bitmaps. */
+  marks = DRD_(bm_new)();
+  for (i = 0; i < 256; i += 2)
+    DRD_(bm_access_load_1)(marks, make_address(i, 0));
+  DRD_(bm_unmark)(bm);
+  DRD_(bm_mark)(bm, marks);
+  DRD_(bm_clear_marked)(bm);
+  DRD_(bm_remove_cleared_marked)(bm);
+  assert(DRD_(bm_get_bitmap2_count)(bm) == 128);
+  for (i = 0; i < 256; i++)
+    assert(! DRD_(bm_has_1)(bm, make_address(i, 0), eStore) == ! (i & 1));
+
+  DRD_(bm_set_cache2_size)(bm, 0);
+  for (i = 0; i < 256; i++)
+    assert(! DRD_(bm_has_1)(bm, make_address(i, 0) + 3, eStore) == ! (i & 1));
+
+  DRD_(bm_delete)(marks);
+  DRD_(bm_delete)(bm);
+}
+
 int main(int argc, char** argv)
 {
   int outer_loop_step = ADDR_GRANULARITY;
@@ -350,6 +454,8 @@ int main(int argc, char** argv)
   bm_test1();
   bm_test2();
   bm_test3(outer_loop_step, inner_loop_step);
+  bm_test4();
+  bm_test5();
   DRD_(bm_module_cleanup)();
 
   fprintf(stderr, "End of DRD BM unit test.\n");
@@ -103,8 +103,53 @@ static void vc_unittest(void)
   DRD_(vc_cleanup)(&vc3);
 }
 
+/* Test copy-on-write sharing and removal of thread entries. */
+static void vc_cow_unittest(void)
+{
+  unsigned i;
+  VectorClock vc1;
+  VectorClock vc2;
+  VectorClock vc3;
+  const DrdThreadId removed[] = { 2, 3, 17, 40 };
+
+  DRD_(vc_init)(&vc1, 0, 0);
+  for (i = 1; i <= 4 * VC_PREALLOCATED; i++)
+    DRD_(vc_increment)(&vc1, i);
+  assert(vc1.size == 4 * VC_PREALLOCATED);
+
+  DRD_(vc_copy)(&vc2, &vc1);
+  assert(vc2.vc == vc1.vc);
+  DRD_(vc_copy)(&vc3, &vc1);
+  DRD_(vc_increment)(&vc2, 1);
+  assert(vc2.vc != vc1.vc);
+  assert(vc1.vc[0].count == 1 && vc2.vc[0].count == 2);
+  assert(DRD_(vc_lte)(&vc1, &vc2) && ! DRD_(vc_lte)(&vc2, &vc1));
+
+  /* Combining with a vector clock that is not smaller shares its array. */
+  DRD_(vc_combine)(&vc3, &vc2);
+  assert(vc3.vc == vc2.vc);
+  DRD_(vc_combine)(&vc3, &vc1);
+  assert(vc3.vc == vc2.vc);
+
+  assert(DRD_(vc_remove_threads)(&vc3, removed,
+                                 sizeof(removed)/sizeof(removed[0])) == 3);
+  assert(vc3.vc != vc2.vc);
+  assert(vc3.size == 4 * VC_PREALLOCATED - 3);
+  assert(vc2.size == 4 * VC_PREALLOCATED);
+  assert(DRD_(vc_lte)(&vc3, &vc2) && ! DRD_(vc_lte)(&vc2, &vc3));
+  for (i = 0; i < vc3.size; i++)
+    assert(vc3.vc[i].threadid != 2 && vc3.vc[i].threadid != 3
+           && vc3.vc[i].threadid != 17);
+  assert(DRD_(vc_remove_threads)(&vc3, removed, 1) == 0);
+
+  DRD_(vc_cleanup)(&vc3);
+  DRD_(vc_cleanup)(&vc2);
+  DRD_(vc_cleanup)(&vc1);
+}
+
 int main(int argc, char** argv)
 {
   vc_unittest();
+  vc_cow_unittest();
   return 0;
 }
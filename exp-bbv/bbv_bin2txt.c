@@ -0,0 +1,149 @@
+/*--------------------------------------------------------------------*/
+/*--- Convert binary BBV files to the text format.   bbv_bin2txt.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of BBV, a Valgrind tool for generating SimPoint
+   basic block vectors.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* A file written with --bb-out-format=binary starts with the line
+   "# bbv binary 1", followed by interval ('T') and text ('#')
+   records.  See the comment on the binary format in bbv_main.c.  Each
+   interval is written as the line exp-bbv would have written in text
+   format, except that its blocks are listed in order of block number
+   rather than address. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef  unsigned long long int ULong;
+
+static const char* argv0 = "bbv_bin2txt";
+static const char* in_name = "-";
+static FILE* in;
+
+static void barf ( const char* msg )
+{
+   fprintf(stderr, "%s: %s: %s\n", argv0, in_name, msg);
+   exit(1);
+}
+
+static void usage ( void )
+{
+   fprintf(stderr, "usage: %s [-o outfile] [bb.out.file]\n", argv0);
+   exit(1);
+}
+
+static ULong get_varint ( void )
+{
+   ULong v = 0;
+   int   shift = 0;
+
+   while (1) {
+      int b = getc(in);
+      if (b == EOF || shift > 63)
+         barf("truncated record");
+      v |= (ULong)(b & 0x7f) << shift;
+      if (!(b & 0x80)) return v;
+      shift += 7;
+   }
+}
+
+int main ( int argc, char** argv )
+{
+   static const char magic[] = "# bbv binary 1\n";
+   FILE* out = stdout;
+   char  line[sizeof(magic)];
+   int   i, tag;
+
+   in = stdin;
+   if (argv[0])
+      argv0 = argv[0];
+
+   for (i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
+         usage();
+      else if (!strcmp(argv[i], "-o")) {
+         if (++i == argc)
+            usage();
+         out = fopen(argv[i], "w");
+         if (!out) {
+            perror(argv0);
+            exit(1);
+         }
+      }
+      else if (in == stdin) {
+         in_name = argv[i];
+         in = fopen(in_name, "rb");
+         if (!in) {
+            perror(argv0);
+            exit(1);
+         }
+      }
+      else
+         usage();
+   }
+
+   setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+   if (fread(line, 1, sizeof(magic) - 1, in) != sizeof(magic) - 1
+       || memcmp(line, magic, sizeof(magic) - 1) != 0)
+      barf("not a binary BBV file");
+
+   while ((tag = getc(in)) != EOF) {
+      switch (tag) {
+      case 'T': {
+         ULong n = get_varint(), block = 0, j;
+         fputc('T', out);
+         for (j = 0; j < n; j++) {
+            block += get_varint();
+            fprintf(out, ":%llu:", block);
+            fprintf(out, "%llu   ", get_varint());
+         }
+         fputc('\n', out);
+         break;
+      }
+      case '#': {
+         ULong len = get_varint(), j;
+         for (j = 0; j < len; j++) {
+            int c = getc(in);
+            if (c == EOF)
+               barf("truncated text");
+            fputc(c, out);
+         }
+         break;
+      }
+      default:
+         barf("unknown record type");
+      }
+   }
+
+   if (fclose(out) != 0) {
+      perror(argv0);
+      exit(1);
+   }
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                            bbv_bin2txt.c ---*/
+/*--------------------------------------------------------------------*/
@@ -46,6 +46,7 @@
 #include "pub_tool_debuginfo.h"  /* VG_(get_fnname) */
 
 #include "pub_tool_oset.h"       /* ordered set stuff */
+#include "pub_tool_xarray.h"     /* growable arrays */
 
    /* instruction special cases */
 #define REP_INSTRUCTION   0x1
@@ -65,6 +66,8 @@ static HChar *bb_out_file=NULL;
    /* output parameters */
 static Bool instr_count_only=False;
 static Bool generate_pc_file=False;
+static Bool binary_output=False;    /* --bb-out-format=binary */
+static Int  clo_simpoints=0;        /* number of clusters, 0 for none */
 
    /* Global values */
 static OSet* instr_info_table;  /* table that holds the basic block info */
@@ -83,6 +86,8 @@ struct thread_info {
    ULong unique_rep_count;
    ULong fldcw_count;       /* fldcw count */
    VgFile *bbtrace_fp;      /* file pointer */
+   XArray *touched;         /* BB_infos counted in this interval     */
+   XArray *projections;     /* an sp_vector per interval (simpoints) */
 };
 
 struct BB_info {
@@ -123,61 +128,375 @@ static void dumpPcFile(void)
    VG_(fclose)(fp);
 }
 
-static VgFile *open_tracefile(Int thread_num)
+   /* Name of the output file of a thread, plus 'suffix'. The result */
+   /*   must be freed by the caller.                                 */
+static HChar *tracefile_name(Int thread_num, const HChar *suffix)
 {
-   VgFile *fp;
-   // Allocate a buffer large enough for the general case "%s.%d" below
-   HChar temp_string[VG_(strlen)(bb_out_file) + 1 + 10 + 1];
+   HChar *name = VG_(malloc)("bbv.tracefile_name",
+                             VG_(strlen)(bb_out_file) + 1 + 10
+                             + VG_(strlen)(suffix) + 1);
 
       /* For thread 1, don't append any thread number  */
       /* This lets the single-thread case not have any */
       /* extra values appended to the file name.       */
    if (thread_num==1) {
-      VG_(strcpy)(temp_string, bb_out_file);
+      VG_(sprintf)(name,"%s%s",bb_out_file,suffix);
    }
    else {
-      VG_(sprintf)(temp_string,"%s.%d",bb_out_file,thread_num);
+      VG_(sprintf)(name,"%s.%d%s",bb_out_file,thread_num,suffix);
    }
+   return name;
+}
+
+static VgFile *create_file(const HChar *name)
+{
+   VgFile *fp;
 
-   fp = VG_(fopen)(temp_string, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+   fp = VG_(fopen)(name, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
                    VKI_S_IRUSR|VKI_S_IWUSR|VKI_S_IRGRP|VKI_S_IWGRP);
 
    if (fp == NULL) {
-      VG_(umsg)("Error: cannot create bb file %s\n",temp_string);
+      VG_(umsg)("Error: cannot create bb file %s\n",name);
       VG_(exit)(1);
    }
 
    return fp;
 }
 
-static void handle_overflow(void)
+static VgFile *open_tracefile(Int thread_num)
 {
-   struct BB_info *bb_elem;
+   VgFile *fp;
+   HChar  *name = tracefile_name(thread_num, "");
 
-   if (bbv_thread[current_thread].dyn_instr > interval_size) {
+   fp = create_file(name);
+   VG_(free)(name);
 
-      if (!instr_count_only) {
+   if (binary_output) {
+      VG_(fprintf)(fp, "# bbv binary 1\n");
+   }
+   return fp;
+}
 
-            /* If our output file hasn't been opened, open it */
-         if (bbv_thread[current_thread].bbtrace_fp == NULL) {
-            bbv_thread[current_thread].bbtrace_fp=open_tracefile(current_thread);
-         }
 
-           /* put an entry to the bb.out file */
+/*--------------------------------------------------------------------*/
+/*--- Binary output                                                ---*/
+/*--------------------------------------------------------------------*/
+
+   /* With --bb-out-format=binary, the file starts with the line     */
+   /*   "# bbv binary 1", followed by records.  Numbers are unsigned */
+   /*   LEB128 varints.  An interval is written as the byte 'T', the */
+   /*   number of blocks n, and n pairs of (block number minus the   */
+   /*   previous block number, count), in increasing block order.   */
+   /*   Text, such as the summary at the end, is written as the byte */
+   /*   '#', its length and its bytes.  bbv_bin2txt turns such a     */
+   /*   file back into the text format.                              */
+
+#define VARINT_MAX 10
+
+static Int put_varint(UChar *buf, ULong v)
+{
+   Int n=0;
+
+   while (v >= 0x80) {
+      buf[n++] = (UChar)(v | 0x80);
+      v >>= 7;
+   }
+   buf[n++] = (UChar)v;
+   return n;
+}
+
+static void write_varint(VgFile *fp, ULong v)
+{
+   UChar buf[VARINT_MAX];
+
+   VG_(fwrite)(fp, buf, put_varint(buf, v));
+}
+
+static void write_binary_text(VgFile *fp, const HChar *text)
+{
+   SizeT len = VG_(strlen)(text);
 
-         VG_(fprintf)(bbv_thread[current_thread].bbtrace_fp, "T");
+   VG_(fwrite)(fp, "#", 1);
+   write_varint(fp, len);
+   VG_(fwrite)(fp, text, len);
+}
+
+
+/*--------------------------------------------------------------------*/
+/*--- Online SimPoint clustering                                   ---*/
+/*--------------------------------------------------------------------*/
+
+   /* With --simpoints=K, each interval's basic block vector is       */
+   /*   normalised and reduced to SP_DIMS dimensions by a random      */
+   /*   linear projection, as the SimPoint tool does.  The projection */
+   /*   matrix is not stored: the weight of a block in a dimension is */
+   /*   a hash of the two.  At exit, the projected intervals are      */
+   /*   clustered with k-means, and the interval closest to the      */
+   /*   centre of each cluster is written out, with the fraction of   */
+   /*   intervals in its cluster, in SimPoint's format.               */
+
+#define SP_DIMS 15
+#define SP_MAX_ITERS 100
+
+typedef struct {
+   double v[SP_DIMS];
+} sp_vector;
+
+static double projection_weight(Int block, Int dim)
+{
+   UInt h = (UInt)block * 0x9E3779B1u + (UInt)(dim+1) * 0x85EBCA77u;
+
+   h ^= h >> 15;
+   h *= 0x2C1B3C6Du;
+   h ^= h >> 12;
+      /* uniform in [-1,1) */
+   return (double)(h & 0xFFFF) / 32768.0 - 1.0;
+}
+
+static void project_interval(struct thread_info *t)
+{
+   sp_vector p;
+   ULong total=0;
+   Word i, n=VG_(sizeXA)(t->touched);
+   Int d;
+
+   for (i=0;i<n;i++) {
+      struct BB_info *bb = *(struct BB_info **)VG_(indexXA)(t->touched, i);
+      total += bb->inst_counter[current_thread];
+   }
+   VG_(memset)(&p, 0, sizeof(p));
+   for (i=0;i<n;i++) {
+      struct BB_info *bb = *(struct BB_info **)VG_(indexXA)(t->touched, i);
+      double frac = (double)bb->inst_counter[current_thread] / (double)total;
+      for (d=0;d<SP_DIMS;d++) {
+         p.v[d] += frac * projection_weight(bb->block_num, d);
+      }
+   }
+
+   if (t->projections == NULL) {
+      t->projections = VG_(newXA)(VG_(malloc), "bbv.projections",
+                                  VG_(free), sizeof(sp_vector));
+   }
+   VG_(addToXA)(t->projections, &p);
+}
+
+static double sp_distance(const sp_vector *a, const sp_vector *b)
+{
+   double sum=0.0;
+   Int d;
+
+   for (d=0;d<SP_DIMS;d++) {
+      double diff = a->v[d] - b->v[d];
+      sum += diff*diff;
+   }
+   return sum;
+}
+
+   /* Cluster the intervals of thread 'thread_num' into at most       */
+   /*   clo_simpoints clusters, and write the simpoints and weights. */
+   /*   The centres start out as the first interval and then, in     */
+   /*   turn, the interval furthest from all centres so far, which    */
+   /*   makes the result deterministic.                               */
+static void write_simpoints(Int thread_num, XArray *projections)
+{
+   Word n = VG_(sizeXA)(projections);
+   Int k = clo_simpoints < n ? clo_simpoints : (Int)n;
+   sp_vector *centres = VG_(calloc)("bbv.centres", k, sizeof(sp_vector));
+   Int *cluster = VG_(calloc)("bbv.cluster", n, sizeof(Int));
+   Word *size = VG_(calloc)("bbv.size", k, sizeof(Word));
+   Word *rep = VG_(calloc)("bbv.rep", k, sizeof(Word));
+   double *rep_dist = VG_(calloc)("bbv.rep_dist", k, sizeof(double));
+   Int c, d, iter;
+   Word i;
+   HChar *name;
+   VgFile *sp_fp, *w_fp;
+
+#define PROJ(_i) ((sp_vector *)VG_(indexXA)(projections, (_i)))
+
+   tl_assert(k > 0);
+
+      /* initial centres */
+   centres[0] = *PROJ(0);
+   for (c=1;c<k;c++) {
+      Word best=0;
+      double best_dist=-1.0;
+      for (i=0;i<n;i++) {
+         double dist=-1.0;
+         Int c2;
+         for (c2=0;c2<c;c2++) {
+            double dd = sp_distance(PROJ(i), &centres[c2]);
+            if (dist < 0.0 || dd < dist) dist = dd;
+         }
+         if (dist > best_dist) {
+            best_dist = dist;
+            best = i;
+         }
+      }
+      centres[c] = *PROJ(best);
+   }
 
-         VG_(OSetGen_ResetIter)(instr_info_table);
-         while ( (bb_elem = VG_(OSetGen_Next)(instr_info_table)) ) {
-            if ( bb_elem->inst_counter[current_thread] != 0 ) {
-               VG_(fprintf)(bbv_thread[current_thread].bbtrace_fp, ":%d:%d   ",
-                            bb_elem->block_num,
-                            bb_elem->inst_counter[current_thread]);
-               bb_elem->inst_counter[current_thread] = 0;
+      /* Lloyd's iterations */
+   for (iter=0;iter<SP_MAX_ITERS;iter++) {
+      Bool changed = False;
+
+      for (i=0;i<n;i++) {
+         Int best=0;
+         double best_dist=sp_distance(PROJ(i), &centres[0]);
+         for (c=1;c<k;c++) {
+            double dd = sp_distance(PROJ(i), &centres[c]);
+            if (dd < best_dist) {
+               best_dist = dd;
+               best = c;
             }
          }
+         if (iter == 0 || cluster[i] != best) {
+            cluster[i] = best;
+            changed = True;
+         }
+      }
+      if (!changed)
+         break;
+
+      VG_(memset)(centres, 0, k * sizeof(sp_vector));
+      VG_(memset)(size, 0, k * sizeof(Word));
+      for (i=0;i<n;i++) {
+         size[cluster[i]]++;
+         for (d=0;d<SP_DIMS;d++)
+            centres[cluster[i]].v[d] += PROJ(i)->v[d];
+      }
+      for (c=0;c<k;c++) {
+         if (size[c] == 0) continue;
+         for (d=0;d<SP_DIMS;d++)
+            centres[c].v[d] /= (double)size[c];
+      }
+   }
 
-         VG_(fprintf)(bbv_thread[current_thread].bbtrace_fp, "\n");
+      /* the interval closest to each centre represents its cluster */
+   VG_(memset)(size, 0, k * sizeof(Word));
+   for (i=0;i<n;i++) {
+      double dist = sp_distance(PROJ(i), &centres[cluster[i]]);
+      c = cluster[i];
+      if (size[c] == 0 || dist < rep_dist[c]) {
+         rep[c] = i;
+         rep_dist[c] = dist;
+      }
+      size[c]++;
+   }
+
+#undef PROJ
+
+   name = tracefile_name(thread_num, ".simpoints");
+   sp_fp = create_file(name);
+   VG_(free)(name);
+   name = tracefile_name(thread_num, ".weights");
+   w_fp = create_file(name);
+   VG_(free)(name);
+
+   for (c=0;c<k;c++) {
+      if (size[c] == 0) continue;
+      VG_(fprintf)(sp_fp, "%ld %d\n", rep[c], c);
+      VG_(fprintf)(w_fp, "%f %d\n", (double)size[c] / (double)n, c);
+   }
+   VG_(fclose)(sp_fp);
+   VG_(fclose)(w_fp);
+
+   VG_(free)(centres);
+   VG_(free)(cluster);
+   VG_(free)(size);
+   VG_(free)(rep);
+   VG_(free)(rep_dist);
+}
+
+
+/*--------------------------------------------------------------------*/
+/*--- Intervals                                                    ---*/
+/*--------------------------------------------------------------------*/
+
+static Int cmp_BB_addr(const void *v1, const void *v2)
+{
+   const struct BB_info *bb1 = *(const struct BB_info * const *)v1;
+   const struct BB_info *bb2 = *(const struct BB_info * const *)v2;
+
+   return bb1->BB_addr < bb2->BB_addr ? -1 : bb1->BB_addr > bb2->BB_addr;
+}
+
+static Int cmp_BB_num(const void *v1, const void *v2)
+{
+   const struct BB_info *bb1 = *(const struct BB_info * const *)v1;
+   const struct BB_info *bb2 = *(const struct BB_info * const *)v2;
+
+   return bb1->block_num < bb2->block_num ? -1
+                                          : bb1->block_num > bb2->block_num;
+}
+
+   /* Called when a block's count in this interval becomes non-zero. */
+   /*   Only these blocks are visited at the end of the interval, so */
+   /*   its cost does not grow with the size of the program.         */
+static void note_touched(struct BB_info *bbInfo)
+{
+   VG_(addToXA)(bbv_thread[current_thread].touched, &bbInfo);
+}
+
+static void end_interval(void)
+{
+   struct thread_info *t = &bbv_thread[current_thread];
+   Word i, n;
+   Int prev_block=0;
+   UChar buf[2*VARINT_MAX];
+
+      /* If our output file hasn't been opened, open it */
+   if (t->bbtrace_fp == NULL) {
+      t->bbtrace_fp=open_tracefile(current_thread);
+   }
+   n = VG_(sizeXA)(t->touched);
+
+      /* Text output lists the blocks by address, binary output by */
+      /*   number, so that the numbers can be delta-encoded.        */
+   VG_(setCmpFnXA)(t->touched, binary_output ? cmp_BB_num : cmp_BB_addr);
+   VG_(sortXA)(t->touched);
+
+   if (clo_simpoints > 0 && n > 0) {
+      project_interval(t);
+   }
+
+      /* put an entry to the bb.out file */
+   if (binary_output) {
+      VG_(fwrite)(t->bbtrace_fp, "T", 1);
+      write_varint(t->bbtrace_fp, n);
+   }
+   else {
+      VG_(fprintf)(t->bbtrace_fp, "T");
+   }
+
+   for (i=0;i<n;i++) {
+      struct BB_info *bb_elem = *(struct BB_info **)VG_(indexXA)(t->touched, i);
+      tl_assert(bb_elem->inst_counter[current_thread] != 0);
+      if (binary_output) {
+         Int len = put_varint(buf, bb_elem->block_num - prev_block);
+         len += put_varint(buf + len, bb_elem->inst_counter[current_thread]);
+         VG_(fwrite)(t->bbtrace_fp, buf, len);
+         prev_block = bb_elem->block_num;
+      }
+      else {
+         VG_(fprintf)(t->bbtrace_fp, ":%d:%d   ",
+                      bb_elem->block_num,
+                      bb_elem->inst_counter[current_thread]);
+      }
+      bb_elem->inst_counter[current_thread] = 0;
+   }
+   VG_(dropTailXA)(t->touched, n);
+
+   if (!binary_output) {
+      VG_(fprintf)(t->bbtrace_fp, "\n");
+   }
+}
+
+static void handle_overflow(void)
+{
+   if (bbv_thread[current_thread].dyn_instr > interval_size) {
+
+      if (!instr_count_only) {
+         end_interval();
       }
 
       bbv_thread[current_thread].dyn_instr -= interval_size;
@@ -205,6 +524,9 @@ static VG_REGPARM(1) void per_instruction_BBV(struct BB_info *bbInfo)
       close_out_reps();
    }
 
+   if (bbInfo->inst_counter[current_thread] == 0 && !instr_count_only) {
+      note_touched(bbInfo);
+   }
    bbInfo->inst_counter[current_thread]+=n_instrs;
 
    bbv_thread[current_thread].total_instr+=n_instrs;
@@ -246,6 +568,9 @@ static VG_REGPARM(1) void per_instruction_BBV_fldcw(struct BB_info *bbInfo)
       /* count fldcw instructions */
    bbv_thread[current_thread].fldcw_count++;
 
+   if (bbInfo->inst_counter[current_thread] == 0 && !instr_count_only) {
+      note_touched(bbInfo);
+   }
    bbInfo->inst_counter[current_thread]+=n_instrs;
 
    bbv_thread[current_thread].total_instr+=n_instrs;
@@ -476,6 +801,9 @@ static struct thread_info *allocate_new_thread(struct thread_info *old,
       temp[i].rep_count=0;
       temp[i].fldcw_count=0;
       temp[i].bbtrace_fp=NULL;
+      temp[i].touched=VG_(newXA)(VG_(malloc), "bbv.touched",
+                                 VG_(free), sizeof(struct BB_info *));
+      temp[i].projections=NULL;
    }
       /* expand the inst_counter on all allocated basic blocks */
    VG_(OSetGen_ResetIter)(instr_info_table);
@@ -528,6 +856,9 @@ static Bool bbv_process_cmd_line_option(const HChar* arg)
       generate_pc_file = True;
    }
    else if VG_BOOL_CLO (arg, "--instr-count-only", instr_count_only) {}
+   else if VG_XACT_CLO (arg, "--bb-out-format=text",   binary_output, False) {}
+   else if VG_XACT_CLO (arg, "--bb-out-format=binary", binary_output, True) {}
+   else if VG_BINT_CLO (arg, "--simpoints",        clo_simpoints, 0, 1000) {}
    else {
       return False;
    }
@@ -542,6 +873,10 @@ static void bbv_print_usage(void)
 "   --pc-out-file=<file>       filename for BB addresses and function names\n"
 "   --interval-size=<num>      interval size\n"
 "   --instr-count-only=yes|no  only print total instruction count\n"
+"   --bb-out-format=text|binary  format of the BBV file [text]\n"
+"   --simpoints=<num>          pick up to <num> representative intervals\n"
+"                              (written to <bb-out-file>.simpoints and\n"
+"                              .weights) [0, none]\n"
    );
 }
 
@@ -585,8 +920,17 @@ static void bbv_fini(Int exitcode)
             bbv_thread[i].bbtrace_fp=open_tracefile(i);
          }
             /* Also print to results file */
-         VG_(fprintf)(bbv_thread[i].bbtrace_fp, "%s", buf);
+         if (binary_output) {
+            write_binary_text(bbv_thread[i].bbtrace_fp, buf);
+         }
+         else {
+            VG_(fprintf)(bbv_thread[i].bbtrace_fp, "%s", buf);
+         }
          VG_(fclose)(bbv_thread[i].bbtrace_fp);
+
+         if (clo_simpoints > 0 && bbv_thread[i].projections != NULL) {
+            write_simpoints(i, bbv_thread[i].projections);
+         }
       }
    }
 }
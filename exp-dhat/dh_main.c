@@ -31,15 +31,23 @@
 
 
 #include "pub_tool_basics.h"
+#include "pub_tool_vki.h"
+#include "pub_tool_clientstate.h"
+#include "pub_tool_debuginfo.h"
+#include "pub_tool_execontext.h"
+#include "pub_tool_hashtable.h"
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcassert.h"
 #include "pub_tool_libcprint.h"
+#include "pub_tool_libcproc.h"
 #include "pub_tool_machine.h"      // VG_(fnptr_to_fnentry)
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_options.h"
 #include "pub_tool_replacemalloc.h"
+#include "pub_tool_threadstate.h"
 #include "pub_tool_tooliface.h"
 #include "pub_tool_wordfm.h"
+#include "pub_tool_xarray.h"
 
 #define HISTOGRAM_SIZE_LIMIT 1024
 
@@ -64,7 +72,7 @@ static ULong g_max_bytes_live  = 0; // the max residency point
 
 
 //------------------------------------------------------------//
-//--- an Interval Tree of live blocks                      ---//
+//--- a page-indexed map of live blocks                    ---//
 //------------------------------------------------------------//
 
 /* Tracks information about live blocks. */
@@ -76,6 +84,11 @@ typedef
       ULong       allocd_at; /* instruction number */
       ULong       n_reads;
       ULong       n_writes;
+      /* Number of sampled accesses behind n_reads and n_writes, which
+         give the counts' precision.  Only counted when sampling;  exact
+         accesses, such as those by syscalls, are not samples. */
+      ULong       n_read_samples;
+      ULong       n_write_samples;
       /* Approx histogram, one byte per payload byte.  Counts latch up
          therefore at 0xFFFF.  Can be NULL if the block is resized or if
          the block is larger than HISTOGRAM_SIZE_LIMIT. */
@@ -83,84 +96,312 @@ typedef
    }
    Block;
 
-/* May not contain zero-sized blocks.  May not contain
-   overlapping blocks. */
-static WordFM* interval_tree = NULL;  /* WordFM* Block* void */
+/* Every memory access is looked up here, so this has to be fast.  Live
+   blocks are found with a two-level map, much like Memcheck's shadow
+   memory.  The primary map is indexed by 64KB chunk, and covers the
+   whole address space on 32-bit platforms, and the first 64GB on 64-bit
+   platforms;  secondary maps for chunks above that live in an auxiliary
+   hash table.
+
+   A secondary map describes the 16 pages of its chunk.  A page that lies
+   entirely inside one block points to that block directly.  Any other
+   page which holds (parts of) blocks has an array of those blocks,
+   sorted by address, which lookups binary-search.  Payloads are at
+   least 8-aligned, so a page holds at most 512 blocks.
+
+   The arrays start with 4 entries and double as needed, so they cost
+   8 bytes or so per block on 64-bit platforms;  a Block* per 8-byte
+   granule would cost 4KB for each page with a small block in it, which
+   for sparse heaps is many times the size of the heap itself.  A lookup
+   costs a few loads plus up to 9 comparisons, which the cache in
+   find_Block_containing mostly avoids;  adding or removing a block
+   costs a store per page it covers entirely, and a move of at most
+   512 pointers in its first and last page.  Arrays are freed when they
+   become empty;  secondary maps are never freed.
+
+   The map may not contain zero-sized blocks, or overlapping blocks. */
+
+#define BM_PAGE_BITS    12
+#define BM_CHUNK_BITS   16
+
+#define BM_PAGE_SZB     (1UL << BM_PAGE_BITS)
+#define BM_N_PAGES      (1 << (BM_CHUNK_BITS - BM_PAGE_BITS)) /* per chunk */
+
+#if VG_WORDSIZE == 4
+#  define BM_PRIMARY_BITS  16
+#else
+#  define BM_PRIMARY_BITS  20
+#endif
+#define BM_N_PRIMARY    (1UL << BM_PRIMARY_BITS)
+
+typedef
+   struct {
+      Block*  whole[BM_N_PAGES];   /* block covering the entire page */
+      Block** parts[BM_N_PAGES];   /* other blocks in the page, or NULL */
+      UShort  n_parts[BM_N_PAGES];
+      UShort  size_parts[BM_N_PAGES];
+   }
+   BlockSecMap;
+
+static BlockSecMap* bm_primary[BM_N_PRIMARY];
+
+/* Secondary maps of chunks beyond the primary map, keyed by chunk
+   number.  This is a VgHashTable node. */
+typedef
+   struct _BlockAuxEnt {
+      struct _BlockAuxEnt* next;
+      UWord                chunk;
+      BlockSecMap*         sm;
+   }
+   BlockAuxEnt;
+
+static VgHashTable* bm_aux = NULL;
+
+static UWord stats__n_bm_secmaps = 0;
+static UWord stats__n_bm_parts   = 0;
 
-/* Here's the comparison function.  Since the tree is required
-to contain non-zero sized, non-overlapping blocks, it's good
-enough to consider any overlap as a match. */
-static Word interval_tree_Cmp ( UWord k1, UWord k2 )
+static BlockSecMap* bm_get_secmap ( Addr a, Bool create )
 {
-   Block* b1 = (Block*)k1;
-   Block* b2 = (Block*)k2;
-   tl_assert(b1->req_szB > 0);
-   tl_assert(b2->req_szB > 0);
-   if (b1->payload + b1->req_szB <= b2->payload) return -1;
-   if (b2->payload + b2->req_szB <= b1->payload) return  1;
-   return 0;
+   UWord        chunk = a >> BM_CHUNK_BITS;
+   BlockSecMap* sm;
+   BlockAuxEnt* ent;
+
+   if (LIKELY(chunk < BM_N_PRIMARY)) {
+      sm = bm_primary[chunk];
+      if (LIKELY(sm || !create))
+         return sm;
+   } else {
+      ent = VG_(HT_lookup)( bm_aux, chunk );
+      if (ent || !create)
+         return ent ? ent->sm : NULL;
+   }
+
+   sm = VG_(calloc)("dh.bm_get_secmap.1", 1, sizeof(BlockSecMap));
+   stats__n_bm_secmaps++;
+   if (chunk < BM_N_PRIMARY) {
+      bm_primary[chunk] = sm;
+   } else {
+      ent = VG_(malloc)("dh.bm_get_secmap.2", sizeof(BlockAuxEnt));
+      ent->chunk = chunk;
+      ent->sm    = sm;
+      VG_(HT_add_node)( bm_aux, ent );
+   }
+   return sm;
 }
 
-// 2-entry cache for find_Block_containing
-static Block* fbc_cache0 = NULL;
-static Block* fbc_cache1 = NULL;
+/* Index of the last of the 'n' blocks in 'parts' that starts at or
+   below 'a', or -1 if there is none. */
+static __inline__ Int bm_find_part ( Block** parts, Int n, Addr a )
+{
+   Int lo = 0;
+   Int hi = n - 1;
+
+   while (lo <= hi) {
+      Int mid = (lo + hi) / 2;
+      if (parts[mid]->payload <= a)
+         lo = mid + 1;
+      else
+         hi = mid - 1;
+   }
+   return hi;
+}
+
+static __inline__ Block* bm_lookup ( Addr a )
+{
+   BlockSecMap* sm = bm_get_secmap( a, False/*!create*/ );
+   UWord        pg;
+   Int          i;
+   Block*       bk;
+
+   if (UNLIKELY(!sm))
+      return NULL;
+   pg = (a >> BM_PAGE_BITS) & (BM_N_PAGES - 1);
+   if (sm->whole[pg])
+      return sm->whole[pg];
+   if (!sm->parts[pg])
+      return NULL;
+   i = bm_find_part( sm->parts[pg], sm->n_parts[pg], a );
+   if (i < 0)
+      return NULL;
+   bk = sm->parts[pg][i];
+   if (a >= bk->payload + bk->req_szB)
+      return NULL;
+   return bk;
+}
+
+/* Add 'bk' to the blocks partly covering the page of [a, a+len), which
+   must lie within one page, or if 'bk' is NULL, remove the block at
+   [a, a+len) from them. */
+static void bm_set_part ( Addr a, SizeT len, Block* bk )
+{
+   BlockSecMap* sm    = bm_get_secmap( a, True/*create*/ );
+   UWord        pg    = (a >> BM_PAGE_BITS) & (BM_N_PAGES - 1);
+   Block**      parts = sm->parts[pg];
+   Int          n     = sm->n_parts[pg];
+   Int          i;
+
+   tl_assert(!sm->whole[pg]);
+   i = parts ? bm_find_part( parts, n, a ) : -1;
+   if (bk) {
+      // no overlap with the neighbours
+      tl_assert(i < 0 || parts[i]->payload + parts[i]->req_szB <= a);
+      tl_assert(i + 1 == n || a + len <= parts[i+1]->payload);
+      if (n == sm->size_parts[pg]) {
+         if (!parts)
+            stats__n_bm_parts++;
+         sm->size_parts[pg] = n == 0 ? 4 : 2 * n;
+         parts = VG_(realloc)("dh.bm_set_part.1", parts,
+                              sm->size_parts[pg] * sizeof(Block*));
+         sm->parts[pg] = parts;
+      }
+      VG_(memmove)(&parts[i+2], &parts[i+1], (n - i - 1) * sizeof(Block*));
+      parts[i+1] = bk;
+      sm->n_parts[pg]++;
+   } else {
+      tl_assert(i >= 0);
+      tl_assert(a + len <= parts[i]->payload + parts[i]->req_szB);
+      VG_(memmove)(&parts[i], &parts[i+1], (n - i - 1) * sizeof(Block*));
+      sm->n_parts[pg]--;
+      if (sm->n_parts[pg] == 0) {
+         VG_(free)(parts);
+         sm->parts[pg]      = NULL;
+         sm->size_parts[pg] = 0;
+      }
+   }
+}
+
+/* Add 'bk' as the block at [a, a+len), or remove the block there if
+   'bk' is NULL. */
+static void bm_set_range ( Addr a, SizeT len, Block* bk )
+{
+   Addr end = a + len;
+
+   tl_assert(len > 0);
+   tl_assert(end > a);
+   tl_assert(VG_IS_8_ALIGNED(a));
+   while (a < end) {
+      Addr  page_end = (a & ~(BM_PAGE_SZB - 1)) + BM_PAGE_SZB;
+      SizeT n        = (end < page_end || page_end == 0 ? end : page_end) - a;
+
+      if (n == BM_PAGE_SZB) {
+         BlockSecMap* sm = bm_get_secmap( a, True/*create*/ );
+         UWord        pg = (a >> BM_PAGE_BITS) & (BM_N_PAGES - 1);
+         tl_assert(!sm->parts[pg]);
+         tl_assert((sm->whole[pg] == NULL) == (bk != NULL));
+         sm->whole[pg] = bk;
+      } else {
+         bm_set_part( a, n, bk );
+      }
+      a += n;
+   }
+}
+
+/* Lookups go through a small direct-mapped cache of recently found
+   blocks, indexed by 64-byte line.  Each thread has its own cache, so
+   threads working on different data don't evict each other's entries.
+   Adding a block can't make a cached entry wrong, but removing one
+   can:  rather than searching every thread's cache, removals bump
+   fbc_epoch, and a cache with an older epoch is emptied before use. */
+#define FBC_CACHE_SIZE  32   /* power of 2 */
+#define FBC_LINE_BITS   6
+
+typedef
+   struct {
+      UInt   epoch;
+      Block* ent[FBC_CACHE_SIZE];
+   }
+   FbcCache;
+
+static FbcCache* fbc_caches = NULL;  /* [VG_N_THREADS] */
+static FbcCache* fbc_cur    = NULL;  /* cache of the running thread */
+static UInt      fbc_epoch  = 1;
 
 static UWord stats__n_fBc_cached = 0;
 static UWord stats__n_fBc_uncached = 0;
 static UWord stats__n_fBc_notfound = 0;
+static UWord stats__n_fBc_flushes = 0;
+
+static void dh_start_client_code ( ThreadId tid, ULong bbs_done )
+{
+   tl_assert(tid > 0 && tid < VG_N_THREADS);
+   fbc_cur = &fbc_caches[tid];
+}
 
 static Block* find_Block_containing ( Addr a )
 {
-   if (LIKELY(fbc_cache0
-              && fbc_cache0->payload <= a 
-              && a < fbc_cache0->payload + fbc_cache0->req_szB)) {
-      // found at 0
-      stats__n_fBc_cached++;
-      return fbc_cache0;
-   }
-   if (LIKELY(fbc_cache1
-              && fbc_cache1->payload <= a 
-              && a < fbc_cache1->payload + fbc_cache1->req_szB)) {
-      // found at 1; swap 0 and 1
-      Block* tmp = fbc_cache0;
-      fbc_cache0 = fbc_cache1;
-      fbc_cache1 = tmp;
+   Block** slot;
+   Block*  res;
+
+   if (UNLIKELY(fbc_cur->epoch != fbc_epoch)) {
+      VG_(memset)(fbc_cur->ent, 0, sizeof(fbc_cur->ent));
+      fbc_cur->epoch = fbc_epoch;
+      stats__n_fBc_flushes++;
+   }
+   slot = &fbc_cur->ent[(a >> FBC_LINE_BITS) & (FBC_CACHE_SIZE - 1)];
+   res  = *slot;
+   if (LIKELY(res && res->payload <= a
+                  && a < res->payload + res->req_szB)) {
       stats__n_fBc_cached++;
-      return fbc_cache0;
-   }
-   Block fake;
-   fake.payload = a;
-   fake.req_szB = 1;
-   UWord foundkey = 1;
-   UWord foundval = 1;
-   Bool found = VG_(lookupFM)( interval_tree,
-                               &foundkey, &foundval, (UWord)&fake );
-   if (!found) {
+      return res;
+   }
+
+   res = bm_lookup(a);
+   if (!res) {
       stats__n_fBc_notfound++;
       return NULL;
    }
-   tl_assert(foundval == 0); // we don't store vals in the interval tree
-   tl_assert(foundkey != 1);
-   Block* res = (Block*)foundkey;
-   tl_assert(res != &fake);
-   // put at the top position
-   fbc_cache1 = fbc_cache0;
-   fbc_cache0 = res;
+   tl_assert(res->payload <= a && a < res->payload + res->req_szB);
+   *slot = res;
    stats__n_fBc_uncached++;
    return res;
 }
 
-// delete a block; asserts if not found.  (viz, 'a' must be
-// known to be present.)
-static void delete_Block_starting_at ( Addr a )
+static void add_Block ( Block* bk )
 {
-   Block fake;
-   fake.payload = a;
-   fake.req_szB = 1;
-   Bool found = VG_(delFromFM)( interval_tree,
-                                NULL, NULL, (Addr)&fake );
-   tl_assert(found);
-   fbc_cache0 = fbc_cache1 = NULL;
+   tl_assert(bk->req_szB > 0);
+   bm_set_range( bk->payload, bk->req_szB, bk );
+}
+
+// delete a block; asserts if it isn't present.
+static void delete_Block ( Block* bk )
+{
+   bm_set_range( bk->payload, bk->req_szB, NULL );
+   fbc_epoch++;
+}
+
+/* Call 'f' on each live block, once. */
+static void forall_Blocks_in_secmap ( BlockSecMap* sm, Addr base,
+                                      void (*f)(Block*) )
+{
+   UWord pg, i;
+
+   for (pg = 0; pg < BM_N_PAGES; pg++) {
+      Addr page = base + (pg << BM_PAGE_BITS);
+      Block* bk = sm->whole[pg];
+      // visit each block in the page it starts in
+      if (bk && bk->payload == page)
+         f(bk);
+      for (i = 0; i < sm->n_parts[pg]; i++) {
+         bk = sm->parts[pg][i];
+         if (bk->payload >= page)
+            f(bk);
+      }
+   }
+}
+
+static void forall_Blocks ( void (*f)(Block*) )
+{
+   UWord        chunk;
+   BlockAuxEnt* ent;
+
+   for (chunk = 0; chunk < BM_N_PRIMARY; chunk++) {
+      if (bm_primary[chunk])
+         forall_Blocks_in_secmap( bm_primary[chunk],
+                                  chunk << BM_CHUNK_BITS, f );
+   }
+   VG_(HT_ResetIter)( bm_aux );
+   while ((ent = VG_(HT_Next)( bm_aux )))
+      forall_Blocks_in_secmap( ent->sm, ent->chunk << BM_CHUNK_BITS, f );
 }
 
 
@@ -195,6 +436,9 @@ typedef
       // by this AP.
       ULong n_reads;
       ULong n_writes;
+      // The number of accesses those counts were made from.
+      ULong n_read_samples;
+      ULong n_write_samples;
       /* Histogram information.  We maintain a histogram aggregated for
          all retiring Blocks allocated by this AP, but only if:
          - this AP has only ever allocated objects of one size
@@ -330,6 +574,8 @@ static void retire_Block ( Block* bk, Bool because_freed )
    // access counts
    api->n_reads  += bk->n_reads;
    api->n_writes += bk->n_writes;
+   api->n_read_samples  += bk->n_read_samples;
+   api->n_write_samples += bk->n_write_samples;
 
    // histo stuff.  First, do state transitions for xsize/xsize_tag.
    switch (api->xsize_tag) {
@@ -457,7 +703,7 @@ void* new_block ( ThreadId tid, void* p, SizeT req_szB, SizeT req_alignB,
    if ((SSizeT)req_szB < 0) return NULL;
 
    if (req_szB == 0)
-      req_szB = 1;  /* can't allow zero-sized blocks in the interval tree */
+      req_szB = 1;  /* can't allow zero-sized blocks in the block map */
 
    // Allocate and zero if necessary
    if (!p) {
@@ -481,6 +727,8 @@ void* new_block ( ThreadId tid, void* p, SizeT req_szB, SizeT req_alignB,
    bk->allocd_at = g_guest_instrs_executed;
    bk->n_reads   = 0;
    bk->n_writes  = 0;
+   bk->n_read_samples  = 0;
+   bk->n_write_samples = 0;
    // set up histogram array, if the block isn't too large
    bk->histoW = NULL;
    if (req_szB <= HISTOGRAM_SIZE_LIMIT) {
@@ -488,9 +736,7 @@ void* new_block ( ThreadId tid, void* p, SizeT req_szB, SizeT req_alignB,
       VG_(memset)(bk->histoW, 0, req_szB * sizeof(UShort));
    }
 
-   Bool present = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/);
-   tl_assert(!present);
-   fbc_cache0 = fbc_cache1 = NULL;
+   add_Block(bk);
 
    intro_Block(bk);
 
@@ -525,7 +771,7 @@ void die_block ( void* p, Bool custom_free )
    retire_Block(bk, True/*because_freed*/);
 
    VG_(cli_free)( (void*)bk->payload );
-   delete_Block_starting_at( bk->payload );
+   delete_Block( bk );
    if (bk->histoW) {
       VG_(free)( bk->histoW );
       bk->histoW = NULL;
@@ -567,10 +813,15 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
    // Actually do the allocation, if necessary.
    if (new_req_szB <= bk->req_szB) {
 
-      // New size is smaller or same; block not moved.
+      // New size is smaller or same; block not moved.  It may no
+      // longer cover the same pages entirely, so re-add it as a whole.
       apinfo_change_cur_bytes_live(bk->ap,
                                    (Long)new_req_szB - (Long)bk->req_szB);
-      bk->req_szB = new_req_szB;
+      if (new_req_szB < bk->req_szB) {
+         delete_Block( bk );
+         bk->req_szB = new_req_szB;
+         add_Block( bk );
+      }
       return p_old;
 
    } else {
@@ -588,10 +839,10 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
       VG_(cli_free)(p_old);
 
       // Since the block has moved, we need to re-insert it into the
-      // interval tree at the new place.  Do this by removing
+      // block map at the new place.  Do this by removing
       // and re-adding it.
-      delete_Block_starting_at( (Addr)p_old );
-      // now 'bk' is no longer in the tree, but the Block itself
+      delete_Block( bk );
+      // now 'bk' is no longer in the map, but the Block itself
       // is still alive
 
       // Update the metadata.
@@ -601,10 +852,7 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
       bk->req_szB = new_req_szB;
 
       // and re-add
-      Bool present
-         = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/); 
-      tl_assert(!present);
-      fbc_cache0 = fbc_cache1 = NULL;
+      add_Block( bk );
 
       return p_new;
    }
@@ -680,8 +928,18 @@ static SizeT dh_malloc_usable_size ( ThreadId tid, void* p )
 //--- memory references                                    ---//
 //------------------------------------------------------------//
 
+/* With --sample-accesses=N, only about one access in N is looked up.
+   The instrumentation counts g_sample_countdown down on every access
+   and calls the sampled helpers when it reaches zero;  these count the
+   access N times, and re-arm the countdown with a random interval of
+   mean N, so that sampling can't lock onto a loop's access pattern.
+   Accesses by syscalls are always counted exactly. */
+static Int   clo_sample_accesses = 1;
+static Long  g_sample_countdown  = 1;
+static UInt  sample_seed         = 0x5a17;
+
 static
-void inc_histo_for_block ( Block* bk, Addr addr, UWord szB )
+void inc_histo_for_block ( Block* bk, Addr addr, UWord szB, UInt weight )
 {
    UWord i, offMin, offMax1;
    offMin = addr - bk->payload;
@@ -691,32 +949,72 @@ void inc_histo_for_block ( Block* bk, Addr addr, UWord szB )
       offMax1 = bk->req_szB;
    //VG_(printf)("%lu %lu   (size of block %lu)\n", offMin, offMax1, bk->req_szB);
    for (i = offMin; i < offMax1; i++) {
-      UShort n = bk->histoW[i];
-      if (n < 0xFFFF) n++;
-      bk->histoW[i] = n;
+      UInt n = bk->histoW[i] + weight;
+      bk->histoW[i] = n < 0xFFFF ? n : 0xFFFF;
    }
 }
 
-static VG_REGPARM(2)
-void dh_handle_write ( Addr addr, UWord szB )
+/* Returns the block written to, if any. */
+static Block* handle_write ( Addr addr, UWord szB, UInt weight )
 {
    Block* bk = find_Block_containing(addr);
    if (bk) {
-      bk->n_writes += szB;
+      bk->n_writes += (ULong)szB * weight;
       if (bk->histoW)
-         inc_histo_for_block(bk, addr, szB);
+         inc_histo_for_block(bk, addr, szB, weight);
    }
+   return bk;
 }
 
-static VG_REGPARM(2)
-void dh_handle_read ( Addr addr, UWord szB )
+/* Returns the block read from, if any. */
+static Block* handle_read ( Addr addr, UWord szB, UInt weight )
 {
    Block* bk = find_Block_containing(addr);
    if (bk) {
-      bk->n_reads += szB;
+      bk->n_reads += (ULong)szB * weight;
       if (bk->histoW)
-         inc_histo_for_block(bk, addr, szB);
+         inc_histo_for_block(bk, addr, szB, weight);
    }
+   return bk;
+}
+
+static VG_REGPARM(2)
+void dh_handle_write ( Addr addr, UWord szB )
+{
+   handle_write(addr, szB, 1);
+}
+
+static VG_REGPARM(2)
+void dh_handle_read ( Addr addr, UWord szB )
+{
+   handle_read(addr, szB, 1);
+}
+
+static void rearm_sample_countdown ( void )
+{
+   tl_assert(g_sample_countdown == 0);
+   g_sample_countdown
+      = 1 + VG_(random)(&sample_seed) % (2 * clo_sample_accesses - 1);
+}
+
+static VG_REGPARM(2)
+void dh_handle_sampled_write ( Addr addr, UWord szB )
+{
+   Block* bk;
+   rearm_sample_countdown();
+   bk = handle_write(addr, szB, clo_sample_accesses);
+   if (bk)
+      bk->n_write_samples++;
+}
+
+static VG_REGPARM(2)
+void dh_handle_sampled_read ( Addr addr, UWord szB )
+{
+   Block* bk;
+   rearm_sample_countdown();
+   bk = handle_read(addr, szB, clo_sample_accesses);
+   if (bk)
+      bk->n_read_samples++;
 }
 
 
@@ -731,7 +1029,7 @@ void dh_handle_noninsn_read ( CorePart part, ThreadId tid, const HChar* s,
 {
    switch (part) {
       case Vg_CoreSysCall:
-         dh_handle_read(base, size);
+         handle_read(base, size, 1);
          break;
       case Vg_CoreSysCallArgInMem:
          break;
@@ -748,7 +1046,7 @@ void dh_handle_noninsn_write ( CorePart part, ThreadId tid,
 {
    switch (part) {
       case Vg_CoreSysCall:
-         dh_handle_write(base, size);
+         handle_write(base, size, 1);
          break;
       case Vg_CoreSignal:
          break;
@@ -811,7 +1109,15 @@ void addMemEvent(IRSB* sbOut, Bool isWrite, Int szB, IRExpr* addr,
    tyAddr = typeOfIRExpr( sbOut->tyenv, addr );
    tl_assert(tyAddr == Ity_I32 || tyAddr == Ity_I64);
 
-   if (isWrite) {
+   if (clo_sample_accesses > 1) {
+      if (isWrite) {
+         hName = "dh_handle_sampled_write";
+         hAddr = &dh_handle_sampled_write;
+      } else {
+         hName = "dh_handle_sampled_read";
+         hAddr = &dh_handle_sampled_read;
+      }
+   } else if (isWrite) {
       hName = "dh_handle_write";
       hAddr = &dh_handle_write;
    } else {
@@ -829,6 +1135,30 @@ void addMemEvent(IRSB* sbOut, Bool isWrite, Int szB, IRExpr* addr,
                            hName, VG_(fnptr_to_fnentry)( hAddr ),
                            argv );
 
+   if (clo_sample_accesses > 1) {
+      // Call the helper only when the countdown reaches zero:
+      //   WrTmp(t1, Load64(&g_sample_countdown))
+      //   WrTmp(t2, Sub64(RdTmp(t1), Const(1)))
+      //   Store(&g_sample_countdown, t2)
+      //   Dirty(if CmpEQ64(t2, 0) helper(addr, szB))
+      // There is no stack filter here, as the helper must always be
+      // called to re-arm the countdown.  That's cheap enough, since
+      // it only happens once every N accesses.
+      IRTemp t1 = newIRTemp(sbOut->tyenv, Ity_I64);
+      IRTemp t2 = newIRTemp(sbOut->tyenv, Ity_I64);
+      IRExpr* countdown_addr = mkIRExpr_HWord( (HWord)&g_sample_countdown );
+
+      addStmtToIRSB( sbOut,
+                     assign(t1, IRExpr_Load(END, Ity_I64, countdown_addr)) );
+      addStmtToIRSB( sbOut,
+                     assign(t2, binop(Iop_Sub64, mkexpr(t1), mkU64(1))) );
+      addStmtToIRSB( sbOut,
+                     IRStmt_Store(END, countdown_addr, mkexpr(t2)) );
+      di->guard = binop(Iop_CmpEQ64, mkexpr(t2), mkU64(0));
+      addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
+      return;
+   }
+
    /* Generate the guard condition: "(addr - (SP - RZ)) >u N", for
       some arbitrary N.  If that fails then addr is in the range (SP -
       RZ .. SP + N - RZ).  If N is smallish (a page?) then we can say
@@ -1034,11 +1364,17 @@ static Bool identify_metric ( /*OUT*/ULong(**get_metricP)(APInfo*),
 
 static Int    clo_show_top_n = 10;
 static const HChar *clo_sort_by = "max-bytes-live";
+static const HChar *clo_dhat_out_file = NULL;
 
 static Bool dh_process_cmd_line_option(const HChar* arg)
 {
    if VG_BINT_CLO(arg, "--show-top-n", clo_show_top_n, 1, 100000) {}
 
+   else if VG_STR_CLO(arg, "--dhat-out-file", clo_dhat_out_file) {}
+
+   else if VG_BINT_CLO(arg, "--sample-accesses", clo_sample_accesses,
+                       1, 1000000) {}
+
    else if VG_STR_CLO(arg, "--sort-by", clo_sort_by) {
        ULong (*dummyFn)(APInfo*);
        Bool dummyB;
@@ -1068,6 +1404,10 @@ static void dh_print_usage(void)
 "                tot-bytes-allocd  bytes allocated in total (turnover)\n"
 "                max-blocks-live   maximum live blocks\n"
 "                tot-blocks-allocd blocks allocated in total (turnover)\n"
+"    --dhat-out-file=<file>    also write all alloc points to <file>,\n"
+"                              in JSON format [none]\n"
+"    --sample-accesses=number  count only about 1 in <number> memory\n"
+"                              accesses, and scale up the results [1]\n"
    );
 }
 
@@ -1092,6 +1432,46 @@ static void show_N_div_100( /*OUT*/HChar* buf, ULong n )
                 nR);
 }
 
+static ULong isqrt ( ULong n )
+{
+   ULong r = 0, bit = 1ULL << 62;
+   while (bit > n)
+      bit >>= 2;
+   while (bit != 0) {
+      if (n >= r + bit) {
+         n -= r + bit;
+         r = (r >> 1) + bit;
+      } else {
+         r >>= 1;
+      }
+      bit >>= 2;
+   }
+   return r;
+}
+
+/* The sampled accesses of an AP are (near enough) a Poisson process, so
+   a count estimated from n of them has a relative standard error of
+   1/sqrt(n).  Show the half-width of its 95% confidence interval,
+   1.96/sqrt(n), as a percentage of the count. */
+static void show_sampling_error( /*OUT*/HChar* buf, ULong n_samples )
+{
+   ULong err_100;   // in hundredths of a percent
+
+   if (n_samples == 0) {
+      VG_(sprintf)(buf, "?");
+      return;
+   }
+   // 1.96 / sqrt(n) * 100% * 100, computed as 1960000 / sqrt(10000 * n)
+   // to keep two digits of the square root
+   err_100 = 1960000ULL / isqrt(10000ULL * n_samples);
+   if (err_100 > 10000)
+      err_100 = 10000;
+   buf[0] = '+';
+   buf[1] = '-';
+   show_N_div_100(buf + 2, err_100);
+   VG_(strcat)(buf, "%");
+}
+
 static void show_APInfo ( APInfo* api )
 {
    HChar bufA[80];   // large enough
@@ -1146,6 +1526,15 @@ static void show_APInfo ( APInfo* api )
              bufR, bufW,
              api->n_reads, api->n_writes);
 
+   if (clo_sample_accesses > 1) {
+      show_sampling_error(bufR, api->n_read_samples);
+      show_sampling_error(bufW, api->n_write_samples);
+      VG_(umsg)("acc-error:   %s rd, %s wr "
+                " (from %'llu and %'llu sampled accesses)\n",
+                bufR, bufW,
+                api->n_read_samples, api->n_write_samples);
+   }
+
    VG_(pp_ExeContext)(api->ap);
 
    if (api->histo && api->xsize_tag == Exactly) {
@@ -1274,6 +1663,215 @@ static void show_top_n_apinfos ( void )
 }
 
 
+//------------------------------------------------------------//
+//--- Machine-readable output                              ---//
+//------------------------------------------------------------//
+
+/* With --dhat-out-file, all allocation points are also written to a
+   file in JSON format, for processing by other programs.  The format is
+   described in the manual.  Stack frames are shared between allocation
+   points, so they are written once, in "frameTable", and allocation
+   points refer to them by index. */
+
+#define FP(format, args...) ({ VG_(fprintf)(fp, format, ##args); })
+
+static WordFM* frame_index = NULL;  /* WordFM* Addr UWord(index) */
+static XArray* frame_ips   = NULL;  /* XArray* Addr */
+
+static UWord get_frame_index ( Addr ip )
+{
+   UWord keyW, valW;
+
+   if (VG_(lookupFM)( frame_index, &keyW, &valW, ip ))
+      return valW;
+   valW = VG_(sizeXA)( frame_ips );
+   VG_(addToXA)( frame_ips, &ip );
+   VG_(addToFM)( frame_index, ip, valW );
+   return valW;
+}
+
+static void write_json_string ( VgFile* fp, const HChar* s )
+{
+   FP("\"");
+   for (; *s; s++) {
+      if (*s == '"' || *s == '\\')
+         FP("\\%c", *s);
+      else if ((UChar)*s < 0x20)
+         FP("\\u%04x", (UInt)(UChar)*s);
+      else
+         FP("%c", *s);
+   }
+   FP("\"");
+}
+
+static Int cmp_UInt_decreasing ( const void* v1, const void* v2 )
+{
+   UInt n1 = *(const UInt*)v1;
+   UInt n2 = *(const UInt*)v2;
+   return n1 > n2 ? -1 : n1 < n2 ? 1 : 0;
+}
+
+/* The aggregated per-offset access counts of 'api', and summaries of
+   them meant for finding hot and cold fields:
+   - "acc": the counts, run-length encoded as [length, count] pairs
+   - "accessedRuns": the maximal runs of accessed bytes, as
+     [offset, length, total count] triples;  the gaps between them are
+     padding or unused fields
+   - "unusedBytes": the number of bytes never accessed
+   - "hot90Bytes": the fewest bytes that account for 90% of the
+     accesses;  if that is small, grouping those bytes together would
+     improve locality */
+static void write_json_histo ( VgFile* fp, APInfo* api )
+{
+   UWord  i, j, n_unused = 0, n_hot = 0;
+   ULong  tot = 0, acc = 0;
+   UInt*  sorted;
+   const HChar* sep;
+
+   tl_assert(api->histo && api->xsize_tag == Exactly);
+
+   FP(",\"acc\":[");
+   sep = "";
+   for (i = 0; i < api->xsize; i = j) {
+      for (j = i; j < api->xsize && api->histo[j] == api->histo[i]; j++)
+         ;
+      FP("%s[%lu,%u]", sep, j - i, api->histo[i]);
+      sep = ",";
+   }
+   FP("]");
+
+   FP(",\"accessedRuns\":[");
+   sep = "";
+   for (i = 0; i < api->xsize; i = j) {
+      ULong run_tot = 0;
+      if (api->histo[i] == 0) {
+         n_unused++;
+         j = i + 1;
+         continue;
+      }
+      for (j = i; j < api->xsize && api->histo[j] != 0; j++)
+         run_tot += api->histo[j];
+      FP("%s[%lu,%lu,%llu]", sep, i, j - i, run_tot);
+      sep = ",";
+      tot += run_tot;
+   }
+   FP("]");
+
+   sorted = VG_(malloc)("dh.write_json_histo.1", api->xsize * sizeof(UInt));
+   VG_(memcpy)(sorted, api->histo, api->xsize * sizeof(UInt));
+   VG_(ssort)(sorted, api->xsize, sizeof(UInt), cmp_UInt_decreasing);
+   while (n_hot < api->xsize && 10 * acc < 9 * tot)
+      acc += sorted[n_hot++];
+   VG_(free)(sorted);
+
+   FP(",\"unusedBytes\":%lu,\"hot90Bytes\":%lu", n_unused, n_hot);
+}
+
+static void write_json_APInfo ( VgFile* fp, APInfo* api )
+{
+   Addr* ips   = VG_(get_ExeContext_StackTrace)(api->ap);
+   Int   n_ips = VG_(get_ExeContext_n_ips)(api->ap);
+   Int   i;
+
+   FP("{\"totBytes\":%llu,\"totBlocks\":%llu", api->tot_bytes,
+      api->tot_blocks);
+   FP(",\"maxBytesLive\":%llu,\"maxBlocksLive\":%llu", api->max_bytes_live,
+      api->max_blocks_live);
+   FP(",\"deaths\":%llu,\"deathAgesSum\":%llu", api->deaths,
+      api->death_ages_sum);
+   FP(",\"readBytes\":%llu,\"writeBytes\":%llu", api->n_reads,
+      api->n_writes);
+   FP(",\"readSamples\":%llu,\"writeSamples\":%llu", api->n_read_samples,
+      api->n_write_samples);
+   if (api->xsize_tag == Exactly) {
+      FP(",\"size\":%lu", api->xsize);
+      if (api->histo)
+         write_json_histo(fp, api);
+   }
+   FP(",\"frames\":[");
+   for (i = 0; i < n_ips; i++)
+      FP("%s%lu", i ? "," : "", get_frame_index(ips[i]));
+   FP("]}");
+}
+
+static void write_json_file ( void )
+{
+   HChar*  name;
+   VgFile* fp;
+   UWord   keyW, valW;
+   Word    i;
+   const HChar* sep;
+
+   // Expand the name now, as the program may have forked.
+   name = VG_(expand_file_name)("--dhat-out-file", clo_dhat_out_file);
+   fp = VG_(fopen)(name, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                         VKI_S_IRUSR|VKI_S_IWUSR);
+   if (fp == NULL) {
+      VG_(umsg)("error: can't open output file '%s'\n", name);
+      VG_(umsg)("       ... so the JSON output will be missing.\n");
+      VG_(free)(name);
+      return;
+   }
+
+   frame_index = VG_(newFM)( VG_(malloc), "dh.write_json_file.1",
+                             VG_(free), NULL/*unboxedcmp*/ );
+   frame_ips   = VG_(newXA)( VG_(malloc), "dh.write_json_file.2",
+                             VG_(free), sizeof(Addr) );
+
+   FP("{\"dhatFileVersion\":1");
+   FP(",\"cmd\":");
+   write_json_string(fp, VG_(args_the_exename));
+   FP(",\"args\":[");
+   for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
+      HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
+      if (i > 0) FP(",");
+      write_json_string(fp, arg);
+   }
+   FP("]");
+   FP(",\"pid\":%d", VG_(getpid)());
+   FP(",\"sampleAccesses\":%d", clo_sample_accesses);
+   FP(",\"guestInsns\":%llu", g_guest_instrs_executed);
+   FP(",\"maxBytesLive\":%llu,\"maxBlocksLive\":%llu",
+      g_max_bytes_live, g_max_blocks_live);
+   FP(",\"totBytes\":%llu,\"totBlocks\":%llu", g_tot_bytes, g_tot_blocks);
+
+   FP(",\n\"aps\":[");
+   sep = "\n";
+   VG_(initIterFM)( apinfo );
+   while (VG_(nextIterFM)( apinfo, &keyW, &valW )) {
+      FP("%s", sep);
+      write_json_APInfo(fp, (APInfo*)valW);
+      sep = ",\n";
+   }
+   VG_(doneIterFM)( apinfo );
+   FP("\n]");
+
+   FP(",\n\"frameTable\":[");
+   sep = "\n";
+   for (i = 0; i < VG_(sizeXA)( frame_ips ); i++) {
+      Addr ip = *(Addr*)VG_(indexXA)( frame_ips, i );
+      FP("%s", sep);
+      write_json_string(fp, VG_(describe_IP)(ip, NULL));
+      sep = ",\n";
+   }
+   FP("\n]}\n");
+
+   VG_(fclose)(fp);
+   VG_(deleteFM)( frame_index, NULL, NULL );
+   VG_(deleteXA)( frame_ips );
+   frame_index = NULL;
+   frame_ips   = NULL;
+   VG_(free)(name);
+}
+
+#undef FP
+
+
+static void retire_live_Block ( Block* bk )
+{
+   retire_Block(bk, False/*!because_freed*/);
+}
+
 static void dh_fini(Int exit_status)
 {
    // Before printing statistics, we must harvest access counts for
@@ -1281,21 +1879,20 @@ static void dh_fini(Int exit_status)
    // access ratios which are too low (zero, in the worst case)
    // for such blocks, since the accesses that do get made will
    // (if we skip this step) not get folded into the AP summaries.
-   UWord keyW, valW;
-   VG_(initIterFM)( interval_tree );
-   while (VG_(nextIterFM)( interval_tree, &keyW, &valW )) {
-      Block* bk = (Block*)keyW;
-      tl_assert(valW == 0);
-      tl_assert(bk);
-      retire_Block(bk, False/*!because_freed*/);
-   }
-   VG_(doneIterFM)( interval_tree );
+   forall_Blocks( retire_live_Block );
 
    // show results
    VG_(umsg)("======== SUMMARY STATISTICS ========\n");
    VG_(umsg)("\n");
    VG_(umsg)("guest_insns:  %'llu\n", g_guest_instrs_executed);
    VG_(umsg)("\n");
+   if (clo_sample_accesses > 1) {
+      VG_(umsg)("sampling:     1 in %d accesses; b-read and b-written "
+                "are estimates,\n", clo_sample_accesses);
+      VG_(umsg)("              acc-error gives their 95%% confidence "
+                "intervals\n");
+      VG_(umsg)("\n");
+   }
    VG_(umsg)("max_live:     %'llu in %'llu blocks\n",
              g_max_bytes_live, g_max_blocks_live);
    VG_(umsg)("\n");
@@ -1310,6 +1907,9 @@ static void dh_fini(Int exit_status)
 
    show_top_n_apinfos();
 
+   if (clo_dhat_out_file)
+      write_json_file();
+
    VG_(umsg)("\n");
    VG_(umsg)("\n");
    VG_(umsg)("==============================================================\n");
@@ -1338,6 +1938,11 @@ static void dh_fini(Int exit_status)
                 stats__n_fBc_cached,
                 stats__n_fBc_uncached);
       VG_(dmsg)("          notfound: %'lu\n", stats__n_fBc_notfound);
+      VG_(dmsg)("    cache flushes: %'lu\n", stats__n_fBc_flushes);
+      VG_(dmsg)(" dhat: block map:\n");
+      VG_(dmsg)("   secondary maps: %'lu (%'u in aux table)\n",
+                stats__n_bm_secmaps, VG_(HT_count_nodes)(bm_aux));
+      VG_(dmsg)("     block arrays: %'lu allocated\n", stats__n_bm_parts);
       VG_(dmsg)("\n");
    }
 }
@@ -1349,6 +1954,11 @@ static void dh_fini(Int exit_status)
 
 static void dh_post_clo_init(void)
 {
+   // One lookup cache per thread.  Entry 0 is never used by a thread;
+   // it serves the lookups made before any thread has run.
+   fbc_caches = VG_(calloc)("dh.post_clo_init.1",
+                            VG_N_THREADS, sizeof(FbcCache));
+   fbc_cur = &fbc_caches[0];
 }
 
 static void dh_pre_clo_init(void)
@@ -1390,14 +2000,12 @@ static void dh_pre_clo_init(void)
    //VG_(track_pre_mem_read_asciiz) ( check_mem_is_defined_asciiz );
    VG_(track_post_mem_write)      ( dh_handle_noninsn_write );
 
-   tl_assert(!interval_tree);
-   tl_assert(!fbc_cache0);
-   tl_assert(!fbc_cache1);
+   VG_(track_start_client_code)   ( dh_start_client_code );
+
+   tl_assert(!bm_aux);
+   tl_assert(!fbc_caches);
 
-   interval_tree = VG_(newFM)( VG_(malloc),
-                               "dh.main.interval_tree.1",
-                               VG_(free),
-                               interval_tree_Cmp );
+   bm_aux = VG_(HT_construct)( "dh.main.bm_aux.1" );
 
    apinfo = VG_(newFM)( VG_(malloc),
                         "dh.main.apinfo.1",
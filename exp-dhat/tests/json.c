@@ -0,0 +1,24 @@
+// One 256-byte block with a known access pattern, for checking the
+// --dhat-out-file output:  bytes 0..31 are written once and read twice,
+// bytes 32..63 written once, bytes 192..199 written once, and the rest
+// is never accessed.
+
+#include <stdlib.h>
+
+int main(void)
+{
+   char*               block = malloc(256);
+   volatile int*       p = (volatile int*)block;
+   volatile long long* q = (volatile long long*)(block + 192);
+   int                 i, j, sum = 0;
+
+   for (i = 0; i < 16; i++)
+      p[i] = i;
+   for (j = 0; j < 2; j++)
+      for (i = 0; i < 8; i++)
+         sum += p[i];
+   *q = sum;
+
+   free(block);
+   return 0;
+}
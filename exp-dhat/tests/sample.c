@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* One block that is written once and read three times, so that
+   --sample-accesses has enough accesses to sample.  sample.vgtest
+   checks the estimates against the exact counts:  16000 bytes written
+   and 48000 read. */
+
+#define N 4000
+
+int main(void)
+{
+   int* a = malloc(N * sizeof(int));
+   int  i, j;
+   long sum = 0;
+
+   for (i = 0; i < N; i++)
+      a[i] = i;
+   for (j = 0; j < 3; j++)
+      for (i = 0; i < N; i++)
+         sum += a[i];
+   free(a);
+
+   printf("Sum: %ld\n", sum);
+   return 0;
+}
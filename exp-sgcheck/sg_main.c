@@ -661,21 +661,97 @@ static Word cmp_intervals_GlobalTreeNode ( GlobalTreeNode* gn1,
                                   gn2->addr, gn2->szB );
 }
 
-/* Find the node holding 'a', if any. */
-static GlobalTreeNode* find_GlobalTreeNode ( WordFM* gitree, Addr a )
+/* Lookups are not done in the tree itself, but in a sorted array of
+   its nodes.  The set of globals only changes when objects are mapped
+   or unmapped, but it is searched for most accesses which miss in the
+   query cache.  A binary search over a flat array touches far fewer
+   cache lines than a walk down the tree, and finds the blocks either
+   side of a hole directly.  The array is rebuilt, when next needed,
+   after each change to the tree. */
+static GlobalTreeNode** giIndex       = NULL;
+static Word             giIndex_used  = 0;
+static Word             giIndex_size  = 0;
+static Bool             giIndex_valid = False;
+
+static ULong stats__giIndex_rebuilds = 0;
+
+static void giIndex__invalidate ( void )
+{
+   giIndex_valid = False;
+}
+
+__attribute__((noinline))
+static void giIndex__rebuild ( WordFM* gitree )
 {
    UWord keyW, valW;
-   GlobalTreeNode key;
-   key.addr = a;
-   key.szB  = 1;
-   if (VG_(lookupFM)( gitree, &keyW, &valW, (UWord)&key )) {
-      GlobalTreeNode* res = (GlobalTreeNode*)keyW;
+   Word  n = VG_(sizeFM)( gitree );
+
+   stats__giIndex_rebuilds++;
+   if (n > giIndex_size) {
+      if (giIndex)
+         sg_free(giIndex);
+      giIndex_size = 2 * n;
+      giIndex = sg_malloc( "di.sg_main.gIr.1",
+                           giIndex_size * sizeof(GlobalTreeNode*) );
+   }
+   giIndex_used = 0;
+   VG_(initIterFM)( gitree );
+   while (VG_(nextIterFM)( gitree, &keyW, &valW )) {
+      GlobalTreeNode* nd = (GlobalTreeNode*)keyW;
       tl_assert(valW == 0);
-      tl_assert(res != &key);
-      return res;
-   } else {
-      return NULL;
+      /* the tree is ordered, and has no overlapping nodes */
+      tl_assert(giIndex_used == 0
+                || giIndex[giIndex_used-1]->addr
+                   + giIndex[giIndex_used-1]->szB <= nd->addr);
+      giIndex[giIndex_used++] = nd;
+   }
+   VG_(doneIterFM)( gitree );
+   tl_assert(giIndex_used == n);
+   giIndex_valid = True;
+}
+
+/* Returns the number of nodes that start at or below 'a'. */
+static Word giIndex__n_at_or_below ( WordFM* gitree, Addr a )
+{
+   Word lo = 0, hi;
+
+   if (UNLIKELY(!giIndex_valid))
+      giIndex__rebuild( gitree );
+   hi = giIndex_used;
+   while (lo < hi) {
+      Word mid = lo + (hi - lo) / 2;
+      if (giIndex[mid]->addr <= a)
+         lo = mid + 1;
+      else
+         hi = mid;
    }
+   return lo;
+}
+
+/* Find the node holding 'a', if any. */
+static GlobalTreeNode* find_GlobalTreeNode ( WordFM* gitree, Addr a )
+{
+   Word k = giIndex__n_at_or_below( gitree, a );
+   if (k > 0 && a < giIndex[k-1]->addr + giIndex[k-1]->szB)
+      return giIndex[k-1];
+   return NULL;
+}
+
+/* Find the nodes closest to [a,a+szB) on either side, setting *lb or
+   *ub to NULL if there is none.  Returns False, leaving *lb and *ub
+   unchanged, if [a,a+szB) overlaps a node. */
+static Bool find_GlobalTree_bounds ( WordFM* gitree, Addr a, SizeT szB,
+                                     /*OUT*/GlobalTreeNode** lb,
+                                     /*OUT*/GlobalTreeNode** ub )
+{
+   Word k;
+   tl_assert(szB > 0);
+   k = giIndex__n_at_or_below( gitree, a + szB - 1 );
+   if (k > 0 && a < giIndex[k-1]->addr + giIndex[k-1]->szB)
+      return False;
+   *lb = k > 0 ? giIndex[k-1] : NULL;
+   *ub = k < giIndex_used ? giIndex[k] : NULL;
+   return True;
 }
 
 /* Note that the supplied GlobalBlock must have been made persistent
@@ -731,6 +807,7 @@ static void add_block_to_GlobalTree (
    }
 
    already_present = VG_(addToFM)( gitree, (UWord)nyu, 0 );
+   giIndex__invalidate();
    /* The interval can't already be there; else we have
       overlapping global blocks. */
    /* Unfortunately (25 Jan 09) at least icc11 has been seen to
@@ -786,6 +863,9 @@ static Bool del_GlobalTree_range ( /*MOD*/WordFM* gitree,
       tl_assert(oldK == keyW); /* check we deleted the node we just found */
    }
 
+   if (anyFound)
+      giIndex__invalidate();
+
    return anyFound;
 }
 
@@ -1137,17 +1217,10 @@ void sg_die_mem_munmap ( Addr a, SizeT len )
 
    overlap = del_GlobalTree_range(giTree, a, len);
 
-   { /* redundant sanity check */
-     UWord keyW, valW;
-     VG_(initIterFM)( giTree );
-     while (VG_(nextIterFM)( giTree, &keyW, &valW )) {
-       GlobalTreeNode* nd = (GlobalTreeNode*)keyW;
-        tl_assert(valW == 0);
-        tl_assert(nd->szB > 0);
-        tl_assert(nd->addr + nd->szB <= a
-                  || a + len <= nd->addr);
-     }
-     VG_(doneIterFM)( giTree );
+   { /* redundant sanity check.  This used to scan the whole tree,
+        which made each munmap O(number of globals). */
+     GlobalTreeNode *lb, *ub;
+     tl_assert(find_GlobalTree_bounds(giTree, a, len, &lb, &ub));
    }
 
    if (!overlap)
@@ -1174,6 +1247,7 @@ static ULong stats__classify_Stack0  = 0;
 static ULong stats__classify_StackN  = 0;
 static ULong stats__classify_Global  = 0;
 static ULong stats__classify_Unknown = 0;
+static ULong stats__classify_same    = 0;
 static ULong stats__Invars_preened   = 0;
 static ULong stats__Invars_changed   = 0;
 static ULong stats__t_i_b_empty      = 0;
@@ -1511,13 +1585,15 @@ static XArray* /* Addr */ calculate_StackBlock_EAs (
 
 /* Try to classify the block into which a memory access falls, and
    write the result in 'inv'.  This writes all relevant fields of
-   'inv'. */
+   'inv'.  'prev' is what this instruction instance accessed last
+   time, or NULL if this is its first access. */
 __attribute__((noinline)) 
 static void classify_address ( /*OUT*/Invar* inv,
                                ThreadId tid,
                                Addr ea, Addr sp, Addr fp,
                                UWord szB,
-                               XArray* /* of StackBlock */ thisInstrBlocks )
+                               XArray* /* of StackBlock */ thisInstrBlocks,
+                               const Invar* prev )
 {
    tl_assert(szB > 0);
    /* First, look in the stack blocks accessible in this instruction's
@@ -1539,6 +1615,31 @@ static void classify_address ( /*OUT*/Invar* inv,
         }
      }
    }
+   /* Most instruction instances keep accessing the same block.  If
+      this access falls inside the caller's stack block or the global
+      block it accessed last time, that is where the searches below
+      would end up, since neither tree holds overlapping blocks;  and
+      the node is still live, as the caller's blocks outlive this frame
+      and Invars of unmapped globals are preened.  (It can't be in a
+      block of this frame instead, as those are disjoint from the
+      callers' and from the globals.)  This makes the common case
+      independent of the query cache's hit rate. */
+   if (prev) {
+      if (prev->tag == Inv_Global
+          && is_subinterval_of(prev->Inv.Global.nd->addr,
+                               prev->Inv.Global.nd->szB, ea, szB)) {
+         *inv = *prev;
+         stats__classify_same++;
+         return;
+      }
+      if (prev->tag == Inv_StackN
+          && is_subinterval_of(prev->Inv.StackN.nd->addr,
+                               prev->Inv.StackN.nd->szB, ea, szB)) {
+         *inv = *prev;
+         stats__classify_same++;
+         return;
+      }
+   }
    /* Look in this thread's query cache */
    { Word i;
      QCache* cache = &qcaches[tid];
@@ -1633,21 +1734,15 @@ static void classify_address ( /*OUT*/Invar* inv,
               we just ignore it and don't update the cache, since we
               have no way to represent this situation precisely. */
            StackTreeNode  sNegInf, sPosInf, sKey, *sLB, *sUB;
-           GlobalTreeNode gNegInf, gPosInf, gKey, *gLB, *gUB;
+           GlobalTreeNode *gLB, *gUB;
            Addr gMin, gMax, sMin, sMax, uMin, uMax;
            Bool sOK, gOK;
            sNegInf.addr = 0;
            sNegInf.szB  = 1;
            sPosInf.addr = ~(UWord)0;
            sPosInf.szB  = 1;
-           gNegInf.addr = 0;
-           gNegInf.szB  = 1;
-           gPosInf.addr = ~(UWord)0;
-           gPosInf.szB  = 1;
            sKey.addr = ea;
            sKey.szB  = szB;
-           gKey.addr = ea;
-           gKey.szB  = szB;
            if (0) VG_(printf)("Tree sizes %lu %lu\n",
                               VG_(sizeFM)(siTrees[tid]), VG_(sizeFM)(giTree));
            sOK = VG_(findBoundsFM)( siTrees[tid], 
@@ -1656,12 +1751,7 @@ static void classify_address ( /*OUT*/Invar* inv,
                                     (UWord)&sNegInf, 0/*unused*/,
                                     (UWord)&sPosInf, 0/*unused*/,
                                     (UWord)&sKey );
-           gOK = VG_(findBoundsFM)( giTree,
-                                    (UWord*)&gLB,    NULL/*unused*/,
-                                    (UWord*)&gUB,    NULL/*unused*/,
-                                    (UWord)&gNegInf, 0/*unused*/,
-                                    (UWord)&gPosInf, 0/*unused*/,
-                                    (UWord)&gKey );
+           gOK = find_GlobalTree_bounds( giTree, ea, szB, &gLB, &gUB );
            if (!(sOK && gOK)) {
               /* If this happens, then [ea,ea+szB) partially overlaps
                  a heap or stack block.  We can't represent that, so
@@ -1714,8 +1804,8 @@ static void classify_address ( /*OUT*/Invar* inv,
            }
            sMin = sLB == &sNegInf  ? 0         : (sLB->addr + sLB->szB);
            sMax = sUB == &sPosInf  ? ~(UWord)0 : (sUB->addr - 1);
-           gMin = gLB == &gNegInf  ? 0         : (gLB->addr + gLB->szB);
-           gMax = gUB == &gPosInf  ? ~(UWord)0 : (gUB->addr - 1);
+           gMin = gLB == NULL      ? 0         : (gLB->addr + gLB->szB);
+           gMax = gUB == NULL      ? ~(UWord)0 : (gUB->addr - 1);
            if (0) VG_(printf)("sMin %lx sMax %lx gMin %lx gMax %lx\n",
                               sMin, sMax, gMin, gMax);
            /* [sMin,sMax] and [gMin,gMax] must both contain
@@ -1805,7 +1895,7 @@ void helperc__mem_access ( /* Known only at run time: */
          can compare it against what happens for 2nd and subsequent
          accesses. */
       classify_address( inv,
-                        tid, ea, sp, fp, szB, iinstance->blocks );
+                        tid, ea, sp, fp, szB, iinstance->blocks, NULL );
       tl_assert(inv->tag != Inv_Unset);
       return;
    }
@@ -1813,7 +1903,7 @@ void helperc__mem_access ( /* Known only at run time: */
    /* So generate an Invar and see if it's different from what
       we had before. */
    classify_address( &new_inv,
-                     tid, ea, sp, fp, szB, iinstance->blocks );
+                     tid, ea, sp, fp, szB, iinstance->blocks, inv );
    tl_assert(new_inv.tag != Inv_Unset);
 
    /* Did we see something different from before?  If no, then there's
@@ -2533,6 +2623,12 @@ void sg_fini(Int exitcode)
       VG_(message)(Vg_DebugMsg,
          " sg_:    unknown: %'12llu classify\n",
          stats__classify_Unknown);
+      VG_(message)(Vg_DebugMsg,
+         " sg_:  %'llu found in the previously accessed block\n",
+         stats__classify_same);
+      VG_(message)(Vg_DebugMsg,
+         " sg_:  %'llu global index rebuilds\n",
+         stats__giIndex_rebuilds);
       VG_(message)(Vg_DebugMsg,
          " sg_:  %'llu Invars preened, of which %'llu changed\n",
          stats__Invars_preened, stats__Invars_changed);
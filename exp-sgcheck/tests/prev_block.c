@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <assert.h>
+#include <dlfcn.h>
+
+/* Loops over a global array, over an array in a calling frame and over
+   a global array in a .so, so that most accesses are found in the block
+   that the same instruction accessed last time.  The last pass over the
+   global array overruns it, which must still be reported.  The .so is
+   closed and reopened between two passes over its array, so that the
+   Invar for its block is preened while the loop's frame is live, and
+   the next access finds the block anew (and is reported, as the Invar
+   was changed to unknown).  Run with --stats=yes, see
+   filter_prev_block. */
+
+#define N 100
+
+int garr[N];
+
+__attribute__((noinline)) int sum_global ( void )
+{
+  int r, i, sum = 0;
+  for (r = 0; r < 10; r++) {
+     for (i = 0; i < (r == 9 ? N+1/*ERROR*/ : N); i++) {
+        sum += garr[i];
+     }
+  }
+  return sum;
+}
+
+__attribute__((noinline)) int sum_caller ( int* arr, int n )
+{
+  int r, i, sum = 0;
+  for (r = 0; r < 10; r++) {
+     for (i = 0; i < n; i++) {
+        sum += arr[i];
+     }
+  }
+  return sum;
+}
+
+int main ( void )
+{
+  int i, r, round, sum;
+  int local[N];
+  void* hdl;
+  char* im_a_global_array;
+
+  for (i = 0; i < N; i++)
+     local[i] = i;
+  sum = sum_global();
+  printf("sum_caller: %d\n", sum_caller(local, N));
+
+  for (round = 0; round < 2; round++) {
+     hdl = dlopen("./preen_invars_so.so", RTLD_NOW);
+     assert(hdl);
+     im_a_global_array = dlsym(hdl, "im_a_global_array");
+     assert(im_a_global_array);
+     for (i = 0; i < 10; i++) {
+        sum += im_a_global_array[i];   /* ERROR in the second round */
+     }
+     r = dlclose(hdl);
+     assert(r == 0);
+  }
+
+  return 1 & (sum / 1000000);
+}
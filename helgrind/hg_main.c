@@ -3295,6 +3295,22 @@ static void evh__HG_PTHREAD_BARRIER_RESIZE_PRE ( ThreadId tid,
 /* UWord -> SO* */
 static WordFM* map_usertag_to_SO = NULL;
 
+/* Lock-free code tends to send and receive on the same few tags over
+   and over again.  A small direct-mapped cache in front of
+   map_usertag_to_SO avoids a WordFM lookup for each such annotation.
+   A cache entry is valid iff its SO field is non-NULL, and entries
+   are removed from the cache before their SO is deallocated. */
+#define N_USERTAG_CACHE 1024 /* must be a power of 2 */
+
+static struct { UWord usertag; SO* so; } usertag_cache[N_USERTAG_CACHE];
+
+static UWord stats__usertag_cache_queries = 0;
+static UWord stats__usertag_cache_misses  = 0;
+
+static inline UWord usertag_cache_index ( UWord usertag ) {
+   return ((usertag >> 2) ^ (usertag >> 12)) & (N_USERTAG_CACHE - 1);
+}
+
 static void map_usertag_to_SO_INIT ( void ) {
    if (UNLIKELY(map_usertag_to_SO == NULL)) {
       map_usertag_to_SO = VG_(newFM)( HG_(zalloc),
@@ -3304,24 +3320,38 @@ static void map_usertag_to_SO_INIT ( void ) {
 
 static SO* map_usertag_to_SO_lookup_or_alloc ( UWord usertag ) {
    UWord key, val;
+   SO*   so;
+   UWord ix = usertag_cache_index(usertag);
+   stats__usertag_cache_queries++;
+   if (LIKELY(usertag_cache[ix].usertag == usertag
+              && usertag_cache[ix].so != NULL))
+      return usertag_cache[ix].so;
+   stats__usertag_cache_misses++;
    map_usertag_to_SO_INIT();
    if (VG_(lookupFM)( map_usertag_to_SO, &key, &val, usertag )) {
       tl_assert(key == (UWord)usertag);
-      return (SO*)val;
+      so = (SO*)val;
    } else {
-      SO* so = libhb_so_alloc();
+      so = libhb_so_alloc();
       VG_(addToFM)( map_usertag_to_SO, usertag, (UWord)so );
-      return so;
    }
+   usertag_cache[ix].usertag = usertag;
+   usertag_cache[ix].so      = so;
+   return so;
 }
 
 static void map_usertag_to_SO_delete ( UWord usertag ) {
    UWord keyW, valW;
+   UWord ix = usertag_cache_index(usertag);
    map_usertag_to_SO_INIT();
    if (VG_(delFromFM)( map_usertag_to_SO, &keyW, &valW, usertag )) {
       SO* so = (SO*)valW;
       tl_assert(keyW == usertag);
       tl_assert(so);
+      if (usertag_cache[ix].so == so) {
+         usertag_cache[ix].usertag = 0;
+         usertag_cache[ix].so      = NULL;
+      }
       libhb_so_dealloc(so);
    }
 }
@@ -5638,6 +5668,10 @@ static void hg_print_stats (void)
    //            stats__ga_LL_adds,
    //            (Int)(ga_to_lastlock ? VG_(sizeFM)( ga_to_lastlock ) : 0) );
 
+   VG_(printf)("   usertag-to-SO: %'8lu queries (%'lu misses, %lu map size)\n",
+               stats__usertag_cache_queries, stats__usertag_cache_misses,
+               map_usertag_to_SO ? VG_(sizeFM)( map_usertag_to_SO ) : 0 );
+
    VG_(printf)("  LockN-to-P map: %'8llu queries (%llu map size)\n",
                HG_(stats__LockN_to_P_queries),
                HG_(stats__LockN_to_P_get_map_size)() );
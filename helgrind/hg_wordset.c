@@ -61,13 +61,29 @@ typedef
    searching more entries more than negates any performance advantage
    from caching those entries in the first place.  Hence use .dynMax
    to allow the size of the cache(s) to be set differently for each
-   different WordSetU. */
-#define N_WCACHE_STAT_MAX 32
+   different WordSetU.
+
+   .dynMax starts at the size given to HG_(newWordSetU), and is
+   re-evaluated every N_WCACHE_WINDOW lookups.  If a noticeable
+   fraction of the lookups hit in the last quarter of a full cache,
+   the working set does not fit and .dynMax is doubled.  If (almost)
+   no lookups hit in the second half, searching that half is wasted
+   effort and .dynMax is halved. */
+#define N_WCACHE_STAT_MAX 64
+#define N_WCACHE_DYN_MIN  2
+#define N_WCACHE_WINDOW   4096
 typedef
    struct {
       WCacheEnt ent[N_WCACHE_STAT_MAX];
       UWord     dynMax; /* 1 .. N_WCACHE_STAT_MAX inclusive */
       UWord     inUse;  /* 0 .. dynMax inclusive */
+      /* Adaptation state for the current window */
+      UWord     win_lookups;
+      UWord     win_tail_hits; /* hits in last quarter of a full cache */
+      UWord     win_back_hits; /* hits in second half of .dynMax */
+      /* Stats */
+      UWord     n_grow;
+      UWord     n_shrink;
    }
    WCache;
 
@@ -77,53 +93,96 @@ typedef
       tl_assert((_zzdynmax) <= N_WCACHE_STAT_MAX);                   \
       (_zzcache).dynMax = (_zzdynmax);                               \
       (_zzcache).inUse = 0;                                          \
+      (_zzcache).win_lookups = 0;                                    \
+      (_zzcache).win_tail_hits = 0;                                  \
+      (_zzcache).win_back_hits = 0;                                  \
+      (_zzcache).n_grow = 0;                                         \
+      (_zzcache).n_shrink = 0;                                       \
    } while (0)
 
+static void WCache_adapt ( WCache* cache )
+{
+   if (16 * cache->win_tail_hits >= N_WCACHE_WINDOW
+       && cache->dynMax < N_WCACHE_STAT_MAX) {
+      cache->dynMax *= 2;
+      if (cache->dynMax > N_WCACHE_STAT_MAX)
+         cache->dynMax = N_WCACHE_STAT_MAX;
+      cache->n_grow++;
+   }
+   else
+   if (256 * cache->win_back_hits < N_WCACHE_WINDOW
+       && cache->dynMax > N_WCACHE_DYN_MIN) {
+      cache->dynMax /= 2;
+      if (cache->dynMax < N_WCACHE_DYN_MIN)
+         cache->dynMax = N_WCACHE_DYN_MIN;
+      if (cache->inUse > cache->dynMax)
+         cache->inUse = cache->dynMax;
+      cache->n_shrink++;
+   }
+   cache->win_lookups   = 0;
+   cache->win_tail_hits = 0;
+   cache->win_back_hits = 0;
+}
+
+static inline Bool WCache_lookup ( WCache* cache, UWord arg1, UWord arg2,
+                                   /*OUT*/UWord* res )
+{
+   UWord i;
+   tl_assert(cache->dynMax >= 1);
+   tl_assert(cache->dynMax <= N_WCACHE_STAT_MAX);
+   tl_assert(cache->inUse <= cache->dynMax);
+   if (UNLIKELY(++cache->win_lookups == N_WCACHE_WINDOW))
+      WCache_adapt(cache);
+   if (cache->inUse > 0) {
+      if (cache->ent[0].arg1 == arg1 && cache->ent[0].arg2 == arg2) {
+         *res = cache->ent[0].res;
+         return True;
+      }
+      for (i = 1; i < cache->inUse; i++) {
+         if (cache->ent[i].arg1 == arg1 && cache->ent[i].arg2 == arg2) {
+            WCacheEnt tmp = cache->ent[i-1];
+            if (cache->inUse == cache->dynMax
+                && 4 * (i+1) > 3 * cache->inUse)
+               cache->win_tail_hits++;
+            if (2 * i >= cache->dynMax)
+               cache->win_back_hits++;
+            cache->ent[i-1] = cache->ent[i];
+            cache->ent[i]   = tmp;
+            *res = cache->ent[i-1].res;
+            return True;
+         }
+      }
+   }
+   return False;
+}
+
+static inline void WCache_update ( WCache* cache,
+                                   UWord arg1, UWord arg2, UWord res )
+{
+   UWord i;
+   tl_assert(cache->dynMax >= 1);
+   tl_assert(cache->dynMax <= N_WCACHE_STAT_MAX);
+   tl_assert(cache->inUse <= cache->dynMax);
+   if (cache->inUse < cache->dynMax)
+      cache->inUse++;
+   for (i = cache->inUse-1; i >= 1; i--)
+      cache->ent[i] = cache->ent[i-1];
+   cache->ent[0].arg1 = arg1;
+   cache->ent[0].arg2 = arg2;
+   cache->ent[0].res  = res;
+}
+
 #define WCache_LOOKUP_AND_RETURN(_retty,_zzcache,_zzarg1,_zzarg2)    \
    do {                                                              \
-      UWord   _i;                                                    \
-      UWord   _arg1  = (UWord)(_zzarg1);                             \
-      UWord   _arg2  = (UWord)(_zzarg2);                             \
-      WCache* _cache = &(_zzcache);                                  \
-      tl_assert(_cache->dynMax >= 1);                                \
-      tl_assert(_cache->dynMax <= N_WCACHE_STAT_MAX);                \
-      tl_assert(_cache->inUse >= 0);                                 \
-      tl_assert(_cache->inUse <= _cache->dynMax);                    \
-      if (_cache->inUse > 0) {                                       \
-         if (_cache->ent[0].arg1 == _arg1                            \
-             && _cache->ent[0].arg2 == _arg2)                        \
-            return (_retty)_cache->ent[0].res;                       \
-         for (_i = 1; _i < _cache->inUse; _i++) {                    \
-            if (_cache->ent[_i].arg1 == _arg1                        \
-                && _cache->ent[_i].arg2 == _arg2) {                  \
-               WCacheEnt tmp     = _cache->ent[_i-1];                \
-               _cache->ent[_i-1] = _cache->ent[_i];                  \
-               _cache->ent[_i]   = tmp;                              \
-               return (_retty)_cache->ent[_i-1].res;                 \
-            }                                                        \
-         }                                                           \
-      }                                                              \
+      UWord _res;                                                    \
+      if (WCache_lookup(&(_zzcache),                                 \
+                        (UWord)(_zzarg1), (UWord)(_zzarg2), &_res))  \
+         return (_retty)_res;                                        \
    } while (0)
 
 #define WCache_UPDATE(_zzcache,_zzarg1,_zzarg2,_zzresult)            \
-   do {                                                              \
-      Word    _i;                                                    \
-      UWord   _arg1  = (UWord)(_zzarg1);                             \
-      UWord   _arg2  = (UWord)(_zzarg2);                             \
-      UWord   _res   = (UWord)(_zzresult);                           \
-      WCache* _cache = &(_zzcache);                                  \
-      tl_assert(_cache->dynMax >= 1);                                \
-      tl_assert(_cache->dynMax <= N_WCACHE_STAT_MAX);                \
-      tl_assert(_cache->inUse >= 0);                                 \
-      tl_assert(_cache->inUse <= _cache->dynMax);                    \
-      if (_cache->inUse < _cache->dynMax)                            \
-         _cache->inUse++;                                            \
-      for (_i = _cache->inUse-1; _i >= 1; _i--)                      \
-         _cache->ent[_i] = _cache->ent[_i-1];                        \
-      _cache->ent[0].arg1 = _arg1;                                   \
-      _cache->ent[0].arg2 = _arg2;                                   \
-      _cache->ent[0].res  = _res;                                    \
-   } while (0)
+   WCache_update(&(_zzcache),                                        \
+                 (UWord)(_zzarg1), (UWord)(_zzarg2), (UWord)(_zzresult))
 
 
 //------------------------------------------------------------------//
@@ -136,13 +195,33 @@ typedef
       WordSetU* owner; /* for sanity checking */
       UWord*    words;
       UWord     size; /* Really this should be SizeT */
+      UWord     hash; /* hash_words(words, size) */
    }
    WordVec;
 
+/* vec2ix is an open-addressing hash table (linear probing) which maps
+   the contents of a WordVec to its WordSet number.  Each slot keeps
+   the full hash of its vector alongside it, so probing only compares
+   the contents of vectors whose hash matches.  A slot is empty when
+   .wv is NULL, and deleted (a tombstone, left by HG_(dieWS)) when .wv
+   is VHT_TOMBSTONE.  The table size is always a power of 2 and the
+   table is rehashed before live entries plus tombstones exceed 3/4 of
+   it, so there is always an empty slot to terminate a probe. */
+typedef
+   struct {
+      UWord    hash;
+      WordVec* wv;
+      WordSet  ws;
+   }
+   VecHashEnt;
+
+#define VHT_TOMBSTONE ((WordVec*)1)
+#define VHT_INIT_SIZE 64
+
 /* ix2vec[0 .. ix2vec_used-1] are pointers to the lock sets (WordVecs)
-   really.  vec2ix is the inverse mapping, mapping WordVec* to the
-   corresponding ix2vec entry number.  The two mappings are mutually
-   redundant. 
+   really.  vec2ix is the inverse mapping, mapping the contents of a
+   WordVec to the corresponding ix2vec entry number.  The two mappings
+   are mutually redundant. 
 
    If a WordVec WV is marked as dead by HG(dieWS), WV is removed from
    vec2ix. The entry of the dead WVs in ix2vec are used to maintain a
@@ -151,15 +230,24 @@ struct _WordSetU {
       void*     (*alloc)(const HChar*,SizeT);
       const HChar* cc;
       void      (*dealloc)(void*);
-      WordFM*   vec2ix; /* WordVec-to-WordSet mapping tree */
+      VecHashEnt* vec2ix; /* WordVec-to-WordSet hash table */
+      UWord     vec2ix_size; /* number of slots, a power of 2 */
+      UWord     vec2ix_used; /* number of live slots */
+      UWord     vec2ix_tomb; /* number of tombstone slots */
       WordVec** ix2vec; /* WordSet-to-WordVec mapping array */
       UWord     ix2vec_size;
       UWord     ix2vec_used;
       WordVec** ix2vec_free;
       WordSet   empty; /* cached, for speed */
+      /* Space in which the set operations build their result, before
+         it is looked up in vec2ix.  Only copied into a new WordVec if
+         the result is not already present. */
+      UWord*    scratch;
+      UWord     scratch_size;
       /* Caches for some operations */
       WCache    cache_addTo;
       WCache    cache_delFrom;
+      WCache    cache_union;
       WCache    cache_intersect;
       WCache    cache_minus;
       /* Stats */
@@ -169,6 +257,7 @@ struct _WordSetU {
       UWord     n_del_uncached;
       UWord     n_die;
       UWord     n_union;
+      UWord     n_union_uncached;
       UWord     n_intersect;
       UWord     n_intersect_uncached;
       UWord     n_minus;
@@ -179,6 +268,10 @@ struct _WordSetU {
       UWord     n_isSingleton;
       UWord     n_anyElementOf;
       UWord     n_isSubsetOf;
+      UWord     n_vht_lookup;
+      UWord     n_vht_probe;
+      UWord     n_vht_found;
+      UWord     n_vht_rehash;
    };
 
 /* Create a new WordVec of the given size. */
@@ -191,6 +284,7 @@ static WordVec* new_WV_of_size ( WordSetU* wsu, UWord sz )
    wv->owner = wsu;
    wv->words = NULL;
    wv->size = sz;
+   wv->hash = 0;
    if (sz > 0) {
      wv->words = wsu->alloc( wsu->cc, (SizeT)sz * sizeof(UWord) );
    }
@@ -205,35 +299,137 @@ static void delete_WV ( WordVec* wv )
    }
    dealloc(wv);
 }
-static void delete_WV_for_FM ( UWord wv ) {
-   delete_WV( (WordVec*)wv );
+
+static inline UWord hash_words ( const UWord* words, UWord size )
+{
+   UWord i;
+   ULong h = 0x9E3779B97F4A7C15ULL ^ (ULong)size;
+   for (i = 0; i < size; i++) {
+      h ^= (ULong)words[i];
+      h *= 0xFF51AFD7ED558CCDULL;
+      h ^= h >> 32;
+   }
+   return (UWord)h;
 }
 
-static Word cmp_WordVecs_for_FM ( UWord wv1W, UWord wv2W )
+static inline Bool eq_words ( const UWord* words1, const UWord* words2,
+                              UWord size )
 {
-   UWord    i;
-   WordVec* wv1    = (WordVec*)wv1W;
-   WordVec* wv2    = (WordVec*)wv2W;
+   UWord i;
+   for (i = 0; i < size; i++) {
+      if (words1[i] != words2[i])
+         return False;
+   }
+   return True;
+}
 
-   // WordVecs with smaller size are smaller.
-   if (wv1->size < wv2->size) {
-      return -1;
+/* Find the vec2ix slot holding a WordVec equal to words[0 .. size-1],
+   or return -1 if there is none. */
+static Word vht_find ( WordSetU* wsu,
+                       UWord hash, const UWord* words, UWord size )
+{
+   UWord mask = wsu->vec2ix_size - 1;
+   UWord i    = hash & mask;
+   wsu->n_vht_lookup++;
+   while (1) {
+      VecHashEnt* ent = &wsu->vec2ix[i];
+      wsu->n_vht_probe++;
+      if (ent->wv == NULL)
+         return -1;
+      if (ent->hash == hash
+          && ent->wv != VHT_TOMBSTONE
+          && ent->wv->size == size
+          && eq_words(ent->wv->words, words, size))
+         return (Word)i;
+      i = (i + 1) & mask;
    }
-   if (wv1->size > wv2->size) {
-      return 1;
+}
+
+/* Put (wv,ws) into the first empty or deleted slot on wv's probe
+   sequence.  Does not check whether wv is already present, and does
+   not check the table load.  Returns True if the slot was deleted,
+   that is, if a tombstone was reused. */
+static Bool vht_place ( VecHashEnt* tab, UWord tab_size,
+                        WordVec* wv, WordSet ws )
+{
+   UWord mask = tab_size - 1;
+   UWord i    = wv->hash & mask;
+   Bool  tomb;
+   while (tab[i].wv != NULL && tab[i].wv != VHT_TOMBSTONE)
+      i = (i + 1) & mask;
+   tomb        = tab[i].wv == VHT_TOMBSTONE;
+   tab[i].hash = wv->hash;
+   tab[i].wv   = wv;
+   tab[i].ws   = ws;
+   return tomb;
+}
+
+/* Move all live entries into a new table, dropping the tombstones.
+   The table is doubled in size unless the live entries alone fill
+   at most half of it. */
+static void vht_rehash ( WordSetU* wsu )
+{
+   UWord       i, new_size;
+   VecHashEnt* new_tab;
+
+   new_size = wsu->vec2ix_size;
+   if (2 * (wsu->vec2ix_used + 1) > new_size)
+      new_size *= 2;
+   new_tab = wsu->alloc( wsu->cc, new_size * sizeof(VecHashEnt) );
+   VG_(memset)( new_tab, 0, new_size * sizeof(VecHashEnt) );
+   for (i = 0; i < wsu->vec2ix_size; i++) {
+      WordVec* wv = wsu->vec2ix[i].wv;
+      if (wv != NULL && wv != VHT_TOMBSTONE)
+         vht_place( new_tab, new_size, wv, wsu->vec2ix[i].ws );
    }
+   wsu->dealloc( wsu->vec2ix );
+   wsu->vec2ix      = new_tab;
+   wsu->vec2ix_size = new_size;
+   wsu->vec2ix_tomb = 0;
+   wsu->n_vht_rehash++;
+}
 
-   // Sizes are equal => order based on content.
-   for (i = 0; i < wv1->size; i++) {
-      if (wv1->words[i] == wv2->words[i])
-         continue;
-      if (wv1->words[i] < wv2->words[i])
-         return -1;
-      if (wv1->words[i] > wv2->words[i])
-         return 1;
-      tl_assert(0);
+static void vht_insert ( WordSetU* wsu, WordVec* wv, WordSet ws )
+{
+   if (4 * (wsu->vec2ix_used + wsu->vec2ix_tomb + 1)
+       > 3 * wsu->vec2ix_size)
+      vht_rehash( wsu );
+   if (vht_place( wsu->vec2ix, wsu->vec2ix_size, wv, ws )) {
+      tl_assert(wsu->vec2ix_tomb > 0);
+      wsu->vec2ix_tomb--;
    }
-   return 0; /* identical */
+   wsu->vec2ix_used++;
+}
+
+/* Remove wv from vec2ix, and return the WordSet it was mapped to. */
+static WordSet vht_remove ( WordSetU* wsu, WordVec* wv )
+{
+   WordSet ws;
+   Word    i = vht_find( wsu, wv->hash, wv->words, wv->size );
+   tl_assert(i >= 0);
+   tl_assert(wsu->vec2ix[i].wv == wv);
+   ws = wsu->vec2ix[i].ws;
+   wsu->vec2ix[i].wv = VHT_TOMBSTONE;
+   wsu->vec2ix_used--;
+   wsu->vec2ix_tomb++;
+   return ws;
+}
+
+/* Return wsu->scratch, first enlarging it to hold at least sz
+   words. */
+static UWord* ensure_scratch ( WordSetU* wsu, UWord sz )
+{
+   UWord new_sz;
+   if (sz <= wsu->scratch_size)
+      return wsu->scratch;
+   new_sz = wsu->scratch_size == 0 ? 16 : wsu->scratch_size;
+   while (new_sz < sz)
+      new_sz *= 2;
+   if (wsu->scratch)
+      wsu->dealloc( wsu->scratch );
+   wsu->scratch      = wsu->alloc( wsu->cc, new_sz * sizeof(UWord) );
+   wsu->scratch_size = new_sz;
+   return wsu->scratch;
 }
 
 static void ensure_ix2vec_space ( WordSetU* wsu )
@@ -305,51 +501,135 @@ static WordVec* do_ix2vec_with_dead ( WordSetU* wsu, WordSet ws )
    return wv;
 }
 
-/* See if wv is contained within wsu.  If so, deallocate wv and return
-   the index of the already-present copy.  If not, add wv to both the
-   vec2ix and ix2vec mappings and return its index. 
+/* See if the strictly increasing vector words[0 .. size-1] is
+   contained within wsu.  If so, return the index of the
+   already-present copy.  If not, copy it into a new WordVec, add that
+   to both the vec2ix and ix2vec mappings and return its index.
+   words[] itself is not retained, so it can be wsu->scratch.
 */
-static WordSet add_or_dealloc_WordVec( WordSetU* wsu, WordVec* wv_new )
-{
-   Bool     have;
-   WordVec* wv_old;
-   UWord/*Set*/ ix_old = -1;
-   /* Really WordSet, but need something that can safely be casted to
-      a Word* in the lookupFM.  Making it WordSet (which is 32 bits)
-      causes failures on a 64-bit platform. */
-   tl_assert(wv_new->owner == wsu);
-   have = VG_(lookupFM)( wsu->vec2ix, 
-                         (UWord*)&wv_old, (UWord*)&ix_old,
-                         (UWord)wv_new );
-   if (have) {
-      tl_assert(wv_old != wv_new);
-      tl_assert(wv_old);
-      tl_assert(wv_old->owner == wsu);
-      tl_assert(ix_old < wsu->ix2vec_used);
-      tl_assert(wsu->ix2vec[ix_old] == wv_old);
-      delete_WV( wv_new );
-      return (WordSet)ix_old;
-   } else if (wsu->ix2vec_free) {
-      WordSet ws;
+static WordSet add_or_find_words ( WordSetU* wsu,
+                                   const UWord* words, UWord size )
+{
+   UWord    hash = hash_words( words, size );
+   Word     i    = vht_find( wsu, hash, words, size );
+   UWord    j;
+   WordVec* wv_new;
+   WordSet  ws;
+
+   if (i >= 0) {
+      ws = wsu->vec2ix[i].ws;
+      tl_assert(ws < wsu->ix2vec_used);
+      tl_assert(wsu->ix2vec[ws] == wsu->vec2ix[i].wv);
+      tl_assert(wsu->ix2vec[ws]->owner == wsu);
+      wsu->n_vht_found++;
+      return ws;
+   }
+
+   wv_new = new_WV_of_size( wsu, size );
+   for (j = 0; j < size; j++)
+      wv_new->words[j] = words[j];
+   wv_new->hash = hash;
+
+   if (wsu->ix2vec_free) {
       tl_assert(is_dead(wsu,(WordVec*)wsu->ix2vec_free));
       ws = wsu->ix2vec_free - &(wsu->ix2vec[0]);
       tl_assert(wsu->ix2vec[ws] == NULL || is_dead(wsu,wsu->ix2vec[ws]));
       wsu->ix2vec_free = (WordVec **) wsu->ix2vec[ws];
       wsu->ix2vec[ws] = wv_new;
-      VG_(addToFM)( wsu->vec2ix, (UWord)wv_new, ws );
-      if (HG_DEBUG) VG_(printf)("aodW %s re-use free %d %p\n", wsu->cc, (Int)ws, wv_new );
+      vht_insert( wsu, wv_new, ws );
+      if (HG_DEBUG) VG_(printf)("aofW %s re-use free %d %p\n", wsu->cc, (Int)ws, wv_new );
       return ws;
    } else {
       ensure_ix2vec_space( wsu );
       tl_assert(wsu->ix2vec);
       tl_assert(wsu->ix2vec_used < wsu->ix2vec_size);
-      wsu->ix2vec[wsu->ix2vec_used] = wv_new;
-      VG_(addToFM)( wsu->vec2ix, (Word)wv_new, (Word)wsu->ix2vec_used );
-      if (HG_DEBUG) VG_(printf)("aodW %s %d %p\n", wsu->cc, (Int)wsu->ix2vec_used, wv_new  );
+      ws = (WordSet)wsu->ix2vec_used;
+      wsu->ix2vec[ws] = wv_new;
+      vht_insert( wsu, wv_new, ws );
+      if (HG_DEBUG) VG_(printf)("aofW %s %d %p\n", wsu->cc, (Int)ws, wv_new  );
       wsu->ix2vec_used++;
       tl_assert(wsu->ix2vec_used <= wsu->ix2vec_size);
-      return (WordSet)(wsu->ix2vec_used - 1);
+      return ws;
+   }
+}
+
+/* Merge kernels for the set operations.  The inputs are strictly
+   increasing vectors, and dst must have room for n1+n2 words.  Each
+   returns the number of words written to dst.
+
+   The inner loops are branch-free: each step compares the two heads,
+   conditionally emits one word and advances either or both inputs by
+   the comparison results.  Compilers turn these into conditional
+   moves and flag arithmetic, so the loops do not suffer from the
+   (inherently unpredictable) mispredicted branches of the classic
+   three-way merge.  The common case of one set lying entirely below
+   the other is detected up front and done with straight copies. */
+
+static inline Bool disjoint_ranges ( const UWord* w1, UWord n1,
+                                     const UWord* w2, UWord n2 )
+{
+   return n1 == 0 || n2 == 0 || w1[n1-1] < w2[0] || w2[n2-1] < w1[0];
+}
+
+static UWord merge_union ( UWord* dst, const UWord* w1, UWord n1,
+                                       const UWord* w2, UWord n2 )
+{
+   UWord i1 = 0, i2 = 0, k = 0;
+   if (n1 > 0 && n2 > 0 && w2[n2-1] < w1[0]) {
+      const UWord* wt = w1; UWord nt = n1;
+      w1 = w2; n1 = n2;
+      w2 = wt; n2 = nt;
+   }
+   if (n1 > 0 && n2 > 0 && w2[0] > w1[n1-1]) {
+      /* All of w1 precedes all of w2: just concatenate them. */
+      i1 = n1;
+      for (k = 0; k < n1; k++)
+         dst[k] = w1[k];
    }
+   while (i1 < n1 && i2 < n2) {
+      UWord a = w1[i1];
+      UWord b = w2[i2];
+      dst[k++] = a < b ? a : b;
+      i1 += a <= b;
+      i2 += b <= a;
+   }
+   while (i1 < n1)
+      dst[k++] = w1[i1++];
+   while (i2 < n2)
+      dst[k++] = w2[i2++];
+   return k;
+}
+
+static UWord merge_intersect ( UWord* dst, const UWord* w1, UWord n1,
+                                           const UWord* w2, UWord n2 )
+{
+   UWord i1 = 0, i2 = 0, k = 0;
+   while (i1 < n1 && i2 < n2) {
+      UWord a = w1[i1];
+      UWord b = w2[i2];
+      dst[k] = a;
+      k  += a == b;
+      i1 += a <= b;
+      i2 += b <= a;
+   }
+   return k;
+}
+
+static UWord merge_minus ( UWord* dst, const UWord* w1, UWord n1,
+                                       const UWord* w2, UWord n2 )
+{
+   UWord i1 = 0, i2 = 0, k = 0;
+   while (i1 < n1 && i2 < n2) {
+      UWord a = w1[i1];
+      UWord b = w2[i2];
+      dst[k] = a;
+      k  += a < b;
+      i1 += a <= b;
+      i2 += b <= a;
+   }
+   while (i1 < n1)
+      dst[k++] = w1[i1++];
+   return k;
 }
 
 
@@ -359,25 +639,29 @@ WordSetU* HG_(newWordSetU) ( void* (*alloc_nofail)( const HChar*, SizeT ),
                              Word  cacheSize )
 {
    WordSetU* wsu;
-   WordVec*  empty;
 
    wsu          = alloc_nofail( cc, sizeof(WordSetU) );
    VG_(memset)( wsu, 0, sizeof(WordSetU) );
    wsu->alloc   = alloc_nofail;
    wsu->cc      = cc;
    wsu->dealloc = dealloc;
-   wsu->vec2ix  = VG_(newFM)( alloc_nofail, cc,
-                              dealloc, cmp_WordVecs_for_FM );
+   wsu->vec2ix_size = VHT_INIT_SIZE;
+   wsu->vec2ix_used = 0;
+   wsu->vec2ix_tomb = 0;
+   wsu->vec2ix  = alloc_nofail( cc, VHT_INIT_SIZE * sizeof(VecHashEnt) );
+   VG_(memset)( wsu->vec2ix, 0, VHT_INIT_SIZE * sizeof(VecHashEnt) );
    wsu->ix2vec_used = 0;
    wsu->ix2vec_size = 0;
    wsu->ix2vec      = NULL;
    wsu->ix2vec_free = NULL;
+   wsu->scratch      = NULL;
+   wsu->scratch_size = 0;
    WCache_INIT(wsu->cache_addTo,     cacheSize);
    WCache_INIT(wsu->cache_delFrom,   cacheSize);
+   WCache_INIT(wsu->cache_union,     cacheSize);
    WCache_INIT(wsu->cache_intersect, cacheSize);
    WCache_INIT(wsu->cache_minus,     cacheSize);
-   empty = new_WV_of_size( wsu, 0 );
-   wsu->empty = add_or_dealloc_WordVec( wsu, empty );
+   wsu->empty = add_or_find_words( wsu, NULL, 0 );
 
    return wsu;
 }
@@ -385,10 +669,17 @@ WordSetU* HG_(newWordSetU) ( void* (*alloc_nofail)( const HChar*, SizeT ),
 void HG_(deleteWordSetU) ( WordSetU* wsu )
 {
    void (*dealloc)(void*) = wsu->dealloc;
+   UWord i;
    tl_assert(wsu->vec2ix);
-   VG_(deleteFM)( wsu->vec2ix, delete_WV_for_FM, NULL/*val-finalizer*/ );
+   for (i = 0; i < wsu->ix2vec_used; i++) {
+      if (!is_dead(wsu, wsu->ix2vec[i]))
+         delete_WV( wsu->ix2vec[i] );
+   }
+   dealloc(wsu->vec2ix);
    if (wsu->ix2vec)
       dealloc(wsu->ix2vec);
+   if (wsu->scratch)
+      dealloc(wsu->scratch);
    dealloc(wsu);
 }
 
@@ -459,7 +750,6 @@ void HG_(getPayloadWS) ( /*OUT*/UWord** words, /*OUT*/UWord* nWords,
 void HG_(dieWS) ( WordSetU* wsu, WordSet ws )
 {
    WordVec* wv = do_ix2vec_with_dead( wsu, ws );
-   WordVec* wv_in_vec2ix;
    UWord/*Set*/ wv_ix = -1;
 
    if (HG_DEBUG) VG_(printf)("dieWS %s %d %p\n", wsu->cc, (Int)ws, wv);
@@ -476,9 +766,7 @@ void HG_(dieWS) ( WordSetU* wsu, WordSet ws )
    wsu->ix2vec[ws] = (WordVec*) wsu->ix2vec_free;
    wsu->ix2vec_free = &wsu->ix2vec[ws];
 
-   VG_(delFromFM) ( wsu->vec2ix, 
-                    (UWord*)&wv_in_vec2ix, (UWord*)&wv_ix,
-                    (UWord)wv );
+   wv_ix = vht_remove( wsu, wv );
 
    if (HG_DEBUG) VG_(printf)("dieWS wv_ix %d\n", (Int)wv_ix);
    tl_assert (wv_ix);
@@ -488,6 +776,7 @@ void HG_(dieWS) ( WordSetU* wsu, WordSet ws )
 
    wsu->cache_addTo.inUse = 0;
    wsu->cache_delFrom.inUse = 0;
+   wsu->cache_union.inUse = 0;
    wsu->cache_intersect.inUse = 0;
    wsu->cache_minus.inUse = 0;
 }
@@ -534,24 +823,22 @@ Bool HG_(elemWS) ( WordSetU* wsu, WordSet ws, UWord w )
 
 WordSet HG_(doubletonWS) ( WordSetU* wsu, UWord w1, UWord w2 )
 {
-   WordVec* wv;
+   UWord words[2];
    wsu->n_doubleton++;
    if (w1 == w2) {
-      wv = new_WV_of_size(wsu, 1);
-      wv->words[0] = w1;
+      words[0] = w1;
+      return add_or_find_words( wsu, words, 1 );
    }
    else if (w1 < w2) {
-      wv = new_WV_of_size(wsu, 2);
-      wv->words[0] = w1;
-      wv->words[1] = w2;
+      words[0] = w1;
+      words[1] = w2;
    }
    else {
       tl_assert(w1 > w2);
-      wv = new_WV_of_size(wsu, 2);
-      wv->words[0] = w2;
-      wv->words[1] = w1;
+      words[0] = w2;
+      words[1] = w1;
    }
-   return add_or_dealloc_WordVec( wsu, wv );
+   return add_or_find_words( wsu, words, 2 );
 }
 
 WordSet HG_(singletonWS) ( WordSetU* wsu, UWord w )
@@ -587,7 +874,8 @@ void HG_(ppWSUstats) ( WordSetU* wsu, const HChar* name )
                wsu->n_add, wsu->n_add_uncached);
    VG_(printf)("      delFrom      %10lu (%lu uncached)\n", 
                wsu->n_del, wsu->n_del_uncached);
-   VG_(printf)("      union        %10lu\n", wsu->n_union);
+   VG_(printf)("      union        %10lu (%lu uncached)\n",
+               wsu->n_union, wsu->n_union_uncached);
    VG_(printf)("      intersect    %10lu (%lu uncached) "
                "[nb. incl isSubsetOf]\n", 
                wsu->n_intersect, wsu->n_intersect_uncached);
@@ -600,12 +888,30 @@ void HG_(ppWSUstats) ( WordSetU* wsu, const HChar* name )
    VG_(printf)("      anyElementOf %10lu\n",   wsu->n_anyElementOf);
    VG_(printf)("      isSubsetOf   %10lu\n",   wsu->n_isSubsetOf);
    VG_(printf)("      dieWS        %10lu\n",   wsu->n_die);
+   VG_(printf)("      vec2ix       %10lu lookups (%lu found), "
+               "%lu probes, %lu rehashes\n",
+               wsu->n_vht_lookup, wsu->n_vht_found,
+               wsu->n_vht_probe, wsu->n_vht_rehash);
+   VG_(printf)("      vec2ix       %10lu slots, %lu live, %lu deleted\n",
+               wsu->vec2ix_size, wsu->vec2ix_used, wsu->vec2ix_tomb);
+   VG_(printf)("      cache sizes  addTo %lu, delFrom %lu, union %lu, "
+               "intersect %lu, minus %lu\n",
+               wsu->cache_addTo.dynMax, wsu->cache_delFrom.dynMax,
+               wsu->cache_union.dynMax, wsu->cache_intersect.dynMax,
+               wsu->cache_minus.dynMax);
+   VG_(printf)("      cache resize %10lu grows, %lu shrinks\n",
+               wsu->cache_addTo.n_grow + wsu->cache_delFrom.n_grow
+               + wsu->cache_union.n_grow + wsu->cache_intersect.n_grow
+               + wsu->cache_minus.n_grow,
+               wsu->cache_addTo.n_shrink + wsu->cache_delFrom.n_shrink
+               + wsu->cache_union.n_shrink + wsu->cache_intersect.n_shrink
+               + wsu->cache_minus.n_shrink);
 }
 
 WordSet HG_(addToWS) ( WordSetU* wsu, WordSet ws, UWord w )
 {
-   UWord    k, j;
-   WordVec* wv_new;
+   UWord    k;
+   UWord*   buf;
    WordVec* wv;
    WordSet  result = (WordSet)(-1); /* bogus */
 
@@ -613,29 +919,25 @@ WordSet HG_(addToWS) ( WordSetU* wsu, WordSet ws, UWord w )
    WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_addTo, ws, w);
    wsu->n_add_uncached++;
 
-   /* If already present, this is a no-op. */
-   wv = do_ix2vec( wsu, ws );
-   for (k = 0; k < wv->size; k++) {
-      if (wv->words[k] == w) {
-         result = ws;
-         goto out;
-      }
-   }
-   /* Ok, not present.  Build a new one ... */
-   wv_new = new_WV_of_size( wsu, wv->size + 1 );
-   k = j = 0;
-   for (; k < wv->size && wv->words[k] < w; k++) {
-      wv_new->words[j++] = wv->words[k];
+   /* Copy the elements smaller than w, stopping early if w is already
+      present, in which case this is a no-op. */
+   wv  = do_ix2vec( wsu, ws );
+   buf = ensure_scratch( wsu, wv->size + 1 );
+   for (k = 0; k < wv->size && wv->words[k] < w; k++)
+      buf[k] = wv->words[k];
+   if (k < wv->size && wv->words[k] == w) {
+      result = ws;
+      goto out;
    }
-   wv_new->words[j++] = w;
+   /* Ok, not present.  Insert it and copy the rest. */
+   buf[k] = w;
    for (; k < wv->size; k++) {
       tl_assert(wv->words[k] > w);
-      wv_new->words[j++] = wv->words[k];
+      buf[k+1] = wv->words[k];
    }
-   tl_assert(j == wv_new->size);
 
    /* Find any existing copy, or add the new one. */
-   result = add_or_dealloc_WordVec( wsu, wv_new );
+   result = add_or_find_words( wsu, buf, wv->size + 1 );
    tl_assert(result != (WordSet)(-1));
 
   out:
@@ -645,8 +947,8 @@ WordSet HG_(addToWS) ( WordSetU* wsu, WordSet ws, UWord w )
 
 WordSet HG_(delFromWS) ( WordSetU* wsu, WordSet ws, UWord w )
 {
-   UWord    i, j, k;
-   WordVec* wv_new;
+   UWord    i, j;
+   UWord*   buf;
    WordSet  result = (WordSet)(-1); /* bogus */
    WordVec* wv = do_ix2vec( wsu, ws );
 
@@ -661,12 +963,12 @@ WordSet HG_(delFromWS) ( WordSetU* wsu, WordSet ws, UWord w )
    WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_delFrom, ws, w);
    wsu->n_del_uncached++;
 
-   /* If not already present, this is a no-op. */
-   for (i = 0; i < wv->size; i++) {
-      if (wv->words[i] == w)
-         break;
-   }
-   if (i == wv->size) {
+   /* Copy the elements smaller than w.  If w is not present, this is
+      a no-op. */
+   buf = ensure_scratch( wsu, wv->size );
+   for (i = 0; i < wv->size && wv->words[i] < w; i++)
+      buf[i] = wv->words[i];
+   if (i == wv->size || wv->words[i] != w) {
       result = ws;
       goto out;
    }
@@ -675,16 +977,10 @@ WordSet HG_(delFromWS) ( WordSetU* wsu, WordSet ws, UWord w )
    tl_assert(i >= 0 && i < wv->size);
    tl_assert(wv->size > 0);
 
-   wv_new = new_WV_of_size( wsu, wv->size - 1 );
-   j = k = 0;
-   for (; j < wv->size; j++) {
-      if (j == i)
-         continue;
-      wv_new->words[k++] = wv->words[j];
-   }
-   tl_assert(k == wv_new->size);
+   for (j = i+1; j < wv->size; j++)
+      buf[j-1] = wv->words[j];
 
-   result = add_or_dealloc_WordVec( wsu, wv_new );
+   result = add_or_find_words( wsu, buf, wv->size - 1 );
    if (wv->size == 1) {
       tl_assert(result == wsu->empty);
    }
@@ -696,79 +992,52 @@ WordSet HG_(delFromWS) ( WordSetU* wsu, WordSet ws, UWord w )
 
 WordSet HG_(unionWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 {
-   UWord    i1, i2, k, sz;
-   WordVec* wv_new;
-   WordVec* wv1 = do_ix2vec( wsu, ws1 );
-   WordVec* wv2 = do_ix2vec( wsu, ws2 );
+   UWord    sz;
+   UWord*   buf;
+   WordSet  ws_new = (WordSet)(-1); /* bogus */
+   WordVec* wv1;
+   WordVec* wv2;
+
    wsu->n_union++;
-   sz = 0;
-   i1 = i2 = 0;
-   while (1) {
-      if (i1 >= wv1->size || i2 >= wv2->size)
-         break;
-      sz++;
-      if (wv1->words[i1] < wv2->words[i2]) {
-         i1++;
-      } else 
-      if (wv1->words[i1] > wv2->words[i2]) {
-         i2++;
-      } else {
-         i1++;
-         i2++;
-      }
-   }
-   tl_assert(i1 <= wv1->size);
-   tl_assert(i2 <= wv2->size);
-   tl_assert(i1 == wv1->size || i2 == wv2->size);
-   if (i1 == wv1->size && i2 < wv2->size) {
-      sz += (wv2->size - i2);
-   }
-   if (i2 == wv2->size && i1 < wv1->size) {
-      sz += (wv1->size - i1);
-   }
 
-   wv_new = new_WV_of_size( wsu, sz );
-   k = 0;
+   /* Deal with an obvious case fast. */
+   if (ws1 == ws2)
+      return ws1;
 
-   i1 = i2 = 0;
-   while (1) {
-      if (i1 >= wv1->size || i2 >= wv2->size)
-         break;
-      if (wv1->words[i1] < wv2->words[i2]) {
-         wv_new->words[k++] = wv1->words[i1];
-         i1++;
-      } else 
-      if (wv1->words[i1] > wv2->words[i2]) {
-         wv_new->words[k++] = wv2->words[i2];
-         i2++;
-      } else {
-         wv_new->words[k++] = wv1->words[i1];
-         i1++;
-         i2++;
-      }
-   }
-   tl_assert(i1 <= wv1->size);
-   tl_assert(i2 <= wv2->size);
-   tl_assert(i1 == wv1->size || i2 == wv2->size);
-   if (i1 == wv1->size && i2 < wv2->size) {
-      while (i2 < wv2->size)
-         wv_new->words[k++] = wv2->words[i2++];
+   /* union(x,y) == union(y,x): see HG_(intersectWS). */
+   if (ws1 > ws2) {
+      WordSet wst = ws1; ws1 = ws2; ws2 = wst;
    }
-   if (i2 == wv2->size && i1 < wv1->size) {
-      while (i1 < wv1->size)
-         wv_new->words[k++] = wv1->words[i1++];
+
+   WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_union, ws1, ws2);
+   wsu->n_union_uncached++;
+
+   wv1 = do_ix2vec( wsu, ws1 );
+   wv2 = do_ix2vec( wsu, ws2 );
+   if (wv1->size == 0) {
+      ws_new = ws2;
+   } else if (wv2->size == 0) {
+      ws_new = ws1;
+   } else {
+      buf = ensure_scratch( wsu, wv1->size + wv2->size );
+      sz  = merge_union( buf, wv1->words, wv1->size,
+                              wv2->words, wv2->size );
+      tl_assert(sz >= wv1->size && sz >= wv2->size);
+      tl_assert(sz <= wv1->size + wv2->size);
+      ws_new = add_or_find_words( wsu, buf, sz );
    }
 
-   tl_assert(k == sz);
+   tl_assert(ws_new != (WordSet)(-1));
+   WCache_UPDATE(wsu->cache_union, ws1, ws2, ws_new);
 
-   return add_or_dealloc_WordVec( wsu, wv_new );
+   return ws_new;
 }
 
 WordSet HG_(intersectWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 {
-   UWord    i1, i2, k, sz;
+   UWord    sz;
+   UWord*   buf;
    WordSet  ws_new = (WordSet)(-1); /* bogus */
-   WordVec* wv_new;
    WordVec* wv1; 
    WordVec* wv2; 
 
@@ -790,54 +1059,18 @@ WordSet HG_(intersectWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 
    wv1 = do_ix2vec( wsu, ws1 );
    wv2 = do_ix2vec( wsu, ws2 );
-   sz = 0;
-   i1 = i2 = 0;
-   while (1) {
-      if (i1 >= wv1->size || i2 >= wv2->size)
-         break;
-      if (wv1->words[i1] < wv2->words[i2]) {
-         i1++;
-      } else 
-      if (wv1->words[i1] > wv2->words[i2]) {
-         i2++;
-      } else {
-         sz++;
-         i1++;
-         i2++;
-      }
-   }
-   tl_assert(i1 <= wv1->size);
-   tl_assert(i2 <= wv2->size);
-   tl_assert(i1 == wv1->size || i2 == wv2->size);
-
-   wv_new = new_WV_of_size( wsu, sz );
-   k = 0;
-
-   i1 = i2 = 0;
-   while (1) {
-      if (i1 >= wv1->size || i2 >= wv2->size)
-         break;
-      if (wv1->words[i1] < wv2->words[i2]) {
-         i1++;
-      } else 
-      if (wv1->words[i1] > wv2->words[i2]) {
-         i2++;
-      } else {
-         wv_new->words[k++] = wv1->words[i1];
-         i1++;
-         i2++;
+   if (disjoint_ranges( wv1->words, wv1->size, wv2->words, wv2->size )) {
+      ws_new = wsu->empty;
+   } else {
+      buf = ensure_scratch( wsu, wv1->size + wv2->size );
+      sz  = merge_intersect( buf, wv1->words, wv1->size,
+                                  wv2->words, wv2->size );
+      tl_assert(sz <= wv1->size && sz <= wv2->size);
+      ws_new = add_or_find_words( wsu, buf, sz );
+      if (sz == 0) {
+         tl_assert(ws_new == wsu->empty);
       }
    }
-   tl_assert(i1 <= wv1->size);
-   tl_assert(i2 <= wv2->size);
-   tl_assert(i1 == wv1->size || i2 == wv2->size);
-
-   tl_assert(k == sz);
-
-   ws_new = add_or_dealloc_WordVec( wsu, wv_new );
-   if (sz == 0) {
-      tl_assert(ws_new == wsu->empty);
-   }
 
    tl_assert(ws_new != (WordSet)(-1));
    WCache_UPDATE(wsu->cache_intersect, ws1, ws2, ws_new);
@@ -847,9 +1080,9 @@ WordSet HG_(intersectWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 
 WordSet HG_(minusWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 {
-   UWord    i1, i2, k, sz;
+   UWord    sz;
+   UWord*   buf;
    WordSet  ws_new = (WordSet)(-1); /* bogus */
-   WordVec* wv_new;
    WordVec* wv1;
    WordVec* wv2;
    
@@ -859,61 +1092,21 @@ WordSet HG_(minusWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 
    wv1 = do_ix2vec( wsu, ws1 );
    wv2 = do_ix2vec( wsu, ws2 );
-   sz = 0;
-   i1 = i2 = 0;
-   while (1) {
-      if (i1 >= wv1->size || i2 >= wv2->size)
-         break;
-      if (wv1->words[i1] < wv2->words[i2]) {
-         sz++;
-         i1++;
-      } else 
-      if (wv1->words[i1] > wv2->words[i2]) {
-         i2++;
-      } else {
-         i1++;
-         i2++;
-      }
-   }
-   tl_assert(i1 <= wv1->size);
-   tl_assert(i2 <= wv2->size);
-   tl_assert(i1 == wv1->size || i2 == wv2->size);
-   if (i2 == wv2->size && i1 < wv1->size) {
-      sz += (wv1->size - i1);
-   }
-
-   wv_new = new_WV_of_size( wsu, sz );
-   k = 0;
-
-   i1 = i2 = 0;
-   while (1) {
-      if (i1 >= wv1->size || i2 >= wv2->size)
-         break;
-      if (wv1->words[i1] < wv2->words[i2]) {
-         wv_new->words[k++] = wv1->words[i1];
-         i1++;
-      } else 
-      if (wv1->words[i1] > wv2->words[i2]) {
-         i2++;
-      } else {
-         i1++;
-         i2++;
+   if (ws1 == ws2) {
+      ws_new = wsu->empty;
+   } else if (disjoint_ranges( wv1->words, wv1->size,
+                               wv2->words, wv2->size )) {
+      ws_new = ws1;
+   } else {
+      buf = ensure_scratch( wsu, wv1->size + wv2->size );
+      sz  = merge_minus( buf, wv1->words, wv1->size,
+                              wv2->words, wv2->size );
+      tl_assert(sz <= wv1->size);
+      ws_new = add_or_find_words( wsu, buf, sz );
+      if (sz == 0) {
+         tl_assert(ws_new == wsu->empty);
       }
    }
-   tl_assert(i1 <= wv1->size);
-   tl_assert(i2 <= wv2->size);
-   tl_assert(i1 == wv1->size || i2 == wv2->size);
-   if (i2 == wv2->size && i1 < wv1->size) {
-      while (i1 < wv1->size)
-         wv_new->words[k++] = wv1->words[i1++];
-   }
-
-   tl_assert(k == sz);
-
-   ws_new = add_or_dealloc_WordVec( wsu, wv_new );
-   if (sz == 0) {
-      tl_assert(ws_new == wsu->empty);
-   }
 
    tl_assert(ws_new != (WordSet)(-1));
    WCache_UPDATE(wsu->cache_minus, ws1, ws2, ws_new);
@@ -46,7 +46,9 @@ typedef  struct _WordSetU  WordSetU;  /* opaque */
 
 typedef  UInt              WordSet;   /* opaque, small int index */
 
-/* Allocate and initialise a WordSetU */
+/* Allocate and initialise a WordSetU.  cacheSize is the initial number
+   of entries in each of the operation caches; the caches then resize
+   themselves according to their hit pattern. */
 WordSetU* HG_(newWordSetU) ( void* (*alloc_nofail)( const HChar*, SizeT ),
                              const HChar* cc,
                              void  (*dealloc)(void*),
@@ -3368,6 +3368,8 @@ static ULong stats__cmpLEQ_queries = 0;
 static ULong stats__cmpLEQ_misses  = 0;
 static ULong stats__join2_queries  = 0;
 static ULong stats__join2_misses   = 0;
+static ULong stats__so_send_fast   = 0;
+static ULong stats__so_recv_fast   = 0;
 
 static inline UInt ROL32 ( UInt w, Int n ) {
    w = (w << n) | (w >> (32-n));
@@ -6401,6 +6403,10 @@ void libhb_shutdown ( Bool show_stats )
                   stats__cmpLEQ_queries, stats__cmpLEQ_misses);
       VG_(printf)("   libhb: %'13llu join2  queries (%'llu misses)\n",
                   stats__join2_queries, stats__join2_misses);
+      VG_(printf)("   libhb: %'13llu SO sends   (fast path)\n",
+                  stats__so_send_fast);
+      VG_(printf)("   libhb: %'13llu SO recvs   (fast path)\n",
+                  stats__so_recv_fast);
 
       VG_(printf)("%s","\n");
       VG_(printf)("   libhb: VTSops: tick %'lu,  join %'lu,  cmpLEQ %'lu\n",
@@ -6629,6 +6635,22 @@ void libhb_so_send ( Thr* thr, SO* so, Bool strong_send )
       so->viW = thr->viW;
       VtsID__rcinc(so->viR);
       VtsID__rcinc(so->viW);
+   } else if (!strong_send
+              && VtsID__cmpLEQ(so->viR, thr->viR)
+              && VtsID__cmpLEQ(so->viW, thr->viW)) {
+      /* Weak send on an SO whose clocks are already dominated by
+         those of the sender, which is the common case for an SO that
+         is repeatedly sent on by the same thread (e.g. the producer
+         side of a lock-free queue).  The join is then just the
+         sender's clocks, so install them without computing and
+         interning a new VTS. */
+      stats__so_send_fast++;
+      VtsID__rcdec(so->viR);
+      VtsID__rcdec(so->viW);
+      so->viR = thr->viR;
+      so->viW = thr->viW;
+      VtsID__rcinc(so->viR);
+      VtsID__rcinc(so->viW);
    } else {
       /* In a strong send, we dump any previous VC in the SO and
          install the sending thread's VC instead.  For a weak send we
@@ -6665,7 +6687,19 @@ void libhb_so_recv ( Thr* thr, SO* so, Bool strong_recv )
    tl_assert(so);
    tl_assert(so->magic == SO_MAGIC);
 
-   if (so->viR != VtsID_INVALID) {
+   if (so->viR != VtsID_INVALID
+       && VtsID__cmpLEQ(so->viR, thr->viR)
+       && (!strong_recv || VtsID__cmpLEQ(so->viW, thr->viW))) {
+      tl_assert(so->viW != VtsID_INVALID);
+      /* The receiver has already acquired everything the SO has to
+         offer, typically because it received on the same SO before
+         and nobody sent on it since.  The joins would leave the
+         receiver's clocks unchanged, so the filter and the recorded
+         stack remain valid too.  Nothing to do. */
+      stats__so_recv_fast++;
+      show_thread_state(strong_recv ? "s-recv" : "w-recv", thr);
+
+   } else if (so->viR != VtsID_INVALID) {
       tl_assert(so->viW != VtsID_INVALID);
 
       /* Weak receive (basically, an R-acquisition of a R-W lock).
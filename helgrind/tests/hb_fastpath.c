@@ -0,0 +1,196 @@
+/* Exercises the shortcuts Helgrind and DRD take for happens-before
+   annotations: the caches in front of the annotated-address lookup,
+   and the skipping of receives that do not add any ordering.
+
+   The threads are put in a fixed order by passing a token through
+   pipes, which neither tool treats as synchronisation, so the only
+   happens-before edges between the threads are the annotations (and
+   thread creation and join).  Each access that must be reported as a
+   race is done in its own function, so that the test only needs to
+   check the names of the functions in the race reports.
+
+   argv[1] says how the annotations on an address are dropped:
+   "forget" uses ANNOTATE_HAPPENS_BEFORE_FORGET_ALL (Helgrind), and
+   "free" frees the memory the address belongs to (DRD). */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../helgrind/helgrind.h"
+
+#define N_RING    4
+#define N_ROUNDS  50
+
+/* Annotated addresses.  tags is aligned such that tag0 and tag1 map
+   onto the same entry of DRD's annotation cache, and tag0 and tag2
+   onto the same entry of Helgrind's. */
+static char tags[0x4000] __attribute__((aligned(0x4000)));
+#define tag0 ((void*)&tags[0])
+#define tag1 ((void*)&tags[0x1000])
+#define tag2 ((void*)&tags[0x1004])
+static int ring_tag;
+
+static int pipes[N_RING][2];
+static int forget;
+
+static int counter;
+static int late;
+static int x0, x1, x2;
+static int evicted, reused;
+
+static void pass_token(int to, void* p)
+{
+   int r = write(pipes[to][1], &p, sizeof p);
+   assert(r == sizeof p);
+}
+
+static void* wait_token(int me)
+{
+   void* p;
+   int r = read(pipes[me][0], &p, sizeof p);
+   assert(r == sizeof p);
+   return p;
+}
+
+/* Several threads in turn receive on, and send on, the same address. */
+static void* ring_fn(void* arg)
+{
+   int me = (long)arg;
+   int i;
+
+   for (i = 0; i < N_ROUNDS; i++) {
+      wait_token(me);
+      ANNOTATE_HAPPENS_AFTER(&ring_tag);
+      counter++;
+      ANNOTATE_HAPPENS_BEFORE(&ring_tag);
+      if (i < N_ROUNDS - 1 || me < N_RING - 1)
+         pass_token((me + 1) % N_RING, NULL);
+   }
+   return NULL;
+}
+
+static int __attribute__((noinline)) read_late(void)    { return late; }
+static int __attribute__((noinline)) read_x2(void)      { return x2; }
+static int __attribute__((noinline)) read_x0(void)      { return x0; }
+static int __attribute__((noinline)) read_evicted(void) { return evicted; }
+
+/* Drops all happens-before annotations on p; returns the address to
+   use from then on. */
+static void* evict(void* p)
+{
+   if (forget) {
+      ANNOTATE_HAPPENS_BEFORE_FORGET_ALL(p);
+      return p;
+   }
+   free(p);
+   return malloc(sizeof(int));
+}
+
+static void* writer_fn(void* arg)
+{
+   void* e;
+
+   ANNOTATE_HAPPENS_BEFORE(tag0);
+   pass_token(1, NULL);
+   wait_token(0);
+
+   late = 1;
+   pass_token(1, NULL);
+   wait_token(0);
+
+   x1 = 1;
+   ANNOTATE_HAPPENS_BEFORE(tag1);
+   x2 = 1;
+   ANNOTATE_HAPPENS_BEFORE(tag2);
+   x0 = 1;
+   ANNOTATE_HAPPENS_BEFORE(tag0);
+   pass_token(1, NULL);
+   wait_token(0);
+
+   e = malloc(sizeof(int));
+   evicted = 1;
+   ANNOTATE_HAPPENS_BEFORE(e);
+   e = evict(e);
+   pass_token(1, e);
+   wait_token(0);
+
+   reused = 1;
+   ANNOTATE_HAPPENS_BEFORE(e);
+   pass_token(1, NULL);
+   wait_token(0);
+   free(e);
+   return NULL;
+}
+
+static void* reader_fn(void* arg)
+{
+   int  sum = 0;
+   void* e;
+
+   wait_token(1);
+   ANNOTATE_HAPPENS_AFTER(tag0);
+   pass_token(0, NULL);
+
+   /* Nothing has been sent on tag0 since the previous receive, so
+      this receive adds no ordering, and the write to 'late' races. */
+   wait_token(1);
+   ANNOTATE_HAPPENS_AFTER(tag0);
+   sum += read_late();
+   pass_token(0, NULL);
+
+   /* Each receive must see the send on its own address only, even
+      though the addresses share cache entries. */
+   wait_token(1);
+   ANNOTATE_HAPPENS_AFTER(tag1);
+   sum += x1;
+   sum += read_x2();
+   ANNOTATE_HAPPENS_AFTER(tag2);
+   sum += read_x0();
+   ANNOTATE_HAPPENS_AFTER(tag0);
+   sum += x0 + x1 + x2;
+   pass_token(0, NULL);
+
+   /* The send before evict() has been dropped ... */
+   e = wait_token(1);
+   ANNOTATE_HAPPENS_AFTER(e);
+   sum += read_evicted();
+   pass_token(0, NULL);
+
+   /* ... but a new one on the same address counts. */
+   wait_token(1);
+   ANNOTATE_HAPPENS_AFTER(e);
+   sum += reused;
+   pass_token(0, NULL);
+
+   return (void*)(long)sum;
+}
+
+int main(int argc, char** argv)
+{
+   pthread_t tid[N_RING];
+   void*     sum;
+   long      i;
+
+   assert(argc == 2);
+   forget = strcmp(argv[1], "forget") == 0;
+   for (i = 0; i < N_RING; i++)
+      assert(pipe(pipes[i]) == 0);
+
+   for (i = 0; i < N_RING; i++)
+      pthread_create(&tid[i], NULL, ring_fn, (void*)i);
+   pass_token(0, NULL);
+   for (i = 0; i < N_RING; i++)
+      pthread_join(tid[i], NULL);
+
+   pthread_create(&tid[0], NULL, writer_fn, NULL);
+   pthread_create(&tid[1], NULL, reader_fn, NULL);
+   pthread_join(tid[0], NULL);
+   pthread_join(tid[1], &sum);
+
+   fprintf(stderr, "counter: %d, sum: %ld\n", counter, (long)sum);
+   return 0;
+}
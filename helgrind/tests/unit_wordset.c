@@ -0,0 +1,240 @@
+/* Unit test for Helgrind's WordSet implementation (hg_wordset.c). */
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "helgrind/hg_wordset.c"
+
+
+/* Replacements for Valgrind core functionality. */
+
+void* VG_(memset)(void *s, Int c, SizeT sz)
+{ return memset(s, c, sz); }
+UInt VG_(printf)(const HChar *format, ...)
+{ UInt ret; va_list vargs; va_start(vargs, format); ret = vprintf(format, vargs); va_end(vargs); return ret; }
+void  VG_(assert_fail)(Bool isCore, const HChar* assertion, const HChar* file,
+                       Int line, const HChar* function, const HChar* format,
+                       ...)
+{
+  fprintf(stderr,
+          "%s:%u: %s%sAssertion `%s' failed.\n",
+          file,
+          line,
+          function ? (char*)function : "",
+          function ? ": " : "",
+          assertion);
+  fflush(stdout);
+  fflush(stderr);
+  abort();
+}
+
+static void* alloc_nofail(const HChar* cc, SizeT szB)
+{ void* p = malloc(szB); assert(p); return p; }
+
+
+/* Consistent random number generator, so that the test does the same
+   on all platforms. */
+
+static UInt seed = 0;
+static UInt myrandom(void)
+{
+  seed = 1103515245 * seed + 12345;
+  return seed >> 8;
+}
+
+
+/* Checks on the hash table which the set operations don't do. */
+
+static void check_vec2ix(WordSetU* wsu)
+{
+  UWord i, n_used = 0, n_tomb = 0;
+
+  for (i = 0; i < wsu->vec2ix_size; i++) {
+    if (wsu->vec2ix[i].wv == VHT_TOMBSTONE)
+      n_tomb++;
+    else if (wsu->vec2ix[i].wv != NULL)
+      n_used++;
+  }
+  assert(n_used == wsu->vec2ix_used);
+  assert(n_tomb == wsu->vec2ix_tomb);
+  assert(4 * (n_used + n_tomb) <= 3 * wsu->vec2ix_size);
+}
+
+/* Sets of up to 64 elements, as bit masks, and the corresponding
+   WordSets.  Element e is the word 0x1000 + 8 * e, so that the words
+   are not small integers. */
+
+#define ELEM(e) ((UWord)0x1000 + 8 * (e))
+
+static WordSet ws_of_mask(WordSetU* wsu, ULong mask)
+{
+  WordSet ws = HG_(emptyWS)(wsu);
+  int     e;
+
+  for (e = 0; e < 64; e++)
+    if (mask & (1ULL << e))
+      ws = HG_(addToWS)(wsu, ws, ELEM(e));
+  return ws;
+}
+
+static ULong mask_of_ws(WordSetU* wsu, WordSet ws)
+{
+  UWord* words;
+  UWord  n, i;
+  ULong  mask = 0;
+
+  HG_(getPayloadWS)(&words, &n, wsu, ws);
+  for (i = 0; i < n; i++) {
+    assert(i == 0 || words[i-1] < words[i]);
+    assert(words[i] >= ELEM(0) && words[i] <= ELEM(63));
+    assert((words[i] - ELEM(0)) % 8 == 0);
+    mask |= 1ULL << ((words[i] - ELEM(0)) / 8);
+  }
+  return mask;
+}
+
+/* A random set within elements lo .. hi-1. */
+static ULong random_mask(int lo, int hi)
+{
+  ULong mask = 0;
+  int   e;
+
+  for (e = lo; e < hi; e++)
+    if (myrandom() % 3 == 0)
+      mask |= 1ULL << e;
+  return mask;
+}
+
+
+/* Actual unit tests */
+
+static void test_interning(void)
+{
+  WordSetU* wsu = HG_(newWordSetU)(alloc_nofail, "unit_wordset", free, 8);
+  WordSet   a, b, c, d;
+  UWord     used, tomb;
+
+  a = HG_(doubletonWS)(wsu, ELEM(2), ELEM(1));
+  b = HG_(addToWS)(wsu, HG_(singletonWS)(wsu, ELEM(1)), ELEM(2));
+  assert(a == b);
+  assert(HG_(cardinalityWS)(wsu, a) == 2);
+  assert(HG_(elemWS)(wsu, a, ELEM(1)) && !HG_(elemWS)(wsu, a, ELEM(3)));
+  assert(HG_(delFromWS)(wsu, a, ELEM(2)) == HG_(singletonWS)(wsu, ELEM(1)));
+  assert(HG_(isEmptyWS)(wsu, HG_(delFromWS)(wsu, HG_(singletonWS)(wsu, ELEM(5)), ELEM(5))));
+  c = HG_(addToWS)(wsu, a, ELEM(3));
+  check_vec2ix(wsu);
+
+  /* Kill c, and intern the same contents again: the probe sequence
+     is the same, so it ends at c's tombstone, which is reused along
+     with c's number. */
+  used = wsu->vec2ix_used;
+  tomb = wsu->vec2ix_tomb;
+  HG_(dieWS)(wsu, c);
+  assert(wsu->vec2ix_used == used - 1);
+  assert(wsu->vec2ix_tomb == tomb + 1);
+  check_vec2ix(wsu);
+  d = HG_(addToWS)(wsu, a, ELEM(3));
+  assert(d == c);
+  assert(mask_of_ws(wsu, d) == 0xe);
+  assert(wsu->vec2ix_used == used);
+  assert(wsu->vec2ix_tomb == tomb);
+  check_vec2ix(wsu);
+  printf("interning, dieWS and tombstone reuse: ok\n");
+
+  HG_(deleteWordSetU)(wsu);
+}
+
+static void test_rehash(void)
+{
+  WordSetU* wsu = HG_(newWordSetU)(alloc_nofail, "unit_wordset", free, 8);
+  WordSet   ws[1000];
+  UWord     size0 = wsu->vec2ix_size;
+  int       i, round;
+
+  /* Enough sets to make the table grow. */
+  for (i = 0; i < 1000; i++) {
+    ws[i] = HG_(doubletonWS)(wsu, ELEM(0) + 8 * i, ELEM(0) + 8 * (i + 1000));
+    check_vec2ix(wsu);
+  }
+  assert(wsu->vec2ix_size > size0);
+  assert(wsu->n_vht_rehash > 0);
+  for (i = 0; i < 1000; i++)
+    assert(HG_(doubletonWS)(wsu, ELEM(0) + 8 * i, ELEM(0) + 8 * (i + 1000))
+           == ws[i]);
+
+  /* Kill and re-create sets, so that tombstones pile up and force
+     rehashes at the same size. */
+  for (round = 0; round < 20; round++) {
+    for (i = round % 2; i < 1000; i += 2)
+      HG_(dieWS)(wsu, ws[i]);
+    check_vec2ix(wsu);
+    for (i = round % 2; i < 1000; i += 2)
+      ws[i] = HG_(doubletonWS)(wsu, ELEM(0) + 8 * i,
+                                    ELEM(0) + 8 * (i + 1000 + round + 1));
+    check_vec2ix(wsu);
+  }
+  for (i = 0; i < 1000; i++) {
+    UWord* words;
+    UWord  n;
+    HG_(getPayloadWS)(&words, &n, wsu, ws[i]);
+    assert(n == 2 && words[0] == ELEM(0) + 8 * i);
+  }
+  assert(HG_(cardinalityWSU)(wsu) <= 1001);
+  printf("rehash: ok\n");
+
+  HG_(deleteWordSetU)(wsu);
+}
+
+/* Ranges the operands are drawn from:  overlapping, identical,
+   adjacent and disjoint in either order. */
+static const int ranges[][4] = {
+  { 0, 40, 20, 64 }, { 0, 64, 0, 64 }, { 0, 32, 32, 64 },
+  { 0, 20, 40, 64 }, { 40, 64, 0, 20 }, { 10, 50, 20, 30 },
+};
+
+static void test_set_ops(void)
+{
+  WordSetU* wsu = HG_(newWordSetU)(alloc_nofail, "unit_wordset", free, 8);
+  int       i, r, n_ops = 0;
+
+  for (i = 0; i < 1000; i++) {
+    for (r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+      ULong   m1  = random_mask(ranges[r][0], ranges[r][1]);
+      ULong   m2  = random_mask(ranges[r][2], ranges[r][3]);
+      WordSet ws1 = ws_of_mask(wsu, m1);
+      WordSet ws2 = ws_of_mask(wsu, m2);
+
+      assert(mask_of_ws(wsu, ws1) == m1);
+      assert(mask_of_ws(wsu, HG_(unionWS)(wsu, ws1, ws2)) == (m1 | m2));
+      assert(mask_of_ws(wsu, HG_(intersectWS)(wsu, ws1, ws2)) == (m1 & m2));
+      assert(mask_of_ws(wsu, HG_(minusWS)(wsu, ws1, ws2)) == (m1 & ~m2));
+      assert(mask_of_ws(wsu, HG_(minusWS)(wsu, ws2, ws1)) == (m2 & ~m1));
+      assert(HG_(isSubsetOf)(wsu, ws1, ws2) == ((m1 & ~m2) == 0));
+      n_ops += 5;
+
+      /* Repeat a query, for the caches, and now and then kill a set,
+         which must flush them. */
+      assert(mask_of_ws(wsu, HG_(unionWS)(wsu, ws2, ws1)) == (m1 | m2));
+      if (i % 7 == 0 && m1 != 0 && ws1 != ws2) {
+        HG_(dieWS)(wsu, ws1);
+        assert(mask_of_ws(wsu, HG_(unionWS)(wsu, ws_of_mask(wsu, m1), ws2))
+               == (m1 | m2));
+      }
+    }
+    if (i % 100 == 0)
+      check_vec2ix(wsu);
+  }
+  printf("union, intersect and minus: ok (%d checks)\n", n_ops);
+
+  HG_(deleteWordSetU)(wsu);
+}
+
+int main(int argc, char** argv)
+{
+  test_interning();
+  test_rehash();
+  test_set_ops();
+  return 0;
+}
@@ -123,6 +123,13 @@ Bool VG_(get_data_description)(
    It doesn't matter if debug info is present or not. */
 extern Bool VG_(get_objname)  ( Addr a, const HChar** objname );
 
+/* returns the "generation" of the debug info.
+   Each time some debuginfo is changed (e.g. loaded or unloaded),
+   the VG_(debuginfo_generation)() value returned will be increased.
+   This can be used to flush cached information derived from debug
+   info (e.g. CFI info or FPO info or function names ...). */
+extern UInt VG_(debuginfo_generation) (void);
+
 
 /* Cursor allowing to describe inlined function calls at an IP,
    by doing successive calls to VG_(describe_IP). */
@@ -109,6 +109,10 @@ extern UInt    VG_(fprintf)  ( VgFile *fp, const HChar *format, ... )
                                PRINTF_CHECK(2, 3);
 extern UInt    VG_(vfprintf) ( VgFile *fp, const HChar *format, va_list vargs )
                                PRINTF_CHECK(2, 0);
+/* Write n raw bytes, through the same buffer as VG_(fprintf). */
+extern void    VG_(fwrite)   ( VgFile *fp, const void *buf, SizeT n );
+/* Write out the buffered output, without closing the file. */
+extern void    VG_(fflush)   ( VgFile *fp );
 
 /* Do a printf-style operation on either the XML 
    or normal output channel
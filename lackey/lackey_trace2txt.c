@@ -0,0 +1,116 @@
+/*--------------------------------------------------------------------*/
+/*--- Convert binary Lackey memory traces to text.                 ---*/
+/*---                                           lackey_trace2txt.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Lackey, an example Valgrind tool that does
+   some simple program measurement and tracing.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Prints a trace written with --trace-mem-format=binary in the format
+   of --trace-mem=yes, see the comment at the top of lk_main.c.  With
+   -t, a line "T <tid>" is printed whenever another thread runs. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lk_trace_reader.h"
+
+static const char* argv0 = "lackey_trace2txt";
+
+static void usage ( void )
+{
+   fprintf(stderr, "usage: %s [-t] [-o outfile] [lackey.trace.file]\n",
+           argv0);
+   exit(1);
+}
+
+int main ( int argc, char** argv )
+{
+   static const char* fmt[4] = {
+      "I  %08llx,%u\n", " L %08llx,%u\n", " S %08llx,%u\n", " M %08llx,%u\n"
+   };
+   const char*    in_name = "-";
+   FILE*          out = stdout;
+   int            show_threads = 0;
+   unsigned int   tid = 0;
+   LkTraceReader* r;
+   LkTraceEvent   ev;
+   int            i, res;
+
+   if (argv[0])
+      argv0 = argv[0];
+
+   for (i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
+         usage();
+      else if (!strcmp(argv[i], "-t"))
+         show_threads = 1;
+      else if (!strcmp(argv[i], "-o")) {
+         if (++i == argc)
+            usage();
+         out = fopen(argv[i], "w");
+         if (!out) {
+            perror(argv0);
+            exit(1);
+         }
+      }
+      else if (!strcmp(in_name, "-"))
+         in_name = argv[i];
+      else
+         usage();
+   }
+
+   r = lk_trace_open(in_name);
+   if (!r) {
+      fprintf(stderr, "%s: %s: %s\n", argv0, in_name,
+              errno == EINVAL ? "not a binary Lackey trace"
+                              : strerror(errno));
+      exit(1);
+   }
+
+   setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+   while ((res = lk_trace_next(r, &ev)) > 0) {
+      if (show_threads && ev.tid != tid) {
+         fprintf(out, "T %u\n", ev.tid);
+         tid = ev.tid;
+      }
+      fprintf(out, fmt[ev.kind], ev.addr, ev.size);
+   }
+   if (res < 0) {
+      fprintf(stderr, "%s: %s: %s\n", argv0, in_name, lk_trace_error(r));
+      exit(1);
+   }
+   lk_trace_close(r);
+
+   if (fclose(out) != 0) {
+      perror(argv0);
+      exit(1);
+   }
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                         lackey_trace2txt.c ---*/
+/*--------------------------------------------------------------------*/
@@ -136,6 +136,38 @@
 // wide range of purposes.  For example, Cachegrind shares all the above
 // shortcomings and it is still useful.
 //
+// Binary traces: --trace-mem-format=binary
+// -----------------------------------------
+// Printing every access as a line of text is slow, and makes for huge
+// traces.  With --trace-mem-format=binary (which implies --trace-mem=yes),
+// the same events are instead encoded into a large buffer, which is written
+// to the file given by --trace-mem-out-file whenever it fills up, or when
+// another thread starts running.  As Valgrind runs one thread at a time,
+// the events in the file are in the order in which they were executed.
+// After a fork, the child reopens --trace-mem-out-file (expanded again,
+// so that %p gives it a file of its own) and writes its events there.
+//
+// The file starts with the line "# lackey trace binary 1", followed by
+// chunks.  A chunk is a header of two 32 bit little-endian numbers, the
+// Valgrind thread id of the thread that executed the chunk's events and
+// the number of bytes of events that follow.  Each event is
+//
+//   - a byte, holding the kind of event in the low two bits (0: I, 1: L,
+//     2: S, 3: M), and the size in the upper six bits, or 63 if the size
+//     is too big for that, in which case the size follows as a varint
+//   - the difference between the event's address and the address of the
+//     previous instruction event (for I) or data event (for L, S and M)
+//     of the chunk, zigzag-encoded as a varint; the previous address is
+//     zero at the start of each chunk
+//
+// Varints are unsigned LEB128: seven bits per byte, least significant
+// first, and the top bit set in all but the last byte.  A typical event
+// takes two or three bytes.
+//
+// lackey_trace2txt prints a binary trace in the text format above.  The
+// files lk_trace_reader.h and lk_trace_reader.c are a small library for
+// reading binary traces from other programs, eg. cache simulators.
+//
 // For further inspiration, you should look at cachegrind/cg_main.c which
 // uses the same basic technique for tracing memory accesses, but also groups
 // events together for processing into twos and threes so that fewer C calls
@@ -177,6 +209,10 @@
 #include "pub_tool_libcbase.h"
 #include "pub_tool_options.h"
 #include "pub_tool_machine.h"     // VG_(fnptr_to_fnentry)
+#include "pub_tool_vki.h"         // VKI_O_CREAT etc.
+#include "pub_tool_libcproc.h"    // VG_(atfork)
+#include "pub_tool_threadstate.h" // VG_INVALID_THREADID
+#include "pub_tool_mallocfree.h"
 
 /*------------------------------------------------------------*/
 /*--- Command line options                                 ---*/
@@ -189,6 +225,11 @@ static Bool clo_detailed_counts = False;
 static Bool clo_trace_mem       = False;
 static Bool clo_trace_sbs       = False;
 
+/* Format and destination of the --trace-mem output.  Text is printed
+ * like the rest of Lackey's output, binary is written to the file. */
+static Bool clo_trace_mem_binary = False;
+static const HChar* clo_trace_mem_out_file = "lackey.trace.%p";
+
 /* The name of the function of which the number of calls (under
  * --basic-counts=yes) is to be counted, with default. Override with command
  * line option --fnname. */
@@ -201,6 +242,11 @@ static Bool lk_process_cmd_line_option(const HChar* arg)
    else if VG_BOOL_CLO(arg, "--detailed-counts",   clo_detailed_counts) {}
    else if VG_BOOL_CLO(arg, "--trace-mem",         clo_trace_mem) {}
    else if VG_BOOL_CLO(arg, "--trace-superblocks", clo_trace_sbs) {}
+   else if VG_XACT_CLO(arg, "--trace-mem-format=text",
+                            clo_trace_mem_binary, False) {}
+   else if VG_XACT_CLO(arg, "--trace-mem-format=binary",
+                            clo_trace_mem_binary, True) {}
+   else if VG_STR_CLO(arg, "--trace-mem-out-file", clo_trace_mem_out_file) {}
    else
       return False;
    
@@ -215,6 +261,10 @@ static void lk_print_usage(void)
 "    --basic-counts=no|yes     count instructions, jumps, etc. [yes]\n"
 "    --detailed-counts=no|yes  count loads, stores and alu ops [no]\n"
 "    --trace-mem=no|yes        trace all loads and stores [no]\n"
+"    --trace-mem-format=text|binary  format of the --trace-mem output;\n"
+"                              binary implies --trace-mem=yes [text]\n"
+"    --trace-mem-out-file=<file>  file for the binary trace\n"
+"                              [lackey.trace.%%p]\n"
 "    --trace-superblocks=no|yes  trace all superblock entries [no]\n"
 "    --fnname=<name>           count calls to <name> (only used if\n"
 "                              --basic-count=yes)  [main]\n"
@@ -474,6 +524,174 @@ static VG_REGPARM(2) void trace_modify(Addr addr, SizeT size)
    VG_(printf)(" M %08lx,%lu\n", addr, size);
 }
 
+/* --- The binary trace, see the comment at the top of this file --- */
+
+/* Size of the buffer, and the most bytes an event can take. */
+#define TRACE_BUF_SIZE   (1 << 20)
+#define TRACE_MAX_EVENT  (1 + 10 + 10)
+#define TRACE_CHUNK_HDR  8
+
+static VgFile*  trace_fp         = NULL;
+static UChar*   trace_buf        = NULL;  /* chunk header, then events */
+static UChar*   trace_ptr        = NULL;  /* where the next event goes */
+static UChar*   trace_limit      = NULL;  /* flush when trace_ptr passes */
+static ThreadId trace_tid        = VG_INVALID_THREADID;
+static ULong    trace_prev_iaddr = 0;
+static ULong    trace_prev_daddr = 0;
+static ULong    trace_n_events   = 0;
+static ULong    trace_n_bytes    = 0;
+
+static void trace_put_uint(UInt n, UChar* p)
+{
+   p[0] = n & 0xff;
+   p[1] = (n >> 8) & 0xff;
+   p[2] = (n >> 16) & 0xff;
+   p[3] = (n >> 24) & 0xff;
+}
+
+/* Writes the events of the running thread as one chunk, and starts a
+   new chunk. */
+static void trace_flush(void)
+{
+   UInt len = trace_ptr - trace_buf - TRACE_CHUNK_HDR;
+
+   if (len > 0) {
+      trace_put_uint(trace_tid, trace_buf);
+      trace_put_uint(len, trace_buf + 4);
+      VG_(fwrite)(trace_fp, trace_buf, TRACE_CHUNK_HDR + len);
+      trace_n_bytes += TRACE_CHUNK_HDR + len;
+   }
+   trace_ptr        = trace_buf + TRACE_CHUNK_HDR;
+   trace_prev_iaddr = 0;
+   trace_prev_daddr = 0;
+}
+
+static __inline__ UChar* trace_put_varint(UChar* p, ULong v)
+{
+   while (v >= 0x80) {
+      *p++ = (v & 0x7f) | 0x80;
+      v >>= 7;
+   }
+   *p++ = v;
+   return p;
+}
+
+static __inline__
+void trace_event(UInt kind, Addr addr, SizeT size, ULong* prev)
+{
+   UChar* p = trace_ptr;
+   Long   d = (Long)((ULong)addr - *prev);
+
+   *prev = addr;
+   if (size < 63) {
+      *p++ = kind | (size << 2);
+   } else {
+      *p++ = kind | (63 << 2);
+      p = trace_put_varint(p, size);
+   }
+   trace_ptr = trace_put_varint(p, ((ULong)d << 1) ^ (ULong)(d >> 63));
+   trace_n_events++;
+
+   if (UNLIKELY(trace_ptr > trace_limit))
+      trace_flush();
+}
+
+static VG_REGPARM(2) void trace_bin_instr(Addr addr, SizeT size)
+{
+   trace_event(0, addr, size, &trace_prev_iaddr);
+}
+
+static VG_REGPARM(2) void trace_bin_load(Addr addr, SizeT size)
+{
+   trace_event(1, addr, size, &trace_prev_daddr);
+}
+
+static VG_REGPARM(2) void trace_bin_store(Addr addr, SizeT size)
+{
+   trace_event(2, addr, size, &trace_prev_daddr);
+}
+
+static VG_REGPARM(2) void trace_bin_modify(Addr addr, SizeT size)
+{
+   trace_event(3, addr, size, &trace_prev_daddr);
+}
+
+/* Events of different threads go into different chunks. */
+static void trace_start_client_code(ThreadId tid, ULong blocks_done)
+{
+   if (tid != trace_tid) {
+      trace_flush();
+      trace_tid = tid;
+   }
+}
+
+/* A forked child (see trace_atfork_child) writes a file of its own.  If
+   the name does not depend on the pid, it gets ".<pid>" appended, so
+   that the child does not truncate the file its parent is writing. */
+static void trace_open_file(Bool in_child)
+{
+   HChar* name = VG_(expand_file_name)("--trace-mem-out-file",
+                                       clo_trace_mem_out_file);
+
+   if (in_child && !VG_(strstr)(clo_trace_mem_out_file, "%p")
+                && !VG_(strstr)(clo_trace_mem_out_file, "%q")) {
+      HChar* pid_name = VG_(malloc)("lk.trace_open_file.1",
+                                    VG_(strlen)(name) + 16);
+      VG_(sprintf)(pid_name, "%s.%d", name, VG_(getpid)());
+      VG_(free)(name);
+      name = pid_name;
+   }
+
+   trace_fp = VG_(fopen)(name, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                         VKI_S_IRUSR|VKI_S_IWUSR|VKI_S_IRGRP|VKI_S_IWGRP);
+   if (trace_fp == NULL) {
+      VG_(umsg)("error: can't open memory trace file '%s'\n", name);
+      VG_(exit)(1);
+   }
+   VG_(free)(name);
+   VG_(fprintf)(trace_fp, "# lackey trace binary 1\n");
+}
+
+/* Write out the parent's events before fork, so that they are neither
+   lost nor written a second time by the child. */
+static void trace_atfork_pre(ThreadId tid)
+{
+   trace_flush();
+   VG_(fflush)(trace_fp);
+}
+
+/* The child traces into a file of its own, rather than interleaving
+   its chunks with the parent's in the shared file.  Closing the
+   inherited copy is harmless, as it was flushed before the fork. */
+static void trace_atfork_child(ThreadId tid)
+{
+   VG_(fclose)(trace_fp);
+   trace_open_file(True/*in_child*/);
+   trace_n_events = 0;
+   trace_n_bytes  = 0;
+}
+
+static void trace_open(void)
+{
+   trace_open_file(False/*!in_child*/);
+
+   trace_buf   = VG_(malloc)("lk.trace_open.1", TRACE_BUF_SIZE);
+   trace_limit = trace_buf + TRACE_BUF_SIZE - TRACE_MAX_EVENT;
+   trace_ptr   = trace_buf + TRACE_CHUNK_HDR;
+
+   VG_(track_start_client_code)(trace_start_client_code);
+   VG_(atfork)(trace_atfork_pre, NULL, trace_atfork_child);
+}
+
+static void trace_close(void)
+{
+   trace_flush();
+   VG_(fclose)(trace_fp);
+   if (VG_(clo_verbosity) > 1)
+      VG_(umsg)("Memory trace: %'llu events in %'llu bytes\n",
+                trace_n_events, trace_n_bytes);
+}
+
 
 static void flushEvents(IRSB* sb)
 {
@@ -489,20 +707,38 @@ static void flushEvents(IRSB* sb)
       ev = &events[i];
       
       // Decide on helper fn to call and args to pass it.
-      switch (ev->ekind) {
-         case Event_Ir: helperName = "trace_instr";
-                        helperAddr =  trace_instr;  break;
+      if (!clo_trace_mem_binary) {
+         switch (ev->ekind) {
+            case Event_Ir: helperName = "trace_instr";
+                           helperAddr =  trace_instr;  break;
 
-         case Event_Dr: helperName = "trace_load";
-                        helperAddr =  trace_load;   break;
+            case Event_Dr: helperName = "trace_load";
+                           helperAddr =  trace_load;   break;
 
-         case Event_Dw: helperName = "trace_store";
-                        helperAddr =  trace_store;  break;
+            case Event_Dw: helperName = "trace_store";
+                           helperAddr =  trace_store;  break;
 
-         case Event_Dm: helperName = "trace_modify";
-                        helperAddr =  trace_modify; break;
-         default:
-            tl_assert(0);
+            case Event_Dm: helperName = "trace_modify";
+                           helperAddr =  trace_modify; break;
+            default:
+               tl_assert(0);
+         }
+      } else {
+         switch (ev->ekind) {
+            case Event_Ir: helperName = "trace_bin_instr";
+                           helperAddr =  trace_bin_instr;  break;
+
+            case Event_Dr: helperName = "trace_bin_load";
+                           helperAddr =  trace_bin_load;   break;
+
+            case Event_Dw: helperName = "trace_bin_store";
+                           helperAddr =  trace_bin_store;  break;
+
+            case Event_Dm: helperName = "trace_bin_modify";
+                           helperAddr =  trace_bin_modify; break;
+            default:
+               tl_assert(0);
+         }
       }
 
       // Add the helper.
@@ -647,6 +883,11 @@ static void lk_post_clo_init(void)
          for (tyIx = 0; tyIx < N_TYPES; tyIx++)
             detailCounts[op][tyIx] = 0;
    }
+
+   if (clo_trace_mem_binary) {
+      clo_trace_mem = True;
+      trace_open();
+   }
 }
 
 static
@@ -1042,6 +1283,9 @@ static void lk_fini(Int exitcode)
       VG_(umsg)("\n");
       VG_(umsg)("Exit code:       %d\n", exitcode);
    }
+
+   if (clo_trace_mem_binary)
+      trace_close();
 }
 
 static void lk_pre_clo_init(void)
@@ -0,0 +1,184 @@
+/*--------------------------------------------------------------------*/
+/*--- Reader for Lackey's binary memory traces.  lk_trace_reader.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Lackey, an example Valgrind tool that does
+   some simple program measurement and tracing.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* See the comment on the binary trace format in lk_main.c.  A whole
+   chunk is read with one fread() and then decoded from memory. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lk_trace_reader.h"
+
+#define LK_TRACE_MAGIC  "# lackey trace binary 1\n"
+
+struct _LkTraceReader {
+   FILE*                in;
+   const char*          error;
+   unsigned char*       chunk;       /* records of the current chunk */
+   size_t               chunk_size;  /* allocated size of 'chunk' */
+   const unsigned char* ptr;         /* next record */
+   const unsigned char* end;         /* end of the current chunk */
+   unsigned int         tid;         /* thread of the current chunk */
+   unsigned long long   prev_iaddr;  /* previous instruction address */
+   unsigned long long   prev_daddr;  /* previous data address */
+};
+
+LkTraceReader* lk_trace_open ( const char* name )
+{
+   char           magic[sizeof(LK_TRACE_MAGIC) - 1];
+   LkTraceReader* r;
+   FILE*          in;
+
+   if (strcmp(name, "-") == 0)
+      in = stdin;
+   else if ((in = fopen(name, "rb")) == NULL)
+      return NULL;
+
+   if (fread(magic, 1, sizeof(magic), in) != sizeof(magic)
+       || memcmp(magic, LK_TRACE_MAGIC, sizeof(magic)) != 0) {
+      if (in != stdin)
+         fclose(in);
+      errno = EINVAL;
+      return NULL;
+   }
+
+   r = calloc(1, sizeof(LkTraceReader));
+   if (r == NULL) {
+      if (in != stdin)
+         fclose(in);
+      return NULL;
+   }
+   r->in = in;
+   return r;
+}
+
+/* Reads the next chunk.  Returns 1 on success, 0 at the end of the
+   file, -1 on error. */
+static int read_chunk ( LkTraceReader* r )
+{
+   unsigned char hdr[8];
+   size_t        n, len;
+
+   n = fread(hdr, 1, sizeof(hdr), r->in);
+   if (n == 0 && feof(r->in))
+      return 0;
+   if (n != sizeof(hdr)) {
+      r->error = ferror(r->in) ? strerror(errno) : "truncated chunk header";
+      return -1;
+   }
+   r->tid = (unsigned int)hdr[0] | ((unsigned int)hdr[1] << 8) |
+            ((unsigned int)hdr[2] << 16) | ((unsigned int)hdr[3] << 24);
+   len    = (size_t)hdr[4] | ((size_t)hdr[5] << 8) |
+            ((size_t)hdr[6] << 16) | ((size_t)hdr[7] << 24);
+
+   if (len > r->chunk_size) {
+      unsigned char* chunk = realloc(r->chunk, len);
+      if (chunk == NULL) {
+         r->error = "out of memory";
+         return -1;
+      }
+      r->chunk      = chunk;
+      r->chunk_size = len;
+   }
+   if (fread(r->chunk, 1, len, r->in) != len) {
+      r->error = ferror(r->in) ? strerror(errno) : "truncated chunk";
+      return -1;
+   }
+   r->ptr        = r->chunk;
+   r->end        = r->chunk + len;
+   r->prev_iaddr = 0;
+   r->prev_daddr = 0;
+   return 1;
+}
+
+static int get_uint ( LkTraceReader* r, unsigned long long* v )
+{
+   unsigned long long res = 0;
+   int                shift = 0;
+
+   while (r->ptr < r->end && shift <= 63) {
+      unsigned char b = *r->ptr++;
+      res |= (unsigned long long)(b & 0x7f) << shift;
+      if (!(b & 0x80)) {
+         *v = res;
+         return 1;
+      }
+      shift += 7;
+   }
+   r->error = "truncated record";
+   return 0;
+}
+
+int lk_trace_next ( LkTraceReader* r, LkTraceEvent* ev )
+{
+   unsigned long long  v;
+   unsigned long long* prev;
+   unsigned char       h;
+
+   while (r->ptr == r->end) {
+      int res = read_chunk(r);
+      if (res <= 0)
+         return res;
+   }
+
+   h        = *r->ptr++;
+   ev->kind = (LkTraceKind)(h & 3);
+   ev->size = h >> 2;
+   ev->tid  = r->tid;
+   if (ev->size == 63) {
+      if (!get_uint(r, &v))
+         return -1;
+      ev->size = (unsigned int)v;
+   }
+
+   /* Zigzag-encoded difference to the previous address of the same
+      class (instruction or data). */
+   if (!get_uint(r, &v))
+      return -1;
+   prev     = ev->kind == LkT_Instr ? &r->prev_iaddr : &r->prev_daddr;
+   *prev   += (v >> 1) ^ (0ULL - (v & 1));
+   ev->addr = *prev;
+   return 1;
+}
+
+const char* lk_trace_error ( const LkTraceReader* r )
+{
+   return r->error ? r->error : "no error";
+}
+
+void lk_trace_close ( LkTraceReader* r )
+{
+   if (r->in != stdin)
+      fclose(r->in);
+   free(r->chunk);
+   free(r);
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                        lk_trace_reader.c ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,95 @@
+/*--------------------------------------------------------------------*/
+/*--- Reader for Lackey's binary memory traces.  lk_trace_reader.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Lackey, an example Valgrind tool that does
+   some simple program measurement and tracing.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* This is a small, self-contained library for reading the traces
+   written by "valgrind --tool=lackey --trace-mem=yes
+   --trace-mem-format=binary".  It only depends on the C library, so
+   lk_trace_reader.h and lk_trace_reader.c can simply be copied into
+   the sources of a trace consumer, such as a cache simulator.
+
+   Typical use:
+
+      LkTraceReader* r = lk_trace_open("lackey.trace.1234");
+      LkTraceEvent   ev;
+      int            res;
+
+      if (!r) { perror("lackey.trace.1234"); exit(1); }
+      while ((res = lk_trace_next(r, &ev)) > 0)
+         simulate(ev.kind, ev.addr, ev.size);
+      if (res < 0)
+         fprintf(stderr, "%s\n", lk_trace_error(r));
+      lk_trace_close(r);
+
+   The events are returned in the order the program executed them,
+   also for multi-threaded programs. */
+
+#ifndef __LK_TRACE_READER_H
+#define __LK_TRACE_READER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The kinds of events, as in the text trace: an instruction fetch
+   ("I"), a data load ("L"), store ("S") or modify ("M"). */
+typedef
+   enum { LkT_Instr = 0, LkT_Load = 1, LkT_Store = 2, LkT_Modify = 3 }
+   LkTraceKind;
+
+typedef
+   struct {
+      LkTraceKind        kind;
+      unsigned int       size;  /* in bytes */
+      unsigned int       tid;   /* Valgrind's number of the thread */
+      unsigned long long addr;
+   }
+   LkTraceEvent;
+
+typedef struct _LkTraceReader LkTraceReader;
+
+/* Opens the trace file 'name', or standard input if 'name' is "-".
+   Returns NULL, with errno set, if the file cannot be opened, and also
+   (with errno set to EINVAL) if it is not a binary Lackey trace. */
+extern LkTraceReader* lk_trace_open ( const char* name );
+
+/* Reads the next event into *ev.  Returns 1 if there was one, 0 at the
+   end of the trace and -1 if the trace is damaged or cannot be read. */
+extern int lk_trace_next ( LkTraceReader* r, LkTraceEvent* ev );
+
+/* After lk_trace_next() returned -1, describes the problem. */
+extern const char* lk_trace_error ( const LkTraceReader* r );
+
+extern void lk_trace_close ( LkTraceReader* r );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif   // __LK_TRACE_READER_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                        lk_trace_reader.h ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,35 @@
+// Does some work in a forked child and in the parent, for tracing into
+// separate files.
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int work(int n)
+{
+   volatile int s = 0;
+   int i;
+   for (i = 0; i < n; i++)
+      s += i;
+   return s;
+}
+
+int main(void)
+{
+   pid_t pid;
+
+   work(1000);
+   pid = fork();
+   if (pid < 0) {
+      perror("fork");
+      return 1;
+   }
+   if (pid == 0) {
+      work(2000);
+      _exit(0);
+   }
+   waitpid(pid, NULL, 0);
+   work(3000);
+   return 0;
+}
@@ -69,10 +69,9 @@
 //   [Introduction of --time-unit=i as the default slowed things down by
 //   roughly 0--20%.]
 //
-// - get_XCon accounts for about 9% of konqueror startup time.  Try
-//   keeping XPt children sorted by 'ip' and use binary search in get_XCon.
-//   Requires factoring out binary search code from various places into a
-//   VG_(bsearch) function.  
+// - get_XCon used to account for about 9% of konqueror startup time.  It
+//   now has a cache of allocation sites, and XPts with many children have
+//   an index of them;  see get_XCon.
 //
 // Todo -- low priority:
 // - In each XPt, record both bytes and the number of allocations, and
@@ -178,6 +177,8 @@ Number of snapshots: 50
 
 #include "pub_tool_clreq.h"           // For {MALLOC,FREE}LIKE_BLOCK
 
+#include "massif.h"
+
 //------------------------------------------------------------*/
 //--- Overview of operation                                ---*/
 //------------------------------------------------------------*/
@@ -252,6 +253,11 @@ static UInt n_detailed_snapshots    = 0;
 static UInt n_peak_snapshots        = 0;
 static UInt n_cullings              = 0;
 static UInt n_XCon_redos            = 0;
+static UInt n_site_cache_hits       = 0;
+static UInt n_site_cache_misses     = 0;
+static UInt n_site_cache_flushes    = 0;
+static UInt n_xpt_child_indexes     = 0;
+static UInt n_arena_switches        = 0;
 
 //------------------------------------------------------------//
 //--- Globals                                              ---//
@@ -385,6 +391,14 @@ static const HChar* TimeUnit_to_string(TimeUnit time_unit)
    }
 }
 
+typedef
+   enum {
+      SplitNone,
+      SplitThread,
+      SplitArena
+   }
+   SplitBy;
+
 static Bool   clo_heap            = True;
    // clo_heap_admin is deliberately a word-sized type.  At one point it was
    // a UInt, but this caused problems on 64-bit machines when it was
@@ -399,6 +413,10 @@ static double clo_peak_inaccuracy = 1.0;  // percentage
 static Int    clo_time_unit       = TimeI;
 static Int    clo_detailed_freq   = 10;
 static Int    clo_max_snapshots   = 100;
+static Bool   clo_stream_snapshots = False;
+static Long   clo_stream_interval = 0;    // 0 means adaptive
+static Int    clo_split           = SplitNone;
+static Bool   clo_site_cache      = True;   // debugging only
 static const HChar* clo_massif_out_file = "massif.out.%p";
 
 static XArray* args_for_massif;
@@ -443,8 +461,18 @@ static Bool ms_process_cmd_line_option(const HChar* arg)
 
    else if VG_BINT_CLO(arg, "--max-snapshots",  clo_max_snapshots, 10, 1000) {}
 
+   else if VG_BOOL_CLO(arg, "--stream-snapshots", clo_stream_snapshots) {}
+   else if VG_BINT_CLO(arg, "--stream-interval", clo_stream_interval,
+                       0, 0x7fffffffffffffffLL) {}
+
+   else if VG_XACT_CLO(arg, "--split=none",     clo_split, SplitNone)   {}
+   else if VG_XACT_CLO(arg, "--split=thread",   clo_split, SplitThread) {}
+   else if VG_XACT_CLO(arg, "--split=arena",    clo_split, SplitArena)  {}
+
    else if VG_STR_CLO(arg, "--massif-out-file", clo_massif_out_file) {}
 
+   else if VG_BOOL_CLO(arg, "--site-cache",     clo_site_cache) {}
+
    else
       return VG_(replacement_malloc_process_cmd_line_option)(arg);
 
@@ -468,6 +496,12 @@ static void ms_print_usage(void)
 "                              or heap bytes alloc'd/dealloc'd [i]\n"
 "    --detailed-freq=<N>       every Nth snapshot should be detailed [10]\n"
 "    --max-snapshots=<N>       maximum number of snapshots recorded [100]\n"
+"    --stream-snapshots=no|yes write snapshots to the output file as they\n"
+"                              are taken, detailed ones as deltas [no]\n"
+"    --stream-interval=<T>     time between streamed snapshots, in\n"
+"                              --time-unit units; 0 is adaptive [0]\n"
+"    --split=none|thread|arena split the heap tree by thread, or by arena\n"
+"                              (see VALGRIND_MASSIF_SET_ARENA) [none]\n"
 "    --massif-out-file=<file>  output file name [massif.out.%%p]\n"
    );
 }
@@ -475,7 +509,7 @@ static void ms_print_usage(void)
 static void ms_print_debug_usage(void)
 {
    VG_(printf)(
-"    (none)\n"
+"    --site-cache=no|yes       cache the XPts of allocation sites [yes]\n"
    );
 }
 
@@ -543,6 +577,20 @@ struct _XPt {
    UInt  n_children;       // number of children
    UInt  max_children;     // capacity of children array
    XPt** children;         // pointers to children XPts
+
+   // Once an XPt has more than XPT_INDEX_MIN children, looking for an IP
+   // in 'children' is done with a hash table, indexed by IP and using
+   // linear probing.  The order of 'children' itself is unchanged.
+   UInt  child_index_size; // 0, or a power of 2 > 2 * n_children
+   XPt** child_index;      // NULL or pointers to children XPts
+
+   // With --stream-snapshots=yes, detailed snapshots only contain the XPts
+   // that changed since the previous one.  update_XCon marks the path it
+   // changes as dirty, so that we only need to visit those.
+   UInt  stream_id;        // id in the output file, 0 if not written yet
+   Bool  stream_dirty;     // szB may have changed since it was written
+   Bool  stream_pruned;    // main or below main: children not written
+   SizeT stream_szB;       // szB as last written
 };
 
 typedef
@@ -596,12 +644,37 @@ static XPt* new_XPt(Addr ip, XPt* parent)
    xpt->max_children = 0;
    xpt->children     = NULL;
 
+   xpt->child_index_size = 0;
+   xpt->child_index      = NULL;
+
+   xpt->stream_id     = 0;
+   xpt->stream_dirty  = False;
+   xpt->stream_pruned = False;
+   xpt->stream_szB    = 0;
+
    // Update statistics
    n_xpts++;
 
    return xpt;
 }
 
+// Number of children above which an XPt gets an index of its children.
+#define XPT_INDEX_MIN   16
+
+static __inline__ UInt child_index_hash(XPt* xpt, Addr ip)
+{
+   UWord h = ip ^ (ip >> 9) ^ (ip >> 21);
+   return (UInt)h & (xpt->child_index_size - 1);
+}
+
+static void insert_child_index(XPt* parent, XPt* child)
+{
+   UInt i = child_index_hash(parent, child->ip);
+   while (NULL != parent->child_index[i])
+      i = (i + 1) & (parent->child_index_size - 1);
+   parent->child_index[i] = child;
+}
+
 static void add_child_xpt(XPt* parent, XPt* child)
 {
    // Expand 'children' if necessary.
@@ -623,6 +696,49 @@ static void add_child_xpt(XPt* parent, XPt* child)
 
    // Insert new child XPt in parent's children list.
    parent->children[ parent->n_children++ ] = child;
+
+   // Keep the index of wide XPts up to date, (re)building it when it
+   // becomes half full.
+   if (parent->child_index_size >= 2 * parent->n_children) {
+      insert_child_index(parent, child);
+   } else if (parent->n_children > XPT_INDEX_MIN) {
+      UInt i;
+      if (NULL == parent->child_index)
+         n_xpt_child_indexes++;
+      else
+         VG_(free)(parent->child_index);
+      parent->child_index_size = 4 * XPT_INDEX_MIN;
+      while (parent->child_index_size < 2 * parent->n_children)
+         parent->child_index_size *= 2;
+      parent->child_index = VG_(calloc)( "ms.main.acx.3",
+                                         parent->child_index_size,
+                                         sizeof(XPt*) );
+      for (i = 0; i < parent->n_children; i++)
+         insert_child_index(parent, parent->children[i]);
+   }
+}
+
+// Find the child of 'xpt' for 'ip', or return NULL.
+static XPt* find_child_xpt(XPt* xpt, Addr ip)
+{
+   UInt i;
+
+   if (NULL == xpt->child_index) {
+      // Linear search.  For konqueror startup this search hits about 98%
+      // of the time, and most XPts have only a few children.
+      for (i = 0; i < xpt->n_children; i++) {
+         if (ip == xpt->children[i]->ip)
+            return xpt->children[i];
+      }
+      return NULL;
+   }
+
+   for (i = child_index_hash(xpt, ip); True;
+        i = (i + 1) & (xpt->child_index_size - 1)) {
+      XPt* child = xpt->child_index[i];
+      if (NULL == child || ip == child->ip)
+         return child;
+   }
 }
 
 // Reverse comparison for a reverse sort -- biggest to smallest.
@@ -794,6 +910,144 @@ static void sanity_check_SXTree(SXPt* sxpt)
 }
 
 
+//------------------------------------------------------------//
+//--- Partitions                                           ---//
+//------------------------------------------------------------//
+
+// With --split=thread or --split=arena, the XTree is split into partitions,
+// one per thread or per arena.  Each partition has a top-XPt, under which
+// are the XCons of the heap blocks attributed to it.  The 'ip' of such a
+// top-XPt is not a code address but the partition's number, counting from
+// 1.  Partitions are never freed;  a thread that reuses the ThreadId of a
+// dead thread continues its partition.
+//
+// The heap size of a partition is the 'szB' of its top-XPt.  The heap
+// extra and stack sizes are kept here, so that each partition's share of
+// heap_szB, heap_extra_szB and stacks_szB can be recorded in snapshots.
+// With --split=arena, stacks are not attributed to arenas.
+typedef
+   struct {
+      HChar* name;
+      HChar* desc;            // name as printed in heap trees
+      XPt*   xpt;             // top-XPt
+      SizeT  heap_extra_szB;
+      SizeT  stacks_szB;
+   }
+   Partition;
+
+static XArray* partitions = NULL;   // of Partition
+
+// The partition number of each thread, 0 if it has none yet.  With
+// --split=arena, this is the thread's current arena, initially the default
+// arena (number 1).
+static UInt* thread_partition = NULL;   // VG_N_THREADS entries
+
+static Partition* get_partition(UInt n)
+{
+   tl_assert(n >= 1 && n <= VG_(sizeXA)(partitions));
+   return VG_(indexXA)(partitions, n - 1);
+}
+
+static UInt new_partition(const HChar* name)
+{
+   Partition part;
+   HChar*    s;
+
+   part.name = VG_(strdup)("ms.main.np.1", name);
+   // Newlines would break the output file format.
+   for (s = part.name; *s; s++) {
+      if ('\n' == *s) *s = ' ';
+   }
+   part.desc = VG_(malloc)("ms.main.np.2", VG_(strlen)(part.name) + 3);
+   VG_(sprintf)(part.desc, "(%s)", part.name);
+   part.xpt = new_XPt(VG_(sizeXA)(partitions) + 1, alloc_xpt);
+   add_child_xpt(alloc_xpt, part.xpt);
+   part.heap_extra_szB = 0;
+   part.stacks_szB     = 0;
+   return VG_(addToXA)(partitions, &part) + 1;
+}
+
+// Returns the partition number of the arena called 'name'.
+static UInt arena_partition(const HChar* name)
+{
+   UInt n;
+
+   if (NULL == name)
+      return 1;   // the default arena
+   for (n = 2; n <= VG_(sizeXA)(partitions); n++) {
+      if (0 == VG_(strcmp)(get_partition(n)->name, name))
+         return n;
+   }
+   return new_partition(name);
+}
+
+static UInt thread_partition_n(ThreadId tid)
+{
+   tl_assert(tid < VG_N_THREADS);
+   if (0 == thread_partition[tid]) {
+      HChar name[32];
+      tl_assert(SplitThread == clo_split);
+      VG_(sprintf)(name, "thread %u", tid);
+      thread_partition[tid] = new_partition(name);
+   }
+   return thread_partition[tid];
+}
+
+// The XPt under which the XCons of thread 'tid' go.
+static XPt* partition_root(ThreadId tid)
+{
+   if (SplitNone == clo_split)
+      return alloc_xpt;
+   return get_partition(thread_partition_n(tid))->xpt;
+}
+
+// The partition of an XPt in the XTree, other than alloc_xpt.
+static Partition* partition_of_XPt(XPt* xpt)
+{
+   while (xpt->parent != alloc_xpt)
+      xpt = xpt->parent;
+   return get_partition(xpt->ip);
+}
+
+static void update_partition_extra(XPt* where, SSizeT extra_szB_delta)
+{
+   Partition* part;
+
+   if (SplitNone == clo_split || 0 == extra_szB_delta)
+      return;
+   part = partition_of_XPt(where);
+   if (extra_szB_delta < 0)
+      tl_assert(part->heap_extra_szB >= -extra_szB_delta);
+   part->heap_extra_szB += extra_szB_delta;
+}
+
+static void update_partition_stacks(SSizeT stack_szB_delta)
+{
+   Partition* part;
+
+   if (SplitThread != clo_split)
+      return;
+   part = get_partition(thread_partition_n(VG_(get_running_tid)()));
+   if (stack_szB_delta < 0)
+      tl_assert(part->stacks_szB >= -stack_szB_delta);
+   part->stacks_szB += stack_szB_delta;
+}
+
+static void init_partitions(void)
+{
+   ThreadId tid;
+
+   partitions = VG_(newXA)(VG_(malloc), "ms.main.ip.1", VG_(free),
+                           sizeof(Partition));
+   thread_partition = VG_(calloc)("ms.main.ip.2", VG_N_THREADS, sizeof(UInt));
+   if (SplitArena == clo_split) {
+      new_partition("default arena");
+      for (tid = 0; tid < VG_N_THREADS; tid++)
+         thread_partition[tid] = 1;
+   }
+}
+
+
 //------------------------------------------------------------//
 //--- XCon Operations                                      ---//
 //------------------------------------------------------------//
@@ -803,6 +1057,9 @@ static void sanity_check_SXTree(SXPt* sxpt)
 #define MAX_OVERESTIMATE   50
 #define MAX_IPS            (MAX_DEPTH + MAX_OVERESTIMATE)
 
+// The number of extra IPs asked for in the first stack trace of an XCon.
+#define FIRST_OVERESTIMATE 3
+
 // Determine if the given IP belongs to a function that should be ignored.
 static Bool fn_should_be_ignored(Addr ip)
 {
@@ -818,10 +1075,15 @@ static Bool fn_should_be_ignored(Addr ip)
 //   becomes:  a / b / main
 // Nb: it's possible to end up with an empty trace, eg. if 'main' is marked
 // as an alloc-fn.  This is ok.
+// On entry, ips[0]..ips[n_ips-1] is the unfiltered stack trace, as given by
+// VG_(get_StackTrace) when asked for clo_depth + FIRST_OVERESTIMATE IPs.
+// *redone is set if a bigger stack trace had to be taken, ie. if the result
+// depends on more than that first stack trace.
 static
-Int get_IPs( ThreadId tid, Bool exclude_first_entry, Addr ips[])
+Int get_IPs( ThreadId tid, Bool exclude_first_entry, Addr ips[], Int n_ips,
+             Bool* redone )
 {
-   Int n_ips, i, n_alloc_fns_removed;
+   Int i, n_alloc_fns_removed;
    Int overestimate;
    Bool redo;
 
@@ -837,17 +1099,21 @@ Int get_IPs( ThreadId tid, Bool exclude_first_entry, Addr ips[])
 
    // Main loop.
    redo = True;      // Assume this to begin with.
-   for (overestimate = 3; redo; overestimate += 6) {
+   *redone = False;
+   for (overestimate = FIRST_OVERESTIMATE; redo; overestimate += 6) {
       // This should never happen -- would require MAX_OVERESTIMATE
       // alloc-fns to be removed from the stack trace.
       if (overestimate > MAX_OVERESTIMATE)
          VG_(tool_panic)("get_IPs: ips[] too small, inc. MAX_OVERESTIMATE?");
 
-      // Ask for more IPs than clo_depth suggests we need.
-      n_ips = VG_(get_StackTrace)( tid, ips, clo_depth + overestimate,
-                                   NULL/*array to dump SP values in*/,
-                                   NULL/*array to dump FP values in*/,
-                                   0/*first_ip_delta*/ );
+      // Ask for more IPs than clo_depth suggests we need.  The first time
+      // round, our caller has already done so.
+      if (overestimate > FIRST_OVERESTIMATE) {
+         n_ips = VG_(get_StackTrace)( tid, ips, clo_depth + overestimate,
+                                      NULL/*array to dump SP values in*/,
+                                      NULL/*array to dump FP values in*/,
+                                      0/*first_ip_delta*/ );
+      }
       tl_assert(n_ips > 0);
 
       // If the original stack trace is smaller than asked-for, redo=False.
@@ -882,51 +1148,148 @@ Int get_IPs( ThreadId tid, Bool exclude_first_entry, Addr ips[])
 
       if (redo) {
          n_XCon_redos++;
+         *redone = True;
       }
    }
    return n_ips;
 }
 
+// Most allocations come from a small number of allocation sites, ie. with
+// the same unfiltered stack trace.  For those, filtering the stack trace
+// (which looks up a function name per entry) and walking down the XTree
+// gives the same bottom-XPt every time.  So we remember, for each stack
+// trace seen, the bottom-XPt it gave, or NULL if the allocation was
+// ignored.  XPts are never freed, so the cached pointers stay valid.
+//
+// Filtering depends on the function names, so the cache is flushed when
+// debuginfo is loaded or discarded.  It is also flushed when it gets too
+// big, to bound its memory use for programs with very many distinct stack
+// traces (eg. deeply recursive ones).
+typedef
+   struct _Site {
+      struct _Site* next;
+      UWord         key;        // hash of the stack trace
+      XPt*          root;       // alloc_xpt, or the partition's top-XPt
+      XPt*          xpt;        // bottom-XPt, NULL if ignored
+      Bool          exclude_first_entry;
+      Int           n_ips;
+      Addr          ips[];      // the unfiltered stack trace
+   }
+   Site;
+
+#define MAX_SITES   100000
+
+static VgHashTable* sites          = NULL;
+static UInt         sites_gen      = 0;   // debuginfo generation of 'sites'
+static UInt         n_sites        = 0;
+static Site*        site_key       = NULL;   // lookup key
+
+static Word cmp_Site(const void* node1, const void* node2)
+{
+   const Site* s1 = node1;
+   const Site* s2 = node2;
+   if (s1->n_ips != s2->n_ips || s1->root != s2->root ||
+       s1->exclude_first_entry != s2->exclude_first_entry)
+      return 1;
+   return VG_(memcmp)(s1->ips, s2->ips, s1->n_ips * sizeof(Addr));
+}
+
+// Looks up the stack trace ips[0]..ips[n_ips-1] below 'root'.  Also copies
+// it into 'site_key', for add_site.
+static Site* lookup_site(XPt* root, const Addr ips[], Int n_ips,
+                         Bool exclude_first_entry)
+{
+   UWord h = (UWord)root ^ exclude_first_entry;
+   Int i;
+
+   if (NULL == sites || sites_gen != VG_(debuginfo_generation)()) {
+      if (NULL == sites) {
+         site_key = VG_(malloc)("ms.main.ls.1", sizeof(Site)
+                                + (MAX_DEPTH + FIRST_OVERESTIMATE) * sizeof(Addr));
+      } else {
+         VG_(HT_destruct)(sites, VG_(free));
+         n_site_cache_flushes++;
+      }
+      sites     = VG_(HT_construct)("Massif's allocation sites");
+      sites_gen = VG_(debuginfo_generation)();
+      n_sites   = 0;
+   }
+
+   tl_assert(n_ips <= MAX_DEPTH + FIRST_OVERESTIMATE);
+   for (i = 0; i < n_ips; i++) {
+      h = (h << 5) + (h >> (sizeof(UWord) * 8 - 5)) + ips[i];
+      site_key->ips[i] = ips[i];
+   }
+   site_key->key                 = h;
+   site_key->root                = root;
+   site_key->exclude_first_entry = exclude_first_entry;
+   site_key->n_ips               = n_ips;
+   return VG_(HT_gen_lookup)(sites, site_key, cmp_Site);
+}
+
+// Remembers that the stack trace in 'site_key' gives 'xpt'.
+static void add_site(XPt* xpt)
+{
+   SizeT szB = sizeof(Site) + site_key->n_ips * sizeof(Addr);
+   Site* site;
+
+   if (n_sites == MAX_SITES) {
+      VG_(HT_destruct)(sites, VG_(free));
+      sites   = VG_(HT_construct)("Massif's allocation sites");
+      n_sites = 0;
+      n_site_cache_flushes++;
+   }
+   site = VG_(malloc)("ms.main.as.1", szB);
+   VG_(memcpy)(site, site_key, szB);
+   site->xpt = xpt;
+   VG_(HT_add_node)(sites, site);
+   n_sites++;
+}
+
 // Gets an XCon and puts it in the tree.  Returns the XCon's bottom-XPt.
 // Unless the allocation should be ignored, in which case we return NULL.
 static XPt* get_XCon( ThreadId tid, Bool exclude_first_entry )
 {
    static Addr ips[MAX_IPS];
-   Int i;
-   XPt* xpt = alloc_xpt;
+   Int i, n_ips;
+   Bool redone;
+   Site* site;
+   XPt* root = partition_root(tid);
+   XPt* xpt = root;
+
+   // Take the stack trace, and see if it's a known allocation site.
+   n_ips = VG_(get_StackTrace)( tid, ips, clo_depth + FIRST_OVERESTIMATE,
+                                NULL/*array to dump SP values in*/,
+                                NULL/*array to dump FP values in*/,
+                                0/*first_ip_delta*/ );
+   site = clo_site_cache ? lookup_site(root, ips, n_ips, exclude_first_entry)
+                         : NULL;
+   if (NULL != site) {
+      n_site_cache_hits++;
+      return site->xpt;
+   }
+   n_site_cache_misses++;
 
    // After this call, the IPs we want are in ips[0]..ips[n_ips-1].
-   Int n_ips = get_IPs(tid, exclude_first_entry, ips);
+   n_ips = get_IPs(tid, exclude_first_entry, ips, n_ips, &redone);
 
    // Should we ignore this allocation?  (Nb: n_ips can be zero, eg. if
    // 'main' is marked as an alloc-fn.)
    if (n_ips > 0 && fn_should_be_ignored(ips[0])) {
+      if (!redone && clo_site_cache)
+         add_site(NULL);
       return NULL;
    }
 
    // Now do the search/insertion of the XCon.
    for (i = 0; i < n_ips; i++) {
-      Addr ip = ips[i];
-      Int ch;
-      // Look for IP in xpt's children.
-      // Linear search, ugh -- about 10% of time for konqueror startup tried
-      // caching last result, only hit about 4% for konqueror.
-      // Nb:  this search hits about 98% of the time for konqueror
-      for (ch = 0; True; ch++) {
-         if (ch == xpt->n_children) {
-            // IP not found in the children.
-            // Create and add new child XPt, then stop.
-            XPt* new_child_xpt = new_XPt(ip, xpt);
-            add_child_xpt(xpt, new_child_xpt);
-            xpt = new_child_xpt;
-            break;
-
-         } else if (ip == xpt->children[ch]->ip) {
-            // Found the IP in the children, stop.
-            xpt = xpt->children[ch];
-            break;
-         }
+      XPt* child = find_child_xpt(xpt, ips[i]);
+      if (NULL == child) {
+         // IP not found in the children.  Create and add new child XPt.
+         child = new_XPt(ips[i], xpt);
+         add_child_xpt(xpt, child);
       }
+      xpt = child;
    }
 
    // [Note: several comments refer to this comment.  Do not delete it
@@ -967,6 +1330,11 @@ static XPt* get_XCon( ThreadId tid, Bool exclude_first_entry )
             "         (And Massif now won't warn about this again.)\n");
       }
    }
+
+   // If a bigger stack trace was needed, the result also depends on the
+   // entries beyond the first one, so it can't be cached.
+   if (!redone && clo_site_cache)
+      add_site(xpt);
    return xpt;
 }
 
@@ -982,10 +1350,12 @@ static void update_XCon(XPt* xpt, SSizeT space_delta)
    while (xpt != alloc_xpt) {
       if (space_delta < 0) tl_assert(xpt->szB >= -space_delta);
       xpt->szB += space_delta;
+      xpt->stream_dirty = True;
       xpt = xpt->parent;
    }
    if (space_delta < 0) tl_assert(alloc_xpt->szB >= -space_delta);
    alloc_xpt->szB += space_delta;
+   alloc_xpt->stream_dirty = True;
 }
 
 
@@ -998,6 +1368,12 @@ static void update_XCon(XPt* xpt, SSizeT space_delta)
 // some (eg. half), and start taking them more slowly.  Once we hit the
 // limit again, we again cull and then take them even more slowly, and so
 // on.
+//
+// With --stream-snapshots=yes, there is no limit and no culling:  each
+// snapshot is written to the output file as soon as it is taken, and
+// detailed snapshots only contain the XPts that changed since the previous
+// detailed snapshot.  Memory use stays bounded, and the whole history is
+// kept.  See "Streaming snapshots" below.
 
 // Time is measured either in i or ms or bytes, depending on the --time-unit
 // option.  It's a Long because it can exceed 32-bits reasonably easily, and
@@ -1022,12 +1398,19 @@ typedef
       SizeT heap_extra_szB;// Heap slop + admin bytes.
       SizeT stacks_szB;
       SXPt* alloc_sxpt;    // Heap XTree root, if a detailed snapshot,
-   }                       // otherwise NULL.
+                           // otherwise NULL.
+      UInt   n_parts;      // With --split, the heap, heap extra and
+      SizeT* parts_szB;    // stacks sizes of each partition;  else NULL.
+   }
    Snapshot;
 
 static UInt      next_snapshot_i = 0;  // Index of where next snapshot will go.
 static Snapshot* snapshots;            // Array of snapshots.
 
+static Bool stream_ready(void);
+static void stream_snapshot(Snapshot* snapshot, Bool is_detailed);
+static Time stream_next_interval(Time my_time);
+
 static Bool is_snapshot_in_use(Snapshot* snapshot)
 {
    if (Unused == snapshot->kind) {
@@ -1037,6 +1420,7 @@ static Bool is_snapshot_in_use(Snapshot* snapshot)
       tl_assert(snapshot->heap_szB       == 0);
       tl_assert(snapshot->stacks_szB     == 0);
       tl_assert(snapshot->alloc_sxpt     == NULL);
+      tl_assert(snapshot->parts_szB      == NULL);
       return False;
    } else {
       tl_assert(snapshot->time           != UNUSED_SNAPSHOT_TIME);
@@ -1088,6 +1472,8 @@ static void clear_snapshot(Snapshot* snapshot, Bool do_sanity_check)
    snapshot->heap_szB       = 0;
    snapshot->stacks_szB     = 0;
    snapshot->alloc_sxpt     = NULL;
+   snapshot->n_parts        = 0;
+   snapshot->parts_szB      = NULL;
 }
 
 // This zeroes all the fields in the snapshot, and frees the heap XTree if
@@ -1098,10 +1484,14 @@ static void delete_snapshot(Snapshot* snapshot)
    // because clear_snapshot does a sanity check which includes checking the
    // XTree.
    SXPt* tmp_sxpt = snapshot->alloc_sxpt;
+   SizeT* tmp_parts_szB = snapshot->parts_szB;
    clear_snapshot(snapshot, /*do_sanity_check*/True);
    if (tmp_sxpt) {
       free_SXTree(tmp_sxpt);
    }
+   if (tmp_parts_szB) {
+      VG_(free)(tmp_parts_szB);
+   }
 }
 
 static void VERB_snapshot(Int verbosity, const HChar* prefix, Int i)
@@ -1291,6 +1681,32 @@ static Time get_time(void)
    }
 }
 
+// Record the share of each partition in the sizes of a snapshot.  They must
+// add up to the snapshot's sizes.
+static void take_partition_sizes(Snapshot* snapshot)
+{
+   UInt  i;
+   SizeT sum_heap_szB = 0, sum_heap_extra_szB = 0, sum_stacks_szB = 0;
+
+   snapshot->n_parts   = VG_(sizeXA)(partitions);
+   snapshot->parts_szB = VG_(malloc)("ms.main.tps.1",
+                                     3 * snapshot->n_parts * sizeof(SizeT));
+   for (i = 0; i < snapshot->n_parts; i++) {
+      Partition* part = get_partition(i + 1);
+      SizeT*     szB  = &snapshot->parts_szB[3 * i];
+      szB[0] = ( clo_heap   ? part->xpt->szB       : 0 );
+      szB[1] = ( clo_heap   ? part->heap_extra_szB : 0 );
+      szB[2] = ( clo_stacks ? part->stacks_szB     : 0 );
+      sum_heap_szB       += szB[0];
+      sum_heap_extra_szB += szB[1];
+      sum_stacks_szB     += szB[2];
+   }
+   tl_assert(sum_heap_szB       == snapshot->heap_szB);
+   tl_assert(sum_heap_extra_szB == snapshot->heap_extra_szB);
+   if (SplitThread == clo_split)
+      tl_assert(sum_stacks_szB  == snapshot->stacks_szB);
+}
+
 // Take a snapshot, and only that -- decisions on whether to take a
 // snapshot, or what kind of snapshot, are made elsewhere.
 // Nb: we call the arg "my_time" because "time" shadows a global declaration
@@ -1321,6 +1737,11 @@ take_snapshot(Snapshot* snapshot, SnapshotKind kind, Time my_time,
       snapshot->stacks_szB = stacks_szB;
    }
 
+   // Partitions.
+   if (SplitNone != clo_split) {
+      take_partition_sizes(snapshot);
+   }
+
    // Rest of snapshot.
    snapshot->kind = kind;
    snapshot->time = my_time;
@@ -1350,6 +1771,7 @@ maybe_take_snapshot(SnapshotKind kind, const HChar* what)
 
    Snapshot* snapshot;
    Bool      is_detailed;
+   Bool      streaming;
    // Nb: we call this variable "my_time" because "time" shadows a global
    // declaration in /usr/include/time.h on Darwin.
    Time      my_time = get_time();
@@ -1385,9 +1807,14 @@ maybe_take_snapshot(SnapshotKind kind, const HChar* what)
       tl_assert2(0, "maybe_take_snapshot: unrecognised snapshot kind");
    }
 
-   // Take the snapshot.
+   // Take the snapshot.  When streaming, the XTree is not duplicated, as
+   // stream_snapshot writes the changes in it directly.  Whether we stream
+   // is settled first:  if the output file cannot be opened, streaming is
+   // switched off and the snapshot is kept, so it needs its own XTree.
+   streaming = clo_stream_snapshots && stream_ready();
    snapshot = & snapshots[next_snapshot_i];
-   take_snapshot(snapshot, kind, my_time, is_detailed);
+   take_snapshot(snapshot, kind, my_time, is_detailed && !streaming);
+   if (is_detailed && streaming) n_detailed_snapshots++;
 
    // Record if it was detailed.
    if (is_detailed) {
@@ -1426,6 +1853,15 @@ maybe_take_snapshot(SnapshotKind kind, const HChar* what)
    VERB_snapshot(2, what, next_snapshot_i);
    n_skipped_snapshots_since_last_snapshot = 0;
 
+   // When streaming, write the snapshot out and reuse its slot.
+   if (streaming) {
+      stream_snapshot(snapshot, is_detailed);
+      delete_snapshot(snapshot);
+      earliest_possible_time_of_next_snapshot =
+         my_time + stream_next_interval(my_time);
+      return;
+   }
+
    // Cull the entries, if our snapshot table is full.
    next_snapshot_i++;
    if (clo_max_snapshots == next_snapshot_i) {
@@ -1519,6 +1955,7 @@ void* record_block( ThreadId tid, void* p, SizeT req_szB, SizeT slop_szB,
 
          // Update heap stats.
          update_heap_stats(req_szB, clo_heap_admin + slop_szB);
+         update_partition_extra(hc->where, clo_heap_admin + slop_szB);
 
          // Update XTree.
          update_XCon(hc->where, req_szB);
@@ -1590,6 +2027,7 @@ void unrecord_block ( void* p, Bool maybe_snapshot )
 
          // Update heap stats.
          update_heap_stats(-hc->req_szB, -clo_heap_admin - hc->slop_szB);
+         update_partition_extra(hc->where, -clo_heap_admin - hc->slop_szB);
 
          // Update XTree.
          update_XCon(hc->where, -hc->req_szB);
@@ -1691,6 +2129,9 @@ void* realloc_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
             hc->where = new_where;
             update_XCon(old_where, -old_req_szB);
             update_XCon(new_where,  new_req_szB);
+            // The block may have moved to another partition.
+            update_partition_extra(old_where, -clo_heap_admin - old_slop_szB);
+            update_partition_extra(new_where,  clo_heap_admin + new_slop_szB);
          } else {
             // The realloc itself is ignored.
             is_ignored = True;
@@ -1899,6 +2340,7 @@ static void update_stack_stats(SSizeT stack_szB_delta)
 {
    if (stack_szB_delta < 0) tl_assert(stacks_szB >= -stack_szB_delta);
    stacks_szB += stack_szB_delta;
+   update_partition_stacks(stack_szB_delta);
 
    update_alloc_stats(stack_szB_delta);
 }
@@ -1996,6 +2438,15 @@ static Bool ms_handle_client_request ( ThreadId tid, UWord* argv, UWord* ret )
       *ret = 0;
       return True;
    }
+   case VG_USERREQ__MASSIF_SET_ARENA: {
+      if (SplitArena == clo_split) {
+         tl_assert(tid < VG_N_THREADS);
+         thread_partition[tid] = arena_partition((const HChar*)argv[1]);
+         n_arena_switches++;
+      }
+      *ret = 0;
+      return True;
+   }
    case VG_USERREQ__GDB_MONITOR_COMMAND: {
      Bool handled = handle_gdb_monitor_command (tid, (HChar*)argv[1]);
      if (handled)
@@ -2109,6 +2560,15 @@ IRSB* ms_instrument ( VgCallbackClosure* closure,
 
 #define FP(format, args...) ({ VG_(fprintf)(fp, format, ##args); })
 
+// Description of alloc_xpt, the root of the heap tree.
+static const HChar* alloc_xpt_desc(void)
+{
+   return ( clo_pages_as_heap
+          ? "(page allocation syscalls) mmap/mremap/brk, --alloc-fns, etc."
+          : "(heap allocation functions) malloc/new/new[], --alloc-fns, etc."
+          );
+}
+
 static void pp_snapshot_SXPt(VgFile *fp, SXPt* sxpt, Int depth,
                              HChar* depth_str, Int depth_str_len,
                              SizeT snapshot_heap_szB, SizeT snapshot_total_szB)
@@ -2126,11 +2586,7 @@ static void pp_snapshot_SXPt(VgFile *fp, SXPt* sxpt, Int depth,
       // Print the SXPt itself.
       if (0 == depth) {
          if (clo_heap) {
-            ip_desc = 
-               ( clo_pages_as_heap
-               ? "(page allocation syscalls) mmap/mremap/brk, --alloc-fns, etc."
-               : "(heap allocation functions) malloc/new/new[], --alloc-fns, etc."
-               );
+            ip_desc = alloc_xpt_desc();
          } else {
             // XXX: --alloc-fns?
 
@@ -2138,6 +2594,8 @@ static void pp_snapshot_SXPt(VgFile *fp, SXPt* sxpt, Int depth,
             // conceptually uninitialised here. Therefore:
             tl_assert2(0, "pp_snapshot_SXPt: unexpected");
          }
+      } else if (1 == depth && SplitNone != clo_split) {
+         ip_desc = get_partition(sxpt->Sig.ip)->desc;
       } else {
          // If it's main-or-below-main, we (if appropriate) ignore everything
          // below it by pretending it has no children.
@@ -2227,10 +2685,8 @@ static void pp_snapshot_SXPt(VgFile *fp, SXPt* sxpt, Int depth,
    }
 }
 
-static void pp_snapshot(VgFile *fp, Snapshot* snapshot, Int snapshot_n)
+static void pp_snapshot_sizes(VgFile *fp, Snapshot* snapshot, Int snapshot_n)
 {
-   sanity_check_snapshot(snapshot);
-
    FP("#-----------\n");
    FP("snapshot=%d\n", snapshot_n);
    FP("#-----------\n");
@@ -2238,10 +2694,40 @@ static void pp_snapshot(VgFile *fp, Snapshot* snapshot, Int snapshot_n)
    FP("mem_heap_B=%lu\n",       snapshot->heap_szB);
    FP("mem_heap_extra_B=%lu\n", snapshot->heap_extra_szB);
    FP("mem_stacks_B=%lu\n",     snapshot->stacks_szB);
+   if (snapshot->parts_szB) {
+      UInt i;
+      FP("mem_split_B=");
+      for (i = 0; i < snapshot->n_parts; i++) {
+         SizeT* szB = &snapshot->parts_szB[3 * i];
+         FP("%s%u:%lu,%lu,%lu", ( i ? " " : "" ), i + 1,
+            szB[0], szB[1], szB[2]);
+      }
+      FP("\n");
+   }
+}
+
+// Print the names of the partitions that have not been printed yet in this
+// file, ie. from number *n_printed + 1 on.
+static void pp_partitions(VgFile *fp, UInt* n_printed)
+{
+   if (SplitNone == clo_split)
+      return;
+   while (*n_printed < VG_(sizeXA)(partitions)) {
+      (*n_printed)++;
+      FP("part=%u %s\n", *n_printed, get_partition(*n_printed)->name);
+   }
+}
+
+static void pp_snapshot(VgFile *fp, Snapshot* snapshot, Int snapshot_n)
+{
+   sanity_check_snapshot(snapshot);
+
+   pp_snapshot_sizes(fp, snapshot, snapshot_n);
 
    if (is_detailed_snapshot(snapshot)) {
       // Detailed snapshot -- print heap tree.
-      Int   depth_str_len = clo_depth + 3;
+      // One more level for the partitions, if any.
+      Int   depth_str_len = clo_depth + 3 + ( SplitNone != clo_split );
       HChar* depth_str = VG_(malloc)("ms.main.pps.1", 
                                      sizeof(HChar) * depth_str_len);
       SizeT snapshot_total_szB =
@@ -2260,22 +2746,9 @@ static void pp_snapshot(VgFile *fp, Snapshot* snapshot, Int snapshot_n)
    }
 }
 
-static void write_snapshots_to_file(const HChar* massif_out_file, 
-                                    Snapshot snapshots_array[], 
-                                    Int nr_elements)
+static void pp_file_header(VgFile *fp)
 {
    Int i;
-   VgFile *fp;
-
-   fp = VG_(fopen)(massif_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
-                                    VKI_S_IRUSR|VKI_S_IWUSR);
-   if (fp == NULL) {
-      // If the file can't be opened for whatever reason (conflict
-      // between multiple cachegrinded processes?), give up now.
-      VG_(umsg)("error: can't open output file '%s'\n", massif_out_file );
-      VG_(umsg)("       ... so profiling results will be missing.\n");
-      return;
-   }
 
    // Print massif-specific options that were used.
    // XXX: is it worth having a "desc:" line?  Could just call it "options:"
@@ -2299,6 +2772,28 @@ static void write_snapshots_to_file(const HChar* massif_out_file,
    FP("\n");
 
    FP("time_unit: %s\n", TimeUnit_to_string(clo_time_unit));
+}
+
+static void write_snapshots_to_file(const HChar* massif_out_file, 
+                                    Snapshot snapshots_array[], 
+                                    Int nr_elements)
+{
+   Int i;
+   UInt n_parts_printed = 0;
+   VgFile *fp;
+
+   fp = VG_(fopen)(massif_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                                    VKI_S_IRUSR|VKI_S_IWUSR);
+   if (fp == NULL) {
+      // If the file can't be opened for whatever reason (conflict
+      // between multiple cachegrinded processes?), give up now.
+      VG_(umsg)("error: can't open output file '%s'\n", massif_out_file );
+      VG_(umsg)("       ... so profiling results will be missing.\n");
+      return;
+   }
+
+   pp_file_header(fp);
+   pp_partitions(fp, &n_parts_printed);
 
    for (i = 0; i < nr_elements; i++) {
       Snapshot* snapshot = & snapshots_array[i];
@@ -2320,6 +2815,182 @@ static void write_snapshots_array_to_file(void)
    VG_(free)(massif_out_file);
 }
 
+
+//------------------------------------------------------------//
+//--- Streaming snapshots                                  ---//
+//------------------------------------------------------------//
+
+// With --stream-snapshots=yes, the output file is opened at start-up (and
+// again in the child of a fork), and each snapshot is appended to it and
+// flushed.  A normal snapshot is written as usual.  A detailed snapshot has
+// "heap_tree=delta" (or "heap_tree=peak_delta"), followed by one line per
+// XPt that is new or whose size changed since the previous detailed
+// snapshot:
+//
+//   +<id> <parent-id> <szB> <ip-desc>     -- new XPt
+//   =<id> <szB>                           -- size changed
+//
+// XPts are numbered from 1 in the order they are first written, and a
+// parent is always written before its children, so replaying all the
+// deltas up to a detailed snapshot gives its complete heap tree.  The
+// root XPt has parent 0.  Unlike normal detailed snapshots, no
+// --threshold aggregation is done;  ms_print applies its own threshold
+// when it reconstructs the tree.
+
+static VgFile* stream_fp        = NULL;
+static HChar*  stream_file_name = NULL;
+static Int     stream_pid       = 0;   // pid that opened stream_fp
+static Int     stream_snapshot_n = 0;  // number of the next snapshot
+static UInt    stream_n_ids     = 0;   // last XPt id used
+static UInt    stream_n_parts   = 0;   // number of partitions written
+
+// Forget what was written, so that the whole XTree is written again.
+static void stream_reset_XTree(XPt* xpt)
+{
+   UInt i;
+
+   xpt->stream_id     = 0;
+   xpt->stream_dirty  = True;
+   xpt->stream_pruned = False;
+   xpt->stream_szB    = 0;
+   for (i = 0; i < xpt->n_children; i++)
+      stream_reset_XTree(xpt->children[i]);
+}
+
+static Bool stream_open(void)
+{
+   // As in write_snapshots_array_to_file, the name is expanded as late as
+   // possible, so that each process of a fork gets its own file.
+   stream_file_name =
+      VG_(expand_file_name)("--massif-out-file", clo_massif_out_file);
+   stream_fp = VG_(fopen)(stream_file_name,
+                          VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                          VKI_S_IRUSR|VKI_S_IWUSR);
+   if (stream_fp == NULL) {
+      VG_(umsg)("error: can't open output file '%s'\n", stream_file_name);
+      VG_(umsg)("       ... so snapshots will be kept in memory instead.\n");
+      VG_(free)(stream_file_name);
+      stream_file_name = NULL;
+      return False;
+   }
+   stream_pid = VG_(getpid)();
+   stream_snapshot_n = 0;
+   stream_n_ids = 0;
+   stream_n_parts = 0;
+   stream_reset_XTree(alloc_xpt);
+   pp_file_header(stream_fp);
+   return True;
+}
+
+static void stream_close(void)
+{
+   if (stream_fp != NULL) {
+      VG_(fclose)(stream_fp);
+      VG_(free)(stream_file_name);
+      stream_fp = NULL;
+      stream_file_name = NULL;
+   }
+}
+
+static void stream_XTree_delta(VgFile *fp, XPt* xpt)
+{
+   UInt i;
+
+   if (!xpt->stream_dirty)
+      return;
+   xpt->stream_dirty = False;
+
+   if (0 == xpt->stream_id) {
+      const HChar* ip_desc;
+      xpt->stream_id = ++stream_n_ids;
+      if (xpt == alloc_xpt) {
+         ip_desc = alloc_xpt_desc();
+      } else if (xpt->parent == alloc_xpt && SplitNone != clo_split) {
+         ip_desc = get_partition(xpt->ip)->desc;
+      } else {
+         // As in pp_snapshot_SXPt:  if appropriate, ignore everything below
+         // main-or-below-main, and use ip-1 to get the line number right.
+         if ( ! VG_(clo_show_below_main) ) {
+            Vg_FnNameKind kind = VG_(get_fnname_kind_from_IP)(xpt->ip);
+            if (Vg_FnNameMain == kind || Vg_FnNameBelowMain == kind)
+               xpt->stream_pruned = True;
+         }
+         ip_desc = VG_(describe_IP)(xpt->ip-1, NULL);
+      }
+      FP("+%u %u %lu %s\n", xpt->stream_id,
+         xpt->parent ? xpt->parent->stream_id : 0, xpt->szB, ip_desc);
+      xpt->stream_szB = xpt->szB;
+
+   } else if (xpt->szB != xpt->stream_szB) {
+      FP("=%u %lu\n", xpt->stream_id, xpt->szB);
+      xpt->stream_szB = xpt->szB;
+   }
+
+   if (xpt->stream_pruned)
+      return;
+   for (i = 0; i < xpt->n_children; i++)
+      stream_XTree_delta(fp, xpt->children[i]);
+}
+
+// Make sure the output file is open before a snapshot is taken.  Returns
+// False if it cannot be opened, in which case streaming is switched off.
+static Bool stream_ready(void)
+{
+   // The child of a fork starts a file of its own.  Everything written by
+   // the parent was flushed, so closing our copy of the file is harmless.
+   if (stream_fp != NULL && stream_pid != VG_(getpid)())
+      stream_close();
+   if (stream_fp == NULL && !stream_open()) {
+      clo_stream_snapshots = False;
+      return False;
+   }
+   return True;
+}
+
+// Write out a snapshot just taken.
+static void stream_snapshot(Snapshot* snapshot, Bool is_detailed)
+{
+   VgFile *fp = stream_fp;
+
+   tl_assert(fp != NULL);
+   sanity_check_snapshot(snapshot);
+   pp_partitions(fp, &stream_n_parts);
+   pp_snapshot_sizes(fp, snapshot, stream_snapshot_n++);
+   if (is_detailed && clo_heap) {
+      FP("heap_tree=%s\n", ( Peak == snapshot->kind ? "peak_delta" : "delta" ));
+      stream_XTree_delta(fp, alloc_xpt);
+   } else {
+      FP("heap_tree=empty\n");
+   }
+   VG_(fflush)(fp);
+}
+
+// Work out the minimum time until the next streamed snapshot.  Unless given
+// with --stream-interval, it is adapted after every --max-snapshots
+// snapshots so that the next ones span twice the time, which is about the
+// rate that culling gives without streaming.
+static Time stream_next_interval(Time my_time)
+{
+   static Time batch_start_time = 0;
+   static Int  n_in_batch       = 0;
+   static Time interval         = 0;
+
+   if (clo_stream_interval > 0)
+      return clo_stream_interval;
+
+   if (++n_in_batch == clo_max_snapshots) {
+      interval = 2 * (my_time - batch_start_time) / clo_max_snapshots;
+      batch_start_time = my_time;
+      n_in_batch = 0;
+   }
+   return interval;
+}
+
+
+//------------------------------------------------------------//
+//--- Monitor commands and stats                           ---//
+//------------------------------------------------------------//
+
 static void handle_snapshot_monitor_command (const HChar *filename,
                                              Bool detailed)
 {
@@ -2350,6 +3021,12 @@ static void handle_all_snapshots_monitor_command (const HChar *filename)
       return;
    }
 
+   if (clo_stream_snapshots) {
+      VG_(gdb_printf)("snapshots are streamed to %s\n",
+                      stream_file_name ? stream_file_name : "the output file");
+      return;
+   }
+
    write_snapshots_to_file ((filename == NULL) ? 
                             "massif.vgdb.out" : filename,
                             snapshots, next_snapshot_i);
@@ -2424,6 +3101,16 @@ static void ms_print_stats (void)
    STATS("peak snapshots:        %u\n", n_peak_snapshots);
    STATS("cullings:              %u\n", n_cullings);
    STATS("XCon redos:            %u\n", n_XCon_redos);
+   STATS("site cache hits:       %u\n", n_site_cache_hits);
+   STATS("site cache misses:     %u\n", n_site_cache_misses);
+   STATS("site cache flushes:    %u\n", n_site_cache_flushes);
+   STATS("XPt child indexes:     %u\n", n_xpt_child_indexes);
+   if (clo_stream_snapshots)
+      STATS("streamed XPts:         %u\n", stream_n_ids);
+   if (SplitNone != clo_split) {
+      STATS("partitions:            %ld\n", VG_(sizeXA)(partitions));
+      STATS("arena switches:        %u\n", n_arena_switches);
+   }
 #undef STATS
 }
 
@@ -2434,7 +3121,10 @@ static void ms_print_stats (void)
 static void ms_fini(Int exit_status)
 {
    // Output.
-   write_snapshots_array_to_file();
+   if (clo_stream_snapshots)
+      stream_close();
+   else
+      write_snapshots_array_to_file();
 
    // Stats
    tl_assert(n_xpts > 0);  // always have alloc_xpt
@@ -2465,6 +3155,10 @@ static void ms_post_clo_init(void)
    if (!clo_heap) {
       clo_pages_as_heap = False;
    }
+   if (clo_stream_interval > 0 && !clo_stream_snapshots) {
+      VG_(fmsg_bad_option)("--stream-interval",
+         "Can only be used together with --stream-snapshots=yes");
+   }
 
    // If --pages-as-heap=yes we don't want malloc replacement to occur.  So we
    // disable vgpreload_massif-$PLATFORM.so by removing it from LD_PRELOAD (or
@@ -2536,6 +3230,10 @@ static void ms_post_clo_init(void)
       VG_(track_die_mem_munmap)  ( ms_die_mem_munmap  ); 
    }
 
+   if (SplitNone != clo_split) {
+      init_partitions();
+   }
+
    // Initialise snapshot array, and sanity-check it.
    snapshots = VG_(malloc)("ms.main.mpoci.1", 
                            sizeof(Snapshot) * clo_max_snapshots);
@@ -2545,6 +3243,11 @@ static void ms_post_clo_init(void)
       clear_snapshot( & snapshots[i], /*do_sanity_check*/False );
    }
    sanity_check_snapshots_array();
+
+   // Open the stream now, so that a bad --massif-out-file is reported
+   // before any snapshot is taken.
+   if (clo_stream_snapshots)
+      (void)stream_ready();
 }
 
 static void ms_pre_clo_init(void)
@@ -0,0 +1,30 @@
+#include <stdlib.h>
+#include "../massif.h"
+
+// Allocate from two arenas and the default arena, to check that --split=arena
+// attributes each block to the arena that was current when it was
+// allocated, and that the sizes of the arenas add up.
+
+int main(void)
+{
+   char *a1, *a2, *b, *c;
+
+   VALGRIND_MASSIF_SET_ARENA("pool-a");
+   a1 = malloc(400);
+   a2 = malloc(400);
+
+   VALGRIND_MASSIF_SET_ARENA("pool-b");
+   b = malloc(2000);
+
+   VALGRIND_MASSIF_SET_ARENA(NULL);
+   c = malloc(1024);
+
+   // A block is freed from its own arena, whatever the current one is.
+   VALGRIND_MASSIF_SET_ARENA("pool-b");
+   free(a1);
+   free(b);
+   free(a2);
+   free(c);
+
+   return 0;
+}
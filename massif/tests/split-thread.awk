@@ -0,0 +1,25 @@
+# Prints the largest heap of each partition of a --split=thread massif
+# output file, and checks that the stack shares add up.  The main thread's
+# heap also has what pthread_create allocates, which depends on the C
+# library.
+/^mem_stacks_B=/ {
+   stacks = substr($0, 14)
+}
+/^mem_split_B=/ {
+   sub(/^mem_split_B=/, "")
+   sum = 0
+   for (i = 1; i <= NF; i++) {
+      split($i, sz, /[:,]/)
+      if (sz[2] > heap[sz[1]]) heap[sz[1]] = sz[2]
+      if (sz[1] > n) n = sz[1]
+      sum += sz[4]
+   }
+   if (sum != stacks) bad_stacks++
+   if (sum > 0) some_stacks = 1
+}
+END {
+   printf "1: heap at least 1000: %s\n", (heap[1] >= 1000 ? "yes" : "no")
+   for (p = 2; p <= n; p++)
+      printf "%d: heap %d\n", p, heap[p]
+   printf "stack shares add up: %s\n", (bad_stacks || !some_stacks ? "no" : "yes")
+}
@@ -0,0 +1,27 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+// Allocate from two threads, to check that --split=thread attributes each
+// block to the thread that allocated it, also when another thread frees
+// it.  With --stacks=yes, the stacks of both threads are attributed too.
+
+static char* from_child;
+
+static void* child(void* arg)
+{
+   from_child = malloc(2000);
+   return NULL;
+}
+
+int main(void)
+{
+   pthread_t t;
+   char* from_main = malloc(1000);
+
+   pthread_create(&t, NULL, child, NULL);
+   pthread_join(t, NULL);
+
+   free(from_child);
+   free(from_main);
+   return 0;
+}
@@ -0,0 +1,13 @@
+# Summarises the entries for wide.c's allocations in a massif.out file.
+
+/ alloc_all \(wide\.c:[0-9]+\)$/ { sites[$NF] = 1 }
+/ lib_alloc /                    { n_lib++ }
+/ main \(wide\.c:[0-9]+\)$/ && $2 == 2000 { lib_caller = 1 }
+
+END {
+   for (s in sites)
+      n_sites++
+   print "alloc_all call sites: " n_sites
+   print "lib_alloc entries: " n_lib + 0
+   print "main's lib_alloc call: " (lib_caller ? "yes" : "no")
+}
@@ -0,0 +1,67 @@
+// One function that allocates from 20 call sites, so that the XPt above
+// them gets an index of its children, plus an allocator in a library
+// that is only loaded halfway, which flushes Massif's cache of
+// allocation sites.  The output must be the same as with
+// --site-cache=no.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+
+#define N_PASSES  3
+
+static void* blocks[N_PASSES * 21];
+static int   n_blocks = 0;
+
+static void alloc_all(void)
+{
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+   blocks[n_blocks++] = malloc(1000);
+}
+
+int main(void)
+{
+   void* handle;
+   void* (*lib_alloc)(size_t);
+   int   i;
+
+   // The second pass uses the cached sites.
+   alloc_all();
+   alloc_all();
+
+   handle = dlopen("./wide_alloc.so", RTLD_NOW);
+   if (!handle) {
+      fprintf(stderr, "%s\n", dlerror());
+      return 1;
+   }
+   lib_alloc = (void* (*)(size_t))dlsym(handle, "lib_alloc");
+   if (!lib_alloc) {
+      fprintf(stderr, "%s\n", dlerror());
+      return 1;
+   }
+
+   alloc_all();
+   blocks[n_blocks++] = lib_alloc(2000);
+
+   for (i = 0; i < n_blocks; i++)
+      free(blocks[i]);
+   return 0;
+}
@@ -0,0 +1,6 @@
+#include <stdlib.h>
+
+void* lib_alloc(size_t n)
+{
+   return malloc(n);
+}
@@ -0,0 +1,82 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// wide-threads simulates a multithreaded application in which every thread
+// touches a wide memory footprint, spread over many pages, and regularly
+// synchronizes with the other threads.
+// It was written to tune the bitmap data structures and the conflict set
+// computation of drd: every mutex operation creates a new segment, and the
+// page-strided accesses defeat a small per-bitmap lookup cache.
+//
+// Usage: wide-threads [nr_threads [nr_pages [nr_loops]]]
+
+#define PAGE_SIZE 4096
+
+static int nr_thr = 16;   // nr of threads
+static int nr_pages = 256; // nr of pages touched by each thread
+static int nr_loops = 20; // nr of times each thread walks over its pages
+
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long s_shared;
+
+static void *wide_fn(void *v)
+{
+   unsigned char *mem = v;
+   unsigned long sum = 0;
+   int loop, p, off;
+
+   for (loop = 0; loop < nr_loops; loop++) {
+      // Stride over all pages such that consecutive accesses hit different
+      // pages, at every 512th byte within a page.
+      for (off = 0; off < PAGE_SIZE; off += 512) {
+         for (p = 0; p < nr_pages; p++) {
+            unsigned char *q = mem + (size_t)p * PAGE_SIZE + off;
+            if ((p + off) & 1)
+               *q += 1;
+            else
+               sum += *q;
+         }
+      }
+      pthread_mutex_lock(&s_mutex);
+      s_shared += sum;
+      pthread_mutex_unlock(&s_mutex);
+   }
+   return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+   pthread_t *thr;
+   unsigned char **mem;
+   int i;
+
+   if (argc > 1)
+      nr_thr = atoi(argv[1]);
+   if (argc > 2)
+      nr_pages = atoi(argv[2]);
+   if (argc > 3)
+      nr_loops = atoi(argv[3]);
+
+   thr = malloc(nr_thr * sizeof(*thr));
+   mem = malloc(nr_thr * sizeof(*mem));
+   for (i = 0; i < nr_thr; i++) {
+      mem[i] = malloc((size_t)nr_pages * PAGE_SIZE);
+      memset(mem[i], i, (size_t)nr_pages * PAGE_SIZE);
+   }
+
+   for (i = 0; i < nr_thr; i++)
+      pthread_create(&thr[i], NULL, wide_fn, mem[i]);
+   for (i = 0; i < nr_thr; i++)
+      pthread_join(thr[i], NULL);
+
+   for (i = 0; i < nr_thr; i++)
+      free(mem[i]);
+   free(mem);
+   free(thr);
+
+   fprintf(stderr, "wide-threads: %d threads, %d pages, %d loops, %lu\n",
+           nr_thr, nr_pages, nr_loops, s_shared);
+   return 0;
+}